@@ -0,0 +1,374 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      asynclog.cpp
+ *
+ * Abstract:
+ *      Asynchronous logging for the hot paths of the examples.
+ *
+ * Reference:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "asynclog.h"
+
+
+#define LOG_LINE_SIZE                   (LOG_CELL_TEXT + 64)
+
+
+/* Text of the last second formatted. */
+typedef struct _LOG_CLOCK {
+    ULONGLONG second;
+    char text[16];
+} LOG_CLOCK;
+
+
+static ASYNC_LOG asyncLog;
+
+static const char *levelNames[] = { "OFF", "ERROR", "WARN", "INFO", "DEBUG" };
+
+
+/**
+ * format_line - One output line: local time, level, thread id and text.
+ *
+ * The clock text is only rebuilt when the second changes.
+ *
+ * Return the line length.
+*/
+static int format_line(LOG_CLOCK *clock, char *line, const FILETIME *time,
+                       DWORD threadId, int level, const char *text, int length)
+{
+    int ret;
+    FILETIME local;
+    SYSTEMTIME st;
+    ULARGE_INTEGER t;
+
+    t.LowPart  = time->dwLowDateTime;
+    t.HighPart = time->dwHighDateTime;
+
+    if (t.QuadPart / 10000000 != clock->second)
+    {
+        FileTimeToLocalFileTime(time, &local);
+        FileTimeToSystemTime(&local, &st);
+
+        clock->second = t.QuadPart / 10000000;
+        snprintf(clock->text, sizeof(clock->text), "%02u:%02u:%02u", st.wHour, st.wMinute, st.wSecond);
+    }
+
+    ret = snprintf(line, LOG_LINE_SIZE, "%s.%06u %-5s [%5lu] %.*s\n",
+                   clock->text, (unsigned)(t.QuadPart % 10000000 / 10),
+                   levelNames[level], threadId, length, text);
+
+    return (0 > ret || ret >= LOG_LINE_SIZE) ? LOG_LINE_SIZE - 1 : ret;
+}
+
+/**
+ * write_sync - The logger is not running, write the message right away.
+*/
+static void write_sync(int level, const char *format, va_list args)
+{
+    int length;
+    FILETIME time;
+    LOG_CLOCK clock = { 0 };
+    char text[LOG_CELL_TEXT];
+    char line[LOG_LINE_SIZE];
+
+    length = vsnprintf(text, sizeof(text), format, args);
+    if (0 > length || length >= (int)sizeof(text))
+        length = (0 > length) ? 0 : (int)sizeof(text) - 1;
+
+    GetSystemTimePreciseAsFileTime(&time);
+
+    length = format_line(&clock, line, &time, GetCurrentThreadId(), level, text, length);
+    fwrite(line, 1, length, stdout);
+}
+
+/**
+ * drain - Write all full cells to stdout in batches.
+ *
+ * Return the number of messages written.
+*/
+static int drain(ASYNC_LOG *log, LOG_CLOCK *clock)
+{
+    int count = 0;
+    int used  = 0;
+    LONG dropped;
+    FILETIME now;
+    LOG_CELL *cell;
+    static const char lost[] = "%ld messages dropped, log ring full.";
+    char text[sizeof(lost) + 16];
+
+    while (TRUE)
+    {
+        cell = &log->cells[log->head & (LOG_RING_CELLS - 1)];
+
+        /* Not written yet, or still being written. */
+        if (cell->sequence != log->head + 1)
+            break;
+
+        if (used > LOG_BATCH_SIZE - LOG_LINE_SIZE)
+        {
+            fwrite(log->batch, 1, used, stdout);
+            used = 0;
+        }
+
+        used += format_line(clock, log->batch + used, &cell->time, cell->threadId,
+                            cell->level, cell->text, cell->length);
+
+        /* Free the cell for the lap after this one. */
+        InterlockedExchange64(&cell->sequence, log->head + LOG_RING_CELLS);
+        log->head++;
+        count++;
+    }
+
+    dropped = InterlockedExchange(&log->dropped, 0);
+    if (0 < dropped)
+    {
+        log->droppedTotal += dropped;
+
+        if (used > LOG_BATCH_SIZE - LOG_LINE_SIZE)
+        {
+            fwrite(log->batch, 1, used, stdout);
+            used = 0;
+        }
+
+        GetSystemTimePreciseAsFileTime(&now);
+        snprintf(text, sizeof(text), lost, dropped);
+        used += format_line(clock, log->batch + used, &now, GetCurrentThreadId(),
+                            LOG_LEVEL_WARN, text, (int)strlen(text));
+    }
+
+    if (0 < used)
+    {
+        fwrite(log->batch, 1, used, stdout);
+        fflush(stdout);
+    }
+
+    return count;
+}
+
+/**
+ * FlushThread - Drain the ring every LOG_FLUSH_MS or when woken.
+*/
+static DWORD WINAPI
+FlushThread(LPVOID lpParam)
+{
+    ASYNC_LOG *log = (ASYNC_LOG *)lpParam;
+    LOG_CLOCK clock = { 0 };
+
+    while (TRUE)
+    {
+        if (0 < drain(log, &clock))
+            continue;
+
+        /* Producers are done, the ring is empty. */
+        if (log->stop && 0 == log->writers)
+            break;
+
+        WaitForSingleObject(log->wake, LOG_FLUSH_MS);
+    }
+
+    return 0;
+}
+
+/**
+ * log_start - Allocate the ring and start the flusher thread.
+*/
+int log_start(void)
+{
+    ASYNC_LOG *log = &asyncLog;
+
+    ZeroMemory(log, sizeof(*log));
+
+    log->cells = (LOG_CELL *)VirtualAlloc(NULL, sizeof(LOG_CELL) * LOG_RING_CELLS,
+                                          MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    log->batch = (char *)malloc(LOG_BATCH_SIZE);
+
+    if (NULL == log->cells || NULL == log->batch)
+    {
+        printf("Out of memory for the log.\n");
+        goto out_free;
+    }
+
+    for (LONG64 i = 0; i < LOG_RING_CELLS; i++)
+        log->cells[i].sequence = i;
+
+    log->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (NULL == log->wake)
+    {
+        printf("Error in CreateEvent: %d.\n", GetLastError());
+        goto out_free;
+    }
+
+    /* printf output so far goes first. */
+    fflush(stdout);
+
+    log->thread = CreateThread(NULL, 0, FlushThread, log, 0, NULL);
+    if (NULL == log->thread)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        goto out_event;
+    }
+
+    return 0;
+
+out_event:
+    CloseHandle(log->wake);
+
+out_free:
+    free(log->batch);
+    if (NULL != log->cells)
+        VirtualFree(log->cells, 0, MEM_RELEASE);
+
+    ZeroMemory(log, sizeof(*log));
+
+    return -1;
+}
+
+/**
+ * log_stop - Write what is queued and stop the flusher.
+ *
+ * Messages after the stop are written synchronously. The ring is freed
+ * once the writers that missed the stop have published their cells.
+ *
+ * Return the number of messages dropped because the ring was full.
+*/
+LONG64 log_stop(void)
+{
+    LONG64 dropped;
+    ASYNC_LOG *log = &asyncLog;
+
+    if (NULL == log->thread)
+        return 0;
+
+    InterlockedExchange(&log->stop, 1);
+
+    /* New writers see the stop, wait for those already past the check. */
+    while (0 != log->writers)
+        Sleep(0);
+
+    SetEvent(log->wake);
+
+    WaitForSingleObject(log->thread, INFINITE);
+    CloseHandle(log->thread);
+    CloseHandle(log->wake);
+
+    VirtualFree(log->cells, 0, MEM_RELEASE);
+    free(log->batch);
+
+    /* stop stays set, a late writer never sees the freed ring. */
+    dropped     = log->droppedTotal;
+    log->cells  = NULL;
+    log->batch  = NULL;
+    log->wake   = NULL;
+    log->thread = NULL;
+
+    return dropped;
+}
+
+/**
+ * log_write - Queue one message, drop it if the ring is full.
+*/
+void log_write(int level, const char *format, ...)
+{
+    int length;
+    LONG64 pos, seq, prev;
+    va_list args;
+    LOG_CELL *cell;
+    ASYNC_LOG *log = &asyncLog;
+
+    va_start(args, format);
+
+    /* Counted before the check, log_stop() waits for it to drop. */
+    InterlockedIncrement(&log->writers);
+
+    if (log->stop || NULL == log->cells)
+    {
+        InterlockedDecrement(&log->writers);
+        write_sync(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    /* Claim the cell at tail, the sequence tells if it is free. */
+    pos = log->tail;
+
+    while (TRUE)
+    {
+        cell = &log->cells[pos & (LOG_RING_CELLS - 1)];
+        seq  = cell->sequence;
+
+        if (seq == pos)
+        {
+            prev = InterlockedCompareExchange64(&log->tail, pos + 1, pos);
+            if (prev == pos)
+                break;
+
+            pos = prev;
+        }
+        else if (seq < pos)
+        {
+            /* A lap behind: the flusher has not freed it yet. */
+            InterlockedIncrement(&log->dropped);
+            InterlockedDecrement(&log->writers);
+            va_end(args);
+            return;
+        }
+        else
+        {
+            pos = log->tail;
+        }
+    }
+
+    length = vsnprintf(cell->text, LOG_CELL_TEXT, format, args);
+    va_end(args);
+
+    if (0 > length || length >= LOG_CELL_TEXT)
+        length = (0 > length) ? 0 : LOG_CELL_TEXT - 1;
+
+    GetSystemTimePreciseAsFileTime(&cell->time);
+    cell->threadId = GetCurrentThreadId();
+    cell->level    = (UINT16)level;
+    cell->length   = (UINT16)length;
+
+    /* Publish, the flusher may take it now. */
+    InterlockedExchange64(&cell->sequence, pos + 1);
+
+    if (LOG_LEVEL_ERROR == level || pos - log->head == LOG_RING_CELLS / 2)
+        SetEvent(log->wake);
+
+    InterlockedDecrement(&log->writers);
+}
+
+/**
+ * log_limit - Allow at most perSecond messages per second from site.
+ *
+ * The first message of a new second reports how many were suppressed.
+*/
+BOOL log_limit(LOG_SITE *site, LONG perSecond)
+{
+    LONG suppressed;
+    LONG64 old = site->window;
+    LONG64 now = (LONG64)(GetTickCount64() / 1000);
+
+    /* One caller opens the new second. */
+    if (old != now && old == InterlockedCompareExchange64(&site->window, now, old))
+    {
+        InterlockedExchange(&site->count, 0);
+
+        suppressed = InterlockedExchange(&site->suppressed, 0);
+        if (0 < suppressed)
+            log_write(LOG_LEVEL_WARN, "%ld similar messages suppressed.", suppressed);
+    }
+
+    if (InterlockedIncrement(&site->count) <= perSecond)
+        return TRUE;
+
+    InterlockedIncrement(&site->suppressed);
+
+    return FALSE;
+}
@@ -0,0 +1,118 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      asynclog.h
+ *
+ * Abstract:
+ *      Asynchronous logging for the hot paths of the examples.
+ *
+ *      LOG_xxx() formats the message in the calling thread into a cell of
+ *      a bounded lock free MPSC ring and returns, no lock, no system call
+ *      but for the wake up of an error or a half full ring. A call costs
+ *      four interlocked operations: the increment and decrement of the
+ *      writer count log_stop() waits on, the compare exchange that claims
+ *      the cell and the exchange that publishes it. The writer count is
+ *      one cache line shared by all logging threads, under heavy logging
+ *      from many cores it moves between them on every call. A flusher
+ *      thread takes the cells in order, adds time, level and thread id,
+ *      and writes them to stdout in large batches. A full ring drops the
+ *      message instead of blocking the caller, the flusher reports how
+ *      many were lost.
+ *
+ *      Levels above LOG_LEVEL are removed at compile time, define it
+ *      before this header or in the project. LOG_RATE() also limits a
+ *      call site to a number of messages per second.
+ *
+ *      Before log_start() and after log_stop() messages are written
+ *      synchronously, so code shared with programs that never start the
+ *      logger still works. Threads may log while log_stop() runs, it
+ *      frees the ring after the writers in flight have left.
+ *
+ * Reference:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+
+#ifndef __ASYNCLOG_H__
+#define __ASYNCLOG_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define LOG_LEVEL_OFF                   0
+#define LOG_LEVEL_ERROR                 1
+#define LOG_LEVEL_WARN                  2
+#define LOG_LEVEL_INFO                  3
+#define LOG_LEVEL_DEBUG                 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL                       LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_CELLS                  8192        // Power of 2.
+#define LOG_CELL_TEXT                   232         // Longer messages are cut.
+#define LOG_FLUSH_MS                    20
+#define LOG_BATCH_SIZE                  (64 * 1024)
+
+
+typedef struct _LOG_CELL {
+    volatile LONG64 sequence;           // Position + 1 when full, + LOG_RING_CELLS when free.
+    FILETIME time;
+    DWORD threadId;
+    UINT16 level;
+    UINT16 length;
+    char text[LOG_CELL_TEXT];
+} LOG_CELL;
+
+typedef struct _LOG_SITE {
+    volatile LONG64 window;             // Second of count.
+    volatile LONG count;
+    volatile LONG suppressed;
+} LOG_SITE;
+
+typedef struct _ASYNC_LOG {
+    DECLSPEC_ALIGN(64) volatile LONG64 tail;    // Next cell to claim, producers.
+    DECLSPEC_ALIGN(64) volatile LONG64 head;    // Next cell to flush, flusher only.
+    LOG_CELL *cells;
+    char *batch;
+    HANDLE wake;
+    HANDLE thread;
+    volatile LONG stop;                 // Stays set after log_stop().
+    volatile LONG writers;              // log_write() calls past the stop check.
+    volatile LONG dropped;              // Ring full, reported by the flusher.
+    LONG64 droppedTotal;                // Flusher only.
+} ASYNC_LOG;
+
+
+int log_start(void);
+LONG64 log_stop(void);
+void log_write(int level, const char *format, ...);
+BOOL log_limit(LOG_SITE *site, LONG perSecond);
+
+
+/* Arguments are not evaluated for levels compiled out. */
+#define LOG_WRITE(level, ...)                                                   \
+    do {                                                                        \
+        if (LOG_LEVEL >= (level))                                               \
+            log_write((level), __VA_ARGS__);                                    \
+    } while (0)
+
+#define LOG_ERROR(...)                  LOG_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)                   LOG_WRITE(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)                   LOG_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...)                  LOG_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* At most perSecond messages per second from this call site. */
+#define LOG_RATE(level, perSecond, ...)                                         \
+    do {                                                                        \
+        static LOG_SITE logSite_;                                               \
+        if (LOG_LEVEL >= (level) && log_limit(&logSite_, (perSecond)))          \
+            log_write((level), __VA_ARGS__);                                    \
+    } while (0)
+
+
+#endif /* __ASYNCLOG_H__ */
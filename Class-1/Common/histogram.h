@@ -0,0 +1,191 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      histogram.h
+ *
+ * Abstract:
+ *      HdrHistogram style log-linear histogram for latency recording.
+ *
+ *      Values below 256 are counted exactly, larger values keep their top
+ *      8 significant bits, so every bucket has a relative error < 0.8%.
+ *      Recording is a few shifts and one increment, the histogram is not
+ *      thread safe: keep one per thread and merge() them for reporting.
+ *
+ * Reference:
+ * https://github.com/HdrHistogram/HdrHistogram
+*/
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+#define HIST_SUB_BITS                   8
+#define HIST_SUB_COUNT                  (1u << HIST_SUB_BITS)
+#define HIST_HALF_COUNT                 (HIST_SUB_COUNT >> 1)
+#define HIST_MAX_BITS                   48          // 2^48 ns ~= 78 hours.
+#define HIST_BUCKETS                    (HIST_SUB_COUNT + (HIST_MAX_BITS - HIST_SUB_BITS) * HIST_HALF_COUNT)
+
+
+class LatencyHistogram {
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t minValue;
+    uint64_t maxValue;
+    double sum;
+
+    static int highest_bit(uint64_t v)
+    {
+#if defined(_MSC_VER) && defined(_WIN64)
+        unsigned long idx = 0;
+        _BitScanReverse64(&idx, v);
+        return (int)idx;
+#elif defined(_MSC_VER)
+        unsigned long idx = 0;
+        if (v >> 32)
+        {
+            _BitScanReverse(&idx, (unsigned long)(v >> 32));
+            return (int)idx + 32;
+        }
+        _BitScanReverse(&idx, (unsigned long)v);
+        return (int)idx;
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+
+    static size_t index_of(uint64_t v)
+    {
+        int shift;
+
+        if (v < HIST_SUB_COUNT)
+            return (size_t)v;
+
+        shift = highest_bit(v) - (HIST_SUB_BITS - 1);
+
+        if (shift > HIST_MAX_BITS - HIST_SUB_BITS)
+            return HIST_BUCKETS - 1;
+
+        return HIST_SUB_COUNT + (size_t)(shift - 1) * HIST_HALF_COUNT +
+               (size_t)((v >> shift) - HIST_HALF_COUNT);
+    }
+
+    /* Highest value that lands in the same bucket as index. */
+    static uint64_t highest_of(size_t index)
+    {
+        size_t shift;
+
+        if (index < HIST_SUB_COUNT)
+            return index;
+
+        shift = (index - HIST_SUB_COUNT) / HIST_HALF_COUNT + 1;
+
+        return ((((index - HIST_SUB_COUNT) % HIST_HALF_COUNT) + HIST_HALF_COUNT + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() : counts(HIST_BUCKETS, 0) {
+        reset();
+    }
+
+    void reset()
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        total       = 0;
+        minValue    = UINT64_MAX;
+        maxValue    = 0;
+        sum         = 0.0;
+    }
+
+    void record(uint64_t v)
+    {
+        record_n(v, 1);
+    }
+
+    void record_n(uint64_t v, uint64_t n)
+    {
+        counts[index_of(v)] += n;
+        total += n;
+        sum += (double)v * n;
+
+        if (v < minValue)
+            minValue = v;
+        if (v > maxValue)
+            maxValue = v;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < HIST_BUCKETS; i++)
+            counts[i] += other.counts[i];
+
+        total += other.total;
+        sum += other.sum;
+
+        if (other.minValue < minValue)
+            minValue = other.minValue;
+        if (other.maxValue > maxValue)
+            maxValue = other.maxValue;
+    }
+
+    /* Value at percentile p (0 - 100), reported as bucket upper bound. */
+    uint64_t percentile(double p) const
+    {
+        uint64_t target, seen = 0;
+
+        if (0 == total)
+            return 0;
+
+        target = (uint64_t)(p / 100.0 * total + 0.5);
+        if (target < 1)
+            target = 1;
+
+        for (size_t i = 0; i < HIST_BUCKETS; i++)
+        {
+            seen += counts[i];
+
+            if (seen >= target)
+            {
+                uint64_t v = highest_of(i);
+                return (v > maxValue) ? maxValue : v;
+            }
+        }
+
+        return maxValue;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t min_value() const { return total ? minValue : 0; }
+    uint64_t max_value() const { return maxValue; }
+    double mean() const { return total ? sum / total : 0.0; }
+
+    /* Print the usual latency summary, values are divided by 'scale'. */
+    void print(const char *title, double scale, const char *unit) const
+    {
+        printf("%s (%llu samples, %s):\n", title, (unsigned long long)total, unit);
+        printf("    min    %12.2f\n", min_value() / scale);
+        printf("    mean   %12.2f\n", mean() / scale);
+        printf("    p50    %12.2f\n", percentile(50.0) / scale);
+        printf("    p90    %12.2f\n", percentile(90.0) / scale);
+        printf("    p99    %12.2f\n", percentile(99.0) / scale);
+        printf("    p99.9  %12.2f\n", percentile(99.9) / scale);
+        printf("    p99.99 %12.2f\n", percentile(99.99) / scale);
+        printf("    max    %12.2f\n", max_value() / scale);
+    }
+};
+
+#endif /* __HISTOGRAM_H__ */
@@ -0,0 +1,273 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      largepage.cpp
+ *
+ * Abstract:
+ *      Small, large and huge page buffers with fallback.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/memory/large-page-support
+*/
+
+#include <iostream>
+
+#include "largepage.h"
+
+#pragma comment(lib, "onecore.lib")
+#pragma comment(lib, "Advapi32.lib")
+
+
+#define PRIVILEGE_UNKNOWN               -2
+#define SMALL_PAGE_SIZE                 4096
+
+
+/* Buffers of page_alloc(), page_free() leaves others alone. */
+typedef struct _PAGE_BLOCK {
+    void *ptr;
+    struct _PAGE_BLOCK *next;
+} PAGE_BLOCK;
+
+
+static const char *kindNames[] = { "small", "large", "huge" };
+
+static SRWLOCK blockLock        = SRWLOCK_INIT;
+static PAGE_BLOCK *blocks       = NULL;
+static volatile LONG privilege  = PRIVILEGE_UNKNOWN;
+
+
+/**
+ * page_init - Enable SeLockMemoryPrivilege for large and huge pages.
+ *
+ * Return 0 if the process holds it, -1 if the account was not granted
+ * "Lock pages in memory", page_alloc() then gives small pages.
+*/
+int page_init(void)
+{
+    HANDLE token = NULL;
+    TOKEN_PRIVILEGES tp;
+    int status = -1;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+    {
+        printf("Error in OpenProcessToken: %d.\n", GetLastError());
+        goto out;
+    }
+
+    ZeroMemory(&tp, sizeof(tp));
+    tp.PrivilegeCount           = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    if (!LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid))
+    {
+        printf("Error in LookupPrivilegeValue: %d.\n", GetLastError());
+        goto out_token;
+    }
+
+    /* Succeeds without the privilege too, then the last error says so. */
+    if (!AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) || ERROR_NOT_ALL_ASSIGNED == GetLastError())
+    {
+        printf("No SeLockMemoryPrivilege, large pages fall back to small pages.\n");
+        goto out_token;
+    }
+
+    status = 0;
+
+out_token:
+    CloseHandle(token);
+
+out:
+    InterlockedExchange(&privilege, status);
+
+    return status;
+}
+
+/**
+ * page_track - Remember a buffer for page_free().
+*/
+static int page_track(void *ptr)
+{
+    PAGE_BLOCK *block = (PAGE_BLOCK *)malloc(sizeof(PAGE_BLOCK));
+
+    if (NULL == block)
+        return -1;
+
+    block->ptr = ptr;
+
+    AcquireSRWLockExclusive(&blockLock);
+    block->next = blocks;
+    blocks      = block;
+    ReleaseSRWLockExclusive(&blockLock);
+
+    return 0;
+}
+
+/**
+ * page_alloc_kind - One try of one kind, NULL if it cannot be had.
+*/
+static void *page_alloc_kind(SIZE_T size, int kind, int node)
+{
+    MEM_EXTENDED_PARAMETER params[2];
+    ULONG count = 0;
+    DWORD preferred = 0 > node ? NUMA_NO_PREFERRED_NODE : (DWORD)node;
+
+    switch (kind)
+    {
+    case PAGES_HUGE:
+        ZeroMemory(params, sizeof(params));
+        params[count].Type      = MemExtendedParameterAttributeFlags;
+        params[count].ULong64   = MEM_EXTENDED_PARAMETER_NONPAGED_HUGE;
+        count++;
+
+        if (0 <= node)
+        {
+            params[count].Type  = MemExtendedParameterNumaNode;
+            params[count].ULong = (DWORD)node;
+            count++;
+        }
+
+        /* Windows 10 1803+. */
+        return VirtualAlloc2(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                             PAGE_READWRITE, params, count);
+
+    case PAGES_LARGE:
+        return VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                  PAGE_READWRITE, preferred);
+
+    default:
+        return VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT,
+                                  PAGE_READWRITE, preferred);
+    }
+}
+
+/**
+ * page_alloc - Committed buffer on pages of a kind, node -1 for any node.
+ *
+ * The size is rounded up to whole pages of the kind. A kind that cannot
+ * be had falls back to the next smaller one, *granted gets the kind of
+ * the buffer. Return NULL if not even small pages could be had.
+*/
+void *page_alloc(SIZE_T size, int kind, int node, int *granted)
+{
+    void *ptr = NULL;
+
+    if (PRIVILEGE_UNKNOWN == privilege && PAGES_SMALL != kind)
+        page_init();
+
+    /* Without the privilege every try of large pages fails. */
+    if (0 != privilege)
+        kind = PAGES_SMALL;
+
+    while (NULL == (ptr = page_alloc_kind(page_round(size, kind), kind, node)) && PAGES_SMALL < kind)
+        kind--;
+
+    if (NULL == ptr)
+    {
+        printf("Error in VirtualAlloc: %d.\n", GetLastError());
+        return NULL;
+    }
+
+    if (0 != page_track(ptr))
+    {
+        printf("Out of memory.\n");
+        VirtualFree(ptr, 0, MEM_RELEASE);
+        return NULL;
+    }
+
+    if (NULL != granted)
+        *granted = kind;
+
+    return ptr;
+}
+
+/**
+ * page_free - Free a buffer of page_alloc(), FALSE if it is not one.
+*/
+BOOL page_free(void *ptr)
+{
+    PAGE_BLOCK **link;
+    PAGE_BLOCK *block = NULL;
+
+    if (NULL == ptr)
+        return FALSE;
+
+    AcquireSRWLockExclusive(&blockLock);
+
+    for (link = &blocks; NULL != *link; link = &(*link)->next)
+    {
+        if ((*link)->ptr == ptr)
+        {
+            block = *link;
+            *link = block->next;
+            break;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&blockLock);
+
+    if (NULL == block)
+        return FALSE;
+
+    VirtualFree(ptr, 0, MEM_RELEASE);
+    free(block);
+
+    return TRUE;
+}
+
+/**
+ * page_size - Bytes of one page of a kind.
+*/
+SIZE_T page_size(int kind)
+{
+    SIZE_T large;
+
+    if (PAGES_HUGE == kind)
+        return PAGE_HUGE_SIZE;
+
+    if (PAGES_LARGE == kind)
+    {
+        large = GetLargePageMinimum();
+        return 0 != large ? large : 2 * 1024 * 1024;
+    }
+
+    return SMALL_PAGE_SIZE;
+}
+
+/**
+ * page_round - Size rounded up to whole pages of a kind.
+*/
+SIZE_T page_round(SIZE_T size, int kind)
+{
+    SIZE_T unit = page_size(kind);
+
+    return (size + unit - 1) / unit * unit;
+}
+
+/**
+ * page_kind_name - Name of a page kind.
+*/
+const char *page_kind_name(int kind)
+{
+    if (0 > kind || PAGES_COUNT <= kind)
+        return "unknown";
+
+    return kindNames[kind];
+}
+
+/**
+ * page_kind_parse - Page kind from its name.
+*/
+int page_kind_parse(const char *name, int *kind)
+{
+    for (int i = 0; i < PAGES_COUNT; i++)
+    {
+        if (0 == strcmp(name, kindNames[i]))
+        {
+            *kind = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
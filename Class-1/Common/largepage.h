@@ -0,0 +1,56 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      largepage.h
+ *
+ * Abstract:
+ *      Buffers on small (4 KiB), large (2 MiB) or huge (1 GiB) pages,
+ *      chosen at run time, optionally on a NUMA node.
+ *
+ *      One TLB entry of a large page covers 512 small pages, buffers of
+ *      hundreds of MiB walk the page tables far less often. Large and
+ *      huge pages are committed and locked when allocated, they are never
+ *      paged out, and need SeLockMemoryPrivilege ("Lock pages in memory"
+ *      in the local security policy). page_init() enables it.
+ *
+ *      page_alloc() falls back to the next smaller kind when the
+ *      privilege is missing or memory is too fragmented for contiguous
+ *      large pages, and tells which kind it got.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/memory/large-page-support
+ * https://docs.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualalloc2
+*/
+
+#ifndef __LARGEPAGE_H__
+#define __LARGEPAGE_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define PAGES_SMALL                     0
+#define PAGES_LARGE                     1
+#define PAGES_HUGE                      2
+#define PAGES_COUNT                     3
+
+#define PAGE_HUGE_SIZE                  (1024 * 1024 * 1024)
+
+
+int page_init(void);
+
+void *page_alloc(SIZE_T size, int kind, int node, int *granted);
+BOOL page_free(void *ptr);
+
+SIZE_T page_size(int kind);
+SIZE_T page_round(SIZE_T size, int kind);
+
+const char *page_kind_name(int kind);
+int page_kind_parse(const char *name, int *kind);
+
+
+#endif /* __LARGEPAGE_H__ */
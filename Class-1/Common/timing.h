@@ -0,0 +1,343 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      timing.h
+ *
+ * Abstract:
+ *      Header only timing of the benchmarks: a monotonic clock in ns, the
+ *      cycle counter calibrated against it, and a scoped timer recording
+ *      into a LatencyHistogram (histogram.h).
+ *
+ *      timing_now_ns() is QueryPerformanceCounter on Windows, 100 ns steps
+ *      or finer, clock_gettime(CLOCK_MONOTONIC_RAW) elsewhere. Neither is
+ *      slewed by NTP. It is the clock of deadlines and of runs of some ms
+ *      and more.
+ *
+ *      timing_cycles() reads the TSC, the virtual counter on ARM64, a few
+ *      ns a read at the resolution of one tick. It is the clock of hot
+ *      paths of some ns to us. timing_cycles_begin() and _end() keep the
+ *      measured instructions between the two reads. timing_calibrate()
+ *      measures the rate of the counter against the clock, call it once
+ *      from main before the threads start, as QueryPerformanceFrequency
+ *      was; the first timing_cycles_to_ns() calibrates otherwise.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/sysinfo/acquiring-high-resolution-time-stamps
+*/
+
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TIMING_X86
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(TIMING_X86)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
+#include "histogram.h"
+
+
+#define TIMING_NS_PER_SEC               1000000000ull
+#define TIMING_CALIBRATE_MS             20
+#define TIMING_OVERHEAD_ROUNDS          1000
+
+
+typedef struct _TIMING_CLOCK {
+    int calibrated;
+    int invariant;                      // Counter rate does not follow the core clock.
+    double cyclesPerNs;
+    double nsPerCycle;
+    uint64_t cycleOverhead;             // Least cycles between begin and end.
+    double clockOverheadNs;             // Mean ns of one timing_now_ns().
+} TIMING_CLOCK;
+
+
+/* Zero initialized, one for the whole program. */
+inline TIMING_CLOCK *timing_clock(void)
+{
+    static TIMING_CLOCK state;
+
+    return &state;
+}
+
+/**
+ * timing_frequency - Ticks per second of the clock.
+*/
+inline uint64_t timing_frequency(void)
+{
+#ifdef _WIN32
+    static const uint64_t frequency = []() {
+        LARGE_INTEGER f;
+
+        QueryPerformanceFrequency(&f);
+
+        return (uint64_t)f.QuadPart;
+    }();
+
+    return frequency;
+#else
+    return TIMING_NS_PER_SEC;
+#endif
+}
+
+/**
+ * timing_now_ns - Monotonic time in nanoseconds.
+*/
+inline uint64_t timing_now_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER t;
+    uint64_t f = timing_frequency();
+
+    QueryPerformanceCounter(&t);
+
+    /* 10 MHz on Windows 10 and later, no division. */
+    if (10000000 == f)
+        return (uint64_t)t.QuadPart * 100;
+
+    return (uint64_t)t.QuadPart / f * TIMING_NS_PER_SEC +
+           (uint64_t)t.QuadPart % f * TIMING_NS_PER_SEC / f;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return (uint64_t)ts.tv_sec * TIMING_NS_PER_SEC + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * timing_cycles - Cycle counter, not ordered against the code around it.
+*/
+inline uint64_t timing_cycles(void)
+{
+#if defined(TIMING_X86)
+    return __rdtsc();
+#elif defined(_M_ARM64)
+    return (uint64_t)_ReadStatusReg(ARM64_CNTVCT);
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+
+    return v;
+#else
+    return timing_now_ns();
+#endif
+}
+
+/**
+ * timing_cycles_begin - Counter at the start of a measured section, the
+ * code before it has finished, the section has not started.
+*/
+inline uint64_t timing_cycles_begin(void)
+{
+#if defined(TIMING_X86)
+    uint64_t t;
+
+    _mm_lfence();
+    t = __rdtsc();
+    _mm_lfence();
+
+    return t;
+#else
+    return timing_cycles();
+#endif
+}
+
+/**
+ * timing_cycles_end - Counter at the end of a measured section, read
+ * after the section has finished.
+*/
+inline uint64_t timing_cycles_end(void)
+{
+#if defined(TIMING_X86)
+    unsigned int aux;
+    uint64_t t = __rdtscp(&aux);
+
+    _mm_lfence();
+
+    return t;
+#else
+    return timing_cycles();
+#endif
+}
+
+/**
+ * timing_invariant - Whether the counter runs at a fixed rate in all
+ * power states, CPUID 80000007h EDX bit 8 on x86.
+*/
+inline int timing_invariant(void)
+{
+#if defined(TIMING_X86)
+    unsigned int regs[4] = { 0 };
+
+#if defined(_MSC_VER)
+    __cpuid((int *)regs, (int)0x80000000);
+    if (regs[0] < 0x80000007)
+        return 0;
+
+    __cpuid((int *)regs, (int)0x80000007);
+#else
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+        return 0;
+
+    __get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+
+    return (regs[3] >> 8) & 1;
+#else
+    /* The generic timer of ARM has a fixed rate. */
+    return 1;
+#endif
+}
+
+/* Clock and counter read at about the same moment, the tightest of some tries. */
+inline void timing_pair(uint64_t *ns, uint64_t *cycles)
+{
+    uint64_t c0, c1, now, best = UINT64_MAX;
+
+    for (int i = 0; i < 16; i++)
+    {
+        c0  = timing_cycles_begin();
+        now = timing_now_ns();
+        c1  = timing_cycles_end();
+
+        if (c1 - c0 < best)
+        {
+            best    = c1 - c0;
+            *ns     = now;
+            *cycles = c0 + (c1 - c0) / 2;
+        }
+    }
+}
+
+/**
+ * timing_calibrate - Measure the counter against the clock for ms, and
+ * the cost of both. Returns counter ticks per ns.
+*/
+inline double timing_calibrate(int ms)
+{
+    TIMING_CLOCK *c = timing_clock();
+    uint64_t ns0 = 0, ns1 = 0, c0 = 0, c1 = 0, t0, t1 = 0, best = UINT64_MAX;
+
+    timing_pair(&ns0, &c0);
+
+    /* The overheads are measured inside the window, it is spent anyway. */
+    for (int i = 0; i < TIMING_OVERHEAD_ROUNDS; i++)
+    {
+        t0 = timing_cycles_begin();
+        t1 = timing_cycles_end();
+
+        if (t1 - t0 < best)
+            best = t1 - t0;
+    }
+
+    t0 = timing_now_ns();
+    for (int i = 0; i < TIMING_OVERHEAD_ROUNDS; i++)
+        t1 = timing_now_ns();
+
+    c->clockOverheadNs = (double)(t1 - t0) / TIMING_OVERHEAD_ROUNDS;
+
+    while (timing_now_ns() - ns0 < (uint64_t)ms * 1000000)
+        ;
+
+    timing_pair(&ns1, &c1);
+
+    c->cyclesPerNs      = (double)(c1 - c0) / (double)(ns1 - ns0);
+    c->nsPerCycle       = 1.0 / c->cyclesPerNs;
+    c->cycleOverhead    = best;
+    c->invariant        = timing_invariant();
+    c->calibrated       = 1;
+
+    return c->cyclesPerNs;
+}
+
+/**
+ * timing_cycles_to_ns - Counter ticks to ns.
+*/
+inline uint64_t timing_cycles_to_ns(uint64_t cycles)
+{
+    TIMING_CLOCK *c = timing_clock();
+
+    if (!c->calibrated)
+        timing_calibrate(TIMING_CALIBRATE_MS);
+
+    return (uint64_t)((double)cycles * c->nsPerCycle);
+}
+
+/**
+ * timing_elapsed_ns - ns since start, a timing_cycles_begin().
+*/
+inline uint64_t timing_elapsed_ns(uint64_t start)
+{
+    return timing_cycles_to_ns(timing_cycles_end() - start);
+}
+
+/**
+ * timing_print - One line about the clock and the counter.
+*/
+inline void timing_print(FILE *fp)
+{
+    TIMING_CLOCK *c = timing_clock();
+
+    if (!c->calibrated)
+        timing_calibrate(TIMING_CALIBRATE_MS);
+
+    fprintf(fp, "Clock %.3f MHz, %.1f ns a read; counter %.3f GHz%s, %llu ticks a read.\n",
+            timing_frequency() / 1e6, c->clockOverheadNs, c->cyclesPerNs,
+            c->invariant ? "" : " (not invariant, follows the core clock)",
+            (unsigned long long)c->cycleOverhead);
+}
+
+
+/* Time of a scope in ns, recorded into a histogram or added to a total. */
+class ScopedTimer {
+private:
+    LatencyHistogram *hist;
+    uint64_t *total;
+    uint64_t start;
+
+public:
+    explicit ScopedTimer(LatencyHistogram *hist) : hist(hist), total(NULL) {
+        start = timing_cycles_begin();
+    }
+
+    explicit ScopedTimer(uint64_t *total) : hist(NULL), total(total) {
+        start = timing_cycles_begin();
+    }
+
+    ~ScopedTimer()
+    {
+        uint64_t ns = timing_elapsed_ns(start);
+
+        if (NULL != hist)
+            hist->record(ns);
+        if (NULL != total)
+            *total += ns;
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
+
+#endif /* __TIMING_H__ */
@@ -0,0 +1,284 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      trace.cpp
+ *
+ * Abstract:
+ *      Per thread trace rings and the Chrome trace JSON export.
+ *
+ * Reference:
+ * https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+*/
+
+#include <iostream>
+
+#include "trace.h"
+
+
+static TRACE trace;
+
+/* The ring of this thread, NULL until its first event. */
+static thread_local TRACE_BUFFER *threadBuffer;
+
+
+/**
+ * trace_attach - Allocate the ring of this thread and link it for export.
+*/
+static TRACE_BUFFER *trace_attach(void)
+{
+    TRACE_BUFFER *buffer, *head;
+
+    buffer = (TRACE_BUFFER *)VirtualAlloc(NULL, sizeof(TRACE_BUFFER), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (NULL == buffer)
+        return NULL;
+
+    buffer->threadId = GetCurrentThreadId();
+
+    do
+    {
+        head = trace.buffers;
+        buffer->next = head;
+    } while (head != InterlockedCompareExchangePointer((PVOID volatile *)&trace.buffers, buffer, head));
+
+    threadBuffer = buffer;
+
+    return buffer;
+}
+
+/**
+ * trace_put - Store one event in the ring of this thread.
+*/
+static inline void trace_put(char phase, const char *name, UINT64 time, UINT64 value)
+{
+    TRACE_BUFFER *buffer = threadBuffer;
+    TRACE_EVENT *event;
+
+    if (!trace.on)
+        return;
+
+    if (NULL == buffer && NULL == (buffer = trace_attach()))
+        return;
+
+    event = &buffer->events[buffer->count & (TRACE_EVENTS - 1)];
+
+    event->time     = time;
+    event->value    = value;
+    event->name     = name;
+    event->phase    = phase;
+
+    /* Only the owner writes, the event is complete before it counts. */
+    buffer->count = buffer->count + 1;
+}
+
+/**
+ * trace_complete - A scope from start to now.
+*/
+void trace_complete(const char *name, UINT64 start)
+{
+    /* Off, no second read of the counter. */
+    if (!trace.on)
+        return;
+
+    trace_put('X', name, start, timing_cycles() - start);
+}
+
+/**
+ * trace_begin - Start of a span, trace_end() on the same thread ends it.
+*/
+void trace_begin(const char *name)
+{
+    trace_put('B', name, timing_cycles(), 0);
+}
+
+/**
+ * trace_end - End of the last span begun on this thread.
+*/
+void trace_end(const char *name)
+{
+    trace_put('E', name, timing_cycles(), 0);
+}
+
+/**
+ * trace_instant - A moment on this thread.
+*/
+void trace_instant(const char *name)
+{
+    trace_put('i', name, timing_cycles(), 0);
+}
+
+/**
+ * trace_counter - A value over time, a graph of its own.
+*/
+void trace_counter(const char *name, INT64 value)
+{
+    trace_put('C', name, timing_cycles(), (UINT64)value);
+}
+
+/**
+ * trace_thread - Name this thread in the trace.
+*/
+void trace_thread(const char *name)
+{
+    TRACE_BUFFER *buffer = threadBuffer;
+
+    if (!trace.on)
+        return;
+
+    if (NULL == buffer && NULL == (buffer = trace_attach()))
+        return;
+
+    buffer->threadName = name;
+}
+
+/**
+ * trace_start - Turn the events on.
+*/
+int trace_start(void)
+{
+    timing_pair(&trace.startNs, &trace.startCycles);
+
+    trace.stopNs        = 0;
+    trace.stopCycles    = 0;
+
+    InterlockedExchange(&trace.on, 1);
+
+    trace_thread("main");
+
+    return 0;
+}
+
+/**
+ * trace_stop - Turn the events off, the rings are kept for the export.
+*/
+void trace_stop(void)
+{
+    if (!InterlockedExchange(&trace.on, 0))
+        return;
+
+    timing_pair(&trace.stopNs, &trace.stopCycles);
+}
+
+/**
+ * write_string - A JSON string, the names come from the code.
+*/
+static void write_string(FILE *fp, const char *text)
+{
+    fputc('"', fp);
+
+    for (const char *p = NULL != text ? text : ""; '\0' != *p; p++)
+    {
+        if ('"' == *p || '\\' == *p)
+            fputc('\\', fp);
+
+        if ((unsigned char)*p >= ' ')
+            fputc(*p, fp);
+    }
+
+    fputc('"', fp);
+}
+
+/**
+ * write_entry - Start an entry of traceEvents, a comma before all but the first.
+*/
+static void write_entry(FILE *fp, LONG64 *entries)
+{
+    fputs(0 < (*entries)++ ? ",\n{" : "{", fp);
+}
+
+/**
+ * write_meta - Name of the process or of a thread.
+*/
+static void write_meta(FILE *fp, LONG64 *entries, const char *kind, DWORD pid, DWORD tid, const char *name)
+{
+    write_entry(fp, entries);
+    fprintf(fp, "\"name\":\"%s\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":", kind, pid, tid);
+    write_string(fp, name);
+    fprintf(fp, "}}");
+}
+
+/**
+ * trace_export - Write all rings as Chrome trace JSON, return the events
+ * written or -1.
+*/
+LONG64 trace_export(const char *path)
+{
+    char program[MAX_PATH], *name;
+    DWORD pid = GetCurrentProcessId();
+    uint64_t stopNs = trace.stopNs, stopCycles = trace.stopCycles;
+    UINT64 first;
+    LONG64 entries = 0, events = 0, overwritten = 0;
+    int threads = 0;
+    double usPerCycle;
+    TRACE_EVENT *event;
+    FILE *fp = NULL;
+
+    /* Still on, the rate is measured up to now. */
+    if (0 == stopCycles)
+        timing_pair(&stopNs, &stopCycles);
+
+    if (stopCycles <= trace.startCycles)
+        return -1;
+
+    usPerCycle = (double)(stopNs - trace.startNs) / (stopCycles - trace.startCycles) / 1000.0;
+
+    if (0 != fopen_s(&fp, path, "w"))
+    {
+        printf("Cannot open %s.\n", path);
+        return -1;
+    }
+
+    GetModuleFileNameA(NULL, program, sizeof(program));
+    name = strrchr(program, '\\');
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    write_meta(fp, &entries, "process_name", pid, 0, NULL != name ? name + 1 : program);
+
+    for (TRACE_BUFFER *buffer = trace.buffers; NULL != buffer; buffer = buffer->next)
+    {
+        UINT64 count = buffer->count;
+
+        first = count > TRACE_EVENTS ? count - TRACE_EVENTS : 0;
+        overwritten += first;
+        threads++;
+
+        if (NULL != buffer->threadName)
+            write_meta(fp, &entries, "thread_name", pid, buffer->threadId, buffer->threadName);
+
+        for (UINT64 i = first; i < count; i++)
+        {
+            event = &buffer->events[i & (TRACE_EVENTS - 1)];
+
+            write_entry(fp, &entries);
+            fprintf(fp, "\"name\":");
+            write_string(fp, event->name);
+            fprintf(fp, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu", event->phase,
+                    (double)(INT64)(event->time - trace.startCycles) * usPerCycle, pid, buffer->threadId);
+
+            if ('X' == event->phase)
+                fprintf(fp, ",\"dur\":%.3f", event->value * usPerCycle);
+            else if ('C' == event->phase)
+                fprintf(fp, ",\"args\":{\"value\":%lld}", (INT64)event->value);
+            else if ('i' == event->phase)
+                fprintf(fp, ",\"s\":\"t\"");
+
+            fputc('}', fp);
+            events++;
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    if (0 != ferror(fp))
+    {
+        printf("Error in writing %s.\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    printf("Trace: %lld events of %d threads to %s, %lld overwritten.\n", events, threads, path, overwritten);
+
+    return events;
+}
@@ -0,0 +1,128 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      trace.h
+ *
+ * Abstract:
+ *      Tracing of the hot paths of the examples, written as Chrome trace
+ *      JSON that chrome://tracing and https://ui.perfetto.dev open.
+ *
+ *      TRACE_xxx() stores the name, the cycle counter (timing.h) and a
+ *      value in a ring of the calling thread: no lock, no interlocked
+ *      operation, no system call, some ns an event. The ring is allocated
+ *      on the first event of the thread and keeps its last TRACE_EVENTS
+ *      events, older ones are overwritten and counted. Names must be
+ *      string literals, only the pointer is stored.
+ *
+ *      trace_start() turns the events on, before it they cost a test of a
+ *      flag. trace_export() writes the rings of all threads, call it after
+ *      the traced threads have ended, or after trace_stop() when some
+ *      events may still be in flight.
+ *
+ *      TRACE_ENABLED 0, before this header or in the project, removes all
+ *      trace points at compile time.
+ *
+ * Reference:
+ * https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+*/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+#include "timing.h"
+
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED                   1
+#endif
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS                    65536       // Per thread, power of 2.
+#endif
+
+
+typedef struct _TRACE_EVENT {
+    UINT64 time;                        // Cycle counter at the start.
+    UINT64 value;                       // Cycles of a scope, value of a counter.
+    const char *name;
+    char phase;                         // Chrome phase, X, B, E, i or C.
+} TRACE_EVENT;
+
+typedef struct _TRACE_BUFFER {
+    struct _TRACE_BUFFER *next;         // All buffers, newest first.
+    DWORD threadId;
+    const char *threadName;
+    volatile UINT64 count;              // Events written, the owner only.
+    TRACE_EVENT events[TRACE_EVENTS];
+} TRACE_BUFFER;
+
+typedef struct _TRACE {
+    volatile LONG on;
+    TRACE_BUFFER *volatile buffers;
+    uint64_t startNs;                   // Clock and counter at start and stop,
+    uint64_t startCycles;               // the counter is converted to time
+    uint64_t stopNs;                    // over the whole trace.
+    uint64_t stopCycles;
+} TRACE;
+
+
+int trace_start(void);
+void trace_stop(void);
+LONG64 trace_export(const char *path);
+void trace_thread(const char *name);
+
+void trace_complete(const char *name, UINT64 start);
+void trace_begin(const char *name);
+void trace_end(const char *name);
+void trace_instant(const char *name);
+void trace_counter(const char *name, INT64 value);
+
+
+/* A scope of the code, one event at its end. */
+class TraceScope {
+private:
+    const char *name;
+    UINT64 start;
+
+public:
+    explicit TraceScope(const char *name) : name(name), start(timing_cycles()) {}
+
+    ~TraceScope()
+    {
+        trace_complete(name, start);
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+
+#define TRACE_CONCAT_(a, b)             a##b
+#define TRACE_CONCAT(a, b)              TRACE_CONCAT_(a, b)
+
+/* "" name "" only compiles for a string literal. */
+#if TRACE_ENABLED
+#define TRACE_SCOPE(name)               TraceScope TRACE_CONCAT(traceScope_, __LINE__)("" name "")
+#define TRACE_BEGIN(name)               trace_begin("" name "")
+#define TRACE_END(name)                 trace_end("" name "")
+#define TRACE_INSTANT(name)             trace_instant("" name "")
+#define TRACE_COUNTER(name, value)      trace_counter("" name "", (INT64)(value))
+#define TRACE_THREAD(name)              trace_thread("" name "")
+#else
+#define TRACE_SCOPE(name)               do { } while (0)
+#define TRACE_BEGIN(name)               do { } while (0)
+#define TRACE_END(name)                 do { } while (0)
+#define TRACE_INSTANT(name)             do { } while (0)
+#define TRACE_COUNTER(name, value)      do { } while (0)
+#define TRACE_THREAD(name)              do { } while (0)
+#endif
+
+
+#endif /* __TRACE_H__ */
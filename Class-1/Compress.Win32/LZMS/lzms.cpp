@@ -6,16 +6,54 @@
  */
 
 #include "lzms.h"
+#include "timing.h"
+#include "trace.h"
 
 #pragma comment(lib, "Cabinet.lib")
 
+
+static int PageKind = PAGES_SMALL;
+
+
+/**
+ * lzms_set_pages - Pages of the large buffers, PAGES_SMALL by default.
+ */
+void lzms_set_pages(int kind)
+{
+    PageKind = kind;
+}
+
+/**
+ * BufferAlloc - Allocate memory, large buffers on the chosen pages.
+ */
+PVOID BufferAlloc(SIZE_T Size)
+{
+    if (PAGES_SMALL == PageKind || Size < LARGE_BUFFER_SIZE)
+    {
+        return malloc(Size);
+    }
+
+    return page_alloc(Size, PageKind, -1, NULL);
+}
+
+/**
+ * BufferFree - Free memory of BufferAlloc().
+ */
+VOID BufferFree(PVOID Memory)
+{
+    if (!page_free(Memory))
+    {
+        free(Memory);
+    }
+}
+
 /**
  * SimpleAlloc - Allocate memory.
  */
 PVOID SimpleAlloc(PVOID Context, SIZE_T Size)
 {
     UNREFERENCED_PARAMETER(Context);
-    return malloc(Size);
+    return BufferAlloc(Size);
 }
 
 /**
@@ -27,7 +65,7 @@ VOID SimpleFree(PVOID Context, PVOID Memory)
 
     if (NULL != Memory)
     {
-        free(Memory);
+        BufferFree(Memory);
     }
 
     return;
@@ -112,7 +150,7 @@ BOOL BlockModeCompress(
     OutputDataSize += InputSize / BLOCK_SIZE;
     OutputDataSize = OutputDataSize * (META_DATA_SIZE + CompressedBlockSize) + sizeof(ULONG);
 
-    *OutputData = (PBYTE)malloc(OutputDataSize);
+    *OutputData = (PBYTE)BufferAlloc(OutputDataSize);
     if (!*OutputData)
     {
         wprintf(L"Cannot allocate memory for compressed buffer.\n");
@@ -127,6 +165,8 @@ BOOL BlockModeCompress(
     /* Compress data block by block. */
     while (ProcessedSoFar < InputSize)
     {
+        TRACE_SCOPE("compress block");
+
         if (OutputSoFar + META_DATA_SIZE >= OutputDataSize)
         {
             Success = FALSE;
@@ -159,6 +199,8 @@ BOOL BlockModeCompress(
         OutputSoFar += sizeof(ULONG);
         OutputSoFar += CompressedDataSize;
 
+        TRACE_COUNTER("compressed block", CompressedDataSize);
+
         ProcessedSoFar += CurrentBlockSize;
     }
 
@@ -224,7 +266,7 @@ BOOL BlockModeDecompress(
     OutputDataSize = *((ULONG UNALIGNED *)(InputData + ProcessedSoFar));
     ProcessedSoFar += sizeof(ULONG);
 
-    *OutputData = (PBYTE)malloc(OutputDataSize);
+    *OutputData = (PBYTE)BufferAlloc(OutputDataSize);
     if (!*OutputData)
     {
         wprintf(L"Cannot allocate memory for uncompressed buffer.\n");
@@ -235,6 +277,8 @@ BOOL BlockModeDecompress(
     /* Decompress data block by block. */
     while (ProcessedSoFar < InputSize)
     {
+        TRACE_SCOPE("decompress block");
+
         if (ProcessedSoFar + META_DATA_SIZE > InputSize)
         {
             Success = FALSE;
@@ -332,7 +376,7 @@ int lzms_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
     InputFileSize = FileSize.LowPart;
 
     /* Allocate memory for compressed content. */
-    CompressedBuffer = (PBYTE)malloc(InputFileSize);
+    CompressedBuffer = (PBYTE)BufferAlloc(InputFileSize);
     if (!CompressedBuffer)
     {
         wprintf(L"Cannot allocate memory for compressed buffer.\n");
@@ -363,7 +407,7 @@ int lzms_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
         goto done;
     }
 
-    StartTime = GetTickCount64();
+    StartTime = timing_now_ns();
 
     /* Decompress data and write data to DecompressedBuffer. */
     Success = BlockModeDecompress(
@@ -377,10 +421,10 @@ int lzms_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
         goto done;
     }
 
-    EndTime = GetTickCount64();
+    EndTime = timing_now_ns();
 
     /* Get decompression time. */
-    TimeDuration = (EndTime - StartTime) / 1000.0;
+    TimeDuration = (double)(EndTime - StartTime) / TIMING_NS_PER_SEC;
 
     /* Write decompressed data to output file. */
     Success = WriteFile(
@@ -399,7 +443,7 @@ int lzms_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
         L"Compressed size: %d; Decompressed Size: %d\n",
         InputFileSize,
         DecompressedDataSize);
-    wprintf(L"Decompression Time(Exclude I/O): %.2f seconds\n", TimeDuration);
+    wprintf(L"Decompression Time(Exclude I/O): %.6f seconds\n", TimeDuration);
     wprintf(L"File decompressed.\n");
 
     DeleteTargetFile = FALSE;
@@ -407,12 +451,12 @@ int lzms_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
 done:
     if (CompressedBuffer)
     {
-        free(CompressedBuffer);
+        BufferFree(CompressedBuffer);
     }
 
     if (DecompressedBuffer)
     {
-        free(DecompressedBuffer);
+        BufferFree(DecompressedBuffer);
     }
 
     if (InputFile != INVALID_HANDLE_VALUE)
@@ -487,7 +531,7 @@ int lzms_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile)
     InputFileSize = FileSize.LowPart;
 
     /* Allocate memory for file content. */
-    InputBuffer = (PBYTE)malloc(InputFileSize);
+    InputBuffer = (PBYTE)BufferAlloc(InputFileSize);
     if (!InputBuffer)
     {
         wprintf(L"Cannot allocate memory for input buffer.\n");
@@ -518,7 +562,7 @@ int lzms_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile)
         goto done;
     }
 
-    StartTime = GetTickCount64();
+    StartTime = timing_now_ns();
 
     /* Call BlockModeCompress() again to do compression. */
     Success = BlockModeCompress(
@@ -532,10 +576,10 @@ int lzms_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile)
         goto done;
     }
 
-    EndTime = GetTickCount64();
+    EndTime = timing_now_ns();
 
     /* Get compression time. */
-    TimeDuration = (EndTime - StartTime) / 1000.0;
+    TimeDuration = (double)(EndTime - StartTime) / TIMING_NS_PER_SEC;
 
     /* Write compressed data to output file. */
     Success = WriteFile(
@@ -553,7 +597,7 @@ int lzms_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile)
 
     wprintf(L"Input file size: %ld; Compressed Size: %ld\n",
             InputFileSize, CompressedDataSize);
-    wprintf(L"Compression Time(Exclude I/O): %.2f seconds\n", TimeDuration);
+    wprintf(L"Compression Time(Exclude I/O): %.6f seconds\n", TimeDuration);
     wprintf(L"File Compressed.\n");
 
     DeleteTargetFile = FALSE;
@@ -562,12 +606,12 @@ done:
 
     if (CompressedBuffer)
     {
-        free(CompressedBuffer);
+        BufferFree(CompressedBuffer);
     }
 
     if (InputBuffer)
     {
-        free(InputBuffer);
+        BufferFree(InputBuffer);
     }
 
     if (InputFile != INVALID_HANDLE_VALUE)
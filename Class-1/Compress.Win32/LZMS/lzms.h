@@ -17,10 +17,15 @@
 #include <Windows.h>
 #include <compressapi.h>
 
+#include "largepage.h"
+
 
 #define META_DATA_SIZE                  (2 * sizeof(ULONG))
 #define BLOCK_SIZE                      (1 << 20)
+#define LARGE_BUFFER_SIZE               (1 << 20)   // Smaller buffers stay on malloc.
+
 
+void lzms_set_pages(int kind);
 
 int lzms_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName);
 int lzms_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile);
@@ -10,23 +10,109 @@
 #include <compressapi.h>
 
 #include "lzms.h"
+#include "trace.h"
 
 
 #define FILE_PATH               L"C:\\Windows\\System32\\shell32.dll"
 #define COMPRESS_FILE           L"shell32.cab"
 #define DECOMPRESS_FILE         L"shell32.dll"
 
+#define PAGES_ALL               -1
+
+
+WCHAR filePath[MAX_PATH]    = FILE_PATH;
+int pageKind                = PAGES_SMALL;
+char *tracePath             = NULL;
+
 
 /**
- * Main function.
+ * ParseArgs - Parse -x value pairs.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'p':
+            if (0 == strcmp(argv[i + 1], "all"))
+                pageKind = PAGES_ALL;
+            else if (0 != page_kind_parse(argv[i + 1], &pageKind))
+                return -1;
+            break;
+        case 'f':
+            if (0 == MultiByteToWideChar(CP_ACP, 0, argv[i + 1], -1, filePath, MAX_PATH))
+                return -1;
+            break;
+        case 'x':
+            tracePath = argv[i + 1];
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * RunKind - Compress and decompress with the buffers on one kind of pages.
 */
-int main(void)
+void RunKind(int kind)
 {
-    printf("Start compress file.\n");
-    lzms_compression(FILE_PATH, COMPRESS_FILE);
+    lzms_set_pages(kind);
 
-    printf("\nStart decompress file.\n");
+    printf("Start compress file, %s pages.\n", page_kind_name(kind));
+    TRACE_BEGIN("compress file");
+    lzms_compression(filePath, COMPRESS_FILE);
+    TRACE_END("compress file");
+
+    printf("\nStart decompress file, %s pages.\n", page_kind_name(kind));
+    TRACE_BEGIN("decompress file");
     lzms_decompression(COMPRESS_FILE, DECOMPRESS_FILE);
+    TRACE_END("decompress file");
+}
+
+/**
+ * Main function.
+*/
+int main(int argc, char **argv)
+{
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-f file] [-p small|large|huge|all] [-x file]\n", argv[0]);
+        printf("  -f file      File to compress, default shell32.dll.\n");
+        printf("  -p pages     Pages of the buffers from 1 MiB up, default small, all compares them.\n");
+        printf("  -x file      Write a Chrome trace of the blocks, default off.\n");
+        return -1;
+    }
+
+    if (NULL != tracePath)
+        trace_start();
+
+    if (PAGES_ALL != pageKind)
+    {
+        RunKind(pageKind);
+    }
+    else
+    {
+        for (int kind = PAGES_SMALL; kind < PAGES_COUNT; kind++)
+        {
+            if (PAGES_SMALL != kind)
+                printf("\n\n");
+
+            RunKind(kind);
+        }
+    }
+
+    if (NULL != tracePath)
+    {
+        trace_stop();
+        trace_export(tracePath);
+    }
 
     return 0;
 }
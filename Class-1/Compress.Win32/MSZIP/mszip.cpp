@@ -7,6 +7,7 @@
 
 
 #include "mszip.h"
+#include "timing.h"
 
 
 #pragma comment(lib, "Cabinet.lib")
@@ -133,7 +134,7 @@ int mszip_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
         }
     }
 
-    StartTime = GetTickCount64();
+    StartTime = timing_now_ns();
 
     /* Decompress data and write data to DecompressedBuffer. */
     Success = Decompress(
@@ -150,10 +151,10 @@ int mszip_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
         goto done;
     }
 
-    EndTime = GetTickCount64();
+    EndTime = timing_now_ns();
 
     /* Get decompression time. */
-    TimeDuration = (EndTime - StartTime) / 1000.0;
+    TimeDuration = (double)(EndTime - StartTime) / TIMING_NS_PER_SEC;
 
     /* Write decompressed data to output file. */
     Success = WriteFile(
@@ -172,7 +173,7 @@ int mszip_decompression(LPCWSTR lpCompressFile, LPCWSTR lpFileName)
 
     wprintf(L"Compressed size: %ld; Decompressed Size: %lld\n",
             InputFileSize, DecompressedDataSize);
-    wprintf(L"Decompression Time(Exclude I/O): %.2f seconds\n", TimeDuration);
+    wprintf(L"Decompression Time(Exclude I/O): %.6f seconds\n", TimeDuration);
     wprintf(L"File decompressed.\n");
 
     DeleteTargetFile = FALSE;
@@ -340,7 +341,7 @@ int mszip_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile)
         }
     }
 
-    StartTime = GetTickCount64();
+    StartTime = timing_now_ns();
 
     /**
      * Call Compress() again to do real compression and
@@ -360,10 +361,10 @@ int mszip_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile)
         goto done;
     }
 
-    EndTime = GetTickCount64();
+    EndTime = timing_now_ns();
 
     /* Get compression time. */
-    TimeDuration = (EndTime - StartTime) / 1000.0;
+    TimeDuration = (double)(EndTime - StartTime) / TIMING_NS_PER_SEC;
 
     /* Write compressed data to output file. */
     Success = WriteFile(
@@ -381,7 +382,7 @@ int mszip_compression(LPCWSTR lpFileName, LPCWSTR lpCompressFile)
 
     wprintf(L"Input file size: %ld; Compressed Size: %lld\n",
             InputFileSize, CompressedDataSize);
-    wprintf(L"Compression Time(Exclude I/O): %.2f seconds\n", TimeDuration);
+    wprintf(L"Compression Time(Exclude I/O): %.6f seconds\n", TimeDuration);
     wprintf(L"File Compressed.\n");
 
     DeleteTargetFile = FALSE;
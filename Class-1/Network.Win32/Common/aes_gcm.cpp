@@ -0,0 +1,454 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      aes_gcm.cpp
+ *
+ * Abstract:
+ *      AES-128-GCM, AES-NI/PCLMULQDQ and CNG backends.
+ *
+ * Reference:
+ * https://www.intel.com/content/dam/develop/external/us/en/documents/clmul-wp-rev-2-02-2014-04-20.pdf
+ * https://csrc.nist.gov/publications/detail/sp/800-38d/final
+*/
+
+#include <iostream>
+#include <smmintrin.h>
+
+#include "aes_gcm.h"
+
+#pragma comment(lib, "bcrypt.lib")
+
+
+#define BSWAP_MASK                      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+#ifndef STATUS_AUTH_TAG_MISMATCH
+#define STATUS_AUTH_TAG_MISMATCH        ((NTSTATUS)0xC000A002L)
+#endif
+
+#define AES_EXPAND(rk, i, rcon)         rk[i] = aes_expand_step(rk[i - 1], _mm_aeskeygenassist_si128(rk[i - 1], rcon))
+
+
+/**
+ * aes_expand_step - One round of the AES-128 key schedule.
+*/
+static inline __m128i aes_expand_step(__m128i key, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+
+    return _mm_xor_si128(key, assist);
+}
+
+/**
+ * aes_encrypt_block - Encrypt one block with the expanded key.
+*/
+static inline __m128i aes_encrypt_block(const __m128i *rk, __m128i block)
+{
+    block = _mm_xor_si128(block, rk[0]);
+
+    for (int i = 1; i < GCM_ROUNDS; i++)
+        block = _mm_aesenc_si128(block, rk[i]);
+
+    return _mm_aesenclast_si128(block, rk[GCM_ROUNDS]);
+}
+
+/**
+ * counter_block - IV || counter (32 bits, big endian).
+*/
+static inline __m128i counter_block(__m128i base, UINT32 counter)
+{
+    return _mm_insert_epi32(base, (int)_byteswap_ulong(counter), 3);
+}
+
+/**
+ * clmul_wide - 256 bit carry-less product of two 128 bit values.
+*/
+static inline void clmul_wide(__m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+    __m128i mid;
+
+    *lo = _mm_clmulepi64_si128(a, b, 0x00);
+    *hi = _mm_clmulepi64_si128(a, b, 0x11);
+    mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+
+    *lo = _mm_xor_si128(*lo, _mm_slli_si128(mid, 8));
+    *hi = _mm_xor_si128(*hi, _mm_srli_si128(mid, 8));
+}
+
+/**
+ * gf_reduce - Reduce a 256 bit product of byte reversed elements.
+ *
+ * Shift left by one to undo the bit reflection, then reduce modulo
+ * x^128 + x^7 + x^2 + x + 1 (Intel white paper). Both steps are linear,
+ * so a sum of several products can be reduced once.
+*/
+static __m128i gf_reduce(__m128i lo, __m128i hi)
+{
+    __m128i t1, t2, t3;
+
+    /* 256 bit product << 1. */
+    t1 = _mm_srli_epi32(lo, 31);
+    t2 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+
+    t3 = _mm_srli_si128(t1, 12);
+    t2 = _mm_slli_si128(t2, 4);
+    t1 = _mm_slli_si128(t1, 4);
+    lo = _mm_or_si128(lo, t1);
+    hi = _mm_or_si128(hi, t2);
+    hi = _mm_or_si128(hi, t3);
+
+    /* First reduction phase. */
+    t1 = _mm_slli_epi32(lo, 31);
+    t2 = _mm_slli_epi32(lo, 30);
+    t3 = _mm_slli_epi32(lo, 25);
+    t1 = _mm_xor_si128(t1, t2);
+    t1 = _mm_xor_si128(t1, t3);
+    t2 = _mm_srli_si128(t1, 4);
+    t1 = _mm_slli_si128(t1, 12);
+    lo = _mm_xor_si128(lo, t1);
+
+    /* Second reduction phase. */
+    t1 = _mm_srli_epi32(lo, 1);
+    t3 = _mm_srli_epi32(lo, 2);
+    t1 = _mm_xor_si128(t1, t3);
+    t3 = _mm_srli_epi32(lo, 7);
+    t1 = _mm_xor_si128(t1, t3);
+    t1 = _mm_xor_si128(t1, t2);
+    lo = _mm_xor_si128(lo, t1);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+/**
+ * gf_mul - Multiply two byte reversed elements of GF(2^128).
+*/
+static inline __m128i gf_mul(__m128i a, __m128i b)
+{
+    __m128i lo, hi;
+
+    clmul_wide(a, b, &lo, &hi);
+
+    return gf_reduce(lo, hi);
+}
+
+/**
+ * ghash_update - Absorb data into the hash state, the last block is zero padded.
+ *
+ * X = (X ^ C0) * H^4 ^ C1 * H^3 ^ C2 * H^2 ^ C3 * H for every four blocks.
+*/
+static __m128i ghash_update(const __m128i *powers, __m128i state, const UINT8 *data, UINT32 length)
+{
+    __m128i block, lo, hi, lo2, hi2;
+    UINT8 last[16];
+
+    while (64 <= length)
+    {
+        block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), BSWAP_MASK);
+        clmul_wide(_mm_xor_si128(state, block), powers[3], &lo, &hi);
+
+        for (int i = 1; i < 4; i++)
+        {
+            block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), BSWAP_MASK);
+            clmul_wide(block, powers[3 - i], &lo2, &hi2);
+            lo = _mm_xor_si128(lo, lo2);
+            hi = _mm_xor_si128(hi, hi2);
+        }
+
+        state   = gf_reduce(lo, hi);
+        data   += 64;
+        length -= 64;
+    }
+
+    while (16 <= length)
+    {
+        block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), BSWAP_MASK);
+        state = gf_mul(_mm_xor_si128(state, block), powers[0]);
+        data   += 16;
+        length -= 16;
+    }
+
+    if (0 < length)
+    {
+        ZeroMemory(last, sizeof(last));
+        memcpy(last, data, length);
+
+        block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)last), BSWAP_MASK);
+        state = gf_mul(_mm_xor_si128(state, block), powers[0]);
+    }
+
+    return state;
+}
+
+/**
+ * aesni_ctr - XOR data with the key stream starting at counter 2.
+*/
+static void aesni_ctr(const __m128i *rk, __m128i base, UINT8 *data, UINT32 length)
+{
+    int r;
+    UINT32 counter = 2;
+    __m128i b0, b1, b2, b3;
+    UINT8 stream[16];
+
+    /* Four independent blocks hide the aesenc latency. */
+    while (64 <= length)
+    {
+        b0 = _mm_xor_si128(counter_block(base, counter + 0), rk[0]);
+        b1 = _mm_xor_si128(counter_block(base, counter + 1), rk[0]);
+        b2 = _mm_xor_si128(counter_block(base, counter + 2), rk[0]);
+        b3 = _mm_xor_si128(counter_block(base, counter + 3), rk[0]);
+
+        for (r = 1; r < GCM_ROUNDS; r++)
+        {
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+            b1 = _mm_aesenc_si128(b1, rk[r]);
+            b2 = _mm_aesenc_si128(b2, rk[r]);
+            b3 = _mm_aesenc_si128(b3, rk[r]);
+        }
+
+        b0 = _mm_aesenclast_si128(b0, rk[GCM_ROUNDS]);
+        b1 = _mm_aesenclast_si128(b1, rk[GCM_ROUNDS]);
+        b2 = _mm_aesenclast_si128(b2, rk[GCM_ROUNDS]);
+        b3 = _mm_aesenclast_si128(b3, rk[GCM_ROUNDS]);
+
+        _mm_storeu_si128((__m128i *)(data +  0), _mm_xor_si128(b0, _mm_loadu_si128((__m128i *)(data +  0))));
+        _mm_storeu_si128((__m128i *)(data + 16), _mm_xor_si128(b1, _mm_loadu_si128((__m128i *)(data + 16))));
+        _mm_storeu_si128((__m128i *)(data + 32), _mm_xor_si128(b2, _mm_loadu_si128((__m128i *)(data + 32))));
+        _mm_storeu_si128((__m128i *)(data + 48), _mm_xor_si128(b3, _mm_loadu_si128((__m128i *)(data + 48))));
+
+        counter += 4;
+        data    += 64;
+        length  -= 64;
+    }
+
+    while (16 <= length)
+    {
+        b0 = aes_encrypt_block(rk, counter_block(base, counter++));
+        _mm_storeu_si128((__m128i *)data, _mm_xor_si128(b0, _mm_loadu_si128((__m128i *)data)));
+
+        data   += 16;
+        length -= 16;
+    }
+
+    if (0 < length)
+    {
+        b0 = aes_encrypt_block(rk, counter_block(base, counter));
+        _mm_storeu_si128((__m128i *)stream, b0);
+
+        for (UINT32 i = 0; i < length; i++)
+            data[i] ^= stream[i];
+    }
+}
+
+/**
+ * aesni_tag - Compute the tag over aad and the cipher text.
+*/
+static void aesni_tag(GCM_CONTEXT *ctx, __m128i base, const UINT8 *aad, UINT32 aadLen,
+                      const UINT8 *cipher, UINT32 length, UINT8 *tag)
+{
+    __m128i state = _mm_setzero_si128();
+    __m128i lengths;
+
+    state = ghash_update(ctx->hashPowers, state, aad, aadLen);
+    state = ghash_update(ctx->hashPowers, state, cipher, length);
+
+    /* len(A) || len(C) in bits, already byte reversed. */
+    lengths = _mm_set_epi64x((long long)aadLen * 8, (long long)length * 8);
+    state   = gf_mul(_mm_xor_si128(state, lengths), ctx->hashPowers[0]);
+    state   = _mm_shuffle_epi8(state, BSWAP_MASK);
+
+    /* Tag = GHASH ^ E(K, IV || 1). */
+    state = _mm_xor_si128(state, aes_encrypt_block(ctx->roundKeys, counter_block(base, 1)));
+    _mm_storeu_si128((__m128i *)tag, state);
+}
+
+/**
+ * iv_block - Load the 96 bit IV into a counter block.
+*/
+static inline __m128i iv_block(const UINT8 *iv)
+{
+    UINT8 block[16] = { 0 };
+
+    memcpy(block, iv, GCM_IV_SIZE);
+
+    return _mm_loadu_si128((const __m128i *)block);
+}
+
+/**
+ * gcm_aesni_supported - Check cpuid for AES-NI, PCLMULQDQ, SSSE3 and SSE4.1.
+*/
+int gcm_aesni_supported(void)
+{
+    int regs[4];
+    int need = (1 << 25) | (1 << 1) | (1 << 9) | (1 << 19);
+
+    __cpuid(regs, 1);
+
+    return need == (regs[2] & need);
+}
+
+/**
+ * gcm_init - Expand the key for the selected backend.
+*/
+int gcm_init(GCM_CONTEXT *ctx, int backend, const UINT8 *key)
+{
+    NTSTATUS status;
+    __m128i *rk = ctx->roundKeys;
+
+    ZeroMemory(ctx, sizeof(*ctx));
+    ctx->backend = backend;
+
+    if (GCM_AESNI == backend)
+    {
+        if (!gcm_aesni_supported())
+        {
+            printf("AES-NI is not supported by this cpu.\n");
+            return -1;
+        }
+
+        rk[0] = _mm_loadu_si128((const __m128i *)key);
+
+        AES_EXPAND(rk,  1, 0x01);
+        AES_EXPAND(rk,  2, 0x02);
+        AES_EXPAND(rk,  3, 0x04);
+        AES_EXPAND(rk,  4, 0x08);
+        AES_EXPAND(rk,  5, 0x10);
+        AES_EXPAND(rk,  6, 0x20);
+        AES_EXPAND(rk,  7, 0x40);
+        AES_EXPAND(rk,  8, 0x80);
+        AES_EXPAND(rk,  9, 0x1b);
+        AES_EXPAND(rk, 10, 0x36);
+
+        ctx->hashPowers[0] = aes_encrypt_block(rk, _mm_setzero_si128());
+        ctx->hashPowers[0] = _mm_shuffle_epi8(ctx->hashPowers[0], BSWAP_MASK);
+
+        for (int i = 1; i < 4; i++)
+            ctx->hashPowers[i] = gf_mul(ctx->hashPowers[i - 1], ctx->hashPowers[0]);
+
+        return 0;
+    }
+
+    if (GCM_CNG == backend)
+    {
+        status = BCryptGenerateSymmetricKey(BCRYPT_AES_GCM_ALG_HANDLE, &ctx->key, NULL, 0,
+                                            (PUCHAR)key, GCM_KEY_SIZE, 0);
+        if (!BCRYPT_SUCCESS(status))
+        {
+            printf("Error in BCryptGenerateSymmetricKey: 0x%08x.\n", status);
+            ctx->key = NULL;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    printf("Unknown gcm backend %d.\n", backend);
+
+    return -1;
+}
+
+/**
+ * gcm_free - Destroy the key.
+*/
+void gcm_free(GCM_CONTEXT *ctx)
+{
+    if (NULL != ctx->key)
+        BCryptDestroyKey(ctx->key);
+
+    SecureZeroMemory(ctx, sizeof(*ctx));
+}
+
+/**
+ * gcm_seal - Encrypt data in place and write the tag.
+*/
+int gcm_seal(GCM_CONTEXT *ctx, const UINT8 *iv, const UINT8 *aad, UINT32 aadLen,
+             UINT8 *data, UINT32 length, UINT8 *tag)
+{
+    __m128i base;
+    ULONG written = 0;
+    NTSTATUS status;
+    BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+
+    if (GCM_AESNI == ctx->backend)
+    {
+        base = iv_block(iv);
+
+        aesni_ctr(ctx->roundKeys, base, data, length);
+        aesni_tag(ctx, base, aad, aadLen, data, length, tag);
+
+        return 0;
+    }
+
+    BCRYPT_INIT_AUTH_MODE_INFO(info);
+    info.pbNonce    = (PUCHAR)iv;
+    info.cbNonce    = GCM_IV_SIZE;
+    info.pbAuthData = (PUCHAR)aad;
+    info.cbAuthData = aadLen;
+    info.pbTag      = tag;
+    info.cbTag      = GCM_TAG_SIZE;
+
+    status = BCryptEncrypt(ctx->key, data, length, &info, NULL, 0, data, length, &written, 0);
+    if (!BCRYPT_SUCCESS(status))
+    {
+        printf("Error in BCryptEncrypt: 0x%08x.\n", status);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * gcm_open - Verify the tag and decrypt data in place.
+ *
+ * Return -1 if the tag does not match, data is then left encrypted
+ * (AES-NI) or undefined (CNG).
+*/
+int gcm_open(GCM_CONTEXT *ctx, const UINT8 *iv, const UINT8 *aad, UINT32 aadLen,
+             UINT8 *data, UINT32 length, const UINT8 *tag)
+{
+    __m128i base, diff;
+    UINT8 expect[GCM_TAG_SIZE];
+    ULONG written = 0;
+    NTSTATUS status;
+    BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+
+    if (GCM_AESNI == ctx->backend)
+    {
+        base = iv_block(iv);
+
+        aesni_tag(ctx, base, aad, aadLen, data, length, expect);
+
+        /* Compare all bytes, no early exit. */
+        diff = _mm_xor_si128(_mm_loadu_si128((const __m128i *)expect),
+                             _mm_loadu_si128((const __m128i *)tag));
+        if (!_mm_testz_si128(diff, diff))
+            return -1;
+
+        aesni_ctr(ctx->roundKeys, base, data, length);
+
+        return 0;
+    }
+
+    BCRYPT_INIT_AUTH_MODE_INFO(info);
+    info.pbNonce    = (PUCHAR)iv;
+    info.cbNonce    = GCM_IV_SIZE;
+    info.pbAuthData = (PUCHAR)aad;
+    info.cbAuthData = aadLen;
+    info.pbTag      = (PUCHAR)tag;
+    info.cbTag      = GCM_TAG_SIZE;
+
+    status = BCryptDecrypt(ctx->key, data, length, &info, NULL, 0, data, length, &written, 0);
+    if (!BCRYPT_SUCCESS(status))
+    {
+        if (STATUS_AUTH_TAG_MISMATCH != status)
+            printf("Error in BCryptDecrypt: 0x%08x.\n", status);
+
+        return -1;
+    }
+
+    return 0;
+}
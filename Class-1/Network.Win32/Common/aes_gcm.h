@@ -0,0 +1,67 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      aes_gcm.h
+ *
+ * Abstract:
+ *      AES-128-GCM authenticated encryption with two backends.
+ *
+ *      GCM_AESNI is a local implementation on the AES-NI and PCLMULQDQ
+ *      instructions, counter blocks are encrypted four at a time and GHASH
+ *      multiplies four blocks by H^4..H^1 with a single reduction.
+ *      GCM_CNG calls the Windows CNG (bcrypt) library. Both produce the
+ *      same output, so the two ends of a connection may use different
+ *      backends.
+ *
+ *      Data is encrypted and decrypted in place.
+ *
+ * Reference:
+ * https://www.intel.com/content/dam/develop/external/us/en/documents/clmul-wp-rev-2-02-2014-04-20.pdf
+ * https://docs.microsoft.com/en-us/windows/win32/api/bcrypt/nf-bcrypt-bcryptencrypt
+*/
+
+#ifndef __AES_GCM_H__
+#define __AES_GCM_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+#include <bcrypt.h>
+#include <intrin.h>
+#include <wmmintrin.h>
+
+
+#define GCM_KEY_SIZE                    16
+#define GCM_IV_SIZE                     12
+#define GCM_TAG_SIZE                    16
+#define GCM_ROUNDS                      10
+
+
+/* Backends. */
+#define GCM_AESNI                       1
+#define GCM_CNG                         2
+
+
+typedef struct _GCM_CONTEXT {
+    int backend;
+    __m128i roundKeys[GCM_ROUNDS + 1];  // GCM_AESNI only.
+    __m128i hashPowers[4];              // H^1..H^4, H = E(K, 0), byte reversed.
+    BCRYPT_KEY_HANDLE key;              // GCM_CNG only.
+} GCM_CONTEXT;
+
+
+int gcm_aesni_supported(void);
+
+int gcm_init(GCM_CONTEXT *ctx, int backend, const UINT8 *key);
+void gcm_free(GCM_CONTEXT *ctx);
+
+int gcm_seal(GCM_CONTEXT *ctx, const UINT8 *iv, const UINT8 *aad, UINT32 aadLen,
+             UINT8 *data, UINT32 length, UINT8 *tag);
+int gcm_open(GCM_CONTEXT *ctx, const UINT8 *iv, const UINT8 *aad, UINT32 aadLen,
+             UINT8 *data, UINT32 length, const UINT8 *tag);
+
+
+#endif /* __AES_GCM_H__ */
@@ -0,0 +1,131 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      bufpool.cpp
+ *
+ * Abstract:
+ *      Slab backed buffer pool on a lock free SLIST.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/interlockedapi/nf-interlockedapi-interlockedpopentryslist
+*/
+
+#include <iostream>
+
+#include "bufpool.h"
+
+
+/**
+ * pool_init - Prepare an empty pool, no memory is committed yet.
+*/
+int pool_init(BUFFER_POOL *pool, UINT32 bufferSize, UINT32 maxBuffers)
+{
+    ZeroMemory(pool, sizeof(*pool));
+
+    if (0 == bufferSize || 0 == maxBuffers)
+        return -1;
+
+    /* Free buffers hold the SLIST entry, keep them aligned. */
+    pool->bufferSize  = (bufferSize + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(MEMORY_ALLOCATION_ALIGNMENT - 1);
+    pool->slabBuffers = BUFFER_POOL_SLAB_SIZE / pool->bufferSize;
+
+    if (0 == pool->slabBuffers)
+        pool->slabBuffers = 1;
+
+    pool->maxSlabs = (maxBuffers + pool->slabBuffers - 1) / pool->slabBuffers;
+
+    pool->slabs = (char **)calloc(pool->maxSlabs, sizeof(char *));
+    if (NULL == pool->slabs)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    InitializeSListHead(&pool->freeList);
+    InitializeSRWLock(&pool->growLock);
+
+    return 0;
+}
+
+/**
+ * pool_destroy - Release all slabs, every buffer must be back.
+*/
+void pool_destroy(BUFFER_POOL *pool)
+{
+    if (NULL == pool->slabs)
+        return;
+
+    for (LONG i = 0; i < pool->slabCount; i++)
+        VirtualFree(pool->slabs[i], 0, MEM_RELEASE);
+
+    free(pool->slabs);
+    ZeroMemory(pool, sizeof(*pool));
+}
+
+/**
+ * pool_grow - Commit one more slab, keep the first buffer for the caller.
+*/
+static void *pool_grow(BUFFER_POOL *pool)
+{
+    char *slab;
+    void *buffer;
+
+    AcquireSRWLockExclusive(&pool->growLock);
+
+    /* Another thread may have grown the pool meanwhile. */
+    buffer = InterlockedPopEntrySList(&pool->freeList);
+
+    if (NULL == buffer && (UINT32)pool->slabCount < pool->maxSlabs)
+    {
+        slab = (char *)VirtualAlloc(NULL, pool_slab_bytes(pool), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+        if (NULL != slab)
+        {
+            for (UINT32 i = 1; i < pool->slabBuffers; i++)
+                InterlockedPushEntrySList(&pool->freeList, (PSLIST_ENTRY)(slab + (SIZE_T)i * pool->bufferSize));
+
+            pool->slabs[pool->slabCount] = slab;
+            InterlockedIncrement(&pool->slabCount);
+            buffer = slab;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&pool->growLock);
+
+    return buffer;
+}
+
+/**
+ * pool_get - Borrow a buffer, NULL when the pool is at its limit.
+*/
+void *pool_get(BUFFER_POOL *pool)
+{
+    LONG used, peak;
+    void *buffer = InterlockedPopEntrySList(&pool->freeList);
+
+    if (NULL == buffer)
+        buffer = pool_grow(pool);
+
+    if (NULL == buffer)
+        return NULL;
+
+    used = InterlockedIncrement(&pool->inUse);
+
+    while (used > (peak = pool->peakInUse))
+    {
+        if (peak == InterlockedCompareExchange(&pool->peakInUse, used, peak))
+            break;
+    }
+
+    return buffer;
+}
+
+/**
+ * pool_put - Return a buffer, the memory stays committed for the next get.
+*/
+void pool_put(BUFFER_POOL *pool, void *buffer)
+{
+    InterlockedPushEntrySList(&pool->freeList, (PSLIST_ENTRY)buffer);
+    InterlockedDecrement(&pool->inUse);
+}
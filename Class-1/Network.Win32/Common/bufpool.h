@@ -0,0 +1,63 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      bufpool.h
+ *
+ * Abstract:
+ *      Fixed size buffer pool shared by many connections.
+ *
+ *      Buffers are cut from slabs of BUFFER_POOL_SLAB_SIZE bytes that are
+ *      committed on demand and kept until the pool is destroyed. Free
+ *      buffers sit on a lock free SLIST, get and put take no lock: a pop
+ *      or push of the list plus an interlocked update of inUse, and of
+ *      peakInUse when a get raises it. Only growing the pool takes a lock.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/sync/using-singly-linked-lists
+*/
+
+#ifndef __BUFPOOL_H__
+#define __BUFPOOL_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define BUFFER_POOL_SLAB_SIZE           (1024 * 1024)   // At least one buffer.
+
+
+typedef struct _BUFFER_POOL {
+    SLIST_HEADER freeList;              // Must stay 16 bytes aligned.
+    SRWLOCK growLock;
+    UINT32 bufferSize;                  // Rounded up to MEMORY_ALLOCATION_ALIGNMENT.
+    UINT32 slabBuffers;
+    UINT32 maxSlabs;
+    volatile LONG slabCount;
+    volatile LONG inUse;
+    volatile LONG peakInUse;
+    char **slabs;
+} BUFFER_POOL;
+
+
+int pool_init(BUFFER_POOL *pool, UINT32 bufferSize, UINT32 maxBuffers);
+void pool_destroy(BUFFER_POOL *pool);
+void *pool_get(BUFFER_POOL *pool);
+void pool_put(BUFFER_POOL *pool, void *buffer);
+
+static inline SIZE_T pool_slab_bytes(const BUFFER_POOL *pool)
+{
+    return (SIZE_T)pool->bufferSize * pool->slabBuffers;
+}
+
+/* Bytes committed by the slabs, free or not. */
+static inline SIZE_T pool_committed(const BUFFER_POOL *pool)
+{
+    return pool_slab_bytes(pool) * pool->slabCount;
+}
+
+
+#endif /* __BUFPOOL_H__ */
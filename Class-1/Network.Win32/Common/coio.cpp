@@ -0,0 +1,333 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      coio.cpp
+ *
+ * Abstract:
+ *      C++20 coroutines over an I/O completion port.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/mswsock/nf-mswsock-acceptex
+*/
+
+#include <iostream>
+
+#include "coio.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Mswsock.lib")
+
+
+/* ConnectEx is only reachable through WSAIoctl, the same for all sockets. */
+static LPFN_CONNECTEX connectEx = NULL;
+
+
+/**
+ * IoContext::init - Create the completion port.
+*/
+int IoContext::init(void)
+{
+    int ret;
+    DWORD bytes = 0;
+    GUID guid   = WSAID_CONNECTEX;
+    SOCKET fd;
+
+    port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (NULL == port)
+    {
+        printf("Error in CreateIoCompletionPort: %d.\n", GetLastError());
+        return -1;
+    }
+
+    if (NULL != connectEx)
+        return 0;
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == fd)
+    {
+        printf("Error in socket: %d.\n", WSAGetLastError());
+        goto out_port;
+    }
+
+    ret = WSAIoctl(
+        fd,
+        SIO_GET_EXTENSION_FUNCTION_POINTER,
+        &guid,
+        sizeof(guid),
+        &connectEx,
+        sizeof(connectEx),
+        &bytes,
+        NULL,
+        NULL
+    );
+
+    closesocket(fd);
+
+    if (SOCKET_ERROR == ret)
+    {
+        printf("Error in WSAIoctl(ConnectEx): %d.\n", WSAGetLastError());
+        goto out_port;
+    }
+
+    return 0;
+
+out_port:
+    CloseHandle(port);
+    port = NULL;
+
+    return -1;
+}
+
+/**
+ * IoContext::free - Close the port, all run() loops must have returned.
+*/
+void IoContext::free(void)
+{
+    if (NULL != port)
+        CloseHandle(port);
+
+    port = NULL;
+}
+
+/**
+ * IoContext::attach - Send the completions of fd to this context.
+ *
+ * With FILE_SKIP_COMPLETION_PORT_ON_SUCCESS an immediate success queues no
+ * packet, the awaiters rely on it: attach fails if the mode can't be set.
+*/
+int IoContext::attach(SOCKET fd)
+{
+    if (NULL == CreateIoCompletionPort((HANDLE)fd, port, 0, 0))
+        return -1;
+
+    if (!SetFileCompletionNotificationModes((HANDLE)fd,
+                                            FILE_SKIP_COMPLETION_PORT_ON_SUCCESS | FILE_SKIP_SET_EVENT_ON_HANDLE))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * IoContext::run - Resume the coroutines of the completions until stop().
+*/
+void IoContext::run(void)
+{
+    BOOL ok;
+    DWORD bytes, flags;
+    ULONG_PTR key;
+    LPOVERLAPPED overlapped;
+    IO_OPERATION *op;
+
+    while (TRUE)
+    {
+        ok = GetQueuedCompletionStatus(port, &bytes, &key, &overlapped, INFINITE);
+
+        if (NULL == overlapped)
+        {
+            if (!ok || COIO_KEY_QUIT == key)
+                break;
+
+            continue;
+        }
+
+        op = CONTAINING_RECORD(overlapped, IO_OPERATION, overlapped);
+        op->bytes = bytes;
+        op->error = 0;
+
+        /* The port reports NTSTATUS based codes, ask Winsock for its own. */
+        if (!ok && !WSAGetOverlappedResult(op->fd, overlapped, &bytes, FALSE, &flags))
+            op->error = WSAGetLastError();
+
+        op->handle.resume();
+    }
+}
+
+/**
+ * IoContext::stop - End the run() loop of that many threads.
+*/
+void IoContext::stop(int threads)
+{
+    for (int i = 0; i < threads; i++)
+        PostQueuedCompletionStatus(port, 0, COIO_KEY_QUIT, NULL);
+}
+
+/**
+ * RecvAwaiter::await_suspend - Start the receive.
+*/
+bool RecvAwaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+    int ret;
+    DWORD bytes = 0;
+    DWORD flags = 0;
+
+    op.handle = h;
+    ret = WSARecv(op.fd, &buf, 1, &bytes, &flags, &op.overlapped, NULL);
+
+    return pending(SOCKET_ERROR != ret, bytes);
+}
+
+/**
+ * SendAwaiter::await_suspend - Start the send.
+*/
+bool SendAwaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+    int ret;
+    DWORD bytes = 0;
+
+    op.handle = h;
+    ret = WSASend(op.fd, bufs, count, &bytes, 0, &op.overlapped, NULL);
+
+    return pending(SOCKET_ERROR != ret, bytes);
+}
+
+/**
+ * ScheduleAwaiter::await_suspend - Queue the coroutine on the port.
+*/
+bool ScheduleAwaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+    op.handle = h;
+
+    if (!PostQueuedCompletionStatus(context->port, 0, 0, &op.overlapped))
+    {
+        op.error = GetLastError();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * AcceptAwaiter::await_suspend - Create the socket and start AcceptEx.
+*/
+bool AcceptAwaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+    BOOL ok;
+    DWORD bytes = 0;
+
+    acceptFd = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+    if (INVALID_SOCKET == acceptFd)
+    {
+        op.error = WSAGetLastError();
+        return false;
+    }
+
+    op.handle = h;
+    ok = AcceptEx(op.fd, acceptFd, addresses, 0, COIO_ADDRESS_SIZE, COIO_ADDRESS_SIZE,
+                  &bytes, &op.overlapped);
+
+    return pending(ok, bytes);
+}
+
+/**
+ * AcceptAwaiter::await_resume - Finish the accepted socket and attach it.
+*/
+SOCKET AcceptAwaiter::await_resume() noexcept
+{
+    int error = op.error;
+
+    if (0 == error &&
+        (SOCKET_ERROR == setsockopt(acceptFd, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+                                    (char *)&op.fd, sizeof(op.fd)) ||
+         0 != context->attach(acceptFd)))
+        error = WSAGetLastError();
+
+    if (0 != error)
+    {
+        if (INVALID_SOCKET != acceptFd)
+            closesocket(acceptFd);
+
+        WSASetLastError(error);
+        return INVALID_SOCKET;
+    }
+
+    return acceptFd;
+}
+
+/**
+ * ConnectAwaiter::await_suspend - Create, bind and attach the socket, start ConnectEx.
+*/
+bool ConnectAwaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+    BOOL ok;
+    struct sockaddr_in local;
+
+    op.fd = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+    if (INVALID_SOCKET == op.fd)
+    {
+        op.error = WSAGetLastError();
+        return false;
+    }
+
+    /* ConnectEx needs a bound socket. */
+    ZeroMemory(&local, sizeof(local));
+    local.sin_family = AF_INET;
+
+    if (SOCKET_ERROR == bind(op.fd, (struct sockaddr *)&local, sizeof(local)) ||
+        0 != context->attach(op.fd))
+    {
+        op.error = WSAGetLastError();
+        return false;
+    }
+
+    op.handle = h;
+    ok = connectEx(op.fd, address, addressLength, NULL, 0, NULL, &op.overlapped);
+
+    return pending(ok, 0);
+}
+
+/**
+ * ConnectAwaiter::await_resume - Finish the connected socket.
+*/
+SOCKET ConnectAwaiter::await_resume() noexcept
+{
+    int error = op.error;
+
+    if (0 == error && SOCKET_ERROR == setsockopt(op.fd, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0))
+        error = WSAGetLastError();
+
+    if (0 != error)
+    {
+        if (INVALID_SOCKET != op.fd)
+            closesocket(op.fd);
+
+        WSASetLastError(error);
+        return INVALID_SOCKET;
+    }
+
+    return op.fd;
+}
+
+/**
+ * async_recv_exact - Receive length bytes.
+ *
+ * Return length, 0 if the peer closed before the first byte or SOCKET_ERROR.
+*/
+CoTask async_recv_exact(SOCKET fd, char *data, int length)
+{
+    int ret;
+    int got = 0;
+
+    while (got < length)
+    {
+        ret = co_await async_recv(fd, data + got, length - got);
+
+        if (SOCKET_ERROR == ret)
+            co_return SOCKET_ERROR;
+
+        if (0 == ret)
+        {
+            if (0 == got)
+                co_return 0;
+
+            /* Closed in the middle of a message. */
+            WSASetLastError(WSAECONNRESET);
+            co_return SOCKET_ERROR;
+        }
+
+        got += ret;
+    }
+
+    co_return length;
+}
@@ -0,0 +1,290 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      coio.h
+ *
+ * Abstract:
+ *      C++20 coroutines over an I/O completion port.
+ *
+ *      co_await async_accept / async_connect / async_recv / async_send
+ *      starts an overlapped operation and suspends the coroutine; the
+ *      thread that dequeues the completion (IoContext::run) resumes it. The
+ *      code of a connection reads like blocking socket code, but a suspended
+ *      connection is only its coroutine frame, a few threads serve all.
+ *
+ *      Sockets are attached with FILE_SKIP_COMPLETION_PORT_ON_SUCCESS: an
+ *      operation that completes at once does not suspend and queues no
+ *      packet. After a suspension the coroutine may go on in another thread
+ *      of the context, thread local state must be read again after co_await.
+ *
+ *      Errors are returned like the Winsock calls: SOCKET_ERROR or
+ *      INVALID_SOCKET, the code in WSAGetLastError() of the resumed thread.
+ *      Only one receive and one send may be pending per socket.
+ *
+ * Reference:
+ * https://en.cppreference.com/w/cpp/language/coroutines
+*/
+
+#ifndef __COIO_H__
+#define __COIO_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include <windows.h>
+#include <winsock2.h>
+#include <mswsock.h>
+
+
+#define COIO_ADDRESS_SIZE               (sizeof(struct sockaddr_in) + 16)   // AcceptEx address slot, IPv4.
+#define COIO_KEY_QUIT                   1                                   // Ends one run() loop.
+
+
+/* The overlapped must be first, the completion returns its address. */
+typedef struct _IO_OPERATION {
+    OVERLAPPED overlapped;
+    SOCKET fd;                          // The operation was started on it.
+    DWORD bytes;
+    DWORD error;
+    std::coroutine_handle<> handle;
+} IO_OPERATION;
+
+
+class IoContext {
+public:
+    HANDLE port;
+
+    IoContext() : port(NULL) {}
+
+    int init(void);
+    void free(void);
+    int attach(SOCKET fd);
+    void run(void);
+    void stop(int threads);
+};
+
+
+/**
+ * Coroutine started at once that frees itself when it returns, the body
+ * of a connection or an accept loop. Nothing can wait for it.
+*/
+class CoDetached {
+public:
+    struct promise_type {
+        CoDetached get_return_object() noexcept { return CoDetached(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/**
+ * Coroutine started by co_await that returns an int to its caller. The
+ * caller is resumed in the same thread when it ends (symmetric transfer).
+*/
+class CoTask {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type h) noexcept { return h.promise().continuation; }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type {
+        int result = 0;
+        std::coroutine_handle<> continuation;
+
+        CoTask get_return_object() noexcept { return CoTask(handle_type::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_value(int value) noexcept { result = value; }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    explicit CoTask(handle_type h) : coro(h) {}
+    CoTask(CoTask &&other) noexcept : coro(std::exchange(other.coro, {})) {}
+    CoTask(const CoTask &) = delete;
+    ~CoTask() { if (coro) coro.destroy(); }
+
+    bool await_ready() noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        coro.promise().continuation = caller;
+        return coro;
+    }
+
+    int await_resume() noexcept { return coro.promise().result; }
+
+private:
+    handle_type coro;
+};
+
+
+/**
+ * Base of the socket awaiters, holds the operation in the coroutine frame.
+*/
+class IoAwaiter {
+protected:
+    IO_OPERATION op;
+
+    IoAwaiter(SOCKET fd)
+    {
+        ZeroMemory(&op.overlapped, sizeof(op.overlapped));
+        op.fd    = fd;
+        op.bytes = 0;
+        op.error = 0;
+    }
+
+    /* The kernel keeps the address of op until the completion. */
+    IoAwaiter(const IoAwaiter &) = delete;
+
+    /* After the call: suspend only if a completion packet will come. */
+    bool pending(BOOL done, DWORD bytes) noexcept
+    {
+        DWORD error;
+
+        if (done)
+        {
+            op.bytes = bytes;
+            return false;
+        }
+
+        /* Pending: the coroutine may already run again, op is not ours. */
+        error = WSAGetLastError();
+        if (WSA_IO_PENDING == error)
+            return true;
+
+        op.error = error;
+        return false;
+    }
+
+public:
+    bool await_ready() noexcept { return false; }
+
+    int await_resume() noexcept
+    {
+        if (0 != op.error)
+        {
+            WSASetLastError(op.error);
+            return SOCKET_ERROR;
+        }
+
+        return (int)op.bytes;
+    }
+};
+
+class RecvAwaiter : public IoAwaiter {
+    WSABUF buf;
+
+public:
+    RecvAwaiter(SOCKET fd, char *data, int length) : IoAwaiter(fd)
+    {
+        buf.buf = data;
+        buf.len = (ULONG)length;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+};
+
+class SendAwaiter : public IoAwaiter {
+    WSABUF one;
+    WSABUF *bufs;
+    DWORD count;
+
+public:
+    SendAwaiter(SOCKET fd, const char *data, int length) : IoAwaiter(fd), bufs(&one), count(1)
+    {
+        one.buf = (char *)data;
+        one.len = (ULONG)length;
+    }
+
+    SendAwaiter(SOCKET fd, WSABUF *list, DWORD listCount) : IoAwaiter(fd), bufs(list), count(listCount) {}
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+};
+
+class AcceptAwaiter : public IoAwaiter {
+    IoContext *context;
+    SOCKET acceptFd;
+    char addresses[2 * COIO_ADDRESS_SIZE];
+
+public:
+    AcceptAwaiter(IoContext *ctx, SOCKET listen_fd) : IoAwaiter(listen_fd), context(ctx), acceptFd(INVALID_SOCKET) {}
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+    SOCKET await_resume() noexcept;
+};
+
+class ScheduleAwaiter : public IoAwaiter {
+    IoContext *context;
+
+public:
+    ScheduleAwaiter(IoContext *ctx) : IoAwaiter(INVALID_SOCKET), context(ctx) {}
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+};
+
+class ConnectAwaiter : public IoAwaiter {
+    IoContext *context;
+    const struct sockaddr *address;
+    int addressLength;
+
+public:
+    ConnectAwaiter(IoContext *ctx, const struct sockaddr *addr, int addrlen)
+        : IoAwaiter(INVALID_SOCKET), context(ctx), address(addr), addressLength(addrlen) {}
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+    SOCKET await_resume() noexcept;
+};
+
+
+/* Receive what is there, at most length bytes: bytes, 0 closed or SOCKET_ERROR. */
+static inline RecvAwaiter async_recv(SOCKET fd, char *data, int length)
+{
+    return RecvAwaiter(fd, data, length);
+}
+
+/* A stream send completes when all bytes are sent: bytes or SOCKET_ERROR. */
+static inline SendAwaiter async_send(SOCKET fd, const char *data, int length)
+{
+    return SendAwaiter(fd, data, length);
+}
+
+static inline SendAwaiter async_send(SOCKET fd, WSABUF *bufs, DWORD count)
+{
+    return SendAwaiter(fd, bufs, count);
+}
+
+/* Go on in a thread of ctx: 0 or SOCKET_ERROR. */
+static inline ScheduleAwaiter async_schedule(IoContext *ctx)
+{
+    return ScheduleAwaiter(ctx);
+}
+
+/* A new socket attached to ctx, or INVALID_SOCKET. listen_fd must be attached. */
+static inline AcceptAwaiter async_accept(IoContext *ctx, SOCKET listen_fd)
+{
+    return AcceptAwaiter(ctx, listen_fd);
+}
+
+/* A connected socket attached to ctx, or INVALID_SOCKET. IPv4 only. */
+static inline ConnectAwaiter async_connect(IoContext *ctx, const struct sockaddr *addr, int addrlen)
+{
+    return ConnectAwaiter(ctx, addr, addrlen);
+}
+
+CoTask async_recv_exact(SOCKET fd, char *data, int length);
+
+
+#endif /* __COIO_H__ */
@@ -0,0 +1,502 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      fileserve.cpp
+ *
+ * Abstract:
+ *      File range serving with TransmitPackets or ReadFile + WSASend.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_transmitpackets
+ * https://docs.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-transmit_packets_element
+*/
+
+#include <iostream>
+
+#include "fileserve.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+
+#define FILE_SLOT_SIZE                  (FILE_CHUNK_SIZE + SECURE_TAG_SIZE)
+
+
+#pragma pack(push, 1)
+typedef struct _FILE_INFO_FRAME {
+    FRAME_HEADER header;
+    FILE_INFO info;
+} FILE_INFO_FRAME;
+#pragma pack(pop)
+
+
+/**
+ * file_mode_name - Printable serving mode.
+*/
+const char *file_mode_name(int mode)
+{
+    return (FILE_SERVE_ZEROCOPY == mode) ? "zerocopy" : "copy";
+}
+
+/**
+ * file_server_init - Load TransmitPackets for zero copy mode.
+ *
+ * Fall back to copy mode if the provider has no TransmitPackets.
+*/
+int file_server_init(FILE_SERVER *server, SOCKET fd, const char *root, int mode)
+{
+    int ret;
+    DWORD bytes = 0;
+    GUID guid = WSAID_TRANSMITPACKETS;
+
+    ZeroMemory(server, sizeof(*server));
+    server->root = root;
+    server->mode = mode;
+
+    if (FILE_SERVE_ZEROCOPY != mode)
+        return 0;
+
+    ret = WSAIoctl(
+        fd,
+        SIO_GET_EXTENSION_FUNCTION_POINTER,
+        &guid,
+        sizeof(guid),
+        &server->transmitPackets,
+        sizeof(server->transmitPackets),
+        &bytes,
+        NULL,
+        NULL
+    );
+
+    if (SOCKET_ERROR == ret)
+    {
+        printf("Error in WSAIoctl(TransmitPackets): %d, use copy mode.\n", WSAGetLastError());
+        server->mode = FILE_SERVE_COPY;
+        server->transmitPackets = NULL;
+    }
+
+    return 0;
+}
+
+/**
+ * file_server_free - Release the copy buffers.
+*/
+void file_server_free(FILE_SERVER *server)
+{
+    free(server->slots);
+    server->slots = NULL;
+}
+
+/**
+ * device_name - Whether a path component is a DOS device, CON, nul.txt, COM1.
+*/
+static BOOL device_name(const char *part, size_t length)
+{
+    static const char *devices[] = { "CON", "PRN", "AUX", "NUL", "CONIN$", "CONOUT$" };
+    size_t base = 0;
+
+    /* The extension and trailing spaces do not count, CON .txt is CON. */
+    while (base < length && '.' != part[base])
+        base++;
+    while (0 < base && ' ' == part[base - 1])
+        base--;
+
+    /* COM0-9 and LPT0-9, the superscript digits of code page 1252 too. */
+    if (4 == base && (0 == _strnicmp(part, "COM", 3) || 0 == _strnicmp(part, "LPT", 3)) &&
+        NULL != strchr("0123456789\xb9\xb2\xb3", part[3]))
+        return TRUE;
+
+    for (size_t i = 0; i < sizeof(devices) / sizeof(devices[0]); i++)
+    {
+        if (strlen(devices[i]) == base && 0 == _strnicmp(part, devices[i], base))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * open_file - Open a file on disk below the root, return 0 or a Win32 error.
+*/
+static DWORD open_file(const char *root, const char *path, UINT32 pathLen, HANDLE *file)
+{
+    int ret;
+    char name[FILE_PATH_MAX];
+    char full[FILE_PATH_MAX];
+
+    if (0 == pathLen || pathLen >= FILE_PATH_MAX)
+        return ERROR_INVALID_NAME;
+
+    memcpy(name, path, pathLen);
+    name[pathLen] = 0;
+
+    /* Stay inside the root. */
+    if (strlen(name) != pathLen || NULL != strstr(name, "..") || NULL != strchr(name, ':') ||
+        '\\' == name[0] || '/' == name[0])
+        return ERROR_ACCESS_DENIED;
+
+    /* A device name opens the device in any directory, root\NUL or root\a\com1.log. */
+    for (const char *part = name; 0 != *part; )
+    {
+        size_t length = strcspn(part, "\\/");
+
+        if (device_name(part, length))
+            return ERROR_ACCESS_DENIED;
+
+        part += length + (0 != part[length]);
+    }
+
+    ret = snprintf(full, sizeof(full), "%s\\%s", root, name);
+    if (0 > ret || ret >= (int)sizeof(full))
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    *file = CreateFileA(
+        full,
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL
+    );
+
+    if (INVALID_HANDLE_VALUE == *file)
+        return GetLastError();
+
+    /* Whatever the name check missed, serve files on disk only, no pipe or device. */
+    if (FILE_TYPE_DISK != GetFileType(*file))
+    {
+        CloseHandle(*file);
+        *file = INVALID_HANDLE_VALUE;
+        return ERROR_ACCESS_DENIED;
+    }
+
+    return 0;
+}
+
+/**
+ * send_info - Send the FILE_INFO frame on its own.
+*/
+static int send_info(SOCKET fd, SECURE_CHANNEL *secure, UINT16 flags, const FILE_INFO *info)
+{
+    int length = sizeof(FILE_INFO);
+    char payload[sizeof(FILE_INFO) + SECURE_TAG_SIZE];
+
+    memcpy(payload, info, sizeof(FILE_INFO));
+
+    if (NULL != secure)
+        length = secure_seal(secure, FRAME_TYPE_FILE_INFO, flags, payload, length);
+
+    if (0 > length)
+        return -1;
+
+    return frame_send(fd, FRAME_TYPE_FILE_INFO, flags, payload, length);
+}
+
+/**
+ * serve_zerocopy - Frame headers from memory, chunks straight from the file.
+*/
+static int serve_zerocopy(FILE_SERVER *server, SOCKET fd, UINT16 flags, HANDLE file, const FILE_INFO *info)
+{
+    int i;
+    DWORD count;
+    UINT32 chunk;
+    UINT64 offset    = info->offset;
+    UINT64 remaining = info->length;
+    FILE_INFO_FRAME infoFrame;
+    FRAME_HEADER headers[FILE_BATCH_CHUNKS];
+    TRANSMIT_PACKETS_ELEMENT elements[1 + 2 * FILE_BATCH_CHUNKS];
+
+    infoFrame.header.length = sizeof(FILE_INFO);
+    infoFrame.header.type   = FRAME_TYPE_FILE_INFO;
+    infoFrame.header.flags  = flags;
+    infoFrame.info          = *info;
+
+    ZeroMemory(elements, sizeof(elements));
+
+    /* The FILE_INFO frame goes out with the first batch. */
+    elements[0].dwElFlags = TP_ELEMENT_MEMORY;
+    elements[0].cLength   = sizeof(infoFrame);
+    elements[0].pBuffer   = &infoFrame;
+    count = 1;
+
+    do
+    {
+        for (i = 0; i < FILE_BATCH_CHUNKS && 0 < remaining; i++)
+        {
+            chunk = (remaining < FILE_CHUNK_SIZE) ? (UINT32)remaining : FILE_CHUNK_SIZE;
+
+            headers[i].length = chunk;
+            headers[i].type   = FRAME_TYPE_FILE_DATA;
+            headers[i].flags  = flags;
+
+            elements[count].dwElFlags = TP_ELEMENT_MEMORY;
+            elements[count].cLength   = FRAME_HEADER_SIZE;
+            elements[count].pBuffer   = &headers[i];
+            count++;
+
+            elements[count].dwElFlags            = TP_ELEMENT_FILE;
+            elements[count].cLength              = chunk;
+            elements[count].nFileOffset.QuadPart = (LONGLONG)offset;
+            elements[count].hFile                = file;
+            count++;
+
+            offset    += chunk;
+            remaining -= chunk;
+        }
+
+        if (!server->transmitPackets(fd, elements, count, 0, NULL, TF_USE_KERNEL_APC))
+        {
+            printf("Error in TransmitPackets: %d.\n", WSAGetLastError());
+            return -1;
+        }
+
+        ZeroMemory(elements, sizeof(elements));
+        count = 0;
+    } while (0 < remaining);
+
+    return 0;
+}
+
+/**
+ * serve_copy - ReadFile into user buffers, then one vectored send per batch.
+*/
+static int serve_copy(FILE_SERVER *server, SOCKET fd, SECURE_CHANNEL *secure, UINT16 flags,
+                      HANDLE file, const FILE_INFO *info)
+{
+    int i, length;
+    DWORD bytes;
+    UINT32 chunk;
+    UINT64 remaining = info->length;
+    LARGE_INTEGER offset;
+    FRAME_WRITER writer;
+    char *slot;
+
+    if (NULL == server->slots)
+    {
+        server->slots = (char *)malloc((size_t)FILE_SLOT_SIZE * FILE_BATCH_CHUNKS);
+        if (NULL == server->slots)
+        {
+            printf("Out of memory.\n");
+            return -1;
+        }
+    }
+
+    if (0 != send_info(fd, secure, flags, info))
+        return -1;
+
+    offset.QuadPart = (LONGLONG)info->offset;
+    if (!SetFilePointerEx(file, offset, NULL, FILE_BEGIN))
+    {
+        printf("Error in SetFilePointerEx: %d.\n", GetLastError());
+        return -1;
+    }
+
+    while (0 < remaining)
+    {
+        frame_writer_init(&writer);
+
+        for (i = 0; i < FILE_BATCH_CHUNKS && 0 < remaining; i++)
+        {
+            chunk = (remaining < FILE_CHUNK_SIZE) ? (UINT32)remaining : FILE_CHUNK_SIZE;
+            slot  = server->slots + (size_t)i * FILE_SLOT_SIZE;
+
+            /* A short read means the file shrank, the reply can not be completed. */
+            if (!ReadFile(file, slot, chunk, &bytes, NULL) || bytes != chunk)
+            {
+                printf("Error in ReadFile: %d.\n", GetLastError());
+                return -1;
+            }
+
+            length = (int)chunk;
+
+            if (NULL != secure)
+                length = secure_seal(secure, FRAME_TYPE_FILE_DATA, flags, slot, chunk);
+
+            if (0 > length)
+                return -1;
+
+            frame_writer_add(&writer, FRAME_TYPE_FILE_DATA, flags, slot, length);
+            remaining -= chunk;
+        }
+
+        if (0 != frame_writer_flush(&writer, fd))
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * file_serve - Answer one FILE_GET frame.
+ *
+ * Errors of the request (bad path, missing file, bad range) are reported
+ * in FILE_INFO. Return -1 only if the connection can not be used anymore.
+*/
+int file_serve(FILE_SERVER *server, SOCKET fd, SECURE_CHANNEL *secure, const FRAME_VIEW *request)
+{
+    int ret;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    FILE_REQUEST range;
+    FILE_INFO info;
+    LARGE_INTEGER size;
+
+    ZeroMemory(&info, sizeof(info));
+
+    if (request->length < sizeof(FILE_REQUEST))
+    {
+        info.status = ERROR_INVALID_PARAMETER;
+        return send_info(fd, secure, request->flags, &info);
+    }
+
+    /* File serving is off unless the server has a root. */
+    if (NULL == server->root)
+    {
+        info.status = ERROR_ACCESS_DENIED;
+        return send_info(fd, secure, request->flags, &info);
+    }
+
+    memcpy(&range, request->payload, sizeof(range));
+
+    info.status = open_file(server->root, request->payload + sizeof(range),
+                            request->length - sizeof(range), &file);
+    if (0 != info.status)
+        return send_info(fd, secure, request->flags, &info);
+
+    if (!GetFileSizeEx(file, &size))
+    {
+        info.status = GetLastError();
+        goto out_info;
+    }
+
+    info.fileSize = (UINT64)size.QuadPart;
+    info.offset   = range.offset;
+
+    if (range.offset > info.fileSize)
+    {
+        info.status = ERROR_HANDLE_EOF;
+        goto out_info;
+    }
+
+    /* Clamp the range to the end of file. */
+    info.length = info.fileSize - range.offset;
+    if (0 != range.length && range.length < info.length)
+        info.length = range.length;
+
+    if (NULL == secure && FILE_SERVE_ZEROCOPY == server->mode)
+        ret = serve_zerocopy(server, fd, request->flags, file, &info);
+    else
+        ret = serve_copy(server, fd, secure, request->flags, file, &info);
+
+    CloseHandle(file);
+
+    return ret;
+
+out_info:
+    CloseHandle(file);
+
+    return send_info(fd, secure, request->flags, &info);
+}
+
+/**
+ * file_request - Send a FILE_GET frame.
+*/
+int file_request(SOCKET fd, SECURE_CHANNEL *secure, const char *path, UINT64 offset, UINT64 length)
+{
+    int size;
+    size_t pathLen = strlen(path);
+    FILE_REQUEST range;
+    char payload[sizeof(FILE_REQUEST) + FILE_PATH_MAX + SECURE_TAG_SIZE];
+
+    if (0 == pathLen || pathLen >= FILE_PATH_MAX)
+    {
+        printf("Bad path: %s.\n", path);
+        return -1;
+    }
+
+    range.offset = offset;
+    range.length = length;
+
+    memcpy(payload, &range, sizeof(range));
+    memcpy(payload + sizeof(range), path, pathLen);
+    size = (int)(sizeof(range) + pathLen);
+
+    if (NULL != secure)
+        size = secure_seal(secure, FRAME_TYPE_FILE_GET, 0, payload, size);
+
+    if (0 > size)
+        return -1;
+
+    return frame_send(fd, FRAME_TYPE_FILE_GET, 0, payload, size);
+}
+
+/**
+ * file_receive - Read the FILE_INFO frame and all FILE_DATA frames.
+ *
+ * Check info->status, the data frames only follow when it is 0.
+*/
+int file_receive(SOCKET fd, FRAME_READER *reader, SECURE_CHANNEL *secure,
+                 FILE_INFO *info, FILE_SINK sink, void *context)
+{
+    int ret;
+    BOOL gotInfo     = FALSE;
+    UINT64 remaining = 0;
+    FRAME_VIEW frame;
+
+    while (TRUE)
+    {
+        while (0 < (ret = frame_next(reader, &frame)))
+        {
+            if (NULL != secure && 0 != secure_open(secure, &frame))
+            {
+                printf("Bad tag from server.\n");
+                return -1;
+            }
+
+            if (!gotInfo)
+            {
+                if (FRAME_TYPE_FILE_INFO != frame.type || sizeof(FILE_INFO) != frame.length)
+                {
+                    printf("Expect a FILE_INFO frame.\n");
+                    return -1;
+                }
+
+                memcpy(info, frame.payload, sizeof(FILE_INFO));
+                gotInfo   = TRUE;
+                remaining = (0 == info->status) ? info->length : 0;
+            }
+            else
+            {
+                if (FRAME_TYPE_FILE_DATA != frame.type || frame.length > remaining)
+                {
+                    printf("Unexpected frame in file data.\n");
+                    return -1;
+                }
+
+                sink(context, frame.payload, frame.length);
+                remaining -= frame.length;
+            }
+
+            if (0 == remaining)
+            {
+                frame_release(reader);
+                return 0;
+            }
+        }
+
+        frame_release(reader);
+
+        if (0 > ret)
+        {
+            printf("Bad frame from server.\n");
+            return -1;
+        }
+
+        ret = frame_reader_fill(reader, fd);
+        if (0 >= ret)
+        {
+            printf("Connection lost in file data.\n");
+            return -1;
+        }
+    }
+}
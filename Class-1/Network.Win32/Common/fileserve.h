@@ -0,0 +1,92 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      fileserve.h
+ *
+ * Abstract:
+ *      File range requests over the frames of framing.h.
+ *
+ *      A FILE_GET frame carries FILE_REQUEST followed by a path relative
+ *      to the server root. The server answers with one FILE_INFO frame and,
+ *      if the status is 0, FILE_DATA frames of up to FILE_CHUNK_SIZE bytes
+ *      that together hold the requested range.
+ *
+ *      FILE_SERVE_ZEROCOPY hands frame headers and file ranges to
+ *      TransmitPackets, the data goes from the file system cache to the
+ *      socket without passing through user space. FILE_SERVE_COPY reads
+ *      each chunk with ReadFile and sends it with WSASend, it is the
+ *      baseline and is also used on encrypted connections.
+ *
+ *      Client versions of Windows run at most two TransmitPackets or
+ *      TransmitFile calls at a time, others wait. Server versions have no
+ *      such limit.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_transmitpackets
+*/
+
+#ifndef __FILESERVE_H__
+#define __FILESERVE_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+#include <winsock2.h>
+#include <mswsock.h>
+
+#include "framing.h"
+#include "secure.h"
+
+
+#define FILE_CHUNK_SIZE                 (60 * 1024)     // Room for the tag when encrypted.
+#define FILE_BATCH_CHUNKS               16              // Chunks per send call.
+#define FILE_PATH_MAX                   MAX_PATH
+
+
+/* Serving modes. */
+#define FILE_SERVE_ZEROCOPY             0
+#define FILE_SERVE_COPY                 1
+
+
+#pragma pack(push, 1)
+typedef struct _FILE_REQUEST {
+    UINT64 offset;
+    UINT64 length;                      // 0 is up to the end of file.
+} FILE_REQUEST;                         // Followed by the path, no '\0'.
+
+typedef struct _FILE_INFO {
+    UINT64 fileSize;
+    UINT64 offset;
+    UINT64 length;                      // Bytes in the FILE_DATA frames.
+    UINT32 status;                      // 0 or a Win32 error code.
+    UINT32 reserved;
+} FILE_INFO;
+#pragma pack(pop)
+
+
+typedef struct _FILE_SERVER {
+    int mode;
+    const char *root;                   // NULL refuses all requests.
+    LPFN_TRANSMITPACKETS transmitPackets;
+    char *slots;                        // Copy mode buffers, allocated on first use.
+} FILE_SERVER;
+
+/* Receives the bytes of FILE_DATA frames in order. */
+typedef void (*FILE_SINK)(void *context, const char *data, UINT32 length);
+
+
+const char *file_mode_name(int mode);
+
+int file_server_init(FILE_SERVER *server, SOCKET fd, const char *root, int mode);
+void file_server_free(FILE_SERVER *server);
+int file_serve(FILE_SERVER *server, SOCKET fd, SECURE_CHANNEL *secure, const FRAME_VIEW *request);
+
+int file_request(SOCKET fd, SECURE_CHANNEL *secure, const char *path, UINT64 offset, UINT64 length);
+int file_receive(SOCKET fd, FRAME_READER *reader, SECURE_CHANNEL *secure,
+                 FILE_INFO *info, FILE_SINK sink, void *context);
+
+
+#endif /* __FILESERVE_H__ */
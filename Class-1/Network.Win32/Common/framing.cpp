@@ -0,0 +1,380 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      framing.cpp
+ *
+ * Abstract:
+ *      Length prefixed framing, mirrored ring buffer reader and vectored
+ *      frame writer.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualalloc2
+ * https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsasend
+*/
+
+#include <iostream>
+
+#include "framing.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "onecore.lib")
+
+
+/**
+ * ring_create - Map capacity bytes twice, back to back.
+ *
+ * Reserve one 2 * capacity placeholder, split it in two, and map the
+ * same pagefile section into both halves.
+*/
+int ring_create(RING_BUFFER *ring, UINT32 capacity)
+{
+    SYSTEM_INFO sysInfo;
+    HANDLE section      = NULL;
+    char *placeholder1  = NULL;
+    char *placeholder2  = NULL;
+    char *view1         = NULL;
+    char *view2         = NULL;
+
+    ZeroMemory(ring, sizeof(*ring));
+    GetSystemInfo(&sysInfo);
+
+    if (0 == capacity || 0 != (capacity % sysInfo.dwAllocationGranularity))
+    {
+        printf("Ring size %u is not a multiple of %u.\n", capacity, sysInfo.dwAllocationGranularity);
+        return -1;
+    }
+
+    placeholder1 = (char *)VirtualAlloc2(
+        NULL,
+        NULL,
+        2 * (SIZE_T)capacity,
+        MEM_RESERVE | MEM_RESERVE_PLACEHOLDER,
+        PAGE_NOACCESS,
+        NULL,
+        0
+    );
+
+    if (NULL == placeholder1)
+    {
+        printf("Error in VirtualAlloc2: %d.\n", GetLastError());
+        goto out_fail;
+    }
+
+    /* Split the placeholder into two halves. */
+    if (!VirtualFree(placeholder1, capacity, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER))
+    {
+        printf("Error in VirtualFree: %d.\n", GetLastError());
+        goto out_fail;
+    }
+
+    placeholder2 = placeholder1 + capacity;
+
+    section = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, capacity, NULL);
+    if (NULL == section)
+    {
+        printf("Error in CreateFileMapping: %d.\n", GetLastError());
+        goto out_fail;
+    }
+
+    view1 = (char *)MapViewOfFile3(section, NULL, placeholder1, 0, capacity,
+                                   MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+    if (NULL == view1)
+    {
+        printf("Error in MapViewOfFile3: %d.\n", GetLastError());
+        goto out_fail;
+    }
+
+    placeholder1 = NULL;
+
+    view2 = (char *)MapViewOfFile3(section, NULL, placeholder2, 0, capacity,
+                                   MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+    if (NULL == view2)
+    {
+        printf("Error in MapViewOfFile3: %d.\n", GetLastError());
+        goto out_fail;
+    }
+
+    /* The views keep the section alive. */
+    CloseHandle(section);
+
+    ring->base      = view1;
+    ring->mirror    = view2;
+    ring->capacity  = capacity;
+
+    return 0;
+
+out_fail:
+    if (NULL != section)
+        CloseHandle(section);
+
+    if (NULL != view1)
+        UnmapViewOfFileEx(view1, 0);
+
+    if (NULL != placeholder1)
+        VirtualFree(placeholder1, 0, MEM_RELEASE);
+
+    if (NULL != placeholder2)
+        VirtualFree(placeholder2, 0, MEM_RELEASE);
+
+    return -1;
+}
+
+/**
+ * ring_destroy - Unmap both views.
+*/
+void ring_destroy(RING_BUFFER *ring)
+{
+    if (NULL != ring->base)
+        UnmapViewOfFileEx(ring->base, 0);
+
+    if (NULL != ring->mirror)
+        UnmapViewOfFileEx(ring->mirror, 0);
+
+    ZeroMemory(ring, sizeof(*ring));
+}
+
+/**
+ * frame_reader_init - Create the receive ring of a connection.
+*/
+int frame_reader_init(FRAME_READER *reader, UINT32 capacity)
+{
+    reader->parsed = 0;
+
+    return ring_create(&reader->ring, capacity);
+}
+
+/**
+ * frame_reader_free - Release the receive ring.
+*/
+void frame_reader_free(FRAME_READER *reader)
+{
+    ring_destroy(&reader->ring);
+    reader->parsed = 0;
+}
+
+/**
+ * frame_reader_fill - recv() straight into the free part of the ring.
+ *
+ * Return received bytes, 0 if the peer closed, SOCKET_ERROR on error
+ * (WSAENOBUFS if unreleased frames fill the whole ring).
+*/
+int frame_reader_fill(FRAME_READER *reader, SOCKET fd)
+{
+    int ret;
+    RING_BUFFER *ring = &reader->ring;
+    UINT32 space = ring_free(ring);
+
+    if (0 == space)
+    {
+        WSASetLastError(WSAENOBUFS);
+        return SOCKET_ERROR;
+    }
+
+    /* Thanks to the mirror the free space is always contiguous. */
+    ret = recv(fd, ring_at(ring, ring->tail), (int)space, 0);
+
+    if (0 < ret)
+        ring->tail += ret;
+
+    return ret;
+}
+
+/**
+ * frame_next - Parse the next complete frame in place.
+ *
+ * Return 1 and fill frame, 0 if more data is needed, -1 on a malformed
+ * frame. The frame stays valid until frame_release().
+*/
+int frame_next(FRAME_READER *reader, FRAME_VIEW *frame)
+{
+    FRAME_HEADER header;
+    RING_BUFFER *ring = &reader->ring;
+    UINT64 avail = ring->tail - reader->parsed;
+
+    if (avail < FRAME_HEADER_SIZE)
+        return 0;
+
+    memcpy(&header, ring_at(ring, reader->parsed), FRAME_HEADER_SIZE);
+
+    if (header.length > FRAME_MAX_PAYLOAD ||
+        header.length + FRAME_HEADER_SIZE > ring->capacity)
+        return -1;
+
+    if (avail < FRAME_HEADER_SIZE + (UINT64)header.length)
+        return 0;
+
+    frame->type     = header.type;
+    frame->flags    = header.flags;
+    frame->length   = header.length;
+    frame->payload  = ring_at(ring, reader->parsed + FRAME_HEADER_SIZE);
+
+    reader->parsed += FRAME_HEADER_SIZE + header.length;
+
+    return 1;
+}
+
+/**
+ * frame_release - Give the space of all parsed frames back to the ring.
+*/
+void frame_release(FRAME_READER *reader)
+{
+    reader->ring.head = reader->parsed;
+}
+
+/**
+ * frame_writer_init - Start an empty reply batch.
+*/
+void frame_writer_init(FRAME_WRITER *writer)
+{
+    writer->count  = 0;
+    writer->frames = 0;
+}
+
+/**
+ * frame_writer_add - Append one frame, the payload is referenced, not copied.
+ *
+ * Return -1 if the batch is full, flush it and add again.
+*/
+int frame_writer_add(FRAME_WRITER *writer, UINT16 type, UINT16 flags, const char *payload, UINT32 length)
+{
+    FRAME_HEADER *header;
+
+    if (writer->frames >= FRAME_WRITER_FRAMES)
+        return -1;
+
+    header = &writer->headers[writer->frames++];
+    header->length  = length;
+    header->type    = type;
+    header->flags   = flags;
+
+    writer->bufs[writer->count].buf = (char *)header;
+    writer->bufs[writer->count].len = FRAME_HEADER_SIZE;
+    writer->count++;
+
+    if (0 < length)
+    {
+        writer->bufs[writer->count].buf = (char *)payload;
+        writer->bufs[writer->count].len = length;
+        writer->count++;
+    }
+
+    return 0;
+}
+
+/**
+ * frame_writer_flush - Write the whole batch with vectored WSASend.
+*/
+int frame_writer_flush(FRAME_WRITER *writer, SOCKET fd)
+{
+    int ret;
+    DWORD sent = 0;
+    WSABUF *bufs = writer->bufs;
+    int count = writer->count;
+
+    while (0 < count)
+    {
+        ret = WSASend(fd, bufs, count, &sent, 0, NULL, NULL);
+
+        if (SOCKET_ERROR == ret)
+        {
+            printf("Error in WSASend: %d.\n", WSAGetLastError());
+            return -1;
+        }
+
+        /* Skip what was written, a blocking socket normally writes all. */
+        while (0 < count && sent >= bufs->len)
+        {
+            sent -= bufs->len;
+            bufs++;
+            count--;
+        }
+
+        if (0 < count)
+        {
+            bufs->buf += sent;
+            bufs->len -= sent;
+        }
+    }
+
+    frame_writer_init(writer);
+
+    return 0;
+}
+
+/**
+ * frame_send - Write a single frame.
+*/
+int frame_send(SOCKET fd, UINT16 type, UINT16 flags, const char *payload, UINT32 length)
+{
+    FRAME_WRITER writer;
+
+    frame_writer_init(&writer);
+    frame_writer_add(&writer, type, flags, payload, length);
+
+    return frame_writer_flush(&writer, fd);
+}
+
+/**
+ * frame_scanner_init - Reset the scanner state.
+*/
+void frame_scanner_init(FRAME_SCANNER *scanner)
+{
+    ZeroMemory(scanner, sizeof(*scanner));
+}
+
+/**
+ * frame_scan - Count the frames completed by data, payload bytes are skipped.
+ *
+ * A GOAWAY frame only sets scanner->goaway, it answers no request.
+ *
+ * Return number of completed frames, -1 on a malformed frame.
+*/
+int frame_scan(FRAME_SCANNER *scanner, const char *data, int len)
+{
+    int frames = 0;
+    UINT32 take;
+
+    while (0 < len)
+    {
+        if (FRAME_HEADER_SIZE > scanner->headerBytes)
+        {
+            take = FRAME_HEADER_SIZE - scanner->headerBytes;
+            if (take > (UINT32)len)
+                take = (UINT32)len;
+
+            memcpy((char *)&scanner->header + scanner->headerBytes, data, take);
+            scanner->headerBytes += take;
+            data += take;
+            len  -= take;
+
+            if (FRAME_HEADER_SIZE > scanner->headerBytes)
+                break;
+
+            if (scanner->header.length > FRAME_MAX_PAYLOAD)
+                return -1;
+
+            scanner->payloadLeft = scanner->header.length;
+        }
+
+        take = scanner->payloadLeft;
+        if (take > (UINT32)len)
+            take = (UINT32)len;
+
+        scanner->payloadLeft -= take;
+        data += take;
+        len  -= take;
+
+        if (0 == scanner->payloadLeft)
+        {
+            scanner->headerBytes = 0;
+
+            if (FRAME_TYPE_GOAWAY == scanner->header.type)
+                scanner->goaway = TRUE;
+            else
+                frames++;
+        }
+    }
+
+    return frames;
+}
@@ -0,0 +1,135 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      framing.h
+ *
+ * Abstract:
+ *      Length prefixed framing for the tcp examples.
+ *
+ *      Every message is an 8 bytes header (payload length, type, flags,
+ *      little endian) followed by the payload. Frames are received into a
+ *      mirrored ring buffer, the same pages are mapped twice back to back,
+ *      so a frame that wraps around the end is still contiguous in memory
+ *      and can be parsed and used in place without any copy.
+ *
+ *      Replies are collected as WSABUF lists (header + payload pointer) and
+ *      written with one WSASend, the payload may point straight into the
+ *      receive ring as long as the frames are released after the send.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualalloc2
+*/
+
+#ifndef __FRAMING_H__
+#define __FRAMING_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+#include <winsock2.h>
+
+
+#define FRAME_MAX_PAYLOAD               (64 * 1024)
+#define FRAME_RING_SIZE                 (256 * 1024)    // Multiple of 64 KiB.
+#define FRAME_WRITER_FRAMES             64
+
+
+/* Frame types. */
+#define FRAME_TYPE_ECHO                 1       // Reply echoes the payload.
+#define FRAME_TYPE_ERROR                2       // Payload is an error text.
+#define FRAME_TYPE_HELLO                3       // Key exchange, see secure.h.
+#define FRAME_TYPE_FILE_GET             4       // File range request, see fileserve.h.
+#define FRAME_TYPE_FILE_INFO            5
+#define FRAME_TYPE_FILE_DATA            6
+#define FRAME_TYPE_GOAWAY               7       // Server drains, no new requests, see graceful.h.
+
+
+#pragma pack(push, 1)
+typedef struct _FRAME_HEADER {
+    UINT32 length;                      // Payload bytes, header excluded.
+    UINT16 type;
+    UINT16 flags;
+} FRAME_HEADER;
+#pragma pack(pop)
+
+#define FRAME_HEADER_SIZE               ((UINT32)sizeof(FRAME_HEADER))
+
+
+/**
+ * Mirrored ring buffer, [base, base + 2 * capacity) maps the same pages
+ * twice. head and tail only grow, the offset is (position % capacity).
+*/
+typedef struct _RING_BUFFER {
+    char *base;
+    char *mirror;
+    UINT32 capacity;
+    UINT64 head;                        // Next byte to release.
+    UINT64 tail;                        // Next byte to write.
+} RING_BUFFER;
+
+/* A parsed frame, payload points into the receive ring. */
+typedef struct _FRAME_VIEW {
+    UINT16 type;
+    UINT16 flags;
+    UINT32 length;
+    char *payload;
+} FRAME_VIEW;
+
+typedef struct _FRAME_READER {
+    RING_BUFFER ring;
+    UINT64 parsed;                      // Next byte to parse, head <= parsed <= tail.
+} FRAME_READER;
+
+typedef struct _FRAME_WRITER {
+    int count;                          // Used entries of bufs.
+    int frames;
+    FRAME_HEADER headers[FRAME_WRITER_FRAMES];
+    WSABUF bufs[FRAME_WRITER_FRAMES * 2];
+} FRAME_WRITER;
+
+/* Counts complete frames in a byte stream without keeping the bytes. */
+typedef struct _FRAME_SCANNER {
+    UINT32 headerBytes;
+    UINT32 payloadLeft;
+    FRAME_HEADER header;
+    BOOL goaway;                        // A GOAWAY frame was seen, it is not counted.
+} FRAME_SCANNER;
+
+
+int ring_create(RING_BUFFER *ring, UINT32 capacity);
+void ring_destroy(RING_BUFFER *ring);
+
+static inline UINT32 ring_used(const RING_BUFFER *ring)
+{
+    return (UINT32)(ring->tail - ring->head);
+}
+
+static inline UINT32 ring_free(const RING_BUFFER *ring)
+{
+    return ring->capacity - ring_used(ring);
+}
+
+static inline char *ring_at(const RING_BUFFER *ring, UINT64 pos)
+{
+    return ring->base + (pos % ring->capacity);
+}
+
+int frame_reader_init(FRAME_READER *reader, UINT32 capacity);
+void frame_reader_free(FRAME_READER *reader);
+int frame_reader_fill(FRAME_READER *reader, SOCKET fd);
+int frame_next(FRAME_READER *reader, FRAME_VIEW *frame);
+void frame_release(FRAME_READER *reader);
+
+void frame_writer_init(FRAME_WRITER *writer);
+int frame_writer_add(FRAME_WRITER *writer, UINT16 type, UINT16 flags, const char *payload, UINT32 length);
+int frame_writer_flush(FRAME_WRITER *writer, SOCKET fd);
+int frame_send(SOCKET fd, UINT16 type, UINT16 flags, const char *payload, UINT32 length);
+
+void frame_scanner_init(FRAME_SCANNER *scanner);
+int frame_scan(FRAME_SCANNER *scanner, const char *data, int len);
+
+
+#endif /* __FRAMING_H__ */
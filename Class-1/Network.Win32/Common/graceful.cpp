@@ -0,0 +1,194 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      graceful.cpp
+ *
+ * Abstract:
+ *      Graceful shutdown of the servers on console control signals.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/console/handlerroutine
+*/
+
+#include <iostream>
+
+#include "graceful.h"
+
+
+/* The handler routine has no context, one instance per process. */
+static GRACEFUL *volatile current = NULL;
+
+/* Handlers running, graceful_free() closes the events after they left. */
+static volatile LONG handlers = 0;
+
+
+/**
+ * ctrl_handler - Console control handler, runs on a thread of its own.
+*/
+static BOOL WINAPI ctrl_handler(DWORD ctrlType)
+{
+    GRACEFUL *graceful;
+    BOOL handled = TRUE;
+
+    InterlockedIncrement(&handlers);
+
+    graceful = current;
+    if (NULL == graceful)
+    {
+        InterlockedDecrement(&handlers);
+        return FALSE;
+    }
+
+    switch (ctrlType)
+    {
+    case CTRL_C_EVENT:
+    case CTRL_BREAK_EVENT:
+        if (1 < InterlockedIncrement(&graceful->signals))
+            printf("Stop now, the drain is cut short.\n");
+
+        graceful_stop(graceful);
+        break;
+
+    case CTRL_CLOSE_EVENT:
+        /* Windows ends the process about 5 s after the close, the drain must end before. */
+        graceful->closeDeadline = GetTickCount64() +
+            ((graceful->drainMs < GRACEFUL_CLOSE_DRAIN_MS) ? graceful->drainMs : GRACEFUL_CLOSE_DRAIN_MS);
+        InterlockedExchange(&graceful->closing, 1);
+
+        InterlockedIncrement(&graceful->signals);
+        graceful_stop(graceful);
+
+        /* The process is killed when this returns. */
+        WaitForSingleObject(graceful->doneEvent, GRACEFUL_CLOSE_WAIT_MS);
+        break;
+
+    default:
+        handled = FALSE;
+        break;
+    }
+
+    InterlockedDecrement(&handlers);
+
+    return handled;
+}
+
+/**
+ * graceful_init - Install the console control handler.
+*/
+int graceful_init(GRACEFUL *graceful, DWORD drainMs, GRACEFUL_CALLBACK onStop, void *context)
+{
+    ZeroMemory(graceful, sizeof(*graceful));
+
+    graceful->drainMs = drainMs;
+    graceful->onStop  = onStop;
+    graceful->context = context;
+
+    graceful->stopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    graceful->doneEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+    if (NULL == graceful->stopEvent || NULL == graceful->doneEvent)
+    {
+        printf("Error in CreateEvent: %d.\n", GetLastError());
+        goto out_event;
+    }
+
+    InterlockedExchangePointer((PVOID volatile *)&current, graceful);
+
+    if (!SetConsoleCtrlHandler(ctrl_handler, TRUE))
+    {
+        printf("Error in SetConsoleCtrlHandler: %d.\n", GetLastError());
+        current = NULL;
+        goto out_event;
+    }
+
+    return 0;
+
+out_event:
+    if (NULL != graceful->stopEvent)
+        CloseHandle(graceful->stopEvent);
+    if (NULL != graceful->doneEvent)
+        CloseHandle(graceful->doneEvent);
+
+    graceful->stopEvent = NULL;
+    graceful->doneEvent = NULL;
+
+    return -1;
+}
+
+/**
+ * graceful_free - Remove the handler, release a waiting close event and
+ * close the events once no handler uses them.
+*/
+void graceful_free(GRACEFUL *graceful)
+{
+    if (NULL == graceful->stopEvent)
+        return;
+
+    SetConsoleCtrlHandler(ctrl_handler, FALSE);
+
+    /* A handler that starts after this returns at once. */
+    InterlockedExchangePointer((PVOID volatile *)&current, NULL);
+
+    SetEvent(graceful->doneEvent);
+
+    while (0 != handlers)
+        Sleep(1);
+
+    CloseHandle(graceful->stopEvent);
+    CloseHandle(graceful->doneEvent);
+
+    graceful->stopEvent = NULL;
+    graceful->doneEvent = NULL;
+}
+
+/**
+ * graceful_stop - Start the shutdown, only the first call does anything.
+*/
+void graceful_stop(GRACEFUL *graceful)
+{
+    if (0 != InterlockedExchange(&graceful->stopping, 1))
+        return;
+
+    if (NULL != graceful->onStop)
+        graceful->onStop(graceful->context);
+
+    SetEvent(graceful->stopEvent);
+}
+
+/**
+ * graceful_deadline - Tick count timeoutMs from now, earlier when the
+ * console is closing.
+*/
+ULONGLONG graceful_deadline(const GRACEFUL *graceful, DWORD timeoutMs)
+{
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+
+    if (0 != graceful->closing && graceful->closeDeadline < deadline)
+        return graceful->closeDeadline;
+
+    return deadline;
+}
+
+/**
+ * graceful_drain - Wait until active drops to 0, for at most timeoutMs.
+ *
+ * Return the number still active, 0 when drained.
+*/
+int graceful_drain(GRACEFUL *graceful, const volatile LONG *active, DWORD timeoutMs)
+{
+    ULONGLONG now;
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+
+    while (0 < *active && 2 > graceful->signals)
+    {
+        now = GetTickCount64();
+
+        if (now >= deadline || (0 != graceful->closing && now >= graceful->closeDeadline))
+            break;
+
+        Sleep(GRACEFUL_POLL_MS);
+    }
+
+    return (0 < *active) ? (int)*active : 0;
+}
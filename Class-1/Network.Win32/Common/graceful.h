@@ -0,0 +1,75 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      graceful.h
+ *
+ * Abstract:
+ *      Graceful shutdown of the servers on Ctrl+C, Ctrl+Break or closing
+ *      the console window.
+ *
+ *      The console control handler runs on a thread of its own. The first
+ *      signal sets stopping, calls the stop callback (close the listening
+ *      socket, wake the main loop) and sets the stop event; the server
+ *      then stops accepting, tells its clients to go away and drains the
+ *      open connections with graceful_drain(). A second Ctrl+C ends the
+ *      drain at once.
+ *
+ *      Closing the console kills the process when the handler returns, and
+ *      about 5 s after the close in any case. The handler waits there until
+ *      graceful_free() is called, for at most GRACEFUL_CLOSE_WAIT_MS, and
+ *      graceful_drain() ends after GRACEFUL_CLOSE_DRAIN_MS, so the servers
+ *      still close the connections and print their counters. Any later
+ *      wait takes its deadline from graceful_deadline(), which is capped
+ *      the same way.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/console/setconsolectrlhandler
+*/
+
+#ifndef __GRACEFUL_H__
+#define __GRACEFUL_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define GRACEFUL_DRAIN_MS               10000
+#define GRACEFUL_POLL_MS                50
+#define GRACEFUL_CLOSE_DRAIN_MS         3000        // Drain on a console close, at most.
+#define GRACEFUL_CLOSE_WAIT_MS          4000        // Below the 5 s Windows gives a close.
+#define GRACEFUL_LEAVE_MS               5000        // Closed connections leaving after the drain.
+
+
+/* Called once on the handler thread when the first signal arrives. */
+typedef void (*GRACEFUL_CALLBACK)(void *context);
+
+typedef struct _GRACEFUL {
+    DWORD drainMs;
+    HANDLE stopEvent;                   // Manual reset, set on the first signal.
+    HANDLE doneEvent;                   // Set by graceful_free().
+    volatile LONG stopping;
+    volatile LONG signals;              // Ctrl+C count, 2 or more skips the drain.
+    volatile LONG closing;              // Console closed, closeDeadline is set.
+    ULONGLONG closeDeadline;            // End of the drain on a close.
+    GRACEFUL_CALLBACK onStop;
+    void *context;
+} GRACEFUL;
+
+
+int graceful_init(GRACEFUL *graceful, DWORD drainMs, GRACEFUL_CALLBACK onStop, void *context);
+void graceful_free(GRACEFUL *graceful);
+void graceful_stop(GRACEFUL *graceful);
+int graceful_drain(GRACEFUL *graceful, const volatile LONG *active, DWORD timeoutMs);
+ULONGLONG graceful_deadline(const GRACEFUL *graceful, DWORD timeoutMs);
+
+static inline BOOL graceful_stopping(const GRACEFUL *graceful)
+{
+    return 0 != graceful->stopping;
+}
+
+
+#endif /* __GRACEFUL_H__ */
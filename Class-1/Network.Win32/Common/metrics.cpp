@@ -0,0 +1,547 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      metrics.cpp
+ *
+ * Abstract:
+ *      Server metrics: per thread counters and latency histograms, served
+ *      in the Prometheus text format on an admin port.
+ *
+ * Reference:
+ * https://prometheus.io/docs/instrumenting/exposition_formats/
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <malloc.h>
+#include <intrin.h>
+
+#include "metrics.h"
+
+
+#define ADMIN_REQUEST_SIZE              1024
+#define ADMIN_RECV_TIMEOUT_MS           1000
+#define NS_PER_SEC                      1000000000ull
+
+#define HTTP_OK     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n" \
+                    "Content-Length: %d\r\nConnection: close\r\n\r\n"
+#define HTTP_404    "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+
+/* Quantiles of the request duration summary. */
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+
+/**
+ * highest_bit - Index of the highest set bit, v is not 0.
+*/
+static inline int highest_bit(UINT64 v)
+{
+    unsigned long index;
+
+#ifdef _WIN64
+    _BitScanReverse64(&index, v);
+#else
+    if (v >> 32)
+    {
+        _BitScanReverse(&index, (unsigned long)(v >> 32));
+        return (int)index + 32;
+    }
+
+    _BitScanReverse(&index, (unsigned long)v);
+#endif
+
+    return (int)index;
+}
+
+/**
+ * bucket_of - Histogram bucket of a latency in ns, as in histogram.h.
+*/
+static inline size_t bucket_of(UINT64 v)
+{
+    int shift;
+
+    if (v < METRICS_HIST_SUB_COUNT)
+        return (size_t)v;
+
+    shift = highest_bit(v) - (METRICS_HIST_SUB_BITS - 1);
+
+    if (shift > METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS)
+        return METRICS_HIST_BUCKETS - 1;
+
+    return METRICS_HIST_SUB_COUNT + (size_t)(shift - 1) * METRICS_HIST_HALF_COUNT +
+           (size_t)((v >> shift) - METRICS_HIST_HALF_COUNT);
+}
+
+/**
+ * bucket_high - Highest latency that lands in bucket index.
+*/
+static inline UINT64 bucket_high(size_t index)
+{
+    size_t shift;
+
+    if (index < METRICS_HIST_SUB_COUNT)
+        return index;
+
+    shift = (index - METRICS_HIST_SUB_COUNT) / METRICS_HIST_HALF_COUNT + 1;
+
+    return ((((index - METRICS_HIST_SUB_COUNT) % METRICS_HIST_HALF_COUNT) + METRICS_HIST_HALF_COUNT + 1) << shift) - 1;
+}
+
+/**
+ * metrics_init - Empty metrics, the admin port is opened by metrics_serve().
+*/
+int metrics_init(METRICS *metrics, const char *prefix)
+{
+    ZeroMemory(metrics, sizeof(*metrics));
+
+    metrics->prefix    = prefix;
+    metrics->startTick = GetTickCount64();
+    metrics->adminFd   = INVALID_SOCKET;
+
+    InitializeSRWLock(&metrics->lock);
+    QueryPerformanceFrequency(&metrics->qpcFreq);
+
+    return 0;
+}
+
+/**
+ * metrics_free - Stop the admin thread and free all slots.
+ *
+ * No thread may be attached any more.
+*/
+void metrics_free(METRICS *metrics)
+{
+    SOCKET fd = metrics->adminFd;
+    METRICS_THREAD *thread;
+
+    /* The blocked accept() fails and the admin thread returns. */
+    if (INVALID_SOCKET != fd)
+    {
+        metrics->adminFd = INVALID_SOCKET;
+        closesocket(fd);
+    }
+
+    if (NULL != metrics->adminThread)
+    {
+        WaitForSingleObject(metrics->adminThread, INFINITE);
+        CloseHandle(metrics->adminThread);
+        metrics->adminThread = NULL;
+    }
+
+    while (NULL != metrics->threads)
+    {
+        thread = metrics->threads;
+        metrics->threads = thread->next;
+        _aligned_free(thread);
+    }
+
+    metrics->freeThreads = NULL;
+}
+
+/**
+ * metrics_value - Export a LONG the caller keeps up to date.
+*/
+int metrics_value(METRICS *metrics, const char *name, const char *type, const char *help, const volatile LONG *value)
+{
+    METRICS_VALUE *entry;
+
+    if (metrics->valueCount >= METRICS_MAX_VALUES)
+        return -1;
+
+    entry = &metrics->values[metrics->valueCount++];
+
+    entry->name  = name;
+    entry->type  = type;
+    entry->help  = help;
+    entry->value = value;
+
+    return 0;
+}
+
+/**
+ * metrics_attach - Slot of the calling thread, reused or new.
+ *
+ * Return NULL if out of memory.
+*/
+METRICS_THREAD *metrics_attach(METRICS *metrics)
+{
+    METRICS_THREAD *thread;
+
+    AcquireSRWLockExclusive(&metrics->lock);
+
+    thread = metrics->freeThreads;
+
+    if (NULL != thread)
+    {
+        metrics->freeThreads = thread->nextFree;
+    }
+    else
+    {
+        thread = (METRICS_THREAD *)_aligned_malloc(sizeof(METRICS_THREAD), __alignof(METRICS_THREAD));
+
+        if (NULL != thread)
+        {
+            ZeroMemory(thread, sizeof(*thread));
+            thread->next     = metrics->threads;
+            metrics->threads = thread;
+        }
+    }
+
+    if (NULL != thread)
+    {
+        thread->nextFree = NULL;
+        metrics->attached++;
+    }
+
+    ReleaseSRWLockExclusive(&metrics->lock);
+
+    return thread;
+}
+
+/**
+ * metrics_detach - Hand the slot to the next thread, its counts stay.
+*/
+void metrics_detach(METRICS *metrics, METRICS_THREAD *thread)
+{
+    if (NULL == thread)
+        return;
+
+    AcquireSRWLockExclusive(&metrics->lock);
+
+    thread->nextFree     = metrics->freeThreads;
+    metrics->freeThreads = thread;
+    metrics->attached--;
+
+    ReleaseSRWLockExclusive(&metrics->lock);
+}
+
+/**
+ * metrics_requests - Count requests served together since start.
+ *
+ * All of them are recorded with the latency of the batch.
+*/
+void metrics_requests(METRICS *metrics, METRICS_THREAD *thread, UINT64 start, UINT64 requests)
+{
+    UINT64 ticks = metrics_now() - start;
+    UINT64 freq  = (UINT64)metrics->qpcFreq.QuadPart;
+    UINT64 ns    = ticks / freq * NS_PER_SEC + ticks % freq * NS_PER_SEC / freq;
+
+    thread->requests   += requests;
+    thread->latencySum += ns * requests;
+    thread->latency[bucket_of(ns)] += requests;
+}
+
+/**
+ * append - printf to the end of text, output past size is dropped.
+*/
+static void append(char *text, int size, int *length, const char *format, ...)
+{
+    int ret;
+    va_list args;
+
+    if (*length >= size - 1)
+        return;
+
+    va_start(args, format);
+    ret = vsnprintf(text + *length, size - *length, format, args);
+    va_end(args);
+
+    if (0 > ret || ret >= size - *length)
+        *length = size - 1;
+    else
+        *length += ret;
+}
+
+/**
+ * counter - One counter or gauge with its help and type lines.
+*/
+static void counter(char *text, int size, int *length, const char *prefix,
+                    const char *name, const char *type, const char *help, UINT64 value)
+{
+    append(text, size, length, "# HELP %s_%s %s\n# TYPE %s_%s %s\n%s_%s %llu\n",
+           prefix, name, help, prefix, name, type, prefix, name, value);
+}
+
+/**
+ * quantile - Latency at quantile q in ns, a bucket upper bound.
+*/
+static UINT64 quantile(const volatile UINT64 *latency, UINT64 total, double q)
+{
+    size_t i = 0;
+    UINT64 seen = 0, target;
+
+    if (0 == total)
+        return 0;
+
+    target = (UINT64)(q * total + 0.5);
+    if (target < 1)
+        target = 1;
+
+    while (i < METRICS_HIST_BUCKETS - 1 && seen + latency[i] < target)
+        seen += latency[i++];
+
+    return bucket_high(i);
+}
+
+/**
+ * metrics_sum - Add all slots into sum, sum->latency holds the merged histogram.
+ *
+ * Return the number of attached threads.
+*/
+LONG metrics_sum(METRICS *metrics, METRICS_THREAD *sum)
+{
+    size_t i;
+    LONG attached;
+    METRICS_THREAD *thread;
+
+    ZeroMemory(sum, sizeof(*sum));
+
+    AcquireSRWLockShared(&metrics->lock);
+
+    for (thread = metrics->threads; NULL != thread; thread = thread->next)
+    {
+        sum->requests   += thread->requests;
+        sum->bytesIn    += thread->bytesIn;
+        sum->bytesOut   += thread->bytesOut;
+        sum->errors     += thread->errors;
+        sum->accepts    += thread->accepts;
+        sum->latencySum += thread->latencySum;
+
+        for (i = 0; i < METRICS_HIST_BUCKETS; i++)
+            sum->latency[i] += thread->latency[i];
+    }
+
+    attached = metrics->attached;
+
+    ReleaseSRWLockShared(&metrics->lock);
+
+    return attached;
+}
+
+/**
+ * metrics_format - Aggregate all slots into Prometheus text.
+ *
+ * Return the text length.
+*/
+int metrics_format(METRICS *metrics, char *text, int size)
+{
+    int length = 0;
+    size_t i, q;
+    UINT64 total = 0;
+    LONG attached;
+    METRICS_THREAD *sum;
+    const char *prefix = metrics->prefix;
+
+    sum = (METRICS_THREAD *)_aligned_malloc(sizeof(METRICS_THREAD), __alignof(METRICS_THREAD));
+    if (NULL == sum)
+        return 0;
+
+    attached = metrics_sum(metrics, sum);
+
+    for (i = 0; i < METRICS_HIST_BUCKETS; i++)
+        total += sum->latency[i];
+
+    counter(text, size, &length, prefix, "requests_total", "counter", "Requests served.", sum->requests);
+    counter(text, size, &length, prefix, "received_bytes_total", "counter", "Bytes received.", sum->bytesIn);
+    counter(text, size, &length, prefix, "sent_bytes_total", "counter", "Bytes sent.", sum->bytesOut);
+    counter(text, size, &length, prefix, "errors_total", "counter", "Failed requests and connections.", sum->errors);
+    counter(text, size, &length, prefix, "accepted_connections_total", "counter", "Connections accepted.", sum->accepts);
+    counter(text, size, &length, prefix, "connections", "gauge", "Open connections.", (UINT64)metrics->connections);
+    counter(text, size, &length, prefix, "threads", "gauge", "Threads with a metrics slot.", (UINT64)attached);
+    counter(text, size, &length, prefix, "uptime_seconds", "gauge", "Seconds since startup.",
+            (GetTickCount64() - metrics->startTick) / 1000);
+
+    for (int k = 0; k < metrics->valueCount; k++)
+    {
+        counter(text, size, &length, prefix, metrics->values[k].name, metrics->values[k].type,
+                metrics->values[k].help, (UINT64)*metrics->values[k].value);
+    }
+
+    /* Quantiles are bucket upper bounds, they only grow over the run. */
+    append(text, size, &length, "# HELP %s_request_duration_seconds Time from receive to reply sent.\n"
+           "# TYPE %s_request_duration_seconds summary\n", prefix, prefix);
+
+    for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+    {
+        append(text, size, &length, "%s_request_duration_seconds{quantile=\"%g\"} %.9f\n",
+               prefix, quantiles[q], (double)quantile(sum->latency, total, quantiles[q]) / NS_PER_SEC);
+    }
+
+    append(text, size, &length, "%s_request_duration_seconds_sum %.9f\n%s_request_duration_seconds_count %llu\n",
+           prefix, (double)sum->latencySum / NS_PER_SEC, prefix, total);
+
+    _aligned_free(sum);
+
+    return length;
+}
+
+/**
+ * metrics_print - Show the totals of the run, for the final stats at shutdown.
+*/
+void metrics_print(METRICS *metrics)
+{
+    size_t i;
+    UINT64 total = 0;
+    double seconds;
+    METRICS_THREAD *sum;
+
+    sum = (METRICS_THREAD *)_aligned_malloc(sizeof(METRICS_THREAD), __alignof(METRICS_THREAD));
+    if (NULL == sum)
+        return;
+
+    metrics_sum(metrics, sum);
+
+    for (i = 0; i < METRICS_HIST_BUCKETS; i++)
+        total += sum->latency[i];
+
+    seconds = (GetTickCount64() - metrics->startTick) / 1000.0;
+
+    printf("Requests:    %llu in %.1f s, %.0f req/s.\n", sum->requests, seconds,
+           (0 < seconds) ? sum->requests / seconds : 0.0);
+    printf("Bytes:       %llu received, %llu sent.\n", sum->bytesIn, sum->bytesOut);
+    if (0 < sum->accepts)
+        printf("Connections: %llu accepted, %ld open.\n", sum->accepts, metrics->connections);
+
+    printf("Errors:      %llu.\n", sum->errors);
+
+    if (0 < total)
+    {
+        printf("Latency:     p50 %.1f us, p99 %.1f us, p99.9 %.1f us, mean %.1f us.\n",
+               quantile(sum->latency, total, 0.5) / 1e3, quantile(sum->latency, total, 0.99) / 1e3,
+               quantile(sum->latency, total, 0.999) / 1e3, (double)sum->latencySum / total / 1e3);
+    }
+
+    _aligned_free(sum);
+}
+
+/**
+ * send_all - Send the whole buffer on a blocking socket.
+*/
+static int send_all(SOCKET fd, const char *data, int length)
+{
+    int ret;
+
+    while (0 < length)
+    {
+        ret = send(fd, data, length, 0);
+
+        if (0 >= ret)
+            return -1;
+
+        data   += ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * AdminThread - Answer one HTTP request per connection, GET /metrics only.
+*/
+static DWORD WINAPI
+AdminThread(LPVOID lpParam)
+{
+    int ret, length;
+    int timeout = ADMIN_RECV_TIMEOUT_MS;
+    char header[128];
+    char request[ADMIN_REQUEST_SIZE];
+    char *text;
+    SOCKET fd;
+    METRICS *metrics = (METRICS *)lpParam;
+
+    text = (char *)malloc(METRICS_TEXT_SIZE);
+    if (NULL == text)
+    {
+        printf("Out of memory for the metrics.\n");
+        return (DWORD)-1;
+    }
+
+    while (TRUE)
+    {
+        fd = accept(metrics->adminFd, NULL, NULL);
+
+        if (INVALID_SOCKET == fd)
+        {
+            /* Closed by metrics_free(). */
+            if (INVALID_SOCKET == metrics->adminFd)
+                break;
+
+            continue;
+        }
+
+        /* A slow client must not hold the scrapes of the others. */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+
+        ret = recv(fd, request, sizeof(request) - 1, 0);
+
+        if (0 < ret)
+        {
+            request[ret] = 0;
+
+            if (0 == strncmp(request, "GET /metrics ", 13) || 0 == strncmp(request, "GET / ", 6))
+            {
+                length = metrics_format(metrics, text, METRICS_TEXT_SIZE);
+                ret    = snprintf(header, sizeof(header), HTTP_OK, length);
+
+                if (0 == send_all(fd, header, ret))
+                    send_all(fd, text, length);
+            }
+            else
+            {
+                send_all(fd, HTTP_404, (int)strlen(HTTP_404));
+            }
+        }
+
+        shutdown(fd, SD_SEND);
+        closesocket(fd);
+    }
+
+    free(text);
+
+    return 0;
+}
+
+/**
+ * metrics_serve - Listen on the admin port and serve scrapes from a thread.
+*/
+int metrics_serve(METRICS *metrics, int port)
+{
+    SOCKET fd;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == fd)
+    {
+        printf("Error in socket: %d.\n", WSAGetLastError());
+        return -1;
+    }
+
+    /* Any address, the scraper usually runs on another host. */
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((u_short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (SOCKET_ERROR == bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        SOCKET_ERROR == listen(fd, SOMAXCONN))
+    {
+        printf("Error in listen on metrics port %d: %d.\n", port, WSAGetLastError());
+        closesocket(fd);
+        return -1;
+    }
+
+    metrics->adminFd     = fd;
+    metrics->adminThread = CreateThread(NULL, 0, AdminThread, metrics, 0, NULL);
+
+    if (NULL == metrics->adminThread)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        metrics->adminFd = INVALID_SOCKET;
+        closesocket(fd);
+        return -1;
+    }
+
+    return 0;
+}
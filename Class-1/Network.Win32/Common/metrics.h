@@ -0,0 +1,109 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      metrics.h
+ *
+ * Abstract:
+ *      Server metrics: per thread counters and latency histograms, served
+ *      in the Prometheus text format on an admin port.
+ *
+ *      Every thread that serves requests attaches its own METRICS_THREAD
+ *      slot and is the only writer of it: counting is a plain add to a
+ *      cache line no other thread writes, no lock and no interlocked
+ *      operation. A scrape of the admin port sums all slots and merges the
+ *      histograms on demand, 64 bit loads and stores are atomic on x64 so
+ *      the reader never sees a torn value.
+ *
+ *      Slots are kept until metrics_free(), a detached slot is reused by
+ *      the next thread, so the counters never go backwards.
+ *
+ * Reference:
+ * https://prometheus.io/docs/instrumenting/exposition_formats/
+*/
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+#include <winsock2.h>
+
+
+/* Log-linear latency buckets in ns, relative error < 3.2%. */
+#define METRICS_HIST_SUB_BITS           5
+#define METRICS_HIST_SUB_COUNT          (1u << METRICS_HIST_SUB_BITS)
+#define METRICS_HIST_HALF_COUNT         (METRICS_HIST_SUB_COUNT >> 1)
+#define METRICS_HIST_MAX_BITS           40          // 2^40 ns ~= 18 minutes.
+#define METRICS_HIST_BUCKETS            (METRICS_HIST_SUB_COUNT + \
+                                         (METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS) * METRICS_HIST_HALF_COUNT)
+
+#define METRICS_MAX_VALUES              8
+#define METRICS_TEXT_SIZE               (64 * 1024)
+
+
+typedef struct DECLSPEC_ALIGN(64) _METRICS_THREAD {
+    /* Written by the owner thread only. */
+    volatile UINT64 requests;
+    volatile UINT64 bytesIn;
+    volatile UINT64 bytesOut;
+    volatile UINT64 errors;
+    volatile UINT64 accepts;
+    volatile UINT64 latencySum;         // ns.
+    volatile UINT64 latency[METRICS_HIST_BUCKETS];
+
+    /* Guarded by METRICS.lock. */
+    struct _METRICS_THREAD *next;       // All slots.
+    struct _METRICS_THREAD *nextFree;
+} METRICS_THREAD;
+
+typedef struct _METRICS_VALUE {
+    const char *name;
+    const char *type;                   // "counter" or "gauge".
+    const char *help;
+    const volatile LONG *value;
+} METRICS_VALUE;
+
+typedef struct _METRICS {
+    const char *prefix;                 // Metric names start with "<prefix>_".
+    LARGE_INTEGER qpcFreq;
+    ULONGLONG startTick;
+    volatile LONG connections;          // Open connections, interlocked.
+    SRWLOCK lock;
+    METRICS_THREAD *threads;
+    METRICS_THREAD *freeThreads;
+    LONG attached;
+    int valueCount;
+    METRICS_VALUE values[METRICS_MAX_VALUES];
+    SOCKET adminFd;
+    HANDLE adminThread;
+} METRICS;
+
+
+int metrics_init(METRICS *metrics, const char *prefix);
+void metrics_free(METRICS *metrics);
+int metrics_value(METRICS *metrics, const char *name, const char *type, const char *help, const volatile LONG *value);
+int metrics_serve(METRICS *metrics, int port);
+int metrics_format(METRICS *metrics, char *text, int size);
+LONG metrics_sum(METRICS *metrics, METRICS_THREAD *sum);
+void metrics_print(METRICS *metrics);
+
+METRICS_THREAD *metrics_attach(METRICS *metrics);
+void metrics_detach(METRICS *metrics, METRICS_THREAD *thread);
+void metrics_requests(METRICS *metrics, METRICS_THREAD *thread, UINT64 start, UINT64 requests);
+
+/* Start of a timed request, in performance counter ticks. */
+static inline UINT64 metrics_now(void)
+{
+    LARGE_INTEGER t;
+
+    QueryPerformanceCounter(&t);
+
+    return (UINT64)t.QuadPart;
+}
+
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,279 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      secure.cpp
+ *
+ * Abstract:
+ *      PSK handshake and AES-128-GCM frame encryption.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/bcrypt/nf-bcrypt-bcrypthash
+ * https://www.rfc-editor.org/rfc/rfc8446#section-5.3
+*/
+
+#include <iostream>
+
+#include "secure.h"
+
+#pragma comment(lib, "bcrypt.lib")
+
+
+#define SECURE_LABEL_SIZE               3
+
+
+/**
+ * secure_mode_parse - Mode from its command line name, -1 if unknown.
+*/
+int secure_mode_parse(const char *name)
+{
+    if (0 == strcmp(name, "none"))
+        return SECURE_MODE_NONE;
+
+    if (0 == strcmp(name, "aesni"))
+        return SECURE_MODE_AESNI;
+
+    if (0 == strcmp(name, "cng"))
+        return SECURE_MODE_CNG;
+
+    if (0 == strcmp(name, "auto"))
+        return SECURE_MODE_AUTO;
+
+    return -1;
+}
+
+/**
+ * secure_mode_name - Printable mode name.
+*/
+const char *secure_mode_name(int mode)
+{
+    switch (mode)
+    {
+    case SECURE_MODE_NONE:  return "none";
+    case SECURE_MODE_AESNI: return "aesni";
+    case SECURE_MODE_CNG:   return "cng";
+    case SECURE_MODE_AUTO:  return "auto";
+    default:                return "unknown";
+    }
+}
+
+/**
+ * secure_mode_resolve - Pick the backend for auto mode.
+*/
+int secure_mode_resolve(int mode)
+{
+    if (SECURE_MODE_AUTO != mode)
+        return mode;
+
+    return gcm_aesni_supported() ? SECURE_MODE_AESNI : SECURE_MODE_CNG;
+}
+
+/**
+ * derive_key - Key and salt of one direction.
+*/
+static int derive_key(GCM_CONTEXT *ctx, UINT8 *salt, int mode, const char *psk, const char *label,
+                      const UINT8 *clientRandom, const UINT8 *serverRandom)
+{
+    int ret;
+    NTSTATUS status;
+    UINT8 input[SECURE_LABEL_SIZE + 2 * SECURE_RANDOM_SIZE];
+    UINT8 output[32];
+
+    memcpy(input, label, SECURE_LABEL_SIZE);
+    memcpy(input + SECURE_LABEL_SIZE, clientRandom, SECURE_RANDOM_SIZE);
+    memcpy(input + SECURE_LABEL_SIZE + SECURE_RANDOM_SIZE, serverRandom, SECURE_RANDOM_SIZE);
+
+    status = BCryptHash(BCRYPT_HMAC_SHA256_ALG_HANDLE, (PUCHAR)psk, (ULONG)strlen(psk),
+                        input, sizeof(input), output, sizeof(output));
+    if (!BCRYPT_SUCCESS(status))
+    {
+        printf("Error in BCryptHash: 0x%08x.\n", status);
+        return -1;
+    }
+
+    memcpy(salt, output + GCM_KEY_SIZE, SECURE_SALT_SIZE);
+    ret = gcm_init(ctx, mode, output);
+
+    SecureZeroMemory(output, sizeof(output));
+
+    return ret;
+}
+
+/**
+ * secure_init - Derive both directions from the exchanged random bytes.
+*/
+int secure_init(SECURE_CHANNEL *channel, int mode, const char *psk,
+                const UINT8 *clientRandom, const UINT8 *serverRandom, BOOL server)
+{
+    const char *txLabel = server ? "s2c" : "c2s";
+    const char *rxLabel = server ? "c2s" : "s2c";
+
+    ZeroMemory(channel, sizeof(*channel));
+    channel->mode = secure_mode_resolve(mode);
+
+    if (0 != derive_key(&channel->tx, channel->txSalt, channel->mode, psk, txLabel, clientRandom, serverRandom) ||
+        0 != derive_key(&channel->rx, channel->rxSalt, channel->mode, psk, rxLabel, clientRandom, serverRandom))
+    {
+        secure_free(channel);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * secure_free - Destroy the keys.
+*/
+void secure_free(SECURE_CHANNEL *channel)
+{
+    gcm_free(&channel->tx);
+    gcm_free(&channel->rx);
+
+    SecureZeroMemory(channel, sizeof(*channel));
+}
+
+/**
+ * read_hello - Wait for the HELLO frame and copy its random bytes.
+*/
+static int read_hello(SOCKET fd, FRAME_READER *reader, UINT8 *random)
+{
+    int ret;
+    FRAME_VIEW frame;
+
+    while (0 == (ret = frame_next(reader, &frame)))
+    {
+        ret = frame_reader_fill(reader, fd);
+
+        if (0 >= ret)
+        {
+            printf("Handshake: connection lost.\n");
+            return -1;
+        }
+    }
+
+    if (0 > ret || FRAME_TYPE_HELLO != frame.type || SECURE_RANDOM_SIZE != frame.length)
+    {
+        printf("Handshake: expect a HELLO frame.\n");
+        return -1;
+    }
+
+    memcpy(random, frame.payload, SECURE_RANDOM_SIZE);
+    frame_release(reader);
+
+    return 0;
+}
+
+/**
+ * send_hello - Generate and send the random bytes of this side.
+*/
+static int send_hello(SOCKET fd, UINT8 *random)
+{
+    NTSTATUS status;
+
+    status = BCryptGenRandom(NULL, random, SECURE_RANDOM_SIZE, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    if (!BCRYPT_SUCCESS(status))
+    {
+        printf("Error in BCryptGenRandom: 0x%08x.\n", status);
+        return -1;
+    }
+
+    return frame_send(fd, FRAME_TYPE_HELLO, 0, (const char *)random, SECURE_RANDOM_SIZE);
+}
+
+/**
+ * secure_client_handshake - Send HELLO, wait for the server HELLO.
+*/
+int secure_client_handshake(SECURE_CHANNEL *channel, int mode, const char *psk,
+                            SOCKET fd, FRAME_READER *reader)
+{
+    UINT8 clientRandom[SECURE_RANDOM_SIZE];
+    UINT8 serverRandom[SECURE_RANDOM_SIZE];
+
+    if (0 != send_hello(fd, clientRandom) || 0 != read_hello(fd, reader, serverRandom))
+        return -1;
+
+    return secure_init(channel, mode, psk, clientRandom, serverRandom, FALSE);
+}
+
+/**
+ * secure_server_handshake - Wait for the client HELLO, answer with HELLO.
+*/
+int secure_server_handshake(SECURE_CHANNEL *channel, int mode, const char *psk,
+                            SOCKET fd, FRAME_READER *reader)
+{
+    UINT8 clientRandom[SECURE_RANDOM_SIZE];
+    UINT8 serverRandom[SECURE_RANDOM_SIZE];
+
+    if (0 != read_hello(fd, reader, clientRandom) || 0 != send_hello(fd, serverRandom))
+        return -1;
+
+    return secure_init(channel, mode, psk, clientRandom, serverRandom, TRUE);
+}
+
+/**
+ * make_nonce - Salt || frame counter.
+*/
+static inline void make_nonce(UINT8 *nonce, const UINT8 *salt, UINT64 seq)
+{
+    memcpy(nonce, salt, SECURE_SALT_SIZE);
+    memcpy(nonce + SECURE_SALT_SIZE, &seq, sizeof(seq));
+}
+
+/**
+ * secure_seal - Encrypt a payload in place and append the tag.
+ *
+ * payload must have SECURE_TAG_SIZE spare bytes after length. Return the
+ * sealed length to put in the frame, -1 on error. Frames must be sent in
+ * the order they were sealed.
+*/
+int secure_seal(SECURE_CHANNEL *channel, UINT16 type, UINT16 flags, char *payload, UINT32 length)
+{
+    FRAME_HEADER header;
+    UINT8 nonce[GCM_IV_SIZE];
+
+    if (length > SECURE_MAX_PAYLOAD)
+        return -1;
+
+    header.length = length + SECURE_TAG_SIZE;
+    header.type   = type;
+    header.flags  = flags;
+
+    make_nonce(nonce, channel->txSalt, channel->txSeq++);
+
+    if (0 != gcm_seal(&channel->tx, nonce, (const UINT8 *)&header, FRAME_HEADER_SIZE,
+                      (UINT8 *)payload, length, (UINT8 *)payload + length))
+        return -1;
+
+    return (int)header.length;
+}
+
+/**
+ * secure_open - Verify and decrypt a received frame in place.
+ *
+ * On success frame->length no longer counts the tag. Return -1 if the
+ * frame was modified, replayed or sealed with another key.
+*/
+int secure_open(SECURE_CHANNEL *channel, FRAME_VIEW *frame)
+{
+    FRAME_HEADER header;
+    UINT8 nonce[GCM_IV_SIZE];
+    UINT32 length;
+
+    if (frame->length < SECURE_TAG_SIZE)
+        return -1;
+
+    header.length = frame->length;
+    header.type   = frame->type;
+    header.flags  = frame->flags;
+
+    length = frame->length - SECURE_TAG_SIZE;
+    make_nonce(nonce, channel->rxSalt, channel->rxSeq++);
+
+    if (0 != gcm_open(&channel->rx, nonce, (const UINT8 *)&header, FRAME_HEADER_SIZE,
+                      (UINT8 *)frame->payload, length, (const UINT8 *)frame->payload + length))
+        return -1;
+
+    frame->length = length;
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      secure.h
+ *
+ * Abstract:
+ *      Optional AES-128-GCM encryption of the frames of framing.h.
+ *
+ *      Both peers share a pre shared key (PSK). The client sends a HELLO
+ *      frame with 16 random bytes, the server answers with its own, and
+ *      each direction gets its key and nonce salt from
+ *      HMAC-SHA256(PSK, "c2s" or "s2c" || client random || server random).
+ *
+ *      After the handshake the frame header stays in clear text and is
+ *      authenticated as additional data, the payload is encrypted in place
+ *      and followed by the 16 bytes tag. The nonce is the salt and a per
+ *      direction frame counter, it is never sent.
+ *
+ *      Windows has no kernel TLS offload like Linux kTLS (TCP_ULP), so
+ *      the choice is between the local AES-NI code and CNG.
+*/
+
+#ifndef __SECURE_H__
+#define __SECURE_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include "aes_gcm.h"
+#include "framing.h"
+
+
+#define SECURE_RANDOM_SIZE              16
+#define SECURE_SALT_SIZE                4
+#define SECURE_TAG_SIZE                 GCM_TAG_SIZE
+#define SECURE_MAX_PAYLOAD              (FRAME_MAX_PAYLOAD - SECURE_TAG_SIZE)
+#define SECURE_DEFAULT_PSK              "Cpp-Helper example key, change it."
+
+
+/* Modes. */
+#define SECURE_MODE_NONE                0
+#define SECURE_MODE_AESNI               GCM_AESNI
+#define SECURE_MODE_CNG                 GCM_CNG
+#define SECURE_MODE_AUTO                3       // AES-NI if the cpu has it, else CNG.
+
+
+typedef struct _SECURE_CHANNEL {
+    int mode;
+    GCM_CONTEXT tx;
+    GCM_CONTEXT rx;
+    UINT8 txSalt[SECURE_SALT_SIZE];
+    UINT8 rxSalt[SECURE_SALT_SIZE];
+    UINT64 txSeq;
+    UINT64 rxSeq;
+} SECURE_CHANNEL;
+
+
+int secure_mode_parse(const char *name);
+const char *secure_mode_name(int mode);
+int secure_mode_resolve(int mode);
+
+int secure_init(SECURE_CHANNEL *channel, int mode, const char *psk,
+                const UINT8 *clientRandom, const UINT8 *serverRandom, BOOL server);
+void secure_free(SECURE_CHANNEL *channel);
+
+int secure_client_handshake(SECURE_CHANNEL *channel, int mode, const char *psk,
+                            SOCKET fd, FRAME_READER *reader);
+int secure_server_handshake(SECURE_CHANNEL *channel, int mode, const char *psk,
+                            SOCKET fd, FRAME_READER *reader);
+
+int secure_seal(SECURE_CHANNEL *channel, UINT16 type, UINT16 flags, char *payload, UINT32 length);
+int secure_open(SECURE_CHANNEL *channel, FRAME_VIEW *frame);
+
+
+#endif /* __SECURE_H__ */
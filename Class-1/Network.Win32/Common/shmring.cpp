@@ -0,0 +1,792 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      shmring.cpp
+ *
+ * Abstract:
+ *      Shared memory rings between two processes, named pipe rendezvous.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-createfilemappinga
+ * https://docs.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-getnamedpipeclientprocessid
+*/
+
+#include <iostream>
+
+#include "shmring.h"
+
+
+/* Sent by the server over the pipe, the client answers with the magic. */
+typedef struct _SHM_OFFER {
+    UINT32 magic;
+    UINT32 ringSize;
+    DWORD serverPid;
+    LONG serial;
+} SHM_OFFER;
+
+
+/* Object names after the prefix, in the order of SHM_CHANNEL.events. */
+static const char *eventSuffix[4] = { "data0", "space0", "data1", "space1" };
+
+
+/**
+ * ring_put - Copy into the ring at pos, wrapping at the end.
+*/
+static void ring_put(SHM_RING *ring, UINT64 pos, const char *data, UINT32 length)
+{
+    UINT32 offset = (UINT32)(pos % ring->size);
+    UINT32 first  = (length < ring->size - offset) ? length : ring->size - offset;
+
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, length - first);
+}
+
+/**
+ * ring_get - Copy out of the ring at pos, wrapping at the end.
+*/
+static void ring_get(SHM_RING *ring, UINT64 pos, char *data, UINT32 length)
+{
+    UINT32 offset = (UINT32)(pos % ring->size);
+    UINT32 first  = (length < ring->size - offset) ? length : ring->size - offset;
+
+    memcpy(data, ring->data + offset, first);
+    memcpy(data + first, ring->data, length - first);
+}
+
+/**
+ * ring_wake - After an index store: wake the peer if it sleeps.
+ *
+ * The waiter sets its flag and then reads the index, we store the index
+ * and then read the flag, with a full barrier on both sides one of us
+ * sees the other. No system call while the peer is awake.
+*/
+static void ring_wake(volatile LONG *waiting, HANDLE event)
+{
+    MemoryBarrier();
+
+    if (0 != *waiting && 0 != InterlockedExchange(waiting, 0))
+        SetEvent(event);
+}
+
+/**
+ * ring_sleep - Sleep on the event until woken or the peer process exits.
+*/
+static int ring_sleep(SHM_CHANNEL *channel, volatile LONG *waiting, HANDLE event)
+{
+    DWORD ret;
+    HANDLE handles[2] = { event, channel->peer };
+
+    ret = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+    if (WAIT_OBJECT_0 == ret)
+        return 0;
+
+    InterlockedExchange(waiting, 0);
+    WSASetLastError((WAIT_OBJECT_0 + 1 == ret) ? WSAECONNRESET : (int)GetLastError());
+
+    return SOCKET_ERROR;
+}
+
+/**
+ * ring_publish - Make the bytes up to tail visible to the consumer.
+*/
+static void ring_publish(SHM_RING *ring, UINT64 tail)
+{
+    WriteRelease64(&ring->control->tail, (LONG64)tail);
+    ring_wake(&ring->control->dataWaiting, ring->dataEvent);
+}
+
+/**
+ * wait_data - Wait until the receive ring has bytes.
+ *
+ * Return the bytes available, 0 at the end of the stream or SOCKET_ERROR.
+*/
+static int wait_data(SHM_CHANNEL *channel, SHM_RING *ring, UINT64 head)
+{
+    LONG done;
+    UINT64 avail;
+    int spins = 0;
+    SHM_RING_CONTROL *control = ring->control;
+
+    while (TRUE)
+    {
+        if (0 != channel->aborted)
+        {
+            WSASetLastError(WSAECONNABORTED);
+            return SOCKET_ERROR;
+        }
+
+        /* The producer stores tail before writerDone, read them the other way. */
+        done  = ReadAcquire(&control->writerDone);
+        avail = (UINT64)ReadAcquire64(&control->tail) - head;
+
+        if (0 != avail)
+            return (int)avail;
+
+        if (0 != done)
+            return 0;
+
+        if (spins < channel->spinCount)
+        {
+            spins++;
+            YieldProcessor();
+            continue;
+        }
+
+        /* Announce the sleep, then look once more. */
+        InterlockedExchange(&control->dataWaiting, 1);
+
+        if ((UINT64)ReadAcquire64(&control->tail) != head || 0 != control->writerDone || 0 != channel->aborted)
+        {
+            InterlockedExchange(&control->dataWaiting, 0);
+            continue;
+        }
+
+        if (0 != ring_sleep(channel, &control->dataWaiting, ring->dataEvent))
+            return SOCKET_ERROR;
+    }
+}
+
+/**
+ * wait_space - Wait until the send ring is not full.
+*/
+static int wait_space(SHM_CHANNEL *channel, SHM_RING *ring, UINT64 tail)
+{
+    int spins = 0;
+    SHM_RING_CONTROL *control = ring->control;
+
+    while (TRUE)
+    {
+        if (0 != channel->aborted)
+        {
+            WSASetLastError(WSAECONNABORTED);
+            return SOCKET_ERROR;
+        }
+
+        if (0 != ReadAcquire(&control->readerGone))
+        {
+            WSASetLastError(WSAECONNRESET);
+            return SOCKET_ERROR;
+        }
+
+        if (tail - (UINT64)ReadAcquire64(&control->head) < ring->size)
+            return 0;
+
+        if (spins < channel->spinCount)
+        {
+            spins++;
+            YieldProcessor();
+            continue;
+        }
+
+        InterlockedExchange(&control->spaceWaiting, 1);
+
+        if (tail - (UINT64)ReadAcquire64(&control->head) < ring->size ||
+            0 != control->readerGone || 0 != channel->aborted)
+        {
+            InterlockedExchange(&control->spaceWaiting, 0);
+            continue;
+        }
+
+        if (0 != ring_sleep(channel, &control->spaceWaiting, ring->spaceEvent))
+            return SOCKET_ERROR;
+    }
+}
+
+/**
+ * channel_open - Create (server) or open (client) the section and events.
+ *
+ * Ring 0 carries client to server, ring 1 server to client.
+*/
+static int channel_open(SHM_CHANNEL *channel, const char *prefix, UINT32 ringSize, BOOL server)
+{
+    int index;
+    char name[SHM_NAME_SIZE + 16];
+    SYSTEM_INFO sysInfo;
+    SIZE_T size = SHM_HEADER_SIZE + 2 * (SIZE_T)ringSize;
+
+    snprintf(name, sizeof(name), "%s-map", prefix);
+
+    if (server)
+    {
+        channel->section = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                              (DWORD)((UINT64)size >> 32), (DWORD)size, name);
+
+        /* A section left by someone else, don't share it. */
+        if (NULL != channel->section && ERROR_ALREADY_EXISTS == GetLastError())
+        {
+            printf("Shared memory %s already exists.\n", name);
+            goto out_fail;
+        }
+    }
+    else
+    {
+        channel->section = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    }
+
+    if (NULL == channel->section)
+    {
+        printf("Error in CreateFileMapping(%s): %d.\n", name, GetLastError());
+        goto out_fail;
+    }
+
+    channel->header = (SHM_HEADER *)MapViewOfFile(channel->section, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (NULL == channel->header)
+    {
+        printf("Error in MapViewOfFile: %d.\n", GetLastError());
+        goto out_fail;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        snprintf(name, sizeof(name), "%s-%s", prefix, eventSuffix[i]);
+
+        if (server)
+            channel->events[i] = CreateEventA(NULL, FALSE, FALSE, name);
+        else
+            channel->events[i] = OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, name);
+
+        if (NULL == channel->events[i])
+        {
+            printf("Error in CreateEvent(%s): %d.\n", name, GetLastError());
+            goto out_fail;
+        }
+    }
+
+    /* A new section is zero filled, the client checks what the server wrote. */
+    if (server)
+    {
+        channel->header->magic    = SHM_MAGIC;
+        channel->header->ringSize = ringSize;
+    }
+    else if (SHM_MAGIC != channel->header->magic || ringSize != channel->header->ringSize)
+    {
+        printf("Bad shared memory header.\n");
+        goto out_fail;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        SHM_RING *ring = (server == (0 == i)) ? &channel->in : &channel->out;
+
+        ring->control    = &channel->header->rings[i];
+        ring->data       = (char *)channel->header + SHM_HEADER_SIZE + (SIZE_T)i * ringSize;
+        ring->size       = ringSize;
+        ring->dataEvent  = channel->events[2 * i];
+        ring->spaceEvent = channel->events[2 * i + 1];
+    }
+
+    /* With one cpu the peer cannot run while we poll, sleep at once. */
+    GetSystemInfo(&sysInfo);
+    channel->spinCount = 1 < sysInfo.dwNumberOfProcessors ? SHM_SPIN_COUNT : 0;
+
+    return 0;
+
+out_fail:
+    for (index = 0; index < 4; index++)
+    {
+        if (NULL != channel->events[index])
+            CloseHandle(channel->events[index]);
+
+        channel->events[index] = NULL;
+    }
+
+    if (NULL != channel->header)
+        UnmapViewOfFile(channel->header);
+    if (NULL != channel->section)
+        CloseHandle(channel->section);
+
+    channel->header  = NULL;
+    channel->section = NULL;
+
+    return -1;
+}
+
+/**
+ * pipe_wait - Finish an overlapped pipe call, give up on stop or timeout.
+ *
+ * Return the bytes transferred or -1.
+*/
+static int pipe_wait(SHM_LISTENER *listener, OVERLAPPED *overlapped, DWORD timeoutMs)
+{
+    DWORD ret;
+    DWORD bytes = 0;
+    HANDLE handles[2] = { listener->ioEvent, listener->stopEvent };
+
+    ret = WaitForMultipleObjects(2, handles, FALSE, timeoutMs);
+    if (WAIT_OBJECT_0 != ret)
+    {
+        CancelIoEx(listener->pipe, overlapped);
+        GetOverlappedResult(listener->pipe, overlapped, &bytes, TRUE);
+        SetLastError((WAIT_TIMEOUT == ret) ? ERROR_TIMEOUT : ERROR_OPERATION_ABORTED);
+        return -1;
+    }
+
+    if (!GetOverlappedResult(listener->pipe, overlapped, &bytes, FALSE))
+        return -1;
+
+    return (int)bytes;
+}
+
+/**
+ * pipe_io - Overlapped read or write of a whole message on the listener pipe.
+*/
+static int pipe_io(SHM_LISTENER *listener, BOOL write, void *data, DWORD length)
+{
+    BOOL ok;
+    OVERLAPPED overlapped;
+
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = listener->ioEvent;
+
+    if (write)
+        ok = WriteFile(listener->pipe, data, length, NULL, &overlapped);
+    else
+        ok = ReadFile(listener->pipe, data, length, NULL, &overlapped);
+
+    if (!ok && ERROR_IO_PENDING != GetLastError())
+        return -1;
+
+    return ((int)length == pipe_wait(listener, &overlapped, SHM_CONNECT_TIMEOUT_MS)) ? 0 : -1;
+}
+
+/**
+ * shm_listen - Create the rendezvous pipe \\.\pipe\name.
+*/
+int shm_listen(SHM_LISTENER *listener, const char *name, UINT32 ringSize)
+{
+    ZeroMemory(listener, sizeof(*listener));
+
+    snprintf(listener->name, sizeof(listener->name), "%s", name);
+    snprintf(listener->pipeName, sizeof(listener->pipeName), "\\\\.\\pipe\\%s", name);
+    listener->ringSize = ringSize;
+
+    listener->ioEvent   = CreateEventW(NULL, TRUE, FALSE, NULL);
+    listener->stopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+    if (NULL == listener->ioEvent || NULL == listener->stopEvent)
+    {
+        printf("Error in CreateEvent: %d.\n", GetLastError());
+        goto out_fail;
+    }
+
+    /* One instance, a client that finds it busy waits for the next accept. */
+    listener->pipe = CreateNamedPipeA(
+        listener->pipeName,
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1,
+        sizeof(SHM_OFFER),
+        sizeof(SHM_OFFER),
+        0,
+        NULL
+    );
+
+    if (INVALID_HANDLE_VALUE == listener->pipe)
+    {
+        printf("Error in CreateNamedPipe(%s): %d.\n", listener->pipeName, GetLastError());
+        listener->pipe = NULL;
+        goto out_fail;
+    }
+
+    return 0;
+
+out_fail:
+    shm_listener_free(listener);
+
+    return -1;
+}
+
+/**
+ * shm_listener_stop - Make the pending and later shm_accept() calls fail.
+*/
+void shm_listener_stop(SHM_LISTENER *listener)
+{
+    SetEvent(listener->stopEvent);
+}
+
+/**
+ * shm_listener_free - Close the pipe, no shm_accept() may be running.
+*/
+void shm_listener_free(SHM_LISTENER *listener)
+{
+    if (NULL != listener->pipe)
+        CloseHandle(listener->pipe);
+    if (NULL != listener->ioEvent)
+        CloseHandle(listener->ioEvent);
+    if (NULL != listener->stopEvent)
+        CloseHandle(listener->stopEvent);
+
+    listener->pipe      = NULL;
+    listener->ioEvent   = NULL;
+    listener->stopEvent = NULL;
+}
+
+/**
+ * shm_accept - Wait for a client and set up its channel.
+ *
+ * After shm_listener_stop() it fails without a message.
+*/
+int shm_accept(SHM_LISTENER *listener, SHM_CHANNEL *channel)
+{
+    DWORD ack       = 0;
+    DWORD clientPid = 0;
+    char prefix[SHM_NAME_SIZE];
+    SHM_OFFER offer;
+    OVERLAPPED overlapped;
+
+    ZeroMemory(channel, sizeof(*channel));
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = listener->ioEvent;
+
+    if (!ConnectNamedPipe(listener->pipe, &overlapped))
+    {
+        switch (GetLastError())
+        {
+        case ERROR_PIPE_CONNECTED:
+            break;
+
+        case ERROR_IO_PENDING:
+            if (0 > pipe_wait(listener, &overlapped, INFINITE))
+                goto out_stopped;
+            break;
+
+        default:
+            goto out_stopped;
+        }
+    }
+
+    if (!GetNamedPipeClientProcessId(listener->pipe, &clientPid))
+    {
+        printf("Error in GetNamedPipeClientProcessId: %d.\n", GetLastError());
+        goto out_disconnect;
+    }
+
+    offer.magic     = SHM_MAGIC;
+    offer.ringSize  = listener->ringSize;
+    offer.serverPid = GetCurrentProcessId();
+    offer.serial    = InterlockedIncrement(&listener->serial);
+
+    snprintf(prefix, sizeof(prefix), "Local\\%s-%lu-%ld", listener->name, offer.serverPid, offer.serial);
+
+    if (0 != channel_open(channel, prefix, offer.ringSize, TRUE))
+        goto out_disconnect;
+
+    channel->serial = offer.serial;
+
+    /* Used to notice a client that dies while we wait for it. */
+    channel->peer = OpenProcess(SYNCHRONIZE, FALSE, clientPid);
+    if (NULL == channel->peer)
+    {
+        printf("Error in OpenProcess(%lu): %d.\n", clientPid, GetLastError());
+        goto out_close;
+    }
+
+    /* Unread data is lost on disconnect, wait for the answer first. */
+    if (0 != pipe_io(listener, TRUE, &offer, sizeof(offer)) ||
+        0 != pipe_io(listener, FALSE, &ack, sizeof(ack)) ||
+        SHM_MAGIC != ack)
+    {
+        if (WAIT_OBJECT_0 != WaitForSingleObject(listener->stopEvent, 0))
+            printf("Shared memory client %lu did not answer: %d.\n", clientPid, GetLastError());
+
+        goto out_close;
+    }
+
+    DisconnectNamedPipe(listener->pipe);
+
+    return 0;
+
+out_close:
+    shm_close(channel);
+
+out_disconnect:
+    DisconnectNamedPipe(listener->pipe);
+
+    return -1;
+
+out_stopped:
+    if (WAIT_OBJECT_0 != WaitForSingleObject(listener->stopEvent, 0))
+        printf("Error in ConnectNamedPipe: %d.\n", GetLastError());
+
+    DisconnectNamedPipe(listener->pipe);
+
+    return -1;
+}
+
+/**
+ * shm_connect - Connect to the server listening on name.
+*/
+int shm_connect(SHM_CHANNEL *channel, const char *name, DWORD timeoutMs)
+{
+    DWORD bytes;
+    DWORD ack           = SHM_MAGIC;
+    HANDLE pipe         = INVALID_HANDLE_VALUE;
+    ULONGLONG deadline  = GetTickCount64() + timeoutMs;
+    char pipeName[SHM_NAME_SIZE];
+    char prefix[SHM_NAME_SIZE];
+    SHM_OFFER offer;
+
+    ZeroMemory(channel, sizeof(*channel));
+    snprintf(pipeName, sizeof(pipeName), "\\\\.\\pipe\\%s", name);
+
+    /* The single pipe instance is busy while the server sets up another client. */
+    while (TRUE)
+    {
+        pipe = CreateFileA(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (INVALID_HANDLE_VALUE != pipe)
+            break;
+
+        if (ERROR_PIPE_BUSY != GetLastError() || GetTickCount64() >= deadline)
+        {
+            printf("Error in CreateFile(%s): %d.\n", pipeName, GetLastError());
+            return -1;
+        }
+
+        WaitNamedPipeA(pipeName, (DWORD)(deadline - GetTickCount64()));
+    }
+
+    if (!ReadFile(pipe, &offer, sizeof(offer), &bytes, NULL) || sizeof(offer) != bytes ||
+        SHM_MAGIC != offer.magic)
+    {
+        printf("Error in ReadFile(%s): %d.\n", pipeName, GetLastError());
+        goto out_pipe;
+    }
+
+    snprintf(prefix, sizeof(prefix), "Local\\%s-%lu-%ld", name, offer.serverPid, offer.serial);
+
+    if (0 != channel_open(channel, prefix, offer.ringSize, FALSE))
+        goto out_pipe;
+
+    channel->serial = offer.serial;
+
+    channel->peer = OpenProcess(SYNCHRONIZE, FALSE, offer.serverPid);
+    if (NULL == channel->peer)
+    {
+        printf("Error in OpenProcess(%lu): %d.\n", offer.serverPid, GetLastError());
+        goto out_close;
+    }
+
+    if (!WriteFile(pipe, &ack, sizeof(ack), &bytes, NULL))
+    {
+        printf("Error in WriteFile(%s): %d.\n", pipeName, GetLastError());
+        goto out_close;
+    }
+
+    CloseHandle(pipe);
+
+    return 0;
+
+out_close:
+    shm_close(channel);
+
+out_pipe:
+    CloseHandle(pipe);
+
+    return -1;
+}
+
+/**
+ * shm_shutdown - No more data will be sent, the peer reads the end of stream.
+*/
+void shm_shutdown(SHM_CHANNEL *channel)
+{
+    WriteRelease(&channel->out.control->writerDone, 1);
+    SetEvent(channel->out.dataEvent);
+}
+
+/**
+ * shm_abort - Make the blocked and later calls of the owner fail.
+ *
+ * Called from another thread, the owner still closes the channel. The
+ * peer sees the end of the stream and its sends fail.
+*/
+void shm_abort(SHM_CHANNEL *channel)
+{
+    InterlockedExchange(&channel->aborted, 1);
+
+    WriteRelease(&channel->in.control->readerGone, 1);
+    shm_shutdown(channel);
+
+    /* Wake our own waits, and a peer waiting for space. */
+    SetEvent(channel->in.dataEvent);
+    SetEvent(channel->out.spaceEvent);
+    SetEvent(channel->in.spaceEvent);
+}
+
+/**
+ * shm_close - Leave the channel, the peer sees the end of the stream.
+*/
+void shm_close(SHM_CHANNEL *channel)
+{
+    if (NULL != channel->header && NULL != channel->in.control)
+    {
+        WriteRelease(&channel->in.control->readerGone, 1);
+        SetEvent(channel->in.spaceEvent);
+
+        shm_shutdown(channel);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (NULL != channel->events[i])
+            CloseHandle(channel->events[i]);
+    }
+
+    if (NULL != channel->header)
+        UnmapViewOfFile(channel->header);
+    if (NULL != channel->section)
+        CloseHandle(channel->section);
+    if (NULL != channel->peer)
+        CloseHandle(channel->peer);
+
+    ZeroMemory(channel, sizeof(*channel));
+}
+
+/**
+ * shm_recv - Receive what is there, at most length bytes.
+ *
+ * Return the bytes, 0 when the peer is done or SOCKET_ERROR, like recv().
+*/
+int shm_recv(SHM_CHANNEL *channel, char *data, int length)
+{
+    int ret;
+    SHM_RING *ring = &channel->in;
+    UINT64 head    = (UINT64)ring->control->head;     // Only we write it.
+
+    ret = wait_data(channel, ring, head);
+    if (0 >= ret)
+        return ret;
+
+    if (ret > length)
+        ret = length;
+
+    ring_get(ring, head, data, (UINT32)ret);
+
+    WriteRelease64(&ring->control->head, (LONG64)(head + ret));
+    ring_wake(&ring->control->spaceWaiting, ring->spaceEvent);
+
+    return ret;
+}
+
+/**
+ * shm_send - Send all buffers, waiting for space when the ring is full.
+ *
+ * The bytes are published once at the end, or when the ring fills up.
+ * Return the bytes sent or SOCKET_ERROR.
+*/
+int shm_send(SHM_CHANNEL *channel, const WSABUF *bufs, int count)
+{
+    int total = 0;
+    UINT32 space, chunk;
+    SHM_RING *ring = &channel->out;
+    SHM_RING_CONTROL *control = ring->control;
+    UINT64 tail = (UINT64)control->tail;              // Only we write it.
+    UINT64 head = (UINT64)ReadAcquire64(&control->head);
+
+    if (0 != channel->aborted || 0 != ReadAcquire(&control->readerGone))
+    {
+        WSASetLastError((0 != channel->aborted) ? WSAECONNABORTED : WSAECONNRESET);
+        return SOCKET_ERROR;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *data = bufs[i].buf;
+        UINT32 left      = bufs[i].len;
+
+        while (0 < left)
+        {
+            space = ring->size - (UINT32)(tail - head);
+
+            if (0 == space)
+            {
+                /* Let the reader see what is there before we wait for it. */
+                ring_publish(ring, tail);
+
+                if (SOCKET_ERROR == wait_space(channel, ring, tail))
+                    return SOCKET_ERROR;
+
+                head  = (UINT64)ReadAcquire64(&control->head);
+                space = ring->size - (UINT32)(tail - head);
+            }
+
+            chunk = (left < space) ? left : space;
+            ring_put(ring, tail, data, chunk);
+
+            tail  += chunk;
+            data  += chunk;
+            left  -= chunk;
+            total += (int)chunk;
+        }
+    }
+
+    ring_publish(ring, tail);
+
+    return total;
+}
+
+/**
+ * shm_send_space - Bytes a send can write now without waiting.
+ *
+ * Only a hint for another thread than the sender, the reader frees more.
+*/
+UINT32 shm_send_space(SHM_CHANNEL *channel)
+{
+    SHM_RING *ring = &channel->out;
+    UINT64 used = (UINT64)ReadAcquire64(&ring->control->tail) - (UINT64)ReadAcquire64(&ring->control->head);
+
+    return (used < ring->size) ? (UINT32)(ring->size - used) : 0;
+}
+
+/**
+ * shm_reader_fill - frame_reader_fill() on a channel.
+*/
+int shm_reader_fill(SHM_CHANNEL *channel, FRAME_READER *reader)
+{
+    int ret;
+    RING_BUFFER *ring = &reader->ring;
+    UINT32 space = ring_free(ring);
+
+    if (0 == space)
+    {
+        WSASetLastError(WSAENOBUFS);
+        return SOCKET_ERROR;
+    }
+
+    ret = shm_recv(channel, ring_at(ring, ring->tail), (int)space);
+
+    if (0 < ret)
+        ring->tail += ret;
+
+    return ret;
+}
+
+/**
+ * shm_writer_flush - frame_writer_flush() on a channel.
+*/
+int shm_writer_flush(SHM_CHANNEL *channel, FRAME_WRITER *writer)
+{
+    if (SOCKET_ERROR == shm_send(channel, writer->bufs, writer->count))
+    {
+        printf("Error in shm_send: %d.\n", WSAGetLastError());
+        return -1;
+    }
+
+    frame_writer_init(writer);
+
+    return 0;
+}
+
+/**
+ * shm_frame_send - frame_send() on a channel.
+*/
+int shm_frame_send(SHM_CHANNEL *channel, UINT16 type, UINT16 flags, const char *payload, UINT32 length)
+{
+    FRAME_WRITER writer;
+
+    frame_writer_init(&writer);
+    frame_writer_add(&writer, type, flags, payload, length);
+
+    return shm_writer_flush(channel, &writer);
+}
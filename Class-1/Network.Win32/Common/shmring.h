@@ -0,0 +1,130 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      shmring.h
+ *
+ * Abstract:
+ *      Shared memory transport for the frames, a fast path for a client
+ *      and a server on the same host.
+ *
+ *      A connection is one named section with two single producer, single
+ *      consumer byte rings, client to server and server to client. Each
+ *      side only writes its own index (tail for the producer, head for the
+ *      consumer) on a cache line of its own, so a message costs two
+ *      memcpy and no system call while the peer is busy.
+ *
+ *      A side that finds its ring empty (or full) polls a short while,
+ *      then sets its waiting flag and sleeps on an auto reset event; the
+ *      other side only calls SetEvent when it sees the flag, the futex
+ *      pattern. WaitOnAddress only works inside one process, named events
+ *      work across processes. The wait also watches the peer process, a
+ *      peer that dies fails the call instead of hanging it.
+ *
+ *      Connections are set up over a named pipe: the server creates the
+ *      section and events of the connection, sends their name prefix, the
+ *      client opens them and answers. The pipe is closed afterwards.
+ *
+ *      Receive and send behave like recv() and a blocking WSASend(),
+ *      errors return SOCKET_ERROR with the code in WSAGetLastError(), so
+ *      the frame reader and writer of framing.h work unchanged on top.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/memory/creating-named-shared-memory
+ * https://docs.microsoft.com/en-us/windows/win32/ipc/named-pipe-server-using-overlapped-i-o
+*/
+
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+#include <winsock2.h>
+
+#include "framing.h"
+
+
+#define SHM_RING_SIZE                   (256 * 1024)    // Per direction.
+#define SHM_HEADER_SIZE                 4096            // Ring data starts after it.
+#define SHM_SPIN_COUNT                  4000            // Polls before sleeping.
+#define SHM_CONNECT_TIMEOUT_MS          5000
+#define SHM_NAME_SIZE                   128
+#define SHM_MAGIC                       0x4d485343      // "CSHM".
+
+
+/**
+ * Shared state of one ring. Producer and consumer fields are on separate
+ * cache lines; a waiting flag is written by the side that sleeps.
+*/
+typedef struct _SHM_RING_CONTROL {
+    DECLSPEC_CACHEALIGN volatile LONG64 tail;       // Next byte to write, producer.
+    volatile LONG writerDone;                       // No more bytes, the end of the stream.
+    volatile LONG spaceWaiting;                     // Producer sleeps on the space event.
+
+    DECLSPEC_CACHEALIGN volatile LONG64 head;       // Next byte to read, consumer.
+    volatile LONG readerGone;                       // Nobody reads any more.
+    volatile LONG dataWaiting;                      // Consumer sleeps on the data event.
+} SHM_RING_CONTROL;
+
+/* Start of the section, the rings follow at SHM_HEADER_SIZE. */
+typedef struct _SHM_HEADER {
+    UINT32 magic;
+    UINT32 ringSize;
+    SHM_RING_CONTROL rings[2];                      // Client to server, server to client.
+} SHM_HEADER;
+
+/* One direction as seen from this side. */
+typedef struct _SHM_RING {
+    SHM_RING_CONTROL *control;
+    char *data;
+    UINT32 size;
+    HANDLE dataEvent;
+    HANDLE spaceEvent;
+} SHM_RING;
+
+typedef struct _SHM_CHANNEL {
+    HANDLE section;
+    SHM_HEADER *header;
+    HANDLE peer;                        // Peer process, signaled when it exits.
+    HANDLE events[4];
+    SHM_RING in;
+    SHM_RING out;
+    LONG serial;                        // Connection number given by the server.
+    int spinCount;                      // Polls before sleeping, 0 with one cpu.
+    volatile LONG aborted;              // Set by shm_abort(), local only.
+} SHM_CHANNEL;
+
+typedef struct _SHM_LISTENER {
+    char name[SHM_NAME_SIZE];
+    char pipeName[SHM_NAME_SIZE];
+    HANDLE pipe;
+    HANDLE ioEvent;
+    HANDLE stopEvent;                   // Manual reset, set by shm_listener_stop().
+    UINT32 ringSize;
+    LONG serial;                        // Connections created so far.
+} SHM_LISTENER;
+
+
+int shm_listen(SHM_LISTENER *listener, const char *name, UINT32 ringSize);
+void shm_listener_stop(SHM_LISTENER *listener);
+void shm_listener_free(SHM_LISTENER *listener);
+int shm_accept(SHM_LISTENER *listener, SHM_CHANNEL *channel);
+int shm_connect(SHM_CHANNEL *channel, const char *name, DWORD timeoutMs);
+
+void shm_shutdown(SHM_CHANNEL *channel);
+void shm_abort(SHM_CHANNEL *channel);
+void shm_close(SHM_CHANNEL *channel);
+
+int shm_recv(SHM_CHANNEL *channel, char *data, int length);
+int shm_send(SHM_CHANNEL *channel, const WSABUF *bufs, int count);
+UINT32 shm_send_space(SHM_CHANNEL *channel);
+
+int shm_reader_fill(SHM_CHANNEL *channel, FRAME_READER *reader);
+int shm_writer_flush(SHM_CHANNEL *channel, FRAME_WRITER *writer);
+int shm_frame_send(SHM_CHANNEL *channel, UINT16 type, UINT16 flags, const char *payload, UINT32 length);
+
+
+#endif /* __SHMRING_H__ */
@@ -0,0 +1,237 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      timerwheel.cpp
+ *
+ * Abstract:
+ *      Hierarchical timing wheel, O(1) add and cancel.
+ *
+ * Reference:
+ * http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+*/
+
+#include "timerwheel.h"
+
+
+#define TIMER_WHEEL_SPAN(level)         (1ull << (TIMER_WHEEL_BITS * ((level) + 1)))
+#define TIMER_WHEEL_INDEX(tick, level)  (((tick) >> (TIMER_WHEEL_BITS * (level))) & TIMER_WHEEL_MASK)
+
+
+/**
+ * list_empty - A slot head that points to itself.
+*/
+static inline BOOL list_empty(const TIMER_ENTRY *head)
+{
+    return head->next == head;
+}
+
+/**
+ * list_append - Link entry before head, at the tail of the slot.
+*/
+static inline void list_append(TIMER_ENTRY *head, TIMER_ENTRY *entry)
+{
+    entry->prev       = head->prev;
+    entry->next       = head;
+    head->prev->next  = entry;
+    head->prev        = entry;
+}
+
+/**
+ * list_take - Move all entries of a slot to an empty local head.
+*/
+static inline void list_take(TIMER_ENTRY *head, TIMER_ENTRY *local)
+{
+    if (list_empty(head))
+    {
+        local->next = local;
+        local->prev = local;
+        return;
+    }
+
+    local->next       = head->next;
+    local->prev       = head->prev;
+    local->next->prev = local;
+    local->prev->next = local;
+
+    head->next = head;
+    head->prev = head;
+}
+
+/**
+ * timer_wheel_init - Empty wheel starting at tick now.
+*/
+void timer_wheel_init(TIMER_WHEEL *wheel, UINT64 now)
+{
+    wheel->now   = now;
+    wheel->count = 0;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
+    }
+}
+
+/**
+ * place - Link entry into the slot that matches its distance from now.
+*/
+static void place(TIMER_WHEEL *wheel, TIMER_ENTRY *entry)
+{
+    int level;
+    UINT64 expires = entry->expires;
+
+    /* Already due, expire on the next tick. */
+    if (expires < wheel->now)
+        expires = wheel->now;
+
+    /* Beyond the last level, park in its farthest slot. */
+    if (expires - wheel->now >= TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS - 1))
+        expires = wheel->now + TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS - 1) - 1;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    {
+        if (expires - wheel->now < TIMER_WHEEL_SPAN(level))
+            break;
+    }
+
+    list_append(&wheel->slots[level][TIMER_WHEEL_INDEX(expires, level)], entry);
+}
+
+/**
+ * timer_add - Arm an entry for tick expires, re-arm it if already pending.
+*/
+void timer_add(TIMER_WHEEL *wheel, TIMER_ENTRY *entry, UINT64 expires)
+{
+    if (timer_pending(entry))
+        timer_cancel(wheel, entry);
+
+    entry->expires = expires;
+    place(wheel, entry);
+    wheel->count++;
+}
+
+/**
+ * timer_cancel - Unlink a pending entry, nothing if it is not pending.
+*/
+void timer_cancel(TIMER_WHEEL *wheel, TIMER_ENTRY *entry)
+{
+    if (!timer_pending(entry))
+        return;
+
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next       = NULL;
+    entry->prev       = NULL;
+
+    wheel->count--;
+}
+
+/**
+ * cascade - Spread one slot of a higher level over the levels below.
+ *
+ * Return the slot index, 0 means the level wrapped too.
+*/
+static UINT32 cascade(TIMER_WHEEL *wheel, int level)
+{
+    UINT32 index = (UINT32)TIMER_WHEEL_INDEX(wheel->now, level);
+    TIMER_ENTRY local;
+    TIMER_ENTRY *entry;
+
+    list_take(&wheel->slots[level][index], &local);
+
+    while (!list_empty(&local))
+    {
+        entry = local.next;
+        local.next        = entry->next;
+        entry->next->prev = &local;
+
+        place(wheel, entry);
+    }
+
+    return index;
+}
+
+/**
+ * timer_wheel_advance - Expire every entry due up to and including now.
+ *
+ * Return the number of expired entries.
+*/
+UINT32 timer_wheel_advance(TIMER_WHEEL *wheel, UINT64 now, TIMER_CALLBACK callback, void *context)
+{
+    int level;
+    UINT32 expired = 0;
+    TIMER_ENTRY local;
+    TIMER_ENTRY *entry;
+
+    while (wheel->now <= now)
+    {
+        /* Level 0 wrapped, refill it from the levels above. */
+        if (0 == TIMER_WHEEL_INDEX(wheel->now, 0))
+        {
+            for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            {
+                if (0 != cascade(wheel, level))
+                    break;
+            }
+        }
+
+        /* The callback may add to this very slot, work on a copy. */
+        list_take(&wheel->slots[0][TIMER_WHEEL_INDEX(wheel->now, 0)], &local);
+        wheel->now++;
+
+        while (!list_empty(&local))
+        {
+            entry = local.next;
+            local.next        = entry->next;
+            entry->next->prev = &local;
+
+            /* Parked beyond the range of the wheel, not due yet. */
+            if (entry->expires >= wheel->now)
+            {
+                place(wheel, entry);
+                continue;
+            }
+
+            entry->next = NULL;
+            entry->prev = NULL;
+
+            wheel->count--;
+            expired++;
+
+            callback(wheel, entry, context);
+        }
+    }
+
+    return expired;
+}
+
+/**
+ * timer_wheel_foreach - Call back every pending entry, none expires.
+ *
+ * The callback must not add or cancel entries. Return the number visited.
+*/
+UINT32 timer_wheel_foreach(TIMER_WHEEL *wheel, TIMER_CALLBACK callback, void *context)
+{
+    UINT32 visited = 0;
+    TIMER_ENTRY *head, *entry;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            head = &wheel->slots[level][slot];
+
+            for (entry = head->next; head != entry; entry = entry->next)
+            {
+                callback(wheel, entry, context);
+                visited++;
+            }
+        }
+    }
+
+    return visited;
+}
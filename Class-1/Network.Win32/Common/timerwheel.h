@@ -0,0 +1,75 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      timerwheel.h
+ *
+ * Abstract:
+ *      Hierarchical timing wheel for connection timeouts.
+ *
+ *      Time is counted in ticks. TIMER_WHEEL_LEVELS wheels of
+ *      TIMER_WHEEL_SLOTS slots cover 2^(8 * levels) ticks, level 0 has one
+ *      slot per tick, each higher level one slot per full turn of the level
+ *      below. Entries of a higher level slot move down (cascade) when the
+ *      lower wheel wraps, so add and cancel are O(1) and an entry moves at
+ *      most once per level before it expires.
+ *
+ *      Entries are embedded in the owner (the connection), the wheel never
+ *      allocates. The wheel is not thread safe, callers serialize access.
+ *
+ * Reference:
+ * http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+*/
+
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define TIMER_WHEEL_BITS                8
+#define TIMER_WHEEL_SLOTS               (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK                (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS              4
+
+
+typedef struct _TIMER_ENTRY {
+    struct _TIMER_ENTRY *next;          // NULL when not pending.
+    struct _TIMER_ENTRY *prev;
+    UINT64 expires;                     // Tick.
+} TIMER_ENTRY;
+
+typedef struct _TIMER_WHEEL {
+    UINT64 now;                         // Next tick to expire.
+    UINT32 count;                       // Pending entries.
+    TIMER_ENTRY slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  // List heads.
+} TIMER_WHEEL;
+
+/* Called for every expired entry, it may add the entry again. */
+typedef void (*TIMER_CALLBACK)(TIMER_WHEEL *wheel, TIMER_ENTRY *entry, void *context);
+
+
+void timer_wheel_init(TIMER_WHEEL *wheel, UINT64 now);
+void timer_add(TIMER_WHEEL *wheel, TIMER_ENTRY *entry, UINT64 expires);
+void timer_cancel(TIMER_WHEEL *wheel, TIMER_ENTRY *entry);
+UINT32 timer_wheel_advance(TIMER_WHEEL *wheel, UINT64 now, TIMER_CALLBACK callback, void *context);
+UINT32 timer_wheel_foreach(TIMER_WHEEL *wheel, TIMER_CALLBACK callback, void *context);
+
+static inline void timer_init(TIMER_ENTRY *entry)
+{
+    entry->next    = NULL;
+    entry->prev    = NULL;
+    entry->expires = 0;
+}
+
+static inline BOOL timer_pending(const TIMER_ENTRY *entry)
+{
+    return NULL != entry->next;
+}
+
+
+#endif /* __TIMERWHEEL_H__ */
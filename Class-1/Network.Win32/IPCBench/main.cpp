@@ -0,0 +1,670 @@
+/**
+ * Win32 local transports benchmark.
+ * Ref 1: [https://devblogs.microsoft.com/commandline/af_unix-comes-to-windows/].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/memory/creating-named-shared-memory].
+ *
+ * Sends echo frames over each local transport to an echo server thread of
+ * this process, the frames and the code are the same for all of them:
+ *
+ *  - tcp: loopback TCP with TCP_NODELAY.
+ *  - unix: AF_UNIX stream socket on a path in the temp directory.
+ *  - shm: shared memory rings (Common/shmring.h).
+ *
+ * Every transport runs a ping-pong phase, one frame and its reply at a
+ * time, for the round trip percentiles, then a throughput phase with
+ * batches of pipelined frames.
+ *
+ * License - MIT.
+ */
+
+#undef UNICODE
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+
+#include "framing.h"
+#include "shmring.h"
+#include "histogram.h"
+#include "timing.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+
+
+#define MODE_TCP                                0
+#define MODE_UNIX                               1
+#define MODE_SHM                                2
+#define MODE_COUNT                              3
+#define MODE_ALL                                -1
+
+#define WARMUP_ROUNDS                           1000
+#define BATCH_MAX_BYTES                         (64 * 1024)     // Fits the socket buffers, no deadlock.
+#define NS_PER_SEC                              1000000000ull
+
+
+/* One end of a connection, a socket or a shared memory channel. */
+typedef struct _LINK {
+    SOCKET fd;
+    SHM_CHANNEL *shm;
+} LINK;
+
+/* The echo server side of one transport. */
+typedef struct _SERVER {
+    int mode;
+    SOCKET listenFd;
+    SHM_LISTENER listener;
+    SHM_CHANNEL channel;
+} SERVER;
+
+typedef struct _RESULT {
+    UINT64 rounds;
+    ULONGLONG pingNs;
+    ULONGLONG pingCpu;
+    UINT64 frames;
+    ULONGLONG streamNs;
+    LatencyHistogram hist;              // Round trip in ns.
+} RESULT;
+
+
+static const char *modeNames[] = { "tcp", "unix", "shm" };
+
+char *payload               = NULL;
+
+int mode                    = MODE_ALL;
+UINT32 payloadSize          = 64;
+int roundCount              = 100000;
+int depth                   = 32;
+int durationSec             = 5;
+
+
+/**
+ * CpuNs - User + kernel time of the whole process, client and server.
+*/
+static ULONGLONG CpuNs(void)
+{
+    FILETIME createTime, exitTime, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    GetProcessTimes(GetCurrentProcess(), &createTime, &exitTime, &kernel, &user);
+
+    k.LowPart  = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart  = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+
+    return (k.QuadPart + u.QuadPart) * 100;
+}
+
+/**
+ * SetNoDelay - Small frames must not wait for Nagle.
+*/
+static inline void SetNoDelay(SOCKET fd)
+{
+    BOOL noDelay = TRUE;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+}
+
+/**
+ * LinkFill - Receive into the reader from a socket or a channel.
+*/
+static inline int LinkFill(LINK *link, FRAME_READER *reader)
+{
+    if (NULL != link->shm)
+        return shm_reader_fill(link->shm, reader);
+
+    return frame_reader_fill(reader, link->fd);
+}
+
+/**
+ * LinkFlush - Send the writer batch and start a new one.
+*/
+static inline int LinkFlush(LINK *link, FRAME_WRITER *writer)
+{
+    int ret;
+
+    if (NULL != link->shm)
+        ret = shm_writer_flush(link->shm, writer);
+    else
+        ret = frame_writer_flush(writer, link->fd);
+
+    frame_writer_init(writer);
+
+    return ret;
+}
+
+/**
+ * LinkClose - Close a socket or a channel.
+*/
+void LinkClose(LINK *link)
+{
+    if (NULL != link->shm)
+        shm_close(link->shm);
+    else if (INVALID_SOCKET != link->fd)
+        closesocket(link->fd);
+}
+
+/**
+ * UnixPath - Socket file of this process in the temp directory.
+*/
+void UnixPath(SOCKADDR_UN *addr)
+{
+    char dir[MAX_PATH];
+
+    ZeroMemory(addr, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (0 == GetTempPathA(sizeof(dir), dir))
+        snprintf(dir, sizeof(dir), ".\\");
+
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%sIPCBench-%lu.sock", dir, GetCurrentProcessId());
+}
+
+/**
+ * StartServer - Listen on a transport, the address to connect to is returned.
+*/
+int StartServer(SERVER *server, SOCKADDR_STORAGE *addr, int *addrLen)
+{
+    int ret;
+    char name[SHM_NAME_SIZE];
+    SOCKADDR_IN *in = (SOCKADDR_IN *)addr;
+
+    server->listenFd = INVALID_SOCKET;
+    ZeroMemory(addr, sizeof(*addr));
+
+    if (MODE_SHM == server->mode)
+    {
+        snprintf(name, sizeof(name), "IPCBench-%lu", GetCurrentProcessId());
+        return shm_listen(&server->listener, name, SHM_RING_SIZE);
+    }
+
+    if (MODE_UNIX == server->mode)
+    {
+        UnixPath((SOCKADDR_UN *)addr);
+        DeleteFileA(((SOCKADDR_UN *)addr)->sun_path);
+        *addrLen = (int)sizeof(SOCKADDR_UN);
+    }
+    else
+    {
+        /* Port 0, the system picks a free one. */
+        in->sin_family      = AF_INET;
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        *addrLen = (int)sizeof(SOCKADDR_IN);
+    }
+
+    server->listenFd = socket(addr->ss_family, SOCK_STREAM, 0);
+    if (INVALID_SOCKET == server->listenFd)
+    {
+        printf("Error in socket: %d.\n", WSAGetLastError());
+        return -1;
+    }
+
+    ret = bind(server->listenFd, (SOCKADDR *)addr, *addrLen);
+    if (SOCKET_ERROR == ret)
+    {
+        printf("Error in bind: %d.\n", WSAGetLastError());
+        goto out_close;
+    }
+
+    ret = listen(server->listenFd, 1);
+    if (SOCKET_ERROR == ret)
+    {
+        printf("Error in listen: %d.\n", WSAGetLastError());
+        goto out_close;
+    }
+
+    if (MODE_TCP == server->mode)
+    {
+        ret = getsockname(server->listenFd, (SOCKADDR *)addr, addrLen);
+        if (SOCKET_ERROR == ret)
+        {
+            printf("Error in getsockname: %d.\n", WSAGetLastError());
+            goto out_close;
+        }
+    }
+
+    return 0;
+
+out_close:
+    closesocket(server->listenFd);
+    server->listenFd = INVALID_SOCKET;
+
+    return -1;
+}
+
+/**
+ * StopServer - Close the listener of a transport.
+*/
+void StopServer(SERVER *server)
+{
+    SOCKADDR_UN addr;
+
+    if (MODE_SHM == server->mode)
+    {
+        shm_listener_free(&server->listener);
+        return;
+    }
+
+    if (INVALID_SOCKET != server->listenFd)
+        closesocket(server->listenFd);
+
+    if (MODE_UNIX == server->mode)
+    {
+        UnixPath(&addr);
+        DeleteFileA(addr.sun_path);
+    }
+}
+
+/**
+ * EchoServer - Accept one client, echo its frames until it shuts down.
+*/
+DWORD WINAPI EchoServer(LPVOID lpParam)
+{
+    int ret;
+    SERVER *server = (SERVER *)lpParam;
+    LINK link = { INVALID_SOCKET, NULL };
+    FRAME_READER reader;
+    FRAME_WRITER writer;
+    FRAME_VIEW frame;
+
+    if (MODE_SHM == server->mode)
+    {
+        if (0 != shm_accept(&server->listener, &server->channel))
+            return 1;
+
+        link.shm = &server->channel;
+    }
+    else
+    {
+        link.fd = accept(server->listenFd, NULL, NULL);
+        if (INVALID_SOCKET == link.fd)
+        {
+            printf("Error in accept: %d.\n", WSAGetLastError());
+            return 1;
+        }
+
+        if (MODE_TCP == server->mode)
+            SetNoDelay(link.fd);
+    }
+
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+    {
+        LinkClose(&link);
+        return 1;
+    }
+
+    frame_writer_init(&writer);
+
+    for (;;)
+    {
+        ret = LinkFill(&link, &reader);
+        if (0 >= ret)
+            break;
+
+        /* Echo in place, the payloads stay in the ring until released. */
+        while (1 == (ret = frame_next(&reader, &frame)))
+        {
+            if (0 != frame_writer_add(&writer, FRAME_TYPE_ECHO, frame.flags, frame.payload, frame.length))
+            {
+                if (0 != LinkFlush(&link, &writer))
+                    break;
+
+                frame_writer_add(&writer, FRAME_TYPE_ECHO, frame.flags, frame.payload, frame.length);
+            }
+        }
+
+        if (-1 == ret || 0 != LinkFlush(&link, &writer))
+            break;
+
+        frame_release(&reader);
+    }
+
+    frame_reader_free(&reader);
+    LinkClose(&link);
+
+    return 0;
+}
+
+/**
+ * Exchange - Send count frames in one batch and wait for all replies.
+*/
+int Exchange(LINK *link, FRAME_READER *reader, FRAME_WRITER *writer, int count)
+{
+    int i, ret;
+    int replies = 0;
+    FRAME_VIEW frame;
+
+    for (i = 0; i < count; i++)
+        frame_writer_add(writer, FRAME_TYPE_ECHO, (UINT16)i, payload, payloadSize);
+
+    if (0 != LinkFlush(link, writer))
+        return -1;
+
+    while (replies < count)
+    {
+        ret = LinkFill(link, reader);
+        if (0 >= ret)
+        {
+            if (0 == ret)
+                printf("Server closed the connection.\n");
+            else
+                printf("Error in receive: %d.\n", WSAGetLastError());
+            return -1;
+        }
+
+        while (1 == (ret = frame_next(reader, &frame)))
+        {
+            if (FRAME_TYPE_ECHO != frame.type || payloadSize != frame.length)
+            {
+                printf("Bad reply.\n");
+                return -1;
+            }
+
+            replies++;
+        }
+
+        if (-1 == ret)
+        {
+            printf("Bad frame.\n");
+            return -1;
+        }
+
+        frame_release(reader);
+    }
+
+    return 0;
+}
+
+/**
+ * RunTransport - Ping-pong, then pipelined batches over one transport.
+*/
+int RunTransport(int transport, RESULT *result)
+{
+    int i, ret;
+    int status = 0;
+    SERVER server;
+    SOCKADDR_STORAGE addr;
+    int addrLen = 0;
+    HANDLE thread;
+    SHM_CHANNEL channel;
+    LINK link = { INVALID_SOCKET, NULL };
+    FRAME_READER reader;
+    FRAME_WRITER writer;
+    ULONGLONG start, end;
+
+    server.mode = transport;
+
+    if (0 != StartServer(&server, &addr, &addrLen))
+        return -1;
+
+    thread = CreateThread(NULL, 0, EchoServer, &server, 0, NULL);
+    if (NULL == thread)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        StopServer(&server);
+        return -1;
+    }
+
+    if (MODE_SHM == transport)
+    {
+        if (0 != shm_connect(&channel, server.listener.name, SHM_CONNECT_TIMEOUT_MS))
+        {
+            status = -1;
+            goto out_stop;
+        }
+
+        link.shm = &channel;
+    }
+    else
+    {
+        link.fd = socket(addr.ss_family, SOCK_STREAM, 0);
+        if (INVALID_SOCKET == link.fd)
+        {
+            printf("Error in socket: %d.\n", WSAGetLastError());
+            status = -1;
+            goto out_stop;
+        }
+
+        ret = connect(link.fd, (SOCKADDR *)&addr, addrLen);
+        if (SOCKET_ERROR == ret)
+        {
+            printf("Error in connect: %d.\n", WSAGetLastError());
+            status = -1;
+            goto out_close;
+        }
+
+        if (MODE_TCP == transport)
+            SetNoDelay(link.fd);
+    }
+
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+    {
+        status = -1;
+        goto out_close;
+    }
+
+    frame_writer_init(&writer);
+
+    for (i = 0; i < WARMUP_ROUNDS; i++)
+    {
+        if (0 != Exchange(&link, &reader, &writer, 1))
+        {
+            status = -1;
+            goto out_reader;
+        }
+    }
+
+    /* Ping-pong: one frame in flight, the round trip is the latency. */
+    result->pingCpu = CpuNs();
+    result->pingNs  = timing_now_ns();
+
+    for (i = 0; i < roundCount; i++)
+    {
+        start = timing_cycles_begin();
+
+        if (0 != Exchange(&link, &reader, &writer, 1))
+        {
+            status = -1;
+            goto out_reader;
+        }
+
+        result->hist.record(timing_elapsed_ns(start));
+    }
+
+    result->pingNs  = timing_now_ns() - result->pingNs;
+    result->pingCpu = CpuNs() - result->pingCpu;
+    result->rounds  = roundCount;
+
+    /* Throughput: depth frames per batch, the replies overlap the sends. */
+    start = timing_now_ns();
+    end   = start + (ULONGLONG)durationSec * NS_PER_SEC;
+
+    do
+    {
+        if (0 != Exchange(&link, &reader, &writer, depth))
+        {
+            status = -1;
+            goto out_reader;
+        }
+
+        result->frames += depth;
+    } while (timing_now_ns() < end);
+
+    result->streamNs = timing_now_ns() - start;
+
+out_reader:
+    frame_reader_free(&reader);
+
+out_close:
+    /* The server sees the end of the stream and leaves its loop. */
+    LinkClose(&link);
+
+out_stop:
+    /* A server still in accept leaves when its listener goes away. */
+    if (MODE_SHM == transport)
+        shm_listener_stop(&server.listener);
+    else
+        closesocket(server.listenFd);
+
+    server.listenFd = INVALID_SOCKET;
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    StopServer(&server);
+
+    return status;
+}
+
+/**
+ * PrintResult - One row of the result table.
+*/
+void PrintResult(int transport, const RESULT *result)
+{
+    double pingSec   = (double)result->pingNs / NS_PER_SEC;
+    double streamSec = (double)result->streamNs / NS_PER_SEC;
+    double mbytes    = (double)result->frames * payloadSize / (1024.0 * 1024.0);
+
+    printf("%-8s %10.2f %10.2f %10.2f %12.0f %10.2f %12.0f %10.1f\n",
+           modeNames[transport],
+           result->hist.percentile(50.0) / 1000.0,
+           result->hist.percentile(99.0) / 1000.0,
+           result->hist.percentile(99.9) / 1000.0,
+           result->rounds / pingSec,
+           (double)result->pingCpu / 1000.0 / result->rounds,
+           result->frames / streamSec,
+           mbytes / streamSec);
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'm':
+            if (0 == strcmp(argv[i + 1], "all"))
+                mode = MODE_ALL;
+            else if (0 == strcmp(argv[i + 1], "tcp"))
+                mode = MODE_TCP;
+            else if (0 == strcmp(argv[i + 1], "unix"))
+                mode = MODE_UNIX;
+            else if (0 == strcmp(argv[i + 1], "shm"))
+                mode = MODE_SHM;
+            else
+                return -1;
+            break;
+        case 's': payloadSize = (UINT32)atoi(argv[i + 1]);  break;
+        case 'n': roundCount  = atoi(argv[i + 1]);          break;
+        case 'd': depth       = atoi(argv[i + 1]);          break;
+        case 'T': durationSec = atoi(argv[i + 1]);          break;
+        default:
+            return -1;
+        }
+    }
+
+    if (payloadSize > FRAME_MAX_PAYLOAD || roundCount < 1 || depth < 1 ||
+        depth > FRAME_WRITER_FRAMES || durationSec < 1)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int i, ret;
+    int status = 0;
+    int maxDepth;
+    WSADATA wsaData;
+    RESULT *results[MODE_COUNT] = { NULL };
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-m all|tcp|unix|shm] [-s bytes] [-n rounds] [-d depth] [-T s]\n", argv[0]);
+        printf("  -m mode      Transport, default all of them.\n");
+        printf("  -s bytes     Frame payload, default 64, at most %d.\n", FRAME_MAX_PAYLOAD);
+        printf("  -n rounds    Ping-pong round trips, default 100000.\n");
+        printf("  -d depth     Frames per pipelined batch, default 32, at most %d.\n", FRAME_WRITER_FRAMES);
+        printf("  -T seconds   Throughput time per transport, default 5.\n");
+        return -1;
+    }
+
+    /* A batch and its replies must fit the buffers on the way. */
+    maxDepth = BATCH_MAX_BYTES / (FRAME_HEADER_SIZE + payloadSize);
+    if (depth > maxDepth)
+        depth = 0 < maxDepth ? maxDepth : 1;
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (0 != ret)
+    {
+        printf("Error in WSAStartup: %d.\n", ret);
+        return -1;
+    }
+
+    timing_calibrate(TIMING_CALIBRATE_MS);
+    timing_print(stdout);
+
+    payload = (char *)malloc(payloadSize ? payloadSize : 1);
+    if (NULL == payload)
+    {
+        printf("Out of memory.\n");
+        status = -1;
+        goto out_wsa;
+    }
+
+    memset(payload, 'a', payloadSize);
+
+    printf("%u bytes payload, %d round trips, %d frames per batch, %d s.\n",
+           payloadSize, roundCount, depth, durationSec);
+
+    for (i = 0; i < MODE_COUNT; i++)
+    {
+        if (MODE_ALL != mode && i != mode)
+            continue;
+
+        results[i] = new RESULT();
+
+        printf("Running %s...\n", modeNames[i]);
+
+        if (0 != RunTransport(i, results[i]))
+        {
+            printf("Transport %s failed.\n", modeNames[i]);
+            delete results[i];
+            results[i] = NULL;
+            status = -1;
+        }
+    }
+
+    printf("\n%-8s %10s %10s %10s %12s %10s %12s %10s\n",
+           "Mode", "p50 us", "p99 us", "p99.9 us", "Round/s", "cpu us/rt", "Frames/s", "MB/s");
+
+    for (i = 0; i < MODE_COUNT; i++)
+    {
+        if (NULL == results[i])
+            continue;
+
+        PrintResult(i, results[i]);
+        delete results[i];
+    }
+
+    free(payload);
+
+out_wsa:
+    WSACleanup();
+
+    return status;
+}
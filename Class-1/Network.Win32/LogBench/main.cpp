@@ -0,0 +1,209 @@
+/**
+ * Win32 logging cost benchmark.
+ * Ref 1: [https://docs.microsoft.com/en-us/cpp/c-runtime-library/reference/printf-printf-l-wprintf-wprintf-l].
+ * Ref 2: [https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue].
+ *
+ * Threads serve simulated requests and log one line per request, as the
+ * servers did, with no logging, with printf (the CRT takes the stdout lock
+ * and writes to the console or file in the calling thread) and with the
+ * asynchronous logger (Common/asynclog.h). Request throughput and the time
+ * spent in the log call show what synchronous logging costs the hot path.
+ *
+ * Log lines go to stdout, redirect it (> NUL or > file.log), the results
+ * are printed to stderr.
+ *
+ * License - MIT.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include "asynclog.h"
+#include "histogram.h"
+#include "timing.h"
+
+
+#define MODE_NONE                               0
+#define MODE_PRINTF                             1
+#define MODE_ASYNC                              2
+#define MODE_COUNT                              3
+
+#define MAX_THREADS                             64
+#define NS_PER_SEC                              1000000000ull
+
+
+typedef struct _WORKER {
+    int id;
+    int mode;
+    UINT64 checksum;                    // Keeps the work from being optimized out.
+    LatencyHistogram hist;              // ns in the log call.
+} WORKER;
+
+
+static const char *modeNames[MODE_COUNT] = { "none", "printf", "async" };
+
+int threadCount     = 4;
+UINT64 requests     = 200000;           // Per thread.
+int workRounds      = 200;
+
+
+/**
+ * Work - Stand in for parsing a request and building the reply.
+*/
+static inline UINT64 Work(UINT64 x)
+{
+    for (int i = 0; i < workRounds; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+
+    return x;
+}
+
+/**
+ * WorkerThread - Serve the requests, log one line each.
+*/
+DWORD WINAPI
+WorkerThread(LPVOID lpParam)
+{
+    WORKER *worker = (WORKER *)lpParam;
+    UINT64 x = 0x9E3779B97F4A7C15ull + worker->id;
+
+    for (UINT64 i = 0; i < requests; i++)
+    {
+        x = Work(x);
+
+        /* The cycle counter, the log call takes some ns. */
+        ScopedTimer timer(&worker->hist);
+
+        if (MODE_PRINTF == worker->mode)
+            printf("Client %d request %llu served, checksum %016llx.\n", worker->id, i, x);
+        else if (MODE_ASYNC == worker->mode)
+            LOG_INFO("Client %d request %llu served, checksum %016llx.", worker->id, i, x);
+    }
+
+    worker->checksum = x;
+
+    return 0;
+}
+
+/**
+ * RunMode - Run all threads in one mode and print a result line.
+*/
+int RunMode(int mode)
+{
+    int i, status = 0;
+    ULONGLONG start, elapsed, drained = 0;
+    LONG64 dropped = 0;
+    HANDLE threads[MAX_THREADS];
+    WORKER *workers;
+    LatencyHistogram total;
+
+    workers = new WORKER[threadCount];
+
+    if (MODE_ASYNC == mode && 0 != log_start())
+    {
+        delete[] workers;
+        return -1;
+    }
+
+    start = timing_now_ns();
+
+    for (i = 0; i < threadCount; i++)
+    {
+        workers[i].id   = i;
+        workers[i].mode = mode;
+
+        threads[i] = CreateThread(NULL, 0, WorkerThread, &workers[i], 0, NULL);
+        if (NULL == threads[i])
+        {
+            fprintf(stderr, "Error in CreateThread: %d.\n", GetLastError());
+            status = -1;
+            break;
+        }
+    }
+
+    WaitForMultipleObjects(i, threads, TRUE, INFINITE);
+    elapsed = timing_now_ns() - start;
+
+    /* The async logger still writes after the requests are served. */
+    if (MODE_ASYNC == mode)
+    {
+        drained = timing_now_ns();
+        dropped = log_stop();
+        drained = timing_now_ns() - drained;
+    }
+
+    fflush(stdout);
+
+    for (int k = 0; k < i; k++)
+    {
+        CloseHandle(threads[k]);
+        total.merge(workers[k].hist);
+    }
+
+    if (0 == status)
+    {
+        fprintf(stderr, "%-8s %12.0f %10.0f %10.0f %10.0f %10.1f %10lld\n",
+                modeNames[mode], (double)total.count() * NS_PER_SEC / elapsed,
+                (double)total.percentile(50.0), (double)total.percentile(99.0),
+                (double)total.max_value(), drained / 1e6, dropped);
+    }
+
+    delete[] workers;
+
+    return status;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            goto out_usage;
+
+        switch (argv[i][1])
+        {
+        case 't': threadCount = atoi(argv[i + 1]);                 break;
+        case 'n': requests    = _strtoui64(argv[i + 1], NULL, 10); break;
+        case 'w': workRounds  = atoi(argv[i + 1]);                 break;
+        default:
+            goto out_usage;
+        }
+    }
+
+    if (threadCount < 1 || threadCount > MAX_THREADS || 0 == requests || workRounds < 0)
+        goto out_usage;
+
+    timing_calibrate(TIMING_CALIBRATE_MS);
+    timing_print(stderr);
+
+    fprintf(stderr, "%d threads, %llu requests each, %d work rounds per request.\n\n",
+            threadCount, requests, workRounds);
+    fprintf(stderr, "%-8s %12s %10s %10s %10s %10s %10s\n",
+            "Mode", "Requests/s", "Log p50", "Log p99", "Log max", "Drain ms", "Dropped");
+    fprintf(stderr, "%-8s %12s %10s %10s %10s %10s %10s\n", "", "", "ns", "ns", "ns", "", "");
+
+    for (int mode = 0; mode < MODE_COUNT; mode++)
+    {
+        if (0 != RunMode(mode))
+            return -1;
+    }
+
+    return 0;
+
+out_usage:
+    printf("Usage: %s [-t threads] [-n requests] [-w rounds] > NUL\n", argv[0]);
+    printf("  -t threads   Request threads, default 4, at most %d.\n", MAX_THREADS);
+    printf("  -n count     Requests per thread, default 200000.\n");
+    printf("  -w rounds    Work per request in xorshift rounds, default 200.\n");
+
+    return -1;
+}
@@ -13,17 +13,37 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
+#include "fileserve.h"
+#include "framing.h"
+#include "secure.h"
+#include "shmring.h"
+
 
 #pragma comment(lib, "Ws2_32.lib")
 #pragma comment(lib, "Mswsock.lib")
 #pragma comment(lib, "AdvApi32.lib")
 
 
+#define PIPELINE_DEPTH                          4
 #define DATA_BUFLEN                             512
 #define SERVER_IP                               "127.0.0.1"
 #define SERVER_PORT                             "65533"
 
 
+int secureMode          = SECURE_MODE_NONE;
+const char *securePsk   = SECURE_DEFAULT_PSK;
+const char *filePath    = NULL;
+UINT64 fileOffset       = 0;
+UINT64 fileLength       = 0;
+const char *shmName     = NULL;
+
+
+typedef struct _FILE_SUM {
+    UINT64 bytes;
+    UINT32 hash;                        // FNV-1a of the received bytes.
+} FILE_SUM;
+
+
 /**
  * ConnectServer - Connect tcp server.
 */
@@ -108,22 +128,209 @@ out_wsa:
     return INVALID_SOCKET;
 }
 
+/**
+ * EchoRound - Send PIPELINE_DEPTH frames in one write, then read all replies.
+ *
+ * Over the socket, or over shared memory when shm is set. A GOAWAY from
+ * a draining server is not a reply, it sets goaway and the replies still
+ * outstanding are read.
+*/
+int EchoRound(SOCKET client_fd, SHM_CHANNEL *shm, FRAME_READER *reader, SECURE_CHANNEL *secure, const char *sendbuf,
+              BOOL *goaway)
+{
+    int ret;
+    int length;
+    int replies = 0;
+    FRAME_VIEW frame;
+    FRAME_WRITER writer;
+    char payloads[PIPELINE_DEPTH][DATA_BUFLEN];
+
+    frame_writer_init(&writer);
+
+    /* The flags field carries the request index, replies keep it. */
+    for (UINT16 i = 0; i < PIPELINE_DEPTH; i++)
+    {
+        length = (int)strlen(sendbuf);
+        memcpy(payloads[i], sendbuf, length);
+
+        /* Sealed in place, each frame needs its own buffer. */
+        if (NULL != secure)
+            length = secure_seal(secure, FRAME_TYPE_ECHO, i, payloads[i], length);
+
+        if (0 > length)
+            return -1;
+
+        frame_writer_add(&writer, FRAME_TYPE_ECHO, i, payloads[i], length);
+    }
+
+    if (NULL != shm)
+        ret = shm_writer_flush(shm, &writer);
+    else
+        ret = frame_writer_flush(&writer, client_fd);
+
+    if (0 != ret)
+        return -1;
+
+    while (replies < PIPELINE_DEPTH)
+    {
+        if (NULL != shm)
+            ret = shm_reader_fill(shm, reader);
+        else
+            ret = frame_reader_fill(reader, client_fd);
+
+        if (0 == ret)
+        {
+            printf("Connection closed.\n");
+            return -1;
+        }
+        else if (0 > ret)
+        {
+            printf("Error in recv: %d.\n", WSAGetLastError());
+            return -1;
+        }
+
+        while (0 < (ret = frame_next(reader, &frame)))
+        {
+            if (NULL != secure && 0 != secure_open(secure, &frame))
+            {
+                printf("Bad tag from server.\n");
+                return -1;
+            }
+
+            if (FRAME_TYPE_GOAWAY == frame.type)
+            {
+                printf("Server going away.\n");
+                *goaway = TRUE;
+                continue;
+            }
+
+            printf("Received %u: %.*s.\n", frame.flags, (int)frame.length, frame.payload);
+            replies++;
+        }
+
+        frame_release(reader);
+
+        if (0 > ret)
+        {
+            printf("Bad frame from server.\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * SumData - FILE_SINK that counts and hashes the file data.
+*/
+void SumData(void *context, const char *data, UINT32 length)
+{
+    FILE_SUM *sum = (FILE_SUM *)context;
+
+    for (UINT32 i = 0; i < length; i++)
+        sum->hash = (sum->hash ^ (UINT8)data[i]) * 16777619u;
+
+    sum->bytes += length;
+}
+
+/**
+ * GetFile - Download a range of a file from the server.
+*/
+int GetFile(SOCKET client_fd, FRAME_READER *reader, SECURE_CHANNEL *secure)
+{
+    FILE_INFO info;
+    FILE_SUM sum = { 0, 2166136261u };
+
+    if (0 != file_request(client_fd, secure, filePath, fileOffset, fileLength) ||
+        0 != file_receive(client_fd, reader, secure, &info, SumData, &sum))
+        return -1;
+
+    if (0 != info.status)
+    {
+        printf("Get %s failed: %u.\n", filePath, info.status);
+        return -1;
+    }
+
+    printf("Get %s: file size %llu, offset %llu, received %llu bytes, fnv1a 0x%08x.\n",
+           filePath, info.fileSize, info.offset, sum.bytes, sum.hash);
+
+    return 0;
+}
+
+/**
+ * ParseArgs - Parse the encryption, file and transport options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'e': secureMode = secure_mode_parse(argv[i + 1]); break;
+        case 'k': securePsk  = argv[i + 1];                    break;
+        case 'g': filePath   = argv[i + 1];                    break;
+        case 'o': fileOffset = _strtoui64(argv[i + 1], NULL, 10); break;
+        case 'l': fileLength = _strtoui64(argv[i + 1], NULL, 10); break;
+        case 's': shmName    = argv[i + 1];                    break;
+        default:
+            return -1;
+        }
+    }
+
+    if (0 > secureMode)
+        return -1;
+
+    /* The shared memory server echoes clear text frames only. */
+    if (NULL != shmName && (SECURE_MODE_NONE != secureMode || NULL != filePath))
+    {
+        printf("Shared memory carries clear text echo frames only.\n");
+        return -1;
+    }
+
+    secureMode = secure_mode_resolve(secureMode);
+
+    if (SECURE_MODE_AESNI == secureMode && !gcm_aesni_supported())
+    {
+        printf("AES-NI is not supported by this cpu.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Main function.
  */
-int main(void)
+int main(int argc, char **argv)
 {
     int ret             = -1;
     int status          = 0;
     SOCKET client_fd    = INVALID_SOCKET;
     const char *sendbuf = "Hello, 0123456789.";
+    BOOL goaway         = FALSE;
 
-    char recvbuf[DATA_BUFLEN + 1] = { 0 };
+    FRAME_READER reader;
+    SECURE_CHANNEL channel;
+    SECURE_CHANNEL *secure = NULL;
+    SHM_CHANNEL shmChannel;
+    SHM_CHANNEL *shm       = NULL;
 
-    /* Connect to server. */
-    client_fd = ConnectServer();
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-e none|auto|aesni|cng] [-k psk] [-g path [-o offset] [-l length]] [-s name]\n", argv[0]);
+        return -1;
+    }
 
-    if (INVALID_SOCKET == client_fd)
+    /* Connect to server, over loopback tcp or shared memory. */
+    if (NULL == shmName)
+        client_fd = ConnectServer();
+    else if (0 == shm_connect(&shmChannel, shmName, SHM_CONNECT_TIMEOUT_MS))
+        shm = &shmChannel;
+
+    if (INVALID_SOCKET == client_fd && NULL == shm)
     {
         printf("Error in connect server.\n");
         status = -1;
@@ -132,49 +339,72 @@ int main(void)
     
     printf("Connected Server!\n");
 
-    /* Receive until the peer closes the connection. */
-    for (int i = 0; i < 5; i++)
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
     {
-        /* Send an initial buffer. */
-        ret = send(client_fd, sendbuf, (int)strlen(sendbuf), 0);
+        status = -1;
+        goto out_close;
+    }
 
-        if (SOCKET_ERROR == ret)
+    if (SECURE_MODE_NONE != secureMode)
+    {
+        if (0 != secure_client_handshake(&channel, secureMode, securePsk, client_fd, &reader))
         {
-            printf("Error in send: %d.\n", WSAGetLastError());
             status = -1;
-            break;
+            goto out_free;
         }
 
-        ret = recv(client_fd, recvbuf, DATA_BUFLEN, 0);
+        secure = &channel;
+        printf("Encryption: %s.\n", secure_mode_name(secureMode));
+    }
 
-        if (0 < ret)
-        {
-            recvbuf[ret] = 0;
-            printf("Received: %s.\n", recvbuf);
-        }
-        else if (0 == ret)
+    if (NULL != filePath)
+    {
+        if (0 != GetFile(client_fd, &reader, secure))
+            status = -1;
+
+        goto out_secure;
+    }
+
+    /* Receive until the peer closes the connection or goes away. */
+    for (int i = 0; i < 5 && !goaway; i++)
+    {
+        if (0 != EchoRound(client_fd, shm, &reader, secure, sendbuf, &goaway))
         {
-            printf("Connection closed.\n");
+            status = -1;
             break;
         }
-        else
-        {
-            printf("Error in recv: %d.\n", WSAGetLastError());
-        }
 
-        Sleep(1000);
+        if (!goaway)
+            Sleep(1000);
     }
 
+out_secure:
+    if (NULL != secure)
+        secure_free(secure);
+
+out_free:
+    frame_reader_free(&reader);
+
     /* shutdown the connection since no more data will be sent. */
-    ret = shutdown(client_fd, SD_BOTH);
+    if (NULL == shm)
+    {
+        ret = shutdown(client_fd, SD_BOTH);
+
+        if (SOCKET_ERROR == ret)
+        {
+            printf("Error in shutdown: %d.\n", WSAGetLastError());
+            status = -1;
+        }
+    }
 
-    if (SOCKET_ERROR == ret)
+out_close:
+    /* cleanup, the server reads the end of the stream. */
+    if (NULL != shm)
     {
-        printf("Error in shutdown: %d.\n", WSAGetLastError());
-        status = -1;
+        shm_close(shm);
+        goto out_end;
     }
 
-    /* cleanup. */
     closesocket(client_fd);
     WSACleanup();
 
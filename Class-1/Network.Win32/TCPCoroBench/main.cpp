@@ -0,0 +1,628 @@
+/**
+ * Win32 coroutine vs thread per client benchmark.
+ * Ref 1: [https://en.cppreference.com/w/cpp/language/coroutines].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/procthread/thread-stack-size].
+ *
+ * Runs many echo client sessions against TCPServerThread or TCPServerCoro.
+ * Every session connects, then sends one frame and waits for its reply in
+ * a loop, the code is the same in both modes:
+ *
+ *  - coro: every session is a coroutine (Common/coio.h), a few threads of
+ *    one completion port resume them.
+ *  - thread: every session is a thread with blocking send and recv, like
+ *    TCPClient.
+ *
+ * Prints requests/s, round trip percentiles, process cpu time per request
+ * and private bytes per session, so both the client and the server model
+ * can be compared.
+ *
+ * License - MIT.
+ */
+
+#undef UNICODE
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <psapi.h>
+
+#include "coio.h"
+#include "framing.h"
+#include "histogram.h"
+#include "timing.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Psapi.lib")
+
+
+#define MODE_CORO                               0
+#define MODE_THREAD                             1
+
+#define PHASE_WARMUP                            0
+#define PHASE_MEASURE                           1
+#define PHASE_STOP                              2
+
+#define SERVER_IP                               "127.0.0.1"
+#define SERVER_PORT                             65533
+#define MAX_WORKERS                             256
+#define SESSION_STACK_SIZE                      (64 * 1024)
+#define CONNECT_WAIT_MS                         30000
+#define STOP_WAIT_MS                            5000
+#define NS_PER_SEC                              1000000000ull
+
+
+/* Results of one coroutine thread, or of a group of session threads. */
+typedef struct _WORKER {
+    SRWLOCK lock;                       // Thread mode only.
+    UINT64 requests;
+    LatencyHistogram hist;              // Round trip in ns.
+} WORKER;
+
+
+static const char *modeNames[] = { "coro", "thread" };
+
+IoContext ioContext;
+struct sockaddr_in serverAddr;
+DWORD workerSlot            = TLS_OUT_OF_INDEXES;
+WORKER *workers             = NULL;
+
+volatile LONG phase         = PHASE_WARMUP;
+volatile LONG attempted     = 0;            // Sessions past their connect.
+volatile LONG connected     = 0;
+volatile LONG failed        = 0;            // Sessions that ended with an error.
+volatile LONG finished      = 0;
+
+int mode                    = MODE_CORO;
+int sessionCount            = 100;
+int workerCount             = 0;
+UINT32 payloadSize          = 64;
+int durationSec             = 10;
+int warmupSec               = 2;
+const char *serverIp        = SERVER_IP;
+int serverPort              = SERVER_PORT;
+
+
+/**
+ * CpuNs - User + kernel time of the whole process.
+*/
+static ULONGLONG CpuNs(void)
+{
+    FILETIME createTime, exitTime, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    GetProcessTimes(GetCurrentProcess(), &createTime, &exitTime, &kernel, &user);
+
+    k.LowPart  = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart  = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+
+    return (k.QuadPart + u.QuadPart) * 100;
+}
+
+/**
+ * PrivateBytes - Committed private memory of this process.
+*/
+SIZE_T PrivateBytes(void)
+{
+    PROCESS_MEMORY_COUNTERS_EX counters;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&counters, sizeof(counters)))
+        return 0;
+
+    return counters.PrivateUsage;
+}
+
+/**
+ * NewRequest - An echo frame and room for its reply.
+*/
+char *NewRequest(int index)
+{
+    FRAME_HEADER header;
+    char *request;
+
+    request = (char *)malloc(2 * (FRAME_HEADER_SIZE + payloadSize));
+    if (NULL == request)
+        return NULL;
+
+    header.length = payloadSize;
+    header.type   = FRAME_TYPE_ECHO;
+    header.flags  = (UINT16)index;
+
+    memcpy(request, &header, FRAME_HEADER_SIZE);
+    memset(request + FRAME_HEADER_SIZE, 'a' + index % 26, payloadSize);
+
+    return request;
+}
+
+/**
+ * CheckReply - The reply must be the request.
+*/
+static inline BOOL CheckReply(const char *request, const char *reply, int length)
+{
+    return 0 == memcmp(request, reply, length);
+}
+
+/**
+ * SetNoDelay - Small requests must not wait for Nagle.
+*/
+static inline void SetNoDelay(SOCKET fd)
+{
+    BOOL noDelay = TRUE;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+}
+
+/**
+ * Record - Count one round trip of the measured phase.
+*/
+static inline void Record(WORKER *worker, ULONGLONG start, BOOL locked)
+{
+    ULONGLONG ns = timing_now_ns() - start;
+
+    if (PHASE_MEASURE != phase)
+        return;
+
+    if (locked)
+        AcquireSRWLockExclusive(&worker->lock);
+
+    worker->hist.record(ns);
+    worker->requests++;
+
+    if (locked)
+        ReleaseSRWLockExclusive(&worker->lock);
+}
+
+/**
+ * CoroSession - One client session as a coroutine.
+ *
+ * The worker is looked up after the reply: the coroutine may resume in any
+ * thread of the context, each thread has its own histogram.
+*/
+CoDetached CoroSession(int index)
+{
+    int ret;
+    int length = (int)(FRAME_HEADER_SIZE + payloadSize);
+    ULONGLONG start;
+    SOCKET fd;
+    char *request, *reply;
+
+    /* Leave the main thread before any I/O. */
+    if (SOCKET_ERROR == co_await async_schedule(&ioContext))
+        goto out_end;
+
+    request = NewRequest(index);
+    if (NULL == request)
+    {
+        InterlockedIncrement(&failed);
+        InterlockedIncrement(&attempted);
+        goto out_end;
+    }
+
+    reply = request + length;
+
+    fd = co_await async_connect(&ioContext, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+    if (INVALID_SOCKET == fd)
+    {
+        printf("Error in connect: %d.\n", WSAGetLastError());
+        InterlockedIncrement(&failed);
+        InterlockedIncrement(&attempted);
+        goto out_free;
+    }
+
+    InterlockedIncrement(&connected);
+    InterlockedIncrement(&attempted);
+
+    SetNoDelay(fd);
+
+    while (PHASE_STOP != phase)
+    {
+        start = timing_now_ns();
+
+        if (SOCKET_ERROR == co_await async_send(fd, request, length))
+            break;
+
+        ret = co_await async_recv_exact(fd, reply, length);
+        if (length != ret || !CheckReply(request, reply, length))
+            break;
+
+        Record((WORKER *)TlsGetValue(workerSlot), start, FALSE);
+    }
+
+    if (PHASE_STOP != phase)
+    {
+        printf("Session %d failed: %d.\n", index, WSAGetLastError());
+        InterlockedIncrement(&failed);
+    }
+
+    closesocket(fd);
+
+out_free:
+    free(request);
+
+out_end:
+    InterlockedIncrement(&finished);
+}
+
+/**
+ * CoroWorker - Resume the session coroutines until the context is stopped.
+*/
+DWORD WINAPI
+CoroWorker(LPVOID lpParam)
+{
+    TlsSetValue(workerSlot, lpParam);
+    ioContext.run();
+
+    return 0;
+}
+
+/**
+ * SendAll - Blocking send of length bytes.
+*/
+int SendAll(SOCKET fd, const char *data, int length)
+{
+    int ret;
+
+    while (0 < length)
+    {
+        ret = send(fd, data, length, 0);
+        if (SOCKET_ERROR == ret)
+            return -1;
+
+        data   += ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * RecvAll - Blocking receive of length bytes.
+*/
+int RecvAll(SOCKET fd, char *data, int length)
+{
+    int ret;
+
+    while (0 < length)
+    {
+        ret = recv(fd, data, length, 0);
+        if (0 >= ret)
+            return -1;
+
+        data   += ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * ThreadSession - One client session as a thread.
+ *
+ * Sessions share the histograms of workerCount groups, one lock each.
+*/
+DWORD WINAPI
+ThreadSession(LPVOID lpParam)
+{
+    int index  = (int)(INT_PTR)lpParam;
+    int length = (int)(FRAME_HEADER_SIZE + payloadSize);
+    ULONGLONG start;
+    SOCKET fd;
+    WORKER *worker = &workers[index % workerCount];
+    char *request, *reply;
+
+    request = NewRequest(index);
+    if (NULL == request)
+    {
+        InterlockedIncrement(&failed);
+        InterlockedIncrement(&attempted);
+        goto out_end;
+    }
+
+    reply = request + length;
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == fd ||
+        SOCKET_ERROR == connect(fd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)))
+    {
+        printf("Error in connect: %d.\n", WSAGetLastError());
+        InterlockedIncrement(&failed);
+
+        InterlockedIncrement(&attempted);
+
+        if (INVALID_SOCKET != fd)
+            closesocket(fd);
+
+        goto out_free;
+    }
+
+    InterlockedIncrement(&connected);
+    InterlockedIncrement(&attempted);
+
+    SetNoDelay(fd);
+
+    while (PHASE_STOP != phase)
+    {
+        start = timing_now_ns();
+
+        if (0 != SendAll(fd, request, length) || 0 != RecvAll(fd, reply, length) ||
+            !CheckReply(request, reply, length))
+            break;
+
+        Record(worker, start, TRUE);
+    }
+
+    if (PHASE_STOP != phase)
+    {
+        printf("Session %d failed: %d.\n", index, WSAGetLastError());
+        InterlockedIncrement(&failed);
+    }
+
+    closesocket(fd);
+
+out_free:
+    free(request);
+
+out_end:
+    InterlockedIncrement(&finished);
+
+    return 0;
+}
+
+/**
+ * WaitCount - Wait until *value reaches target, at most timeoutMs.
+*/
+BOOL WaitCount(volatile LONG *value, LONG target, DWORD timeoutMs)
+{
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+
+    while (*value < target && GetTickCount64() < deadline)
+        Sleep(10);
+
+    return *value >= target;
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'm':
+            if (0 == strcmp(argv[i + 1], "coro"))
+                mode = MODE_CORO;
+            else if (0 == strcmp(argv[i + 1], "thread"))
+                mode = MODE_THREAD;
+            else
+                return -1;
+            break;
+        case 'h': serverIp     = argv[i + 1];                break;
+        case 'p': serverPort   = atoi(argv[i + 1]);          break;
+        case 'c': sessionCount = atoi(argv[i + 1]);          break;
+        case 't': workerCount  = atoi(argv[i + 1]);          break;
+        case 's': payloadSize  = (UINT32)atoi(argv[i + 1]);  break;
+        case 'T': durationSec  = atoi(argv[i + 1]);          break;
+        case 'w': warmupSec    = atoi(argv[i + 1]);          break;
+        default:
+            return -1;
+        }
+    }
+
+    if (serverPort < 1 || serverPort > 65535 || sessionCount < 1 || workerCount < 0 ||
+        workerCount > MAX_WORKERS || payloadSize > FRAME_MAX_PAYLOAD || durationSec < 1 || warmupSec < 0)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int i, ret;
+    int status = 0;
+    WSADATA wsaData;
+    SYSTEM_INFO sysInfo;
+    HANDLE *threads = NULL;
+    int threadCount = 0;
+    SIZE_T baseline, privBytes;
+    ULONGLONG start, elapsed, cpu;
+    UINT64 requests = 0;
+    LatencyHistogram total;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-m coro|thread] [-h ip] [-p port] [-c sessions] [-t threads] [-s bytes] [-T s] [-w s]\n", argv[0]);
+        printf("  -m mode      coro (default) or thread per session.\n");
+        printf("  -h ip        Server address, default %s.\n", SERVER_IP);
+        printf("  -p port      Server port, default %d.\n", SERVER_PORT);
+        printf("  -c count     Sessions, default 100.\n");
+        printf("  -t threads   Coroutine threads or histogram groups, default 1 per cpu.\n");
+        printf("  -s bytes     Request payload, default 64, at most %d.\n", FRAME_MAX_PAYLOAD);
+        printf("  -T seconds   Measured time, default 10.\n");
+        printf("  -w seconds   Warmup, not measured, default 2.\n");
+        return -1;
+    }
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (0 != ret)
+    {
+        printf("Error in WSAStartup: %d.\n", ret);
+        return -1;
+    }
+
+    ZeroMemory(&serverAddr, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port   = htons((u_short)serverPort);
+
+    if (1 != inet_pton(AF_INET, serverIp, &serverAddr.sin_addr))
+    {
+        printf("Bad server address: %s.\n", serverIp);
+        status = -1;
+        goto out_wsa;
+    }
+
+    GetSystemInfo(&sysInfo);
+    if (0 == workerCount)
+        workerCount = (int)sysInfo.dwNumberOfProcessors < MAX_WORKERS ? (int)sysInfo.dwNumberOfProcessors : MAX_WORKERS;
+
+    workers = new WORKER[workerCount];
+    threads = (HANDLE *)calloc(MODE_CORO == mode ? workerCount : sessionCount, sizeof(HANDLE));
+    if (NULL == threads)
+    {
+        printf("Out of memory.\n");
+        status = -1;
+        goto out_free;
+    }
+
+    for (i = 0; i < workerCount; i++)
+    {
+        InitializeSRWLock(&workers[i].lock);
+        workers[i].requests = 0;
+    }
+
+    printf("Mode %s, %d sessions, %d %s, %u bytes payload, %d s.\n",
+           modeNames[mode], sessionCount, workerCount,
+           MODE_CORO == mode ? "threads" : "histogram groups", payloadSize, durationSec);
+
+    baseline = PrivateBytes();
+
+    if (MODE_CORO == mode)
+    {
+        workerSlot = TlsAlloc();
+        if (TLS_OUT_OF_INDEXES == workerSlot)
+        {
+            printf("Error in TlsAlloc: %d.\n", GetLastError());
+            status = -1;
+            goto out_free;
+        }
+
+        if (0 != ioContext.init())
+        {
+            status = -1;
+            goto out_tls;
+        }
+
+        for (i = 0; i < workerCount; i++)
+        {
+            threads[i] = CreateThread(NULL, 0, CoroWorker, &workers[i], 0, NULL);
+            if (NULL == threads[i])
+            {
+                printf("Error in CreateThread: %d.\n", GetLastError());
+                status = -1;
+                goto out_threads;
+            }
+
+            threadCount++;
+        }
+
+        for (i = 0; i < sessionCount; i++)
+            CoroSession(i);
+    }
+    else
+    {
+        /* Only the stack reservation is set, the committed part grows on use. */
+        for (i = 0; i < sessionCount; i++)
+        {
+            threads[i] = CreateThread(NULL, SESSION_STACK_SIZE, ThreadSession, (LPVOID)(INT_PTR)i,
+                                      STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+            if (NULL == threads[i])
+            {
+                printf("Error in CreateThread: %d, %d sessions started.\n", GetLastError(), i);
+                break;
+            }
+
+            threadCount++;
+        }
+
+        /* Sessions never started count as finished. */
+        InterlockedExchangeAdd(&failed, sessionCount - threadCount);
+        InterlockedExchangeAdd(&attempted, sessionCount - threadCount);
+        InterlockedExchangeAdd(&finished, sessionCount - threadCount);
+    }
+
+    if (!WaitCount(&attempted, sessionCount, CONNECT_WAIT_MS))
+        printf("Connect timeout.\n");
+
+    privBytes = PrivateBytes();
+    printf("Connected %ld sessions, %ld failed.\n", connected, failed);
+
+    if (0 == connected)
+    {
+        status = -1;
+        phase  = PHASE_STOP;
+        goto out_stop;
+    }
+
+    Sleep(warmupSec * 1000);
+
+    start = timing_now_ns();
+    cpu   = CpuNs();
+    InterlockedExchange(&phase, PHASE_MEASURE);
+
+    Sleep(durationSec * 1000);
+
+    InterlockedExchange(&phase, PHASE_STOP);
+    elapsed = timing_now_ns() - start;
+    cpu     = CpuNs() - cpu;
+
+out_stop:
+    /* Every session leaves after its current round trip. */
+    if (!WaitCount(&finished, sessionCount, STOP_WAIT_MS))
+        printf("%ld sessions did not stop.\n", sessionCount - finished);
+
+out_threads:
+    if (MODE_CORO == mode)
+        ioContext.stop(threadCount);
+
+    for (i = 0; i < threadCount; i++)
+    {
+        WaitForSingleObject(threads[i], STOP_WAIT_MS);
+        CloseHandle(threads[i]);
+    }
+
+    if (MODE_CORO == mode)
+        ioContext.free();
+
+    if (0 != status)
+        goto out_tls;
+
+    for (i = 0; i < workerCount; i++)
+    {
+        total.merge(workers[i].hist);
+        requests += workers[i].requests;
+    }
+
+    printf("\n%-8s %12s %10s %10s %10s %10s %12s %8s\n",
+           "Mode", "Requests/s", "p50 us", "p99 us", "p99.9 us", "cpu us/req", "KB/session", "Errors");
+    printf("%-8s %12.0f %10.1f %10.1f %10.1f %10.2f %12.1f %8ld\n",
+           modeNames[mode], (double)requests * NS_PER_SEC / elapsed,
+           total.percentile(50.0) / 1e3, total.percentile(99.0) / 1e3, total.percentile(99.9) / 1e3,
+           0 < requests ? (double)cpu / requests / 1e3 : 0.0,
+           privBytes > baseline ? (double)(privBytes - baseline) / 1024 / connected : 0.0, failed);
+
+out_tls:
+    if (TLS_OUT_OF_INDEXES != workerSlot)
+        TlsFree(workerSlot);
+
+out_free:
+    free(threads);
+    delete[] workers;
+
+out_wsa:
+    WSACleanup();
+
+    return status;
+}
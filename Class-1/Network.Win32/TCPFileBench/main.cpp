@@ -0,0 +1,442 @@
+/**
+ * Win32 zero copy file serving benchmark.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_transmitpackets].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-getthreadtimes].
+ *
+ * Serves one file over loopback tcp with TransmitPackets (zero copy) and
+ * with ReadFile + WSASend (copy), and reports GB/s, the cpu time of the
+ * serving thread per GB and the cpu usage of the whole process.
+ *
+ * License - MIT.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "fileserve.h"
+#include "framing.h"
+#include "timing.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+
+
+#define TEMP_FILE_NAME                          "TCPFileBench.dat"
+#define WRITE_BLOCK                             (1024 * 1024)
+#define NS_PER_SEC                              1000000000ull
+
+
+typedef struct _BENCH_SERVER {
+    SOCKET listen_fd;
+    int mode;
+    int status;
+    ULONGLONG cpuNs;            // Cpu time of the serving thread.
+} BENCH_SERVER;
+
+typedef struct _BENCH_RESULT {
+    double gbps;
+    double serverMsPerGB;
+    double cpuPercent;
+} BENCH_RESULT;
+
+
+char fileRoot[MAX_PATH] = ".";
+char fileName[MAX_PATH] = TEMP_FILE_NAME;
+UINT64 rangeOffset      = 0;
+UINT64 rangeLength      = 0;
+int repeats             = 10;
+
+
+/**
+ * FileTimeNs - User + kernel FILETIME in nanoseconds.
+*/
+static ULONGLONG FileTimeNs(const FILETIME *kernel, const FILETIME *user)
+{
+    ULARGE_INTEGER k, u;
+
+    k.LowPart  = kernel->dwLowDateTime;
+    k.HighPart = kernel->dwHighDateTime;
+    u.LowPart  = user->dwLowDateTime;
+    u.HighPart = user->dwHighDateTime;
+
+    return (k.QuadPart + u.QuadPart) * 100;
+}
+
+/**
+ * ThreadCpuNs - Cpu time of the calling thread.
+*/
+static ULONGLONG ThreadCpuNs(void)
+{
+    FILETIME createTime, exitTime, kernel, user;
+
+    GetThreadTimes(GetCurrentThread(), &createTime, &exitTime, &kernel, &user);
+
+    return FileTimeNs(&kernel, &user);
+}
+
+/**
+ * ProcessCpuNs - Cpu time of the whole process.
+*/
+static ULONGLONG ProcessCpuNs(void)
+{
+    FILETIME createTime, exitTime, kernel, user;
+
+    GetProcessTimes(GetCurrentProcess(), &createTime, &exitTime, &kernel, &user);
+
+    return FileTimeNs(&kernel, &user);
+}
+
+/**
+ * CreateTestFile - Write a file of the given size in the temp directory.
+*/
+int CreateTestFile(UINT64 megabytes)
+{
+    int status = -1;
+    DWORD written;
+    HANDLE file;
+    char path[MAX_PATH];
+    char *block;
+
+    if (0 == GetTempPathA(sizeof(fileRoot), fileRoot))
+    {
+        printf("Error in GetTempPath: %d.\n", GetLastError());
+        return -1;
+    }
+
+    /* The server adds the separator. */
+    fileRoot[strlen(fileRoot) - 1] = 0;
+    snprintf(path, sizeof(path), "%s\\%s", fileRoot, TEMP_FILE_NAME);
+
+    block = (char *)malloc(WRITE_BLOCK);
+    if (NULL == block)
+        return -1;
+
+    for (int i = 0; i < WRITE_BLOCK; i++)
+        block[i] = (char)(i * 31);
+
+    file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        printf("Error in CreateFile: %d.\n", GetLastError());
+        goto out_free;
+    }
+
+    for (UINT64 i = 0; i < megabytes; i++)
+    {
+        if (!WriteFile(file, block, WRITE_BLOCK, &written, NULL))
+        {
+            printf("Error in WriteFile: %d.\n", GetLastError());
+            goto out_close;
+        }
+    }
+
+    status = 0;
+
+out_close:
+    CloseHandle(file);
+
+out_free:
+    free(block);
+
+    return status;
+}
+
+/**
+ * SplitPath - Serve an existing file, root is its directory.
+*/
+void SplitPath(const char *path)
+{
+    const char *slash = strrchr(path, '\\');
+
+    if (NULL == slash)
+        slash = strrchr(path, '/');
+
+    if (NULL == slash)
+    {
+        snprintf(fileName, sizeof(fileName), "%s", path);
+        return;
+    }
+
+    snprintf(fileRoot, sizeof(fileRoot), "%.*s", (int)(slash - path), path);
+    snprintf(fileName, sizeof(fileName), "%s", slash + 1);
+}
+
+/**
+ * ServerThread - Accept one connection and serve its FILE_GET frames.
+*/
+DWORD WINAPI
+ServerThread(LPVOID lpParam)
+{
+    int ret;
+    BENCH_SERVER *server = (BENCH_SERVER *)lpParam;
+    SOCKET client_fd;
+    FRAME_VIEW frame;
+    FRAME_READER reader;
+    FILE_SERVER fileServer;
+    ULONGLONG cpu;
+    BOOL noDelay = TRUE;
+
+    server->status = -1;
+
+    client_fd = accept(server->listen_fd, NULL, NULL);
+    if (INVALID_SOCKET == client_fd)
+        return 1;
+
+    /* Small ranges are request/response, do not wait for Nagle. */
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+        goto out_close;
+
+    file_server_init(&fileServer, client_fd, fileRoot, server->mode);
+    cpu = ThreadCpuNs();
+
+    while (0 < (ret = frame_reader_fill(&reader, client_fd)))
+    {
+        while (0 < (ret = frame_next(&reader, &frame)))
+        {
+            if (FRAME_TYPE_FILE_GET != frame.type ||
+                0 != file_serve(&fileServer, client_fd, NULL, &frame))
+                goto out_free;
+        }
+
+        if (0 > ret)
+            goto out_free;
+
+        frame_release(&reader);
+    }
+
+    if (0 == ret)
+        server->status = 0;
+
+    server->cpuNs = ThreadCpuNs() - cpu;
+
+out_free:
+    file_server_free(&fileServer);
+    frame_reader_free(&reader);
+
+out_close:
+    closesocket(client_fd);
+
+    return 0;
+}
+
+/**
+ * CountData - FILE_SINK that only counts, the client should cost little.
+*/
+void CountData(void *context, const char *data, UINT32 length)
+{
+    *(UINT64 *)context += length;
+}
+
+/**
+ * FetchBench - Fetch the range 'repeats' times in one serving mode.
+*/
+int FetchBench(int mode, BENCH_RESULT *result)
+{
+    int status = -1;
+    int len;
+    HANDLE thrdHandle = NULL;
+    SOCKET client_fd  = INVALID_SOCKET;
+    BENCH_SERVER server;
+    FRAME_READER reader;
+    FILE_INFO info;
+    struct sockaddr_in addr;
+    UINT64 bytes = 0, warm = 0;
+    ULONGLONG start, elapsed, cpu;
+    BOOL noDelay = TRUE;
+
+    ZeroMemory(&server, sizeof(server));
+    server.mode = mode;
+
+    server.listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == server.listen_fd)
+        return -1;
+
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(addr);
+
+    if (SOCKET_ERROR == bind(server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        SOCKET_ERROR == getsockname(server.listen_fd, (struct sockaddr *)&addr, &len) ||
+        SOCKET_ERROR == listen(server.listen_fd, 1))
+    {
+        printf("Error in listen: %d.\n", WSAGetLastError());
+        goto out_listen;
+    }
+
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+        goto out_listen;
+
+    thrdHandle = CreateThread(NULL, 0, ServerThread, &server, 0, NULL);
+    if (NULL == thrdHandle)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        goto out_reader;
+    }
+
+    client_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == client_fd ||
+        SOCKET_ERROR == connect(client_fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        printf("Error in connect: %d.\n", WSAGetLastError());
+        goto out_thread;
+    }
+
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+    /* One untimed fetch brings the file into the cache. */
+    if (0 != file_request(client_fd, NULL, fileName, rangeOffset, rangeLength) ||
+        0 != file_receive(client_fd, &reader, NULL, &info, CountData, &warm))
+        goto out_thread;
+
+    if (0 != info.status)
+    {
+        printf("Get %s\\%s failed: %u.\n", fileRoot, fileName, info.status);
+        goto out_thread;
+    }
+
+    start = timing_now_ns();
+    cpu   = ProcessCpuNs();
+
+    for (int i = 0; i < repeats; i++)
+    {
+        if (0 != file_request(client_fd, NULL, fileName, rangeOffset, rangeLength) ||
+            0 != file_receive(client_fd, &reader, NULL, &info, CountData, &bytes))
+            goto out_thread;
+    }
+
+    elapsed = timing_now_ns() - start;
+    cpu     = ProcessCpuNs() - cpu;
+
+    /* The server thread reports its cpu time when the client leaves. */
+    shutdown(client_fd, SD_SEND);
+    WaitForSingleObject(thrdHandle, INFINITE);
+
+    if (0 == server.status && 0 < bytes)
+    {
+        result->gbps          = (double)bytes / elapsed;
+        result->serverMsPerGB = server.cpuNs / 1e6 / ((bytes + warm) / 1e9);
+        result->cpuPercent    = 100.0 * cpu / elapsed;
+        status = 0;
+    }
+
+out_thread:
+    if (INVALID_SOCKET != client_fd)
+        closesocket(client_fd);
+
+    closesocket(server.listen_fd);
+    server.listen_fd = INVALID_SOCKET;
+
+    WaitForSingleObject(thrdHandle, INFINITE);
+    CloseHandle(thrdHandle);
+
+out_reader:
+    frame_reader_free(&reader);
+
+out_listen:
+    if (INVALID_SOCKET != server.listen_fd)
+        closesocket(server.listen_fd);
+
+    return status;
+}
+
+/**
+ * Usage - Show command line options.
+*/
+void Usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -f path      File to serve, default a temp file of -m MB.\n");
+    printf("  -m MB        Size of the temp file, default 512.\n");
+    printf("  -o offset    Range offset, default 0.\n");
+    printf("  -l length    Range length, default 0 (to end of file).\n");
+    printf("  -n count     Timed fetches per mode, default 10.\n");
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int ret;
+    WSADATA wsaData;
+    BENCH_RESULT result;
+    const char *path = NULL;
+    UINT64 megabytes = 512;
+    const int modes[] = { FILE_SERVE_COPY, FILE_SERVE_ZEROCOPY };
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+        {
+            Usage(argv[0]);
+            return -1;
+        }
+
+        switch (argv[i][1])
+        {
+        case 'f': path        = argv[i + 1];                        break;
+        case 'm': megabytes   = _strtoui64(argv[i + 1], NULL, 10);  break;
+        case 'o': rangeOffset = _strtoui64(argv[i + 1], NULL, 10);  break;
+        case 'l': rangeLength = _strtoui64(argv[i + 1], NULL, 10);  break;
+        case 'n': repeats     = atoi(argv[i + 1]);                  break;
+        default:
+            Usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (repeats < 1 || (NULL == path && 0 == megabytes))
+    {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (0 != ret)
+    {
+        printf("Error in WSAStartup: %d.\n", ret);
+        return -1;
+    }
+
+    if (NULL != path)
+        SplitPath(path);
+    else if (0 != CreateTestFile(megabytes))
+        goto out_wsa;
+
+    printf("Serving %s\\%s, offset %llu, length %llu, %d fetches per mode.\n\n",
+           fileRoot, fileName, rangeOffset, rangeLength, repeats);
+    printf("%-10s %8s %16s %8s\n", "Mode", "GB/s", "Server ms/GB", "CPU %");
+
+    for (int m = 0; m < (int)(sizeof(modes) / sizeof(modes[0])); m++)
+    {
+        if (0 != FetchBench(modes[m], &result))
+        {
+            printf("%-10s %8s\n", file_mode_name(modes[m]), "failed");
+            continue;
+        }
+
+        printf("%-10s %8.2f %16.1f %8.1f\n", file_mode_name(modes[m]),
+               result.gbps, result.serverMsPerGB, result.cpuPercent);
+    }
+
+    if (NULL == path)
+    {
+        char temp[MAX_PATH];
+
+        snprintf(temp, sizeof(temp), "%s\\%s", fileRoot, fileName);
+        DeleteFileA(temp);
+    }
+
+out_wsa:
+    WSACleanup();
+
+    return 0;
+}
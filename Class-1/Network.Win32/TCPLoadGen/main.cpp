@@ -0,0 +1,686 @@
+/**
+ * Win32 tcp load generator example.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsapoll].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsasend].
+ *
+ * Opens many connections from a few threads and drives them either in
+ * closed loop (each connection keeps 'depth' requests in flight) or in open
+ * loop (requests are issued on a fixed schedule). In open loop a request's
+ * latency is measured from its scheduled time, so a stalled server is not
+ * hidden by the generator backing off (coordinated omission). With depth 0
+ * the connections are only held open, to measure what idle connections
+ * cost the server.
+ *
+ * A server that drains sends GOAWAY: the connection sends no new requests,
+ * waits for the replies of the outstanding ones, closes and connects
+ * again, so a rolling restart of the server costs no failed requests.
+ *
+ * License - MIT.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "framing.h"
+#include "histogram.h"
+#include "timing.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+
+
+#define DATA_BUFLEN                             65536
+#define SERVER_IP                               "127.0.0.1"
+#define SERVER_PORT                             "65533"
+#define SEND_BATCH                              64          // WSABUF per WSASend.
+#define MAX_DEPTH                               4096
+#define POLL_TIMEOUT_MS                         1
+#define IDLE_POLL_TIMEOUT_MS                    100
+#define RECONNECT_MS                            100
+
+
+typedef struct _LOAD_CONFIG {
+    const char *host;
+    const char *port;
+    int ports;                  // Connections are spread over port .. port + ports - 1.
+    int connections;
+    int threads;
+    int depth;                  // 0 holds idle connections.
+    int msgSize;                // Payload bytes of a request.
+    int frameSize;              // Header + payload bytes on the wire.
+    double rate;                // Total requests per second, 0 is closed loop.
+    int duration;               // Measured seconds.
+    int warmup;                 // Seconds before recording starts.
+} LOAD_CONFIG;
+
+typedef struct _LOAD_CONN {
+    SOCKET fd;
+    int outstanding;            // Requests sent or queued, waiting for reply.
+    int queued;                 // Requests not completely written yet.
+    int sendOffset;             // Bytes written of the first queued request.
+    FRAME_SCANNER scanner;      // Counts reply frames.
+    UINT head;                  // Ring of request start times.
+    UINT tail;
+    ULONGLONG *startNs;
+    ULONGLONG nextDue;          // Open loop: scheduled time of next request.
+    BOOL reconnect;             // Closed after GOAWAY, connect again.
+    ULONGLONG retryAt;
+} LOAD_CONN;
+
+typedef struct _LOAD_WORKER {
+    int id;
+    int connCount;
+    int connFailed;
+    LOAD_CONN *conns;
+    char *message;
+    char *recvbuf;
+
+    ULONGLONG requests;
+    ULONGLONG bytes;
+    ULONGLONG errors;
+    ULONGLONG reconnects;
+    LatencyHistogram hist;
+} LOAD_WORKER;
+
+
+LOAD_CONFIG config;
+
+ULONGLONG measureStartNs = 0;
+ULONGLONG measureEndNs   = 0;
+
+
+/**
+ * ConnectServer - Connect tcp server, return a non-blocking socket.
+*/
+SOCKET ConnectServer(const char *host, const char *port)
+{
+    int ret = -1;
+    u_long nonBlocking = 1;
+    BOOL noDelay = TRUE;
+    BOOL reusePort = TRUE;
+    SOCKET client_fd = INVALID_SOCKET;
+
+    struct addrinfo *addr_data = NULL,
+                    *addr_ptr  = NULL,
+                    hints;
+
+    ZeroMemory(&hints, sizeof(hints));
+
+    hints.ai_family     = AF_UNSPEC;
+    hints.ai_socktype   = SOCK_STREAM;
+    hints.ai_protocol   = IPPROTO_TCP;
+
+    /* Resolve the server address and port. */
+    ret = getaddrinfo(host, port, &hints, &addr_data);
+
+    if (0 != ret)
+    {
+        printf("Error in getaddrinfo: %d.\n", ret);
+        return INVALID_SOCKET;
+    }
+
+    /* Attempt to connect to an address until one succeeds. */
+    for (addr_ptr = addr_data; addr_ptr != NULL; addr_ptr = addr_ptr->ai_next)
+    {
+        client_fd = socket(
+            addr_ptr->ai_family,
+            addr_ptr->ai_socktype,
+            addr_ptr->ai_protocol
+        );
+
+        if (INVALID_SOCKET == client_fd)
+            break;
+
+        /* Share local ports between different server ports, more than 64k connections. */
+        setsockopt(client_fd, SOL_SOCKET, SO_REUSE_UNICASTPORT, (const char *)&reusePort, sizeof(reusePort));
+
+        ret = connect(client_fd, addr_ptr->ai_addr, (int)addr_ptr->ai_addrlen);
+
+        if (SOCKET_ERROR == ret)
+        {
+            closesocket(client_fd);
+            client_fd = INVALID_SOCKET;
+            continue;
+        }
+
+        break;
+    }
+
+    freeaddrinfo(addr_data);
+
+    if (INVALID_SOCKET == client_fd)
+        return INVALID_SOCKET;
+
+    /* Small requests must not wait for Nagle. */
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+    ioctlsocket(client_fd, FIONBIO, &nonBlocking);
+
+    return client_fd;
+}
+
+/**
+ * EnqueueRequest - Queue one request that is considered started at startNs.
+*/
+static void EnqueueRequest(LOAD_CONN *conn, ULONGLONG startNs)
+{
+    conn->startNs[conn->tail % config.depth] = startNs;
+    conn->tail++;
+    conn->outstanding++;
+    conn->queued++;
+}
+
+/**
+ * FlushRequests - Write queued requests with one vectored send.
+*/
+static int FlushRequests(LOAD_WORKER *worker, LOAD_CONN *conn)
+{
+    int i, count, ret;
+    DWORD sent = 0;
+    WSABUF bufs[SEND_BATCH];
+
+    while (conn->queued > 0)
+    {
+        count = (conn->queued < SEND_BATCH) ? conn->queued : SEND_BATCH;
+
+        for (i = 0; i < count; i++)
+        {
+            bufs[i].buf = worker->message;
+            bufs[i].len = config.frameSize;
+        }
+
+        bufs[0].buf += conn->sendOffset;
+        bufs[0].len -= conn->sendOffset;
+
+        ret = WSASend(conn->fd, bufs, count, &sent, 0, NULL, NULL);
+
+        if (SOCKET_ERROR == ret)
+        {
+            if (WSAEWOULDBLOCK == WSAGetLastError())
+                return 0;
+
+            return -1;
+        }
+
+        /* Account written bytes against the queued requests. */
+        sent += conn->sendOffset;
+        conn->queued    -= sent / config.frameSize;
+        conn->sendOffset = sent % config.frameSize;
+
+        if (sent < (DWORD)count * config.frameSize)
+            return 0;
+    }
+
+    return 0;
+}
+
+/**
+ * CompleteRequests - Match replies against the oldest outstanding requests.
+*/
+static int CompleteRequests(LOAD_WORKER *worker, LOAD_CONN *conn, int replies, ULONGLONG now)
+{
+    ULONGLONG startNs;
+
+    if (replies > conn->outstanding)
+    {
+        /* More replies than requests, the server is broken. */
+        worker->errors += replies - conn->outstanding;
+        replies = conn->outstanding;
+    }
+
+    while (replies-- > 0)
+    {
+        startNs = conn->startNs[conn->head % config.depth];
+        conn->head++;
+        conn->outstanding--;
+
+        if (now >= measureStartNs && now < measureEndNs)
+        {
+            worker->hist.record(now - startNs);
+            worker->requests++;
+            worker->bytes += config.msgSize;
+        }
+
+        /* Closed loop: a reply immediately releases the next request. */
+        if (0 == config.rate && !conn->scanner.goaway)
+            EnqueueRequest(conn, now);
+    }
+
+    return 0;
+}
+
+/**
+ * OpenConnection - Connect connection i of the worker and prime it.
+*/
+static int OpenConnection(LOAD_WORKER *worker, int i, ULONGLONG now)
+{
+    char port[8];
+    LOAD_CONN *conn = &worker->conns[i];
+
+    snprintf(port, sizeof(port), "%d", atoi(config.port) + (i * config.threads + worker->id) % config.ports);
+
+    conn->fd = ConnectServer(config.host, port);
+    frame_scanner_init(&conn->scanner);
+
+    if (INVALID_SOCKET == conn->fd)
+        return -1;
+
+    if (0 == config.rate)
+    {
+        for (int d = 0; d < config.depth; d++)
+            EnqueueRequest(conn, now);
+    }
+
+    return 0;
+}
+
+/**
+ * LoadWorker - Drive a group of connections with WSAPoll.
+*/
+DWORD WINAPI
+LoadWorker(LPVOID lpParam)
+{
+    int i, ret, replies;
+    int timeout, polled;
+    ULONGLONG now, interval = 0;
+    LOAD_WORKER *worker = (LOAD_WORKER *)lpParam;
+    WSAPOLLFD *pfds = NULL;
+    LOAD_CONN *conn;
+
+    pfds = (WSAPOLLFD *)calloc(worker->connCount, sizeof(WSAPOLLFD));
+    if (NULL == pfds)
+    {
+        printf("Worker %d: out of memory.\n", worker->id);
+        return 1;
+    }
+
+    if (0 < config.rate)
+        interval = (ULONGLONG)(1e9 * config.connections / config.rate);
+
+    /* Open connections and prime them. */
+    now = timing_now_ns();
+
+    for (i = 0; i < worker->connCount; i++)
+    {
+        conn = &worker->conns[i];
+
+        if (0 != OpenConnection(worker, i, now))
+        {
+            worker->connFailed++;
+            continue;
+        }
+
+        if (0 < config.rate)
+        {
+            /* Spread connection schedules over one interval. */
+            conn->nextDue = measureStartNs - (ULONGLONG)config.warmup * 1000000000ull +
+                            interval * (i * config.threads + worker->id) / config.connections;
+        }
+    }
+
+    timeout = (0 < config.rate) ? 0 : POLL_TIMEOUT_MS;
+
+    if (0 == config.depth)
+        timeout = IDLE_POLL_TIMEOUT_MS;
+
+    while ((now = timing_now_ns()) < measureEndNs)
+    {
+        polled = 0;
+
+        for (i = 0; i < worker->connCount; i++)
+        {
+            conn = &worker->conns[i];
+
+            /* The server restarts, requests due meanwhile wait for the new connection. */
+            if (conn->reconnect && now >= conn->retryAt)
+            {
+                if (0 == OpenConnection(worker, i, now))
+                {
+                    conn->reconnect = FALSE;
+                    worker->reconnects++;
+                }
+                else
+                {
+                    conn->retryAt = now + RECONNECT_MS * 1000000ull;
+                }
+            }
+
+            pfds[i].fd      = conn->fd;
+            pfds[i].events  = 0;
+            pfds[i].revents = 0;
+
+            if (INVALID_SOCKET == conn->fd)
+            {
+                /* Negative fd entries are ignored by WSAPoll. */
+                pfds[i].fd = INVALID_SOCKET;
+                continue;
+            }
+
+            /* Open loop: release every request whose time has come. */
+            while (0 < config.rate && now >= conn->nextDue && conn->outstanding < config.depth &&
+                   !conn->scanner.goaway)
+            {
+                EnqueueRequest(conn, conn->nextDue);
+                conn->nextDue += interval;
+            }
+
+            if (0 < conn->queued && 0 != FlushRequests(worker, conn))
+            {
+                worker->errors++;
+                closesocket(conn->fd);
+                conn->fd = INVALID_SOCKET;
+                pfds[i].fd = INVALID_SOCKET;
+                continue;
+            }
+
+            pfds[i].events = POLLRDNORM | ((0 < conn->queued) ? POLLWRNORM : 0);
+            polled++;
+        }
+
+        /* All connections wait for a reconnect. */
+        if (0 == polled)
+        {
+            Sleep((0 < timeout) ? timeout : POLL_TIMEOUT_MS);
+            continue;
+        }
+
+        ret = WSAPoll(pfds, worker->connCount, timeout);
+
+        if (SOCKET_ERROR == ret)
+        {
+            printf("Worker %d: error in WSAPoll: %d.\n", worker->id, WSAGetLastError());
+            break;
+        }
+
+        if (0 == ret)
+            continue;
+
+        now = timing_now_ns();
+
+        for (i = 0; i < worker->connCount; i++)
+        {
+            conn = &worker->conns[i];
+
+            if (0 == pfds[i].revents || INVALID_SOCKET == conn->fd)
+                continue;
+
+            if (pfds[i].revents & (POLLRDNORM | POLLERR | POLLHUP))
+            {
+                ret = recv(conn->fd, worker->recvbuf, DATA_BUFLEN, 0);
+
+                /* Replies are only counted, the payload is not needed. */
+                if (0 < ret)
+                {
+                    replies = frame_scan(&conn->scanner, worker->recvbuf, ret);
+
+                    if (0 <= replies)
+                    {
+                        CompleteRequests(worker, conn, replies, now);
+
+                        /* GOAWAY and all replies are in, the server may close now. */
+                        if (conn->scanner.goaway && 0 == conn->outstanding)
+                        {
+                            closesocket(conn->fd);
+                            conn->fd        = INVALID_SOCKET;
+                            conn->reconnect = TRUE;
+                            conn->retryAt   = now;
+                        }
+
+                        continue;
+                    }
+                }
+
+                /* Closed, bad frame or a real error. */
+                if (SOCKET_ERROR != ret || WSAEWOULDBLOCK != WSAGetLastError())
+                {
+                    worker->errors++;
+                    closesocket(conn->fd);
+                    conn->fd = INVALID_SOCKET;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < worker->connCount; i++)
+    {
+        if (INVALID_SOCKET != worker->conns[i].fd)
+        {
+            closesocket(worker->conns[i].fd);
+            worker->conns[i].fd = INVALID_SOCKET;
+        }
+    }
+
+    free(pfds);
+
+    return 0;
+}
+
+/**
+ * Usage - Show command line options.
+*/
+void Usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -h host      Server address, default %s.\n", SERVER_IP);
+    printf("  -p port      Server port, default %s.\n", SERVER_PORT);
+    printf("  -P ports     Spread connections over this many ports from -p, default 1.\n");
+    printf("  -c count     Connections, default 100.\n");
+    printf("  -t threads   Worker threads, default 4.\n");
+    printf("  -d depth     Requests in flight per connection, default 1, 0 is idle.\n");
+    printf("  -s size      Request payload in bytes, default 64, max %d.\n", FRAME_MAX_PAYLOAD);
+    printf("  -r rate      Open loop total requests/s, default 0 (closed loop).\n");
+    printf("  -T seconds   Measured duration, default 10.\n");
+    printf("  -w seconds   Warmup before measuring, default 2.\n");
+}
+
+/**
+ * ParseArgs - Parse command line options into config.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    config.host         = SERVER_IP;
+    config.port         = SERVER_PORT;
+    config.ports        = 1;
+    config.connections  = 100;
+    config.threads      = 4;
+    config.depth        = 1;
+    config.msgSize      = 64;
+    config.rate         = 0;
+    config.duration     = 10;
+    config.warmup       = 2;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'h': config.host        = argv[i + 1];       break;
+        case 'p': config.port        = argv[i + 1];       break;
+        case 'P': config.ports       = atoi(argv[i + 1]); break;
+        case 'c': config.connections = atoi(argv[i + 1]); break;
+        case 't': config.threads     = atoi(argv[i + 1]); break;
+        case 'd': config.depth       = atoi(argv[i + 1]); break;
+        case 's': config.msgSize     = atoi(argv[i + 1]); break;
+        case 'r': config.rate        = atof(argv[i + 1]); break;
+        case 'T': config.duration    = atoi(argv[i + 1]); break;
+        case 'w': config.warmup      = atoi(argv[i + 1]); break;
+        default:
+            return -1;
+        }
+    }
+
+    if (config.connections < 1 || config.threads < 1 || config.msgSize < 1 ||
+        config.depth < 0 || config.depth > MAX_DEPTH || (0 == config.depth && 0 < config.rate) ||
+        config.ports < 1 || atoi(config.port) + config.ports > 65536 || config.duration < 1 ||
+        config.warmup < 0 || config.rate < 0 || config.msgSize > FRAME_MAX_PAYLOAD)
+        return -1;
+
+    config.frameSize = FRAME_HEADER_SIZE + config.msgSize;
+
+    if (config.threads > config.connections)
+        config.threads = config.connections;
+
+    return 0;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int i, ret;
+    int status = 0;
+    int opened = 0, failed = 0;
+    double seconds;
+    WSADATA wsaData;
+    HANDLE *handles = NULL;
+    LOAD_WORKER **workers = NULL;
+    LOAD_CONN *conns = NULL;
+    ULONGLONG *startRing = NULL;
+    LatencyHistogram total;
+    FRAME_HEADER header;
+    ULONGLONG requests = 0, bytes = 0, errors = 0, reconnects = 0;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    /* Initialize Winsock. */
+    ret = WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    if (0 != ret)
+    {
+        printf("Error in WSAStartup: %d.\n", ret);
+        return -1;
+    }
+
+    handles   = (HANDLE *)calloc(config.threads, sizeof(HANDLE));
+    workers   = (LOAD_WORKER **)calloc(config.threads, sizeof(LOAD_WORKER *));
+    conns     = (LOAD_CONN *)calloc(config.connections, sizeof(LOAD_CONN));
+    startRing = (ULONGLONG *)calloc((size_t)config.connections * config.depth, sizeof(ULONGLONG));
+
+    if (NULL == handles || NULL == workers || NULL == conns || (NULL == startRing && 0 < config.depth))
+    {
+        printf("Out of memory.\n");
+        status = -1;
+        goto out_free;
+    }
+
+    for (i = 0; i < config.connections; i++)
+    {
+        conns[i].fd      = INVALID_SOCKET;
+        conns[i].startNs = startRing + (size_t)i * config.depth;
+    }
+
+    measureStartNs = timing_now_ns() + (ULONGLONG)config.warmup * 1000000000ull;
+    measureEndNs   = measureStartNs + (ULONGLONG)config.duration * 1000000000ull;
+
+    printf("Load %s:%s, %d connections, %d threads, depth %d, %d bytes, ",
+           config.host, config.port, config.connections, config.threads,
+           config.depth, config.msgSize);
+
+    if (0 == config.depth)
+        printf("idle.\n");
+    else if (0 < config.rate)
+        printf("open loop %.0f req/s.\n", config.rate);
+    else
+        printf("closed loop.\n");
+
+    /* Split connections evenly over the workers. */
+    for (i = 0; i < config.threads; i++)
+    {
+        int first = config.connections * i / config.threads;
+        int last  = config.connections * (i + 1) / config.threads;
+
+        workers[i] = new LOAD_WORKER();
+        workers[i]->id        = i;
+        workers[i]->conns     = conns + first;
+        workers[i]->connCount = last - first;
+        workers[i]->message   = (char *)malloc(config.frameSize);
+        workers[i]->recvbuf   = (char *)malloc(DATA_BUFLEN);
+
+        if (NULL == workers[i]->message || NULL == workers[i]->recvbuf)
+        {
+            printf("Out of memory.\n");
+            status = -1;
+            goto out_join;
+        }
+
+        /* Every request is the same prebuilt echo frame. */
+        header.length = config.msgSize;
+        header.type   = FRAME_TYPE_ECHO;
+        header.flags  = 0;
+
+        memcpy(workers[i]->message, &header, FRAME_HEADER_SIZE);
+        memset(workers[i]->message + FRAME_HEADER_SIZE, 'a' + (i % 26), config.msgSize);
+
+        handles[i] = CreateThread(NULL, 0, LoadWorker, workers[i], 0, NULL);
+
+        if (NULL == handles[i])
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            status = -1;
+            goto out_join;
+        }
+    }
+
+out_join:
+    for (i = 0; i < config.threads; i++)
+    {
+        if (NULL != handles[i])
+        {
+            WaitForSingleObject(handles[i], INFINITE);
+            CloseHandle(handles[i]);
+        }
+    }
+
+    for (i = 0; i < config.threads; i++)
+    {
+        if (NULL == workers[i])
+            continue;
+
+        total.merge(workers[i]->hist);
+        requests   += workers[i]->requests;
+        bytes      += workers[i]->bytes;
+        errors     += workers[i]->errors;
+        reconnects += workers[i]->reconnects;
+        opened     += workers[i]->connCount - workers[i]->connFailed;
+        failed     += workers[i]->connFailed;
+
+        free(workers[i]->message);
+        free(workers[i]->recvbuf);
+        delete workers[i];
+    }
+
+    if (0 == status)
+    {
+        seconds = (double)config.duration;
+
+        printf("\nConnections: %d opened, %d failed.\n", opened, failed);
+        printf("Requests:    %llu in %.1f s, %.0f req/s, %.2f MB/s.\n",
+               requests, seconds, requests / seconds, bytes / seconds / 1e6);
+        printf("Errors:      %llu.\n", errors);
+        printf("Reconnects:  %llu after GOAWAY.\n\n", reconnects);
+
+        if (0 < config.depth)
+            total.print("Latency", 1000.0, "us");
+    }
+
+out_free:
+    free(startRing);
+    free(conns);
+    free(workers);
+    free(handles);
+
+    WSACleanup();
+
+    return status;
+}
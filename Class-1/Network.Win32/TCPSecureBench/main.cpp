@@ -0,0 +1,439 @@
+/**
+ * Win32 encrypted tcp channel cost benchmark.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/api/bcrypt/nf-bcrypt-bcryptencrypt].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-getprocesstimes].
+ *
+ * Measures AES-128-GCM speed of the AES-NI and CNG backends, then streams
+ * frames over loopback tcp in clear text and with each backend, and
+ * reports throughput and cpu time per GB. Kernel TLS offload (Linux kTLS)
+ * does not exist on Windows and is reported as not available.
+ *
+ * License - MIT.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "framing.h"
+#include "secure.h"
+#include "timing.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+
+
+#define BENCH_MODES                             3
+#define CIPHER_SECONDS                          0.5
+#define NS_PER_SEC                              1000000000ull
+
+
+typedef struct _BENCH_SERVER {
+    SOCKET listen_fd;
+    int mode;
+    int status;
+    ULONGLONG bytes;
+    ULONGLONG frames;
+} BENCH_SERVER;
+
+typedef struct _BENCH_RESULT {
+    double mbps;
+    double cpuPercent;
+    double cpuMsPerGB;
+} BENCH_RESULT;
+
+
+int payloadSize = 16384;
+int seconds     = 5;
+
+const int modes[BENCH_MODES] = { SECURE_MODE_NONE, SECURE_MODE_AESNI, SECURE_MODE_CNG };
+
+
+/**
+ * CpuNs - User + kernel time of the whole process.
+*/
+static ULONGLONG CpuNs(void)
+{
+    FILETIME createTime, exitTime, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    GetProcessTimes(GetCurrentProcess(), &createTime, &exitTime, &kernel, &user);
+
+    k.LowPart  = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart  = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+
+    return (k.QuadPart + u.QuadPart) * 100;
+}
+
+/**
+ * CipherSpeed - GB/s of gcm_seal on one buffer size.
+*/
+double CipherSpeed(int backend, UINT32 size)
+{
+    GCM_CONTEXT ctx;
+    UINT8 key[GCM_KEY_SIZE] = { 0 };
+    UINT8 iv[GCM_IV_SIZE]   = { 0 };
+    UINT8 aad[FRAME_HEADER_SIZE] = { 0 };
+    UINT8 tag[GCM_TAG_SIZE];
+    UINT8 *data;
+    ULONGLONG start, elapsed, bytes = 0;
+
+    data = (UINT8 *)calloc(1, size);
+    if (NULL == data || 0 != gcm_init(&ctx, backend, key))
+    {
+        free(data);
+        return 0;
+    }
+
+    start = timing_now_ns();
+
+    do
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            iv[0]++;
+            gcm_seal(&ctx, iv, aad, sizeof(aad), data, size, tag);
+        }
+
+        bytes  += 64ull * size;
+        elapsed = timing_now_ns() - start;
+    } while (elapsed < (ULONGLONG)(CIPHER_SECONDS * NS_PER_SEC));
+
+    gcm_free(&ctx);
+    free(data);
+
+    return (double)bytes / elapsed;
+}
+
+/**
+ * ServerThread - Accept one connection, open every frame and count bytes.
+*/
+DWORD WINAPI
+ServerThread(LPVOID lpParam)
+{
+    int ret;
+    BENCH_SERVER *server = (BENCH_SERVER *)lpParam;
+    SOCKET client_fd;
+    FRAME_VIEW frame;
+    FRAME_READER reader;
+    SECURE_CHANNEL channel;
+    SECURE_CHANNEL *secure = NULL;
+
+    server->status = -1;
+
+    client_fd = accept(server->listen_fd, NULL, NULL);
+    if (INVALID_SOCKET == client_fd)
+    {
+        printf("Error in accept: %d.\n", WSAGetLastError());
+        return 1;
+    }
+
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+        goto out_close;
+
+    if (SECURE_MODE_NONE != server->mode)
+    {
+        if (0 != secure_server_handshake(&channel, server->mode, SECURE_DEFAULT_PSK, client_fd, &reader))
+            goto out_free;
+
+        secure = &channel;
+    }
+
+    while (0 < (ret = frame_reader_fill(&reader, client_fd)))
+    {
+        while (0 < (ret = frame_next(&reader, &frame)))
+        {
+            if (NULL != secure && 0 != secure_open(secure, &frame))
+            {
+                printf("Bad tag.\n");
+                goto out_secure;
+            }
+
+            server->bytes += frame.length;
+            server->frames++;
+        }
+
+        if (0 > ret)
+            goto out_secure;
+
+        frame_release(&reader);
+    }
+
+    /* The client closes when done. */
+    if (0 == ret)
+        server->status = 0;
+
+out_secure:
+    if (NULL != secure)
+        secure_free(secure);
+
+out_free:
+    frame_reader_free(&reader);
+
+out_close:
+    closesocket(client_fd);
+
+    return 0;
+}
+
+/**
+ * ListenLoopback - Listen on 127.0.0.1 with a system chosen port.
+*/
+SOCKET ListenLoopback(USHORT *port)
+{
+    SOCKET fd;
+    struct sockaddr_in addr;
+    int len = sizeof(addr);
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == fd)
+        return INVALID_SOCKET;
+
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+
+    if (SOCKET_ERROR == bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        SOCKET_ERROR == getsockname(fd, (struct sockaddr *)&addr, &len) ||
+        SOCKET_ERROR == listen(fd, 1))
+    {
+        printf("Error in listen: %d.\n", WSAGetLastError());
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
+
+    *port = addr.sin_port;
+
+    return fd;
+}
+
+/**
+ * StreamBench - Send frames for the configured time in one mode.
+*/
+int StreamBench(int mode, BENCH_RESULT *result)
+{
+    int i, length;
+    int status = -1;
+    int slotSize = payloadSize + SECURE_TAG_SIZE;
+    USHORT port;
+    HANDLE thrdHandle = NULL;
+    SOCKET client_fd  = INVALID_SOCKET;
+    BENCH_SERVER server;
+    FRAME_READER reader;
+    FRAME_WRITER writer;
+    SECURE_CHANNEL channel;
+    SECURE_CHANNEL *secure = NULL;
+    struct sockaddr_in addr;
+    char *plain = NULL, *slots = NULL;
+    ULONGLONG start, end, cpu, elapsed;
+
+    ZeroMemory(&server, sizeof(server));
+    server.mode = mode;
+
+    server.listen_fd = ListenLoopback(&port);
+    if (INVALID_SOCKET == server.listen_fd)
+        return -1;
+
+    plain = (char *)malloc(payloadSize);
+    slots = (char *)malloc((size_t)slotSize * FRAME_WRITER_FRAMES);
+
+    if (NULL == plain || NULL == slots || 0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+    {
+        printf("Out of memory.\n");
+        goto out_buf;
+    }
+
+    memset(plain, 'x', payloadSize);
+
+    thrdHandle = CreateThread(NULL, 0, ServerThread, &server, 0, NULL);
+    if (NULL == thrdHandle)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        goto out_reader;
+    }
+
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = port;
+
+    client_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == client_fd ||
+        SOCKET_ERROR == connect(client_fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        printf("Error in connect: %d.\n", WSAGetLastError());
+        goto out_thread;
+    }
+
+    if (SECURE_MODE_NONE != mode)
+    {
+        if (0 != secure_client_handshake(&channel, mode, SECURE_DEFAULT_PSK, client_fd, &reader))
+            goto out_thread;
+
+        secure = &channel;
+    }
+
+    start = timing_now_ns();
+    end   = start + (ULONGLONG)seconds * NS_PER_SEC;
+    cpu   = CpuNs();
+
+    /* Batches of frames, each copied in like a real payload would be. */
+    while (timing_now_ns() < end)
+    {
+        frame_writer_init(&writer);
+
+        for (i = 0; i < FRAME_WRITER_FRAMES; i++)
+        {
+            char *slot = slots + (size_t)i * slotSize;
+
+            memcpy(slot, plain, payloadSize);
+            length = payloadSize;
+
+            if (NULL != secure)
+                length = secure_seal(secure, FRAME_TYPE_ECHO, 0, slot, payloadSize);
+
+            frame_writer_add(&writer, FRAME_TYPE_ECHO, 0, slot, length);
+        }
+
+        if (0 != frame_writer_flush(&writer, client_fd))
+            goto out_thread;
+    }
+
+    shutdown(client_fd, SD_SEND);
+    WaitForSingleObject(thrdHandle, INFINITE);
+
+    elapsed = timing_now_ns() - start;
+    cpu     = CpuNs() - cpu;
+
+    if (0 == server.status)
+    {
+        result->mbps       = server.bytes * 1000.0 / elapsed;
+        result->cpuPercent = 100.0 * cpu / elapsed;
+        result->cpuMsPerGB = server.bytes ? cpu / 1e6 / (server.bytes / 1e9) : 0;
+        status = 0;
+    }
+
+out_thread:
+    if (NULL != secure)
+        secure_free(secure);
+
+    if (INVALID_SOCKET != client_fd)
+        closesocket(client_fd);
+
+    /* Unblock accept() if the client never connected. */
+    closesocket(server.listen_fd);
+    server.listen_fd = INVALID_SOCKET;
+
+    WaitForSingleObject(thrdHandle, INFINITE);
+    CloseHandle(thrdHandle);
+
+out_reader:
+    frame_reader_free(&reader);
+
+out_buf:
+    free(slots);
+    free(plain);
+
+    if (INVALID_SOCKET != server.listen_fd)
+        closesocket(server.listen_fd);
+
+    return status;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int ret;
+    WSADATA wsaData;
+    BENCH_RESULT result;
+    BOOL aesni;
+    const UINT32 sizes[] = { 64, 1024, 16384, SECURE_MAX_PAYLOAD };
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 < argc && 0 == strcmp(argv[i], "-s"))
+            payloadSize = atoi(argv[i + 1]);
+        else if (i + 1 < argc && 0 == strcmp(argv[i], "-T"))
+            seconds = atoi(argv[i + 1]);
+        else
+            payloadSize = -1;
+    }
+
+    if (payloadSize < 1 || payloadSize > SECURE_MAX_PAYLOAD || seconds < 1)
+    {
+        printf("Usage: %s [-s payload] [-T seconds]\n", argv[0]);
+        printf("  payload 1 - %d bytes, default 16384, seconds default 5.\n", SECURE_MAX_PAYLOAD);
+        return -1;
+    }
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (0 != ret)
+    {
+        printf("Error in WSAStartup: %d.\n", ret);
+        return -1;
+    }
+
+    aesni = gcm_aesni_supported();
+
+    /* AES-128-GCM alone. */
+    printf("AES-128-GCM seal, GB/s:\n");
+    printf("%-8s", "Size");
+
+    for (int m = 1; m < BENCH_MODES; m++)
+        printf(" %10s", secure_mode_name(modes[m]));
+
+    printf("\n");
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        printf("%-8u", sizes[s]);
+
+        for (int m = 1; m < BENCH_MODES; m++)
+        {
+            if (SECURE_MODE_AESNI == modes[m] && !aesni)
+                printf(" %10s", "n/a");
+            else
+                printf(" %10.2f", CipherSpeed(modes[m], sizes[s]));
+        }
+
+        printf("\n");
+    }
+
+    /* The whole channel over loopback. */
+    printf("\nLoopback stream, %d bytes payload, %d s per mode:\n", payloadSize, seconds);
+    printf("%-8s %10s %8s %12s\n", "Mode", "MB/s", "CPU %", "CPU ms/GB");
+
+    for (int m = 0; m < BENCH_MODES; m++)
+    {
+        if (SECURE_MODE_AESNI == modes[m] && !aesni)
+        {
+            printf("%-8s %10s\n", secure_mode_name(modes[m]), "n/a");
+            continue;
+        }
+
+        if (0 != StreamBench(modes[m], &result))
+        {
+            printf("%-8s %10s\n", secure_mode_name(modes[m]), "failed");
+            continue;
+        }
+
+        printf("%-8s %10.1f %8.1f %12.1f\n", secure_mode_name(modes[m]),
+               result.mbps, result.cpuPercent, result.cpuMsPerGB);
+    }
+
+    printf("%-8s %10s\n", "ktls", "n/a");
+    printf("\nKernel TLS offload (Linux kTLS, TCP_ULP) is not available on Windows.\n");
+
+    WSACleanup();
+
+    return 0;
+}
@@ -0,0 +1,609 @@
+/**
+ * Win32 coroutine tcp server example.
+ * Ref 1: [https://en.cppreference.com/w/cpp/language/coroutines].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/fileio/i-o-completion-ports].
+ *
+ * Echoes frames like TCPServerThread, but every connection is a C++20
+ * coroutine (Common/coio.h) served by a few threads of one completion
+ * port. The connection code is the same receive, answer, send loop as the
+ * thread per client server, each co_await only parks the coroutine frame.
+ *
+ * Ctrl+C closes the listening socket; a connection that sends a request
+ * after that gets GOAWAY with its replies, the ones still open at the
+ * drain deadline have their I/O cancelled.
+ *
+ * License - MIT.
+ */
+
+#undef UNICODE
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <psapi.h>
+
+#include "asynclog.h"
+#include "coio.h"
+#include "framing.h"
+#include "graceful.h"
+#include "metrics.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Psapi.lib")
+
+
+#define SERVER_IP                               "127.0.0.1"
+#define SERVER_PORT                             65533
+#define SESSION_BUFFER_SIZE                     (8 * 1024)
+#define ACCEPTS_PENDING                         16
+#define THREAD_STACK_SIZE                       (64 * 1024)
+#define STATS_INTERVAL_MS                       5000
+
+
+/* Lives in the coroutine frame of the connection. */
+typedef struct _SESSION {
+    struct _SESSION *next;
+    struct _SESSION *prev;
+    SOCKET fd;
+} SESSION;
+
+
+IoContext ioContext;
+METRICS metrics;
+GRACEFUL graceful;
+SOCKET listenFd             = INVALID_SOCKET;
+DWORD statsSlot             = TLS_OUT_OF_INDEXES;
+volatile LONG accepting     = 0;            // Accept loops still running.
+
+SRWLOCK sessionLock         = SRWLOCK_INIT;
+SESSION sessions            = { &sessions, &sessions, INVALID_SOCKET };
+
+int listenPort              = SERVER_PORT;
+int workerThreads           = 0;
+int metricsPort             = 0;
+DWORD drainMs               = GRACEFUL_DRAIN_MS;
+
+
+/**
+ * Stats - Counters of the running thread.
+ *
+ * A coroutine may resume in another thread after each co_await, so this
+ * is read again each time; TlsGetValue keeps the compiler from caching it.
+*/
+static inline METRICS_THREAD *Stats(void)
+{
+    return (METRICS_THREAD *)TlsGetValue(statsSlot);
+}
+
+/**
+ * SessionAdd - Make the connection visible to the drain.
+*/
+void SessionAdd(SESSION *session, SOCKET fd)
+{
+    session->fd = fd;
+
+    AcquireSRWLockExclusive(&sessionLock);
+
+    session->next       = &sessions;
+    session->prev       = sessions.prev;
+    sessions.prev->next = session;
+    sessions.prev       = session;
+
+    ReleaseSRWLockExclusive(&sessionLock);
+}
+
+/**
+ * SessionRemove - After this the main thread no longer uses the session.
+*/
+void SessionRemove(SESSION *session)
+{
+    AcquireSRWLockExclusive(&sessionLock);
+
+    session->prev->next = session->next;
+    session->next->prev = session->prev;
+
+    ReleaseSRWLockExclusive(&sessionLock);
+}
+
+/**
+ * ScanFrames - Length of the complete echo frames at the start of data.
+ *
+ * Return -1 on a bad frame.
+*/
+int ScanFrames(const char *data, UINT32 used, UINT32 *frames)
+{
+    UINT32 offset = 0;
+    FRAME_HEADER header;
+
+    *frames = 0;
+
+    while (used - offset >= FRAME_HEADER_SIZE)
+    {
+        memcpy(&header, data + offset, FRAME_HEADER_SIZE);
+
+        if (header.length > FRAME_MAX_PAYLOAD || FRAME_TYPE_ECHO != header.type)
+            return -1;
+
+        if (used - offset - FRAME_HEADER_SIZE < header.length)
+            break;
+
+        offset += FRAME_HEADER_SIZE + header.length;
+        (*frames)++;
+    }
+
+    return (int)offset;
+}
+
+/**
+ * Session - Serve one connection.
+ *
+ * An echo reply is the request itself, complete frames are sent back from
+ * the receive buffer. A frame larger than the buffer is echoed piece by
+ * piece as it arrives.
+*/
+CoDetached Session(SOCKET fd)
+{
+    int ret, served;
+    UINT32 used = 0;
+    UINT32 frames, left;
+    UINT64 start;
+    BOOL goaway = FALSE;
+    BOOL noDelay = TRUE;
+    FRAME_HEADER header;
+    SESSION session;
+    char buffer[SESSION_BUFFER_SIZE];
+
+    /* The pieces of a large echo must not wait for the ACK of the previous one. */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+    InterlockedIncrement(&metrics.connections);
+    Stats()->accepts++;
+    SessionAdd(&session, fd);
+
+    LOG_DEBUG("Client connected: %lld.", fd);
+
+    while (TRUE)
+    {
+        ret = co_await async_recv(fd, buffer + used, SESSION_BUFFER_SIZE - used);
+
+        if (0 == ret)
+            break;
+
+        if (SOCKET_ERROR == ret)
+        {
+            LOG_DEBUG("Error in recv: %d.", WSAGetLastError());
+            Stats()->errors++;
+            break;
+        }
+
+        start = metrics_now();
+        Stats()->bytesIn += ret;
+        used += ret;
+
+        served = ScanFrames(buffer, used, &frames);
+        if (0 > served)
+        {
+            LOG_WARN("Bad frame from client: %lld.", fd);
+            Stats()->errors++;
+            break;
+        }
+
+        if (0 == served && SESSION_BUFFER_SIZE == used)
+        {
+            /* The buffer only holds the start of a large frame. */
+            memcpy(&header, buffer, FRAME_HEADER_SIZE);
+            left = FRAME_HEADER_SIZE + header.length;
+
+            while (0 < left)
+            {
+                if (SOCKET_ERROR == co_await async_send(fd, buffer, (int)used))
+                    goto out_error;
+
+                Stats()->bytesOut += used;
+                left -= used;
+
+                if (0 == left)
+                    break;
+
+                ret = co_await async_recv(fd, buffer, (int)(left < SESSION_BUFFER_SIZE ? left : SESSION_BUFFER_SIZE));
+                if (0 >= ret)
+                    goto out_error;
+
+                Stats()->bytesIn += ret;
+                used = (UINT32)ret;
+            }
+
+            metrics_requests(&metrics, Stats(), start, 1);
+            used = 0;
+        }
+        else if (0 < served)
+        {
+            if (SOCKET_ERROR == co_await async_send(fd, buffer, served))
+                goto out_error;
+
+            Stats()->bytesOut += served;
+            metrics_requests(&metrics, Stats(), start, frames);
+
+            memmove(buffer, buffer + served, used - served);
+            used -= served;
+        }
+
+        /* Told along with the first replies after Ctrl+C. */
+        if (!goaway && graceful_stopping(&graceful))
+        {
+            goaway = TRUE;
+
+            header.length = 0;
+            header.type   = FRAME_TYPE_GOAWAY;
+            header.flags  = 0;
+
+            if (SOCKET_ERROR == co_await async_send(fd, (const char *)&header, FRAME_HEADER_SIZE))
+                goto out_error;
+        }
+    }
+
+    goto out_close;
+
+out_error:
+    LOG_DEBUG("Error in session %lld: %d.", fd, WSAGetLastError());
+    Stats()->errors++;
+
+out_close:
+    SessionRemove(&session);
+    closesocket(fd);
+
+    LOG_DEBUG("Client closed: %lld.", fd);
+    InterlockedDecrement(&metrics.connections);
+}
+
+/**
+ * AcceptLoop - Accept connections, each one starts its session.
+ *
+ * A session runs in the accepting thread until its first receive is
+ * pending, then this loop accepts the next connection.
+*/
+CoDetached AcceptLoop(void)
+{
+    SOCKET client_fd;
+
+    /* Leave the main thread. */
+    if (SOCKET_ERROR == co_await async_schedule(&ioContext))
+        goto out_end;
+
+    while (!graceful_stopping(&graceful))
+    {
+        client_fd = co_await async_accept(&ioContext, listenFd);
+
+        if (INVALID_SOCKET == client_fd)
+        {
+            if (!graceful_stopping(&graceful))
+                LOG_WARN("Error in accept: %d.", WSAGetLastError());
+
+            continue;
+        }
+
+        Session(client_fd);
+    }
+
+out_end:
+    InterlockedDecrement(&accepting);
+}
+
+/**
+ * WorkerThread - Resume the coroutines until the context is stopped.
+*/
+DWORD WINAPI
+WorkerThread(LPVOID lpParam)
+{
+    METRICS_THREAD *stats;
+
+    stats = metrics_attach(&metrics);
+    if (NULL == stats)
+    {
+        LOG_ERROR("Error in metrics_attach.");
+        return (DWORD)-1;
+    }
+
+    TlsSetValue(statsSlot, stats);
+    ioContext.run();
+
+    metrics_detach(&metrics, stats);
+
+    return 0;
+}
+
+/**
+ * DrainSessions - Wait for the clients to close, cancel the rest.
+*/
+void DrainSessions(void)
+{
+    int left;
+    ULONGLONG deadline;
+    SESSION *session;
+
+    LOG_INFO("Stopping, draining %ld connections for at most %lu ms.", metrics.connections, drainMs);
+
+    left = graceful_drain(&graceful, &metrics.connections, drainMs);
+    if (0 == left)
+    {
+        LOG_INFO("All connections drained.");
+        return;
+    }
+
+    LOG_WARN("Drain deadline, closing %d connections.", left);
+
+    /* The pending receive or send fails, the session closes itself. */
+    AcquireSRWLockShared(&sessionLock);
+
+    for (session = sessions.next; &sessions != session; session = session->next)
+        CancelIoEx((HANDLE)session->fd, NULL);
+
+    ReleaseSRWLockShared(&sessionLock);
+
+    deadline = graceful_deadline(&graceful, GRACEFUL_LEAVE_MS);
+
+    while (0 < metrics.connections && GetTickCount64() < deadline)
+        Sleep(GRACEFUL_POLL_MS);
+}
+
+/**
+ * OnStop - First Ctrl+C, the pending AcceptEx calls fail.
+*/
+void OnStop(void *context)
+{
+    closesocket(listenFd);
+}
+
+/**
+ * PrivateBytes - Committed private memory of this process.
+*/
+SIZE_T PrivateBytes(void)
+{
+    PROCESS_MEMORY_COUNTERS_EX counters;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&counters, sizeof(counters)))
+        return 0;
+
+    return counters.PrivateUsage;
+}
+
+/**
+ * ShowStats - Print the memory cost of the open connections.
+*/
+void ShowStats(SIZE_T baseline)
+{
+    LONG count       = metrics.connections;
+    SIZE_T privBytes = PrivateBytes();
+
+    LOG_INFO("Connections: %ld.", count);
+
+    if (0 < count && privBytes > baseline)
+        LOG_INFO("Private: %zu KB, %.0f bytes per connection (buffer %d bytes).",
+                 privBytes / 1024, (double)(privBytes - baseline) / count, SESSION_BUFFER_SIZE);
+}
+
+/**
+ * StartListen - Listen on the loopback address.
+*/
+SOCKET StartListen(int port)
+{
+    SOCKET server_fd;
+    struct sockaddr_in addr;
+
+    server_fd = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+    if (INVALID_SOCKET == server_fd)
+    {
+        printf("Error in socket: %d.\n", WSAGetLastError());
+        return INVALID_SOCKET;
+    }
+
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons((u_short)port);
+    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+    if (SOCKET_ERROR == bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        SOCKET_ERROR == listen(server_fd, SOMAXCONN))
+    {
+        printf("Error in listen on port %d: %d.\n", port, WSAGetLastError());
+        closesocket(server_fd);
+        return INVALID_SOCKET;
+    }
+
+    if (0 != ioContext.attach(server_fd))
+    {
+        printf("Error in attach: %d.\n", GetLastError());
+        closesocket(server_fd);
+        return INVALID_SOCKET;
+    }
+
+    return server_fd;
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'p': listenPort    = atoi(argv[i + 1]); break;
+        case 't': workerThreads = atoi(argv[i + 1]); break;
+        case 'm': metricsPort   = atoi(argv[i + 1]); break;
+        case 'D': drainMs       = 1000 * atoi(argv[i + 1]); break;
+        default:
+            return -1;
+        }
+    }
+
+    if (listenPort < 1 || listenPort > 65535 || workerThreads < 0 ||
+        metricsPort < 0 || metricsPort > 65535 || 0 > (LONG)drainMs)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int i, ret;
+    int status = 0;
+    WSADATA wsaData;
+    SYSTEM_INFO sysInfo;
+    HANDLE *threads = NULL;
+    int threadCount = 0;
+    SIZE_T baseline;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-p port] [-t threads] [-m port] [-D s]\n", argv[0]);
+        printf("  -p port      Listen port, default %d.\n", SERVER_PORT);
+        printf("  -t threads   Worker threads, default 1 per cpu.\n");
+        printf("  -m port      Serve metrics on this port, default off.\n");
+        printf("  -D seconds   Drain deadline after Ctrl+C, default %d.\n", GRACEFUL_DRAIN_MS / 1000);
+        return -1;
+    }
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (0 != ret)
+    {
+        printf("Error in WSAStartup: %d.\n", ret);
+        return -1;
+    }
+
+    /* Before any thread that logs. */
+    if (0 != log_start())
+    {
+        WSACleanup();
+        return -1;
+    }
+
+    metrics_init(&metrics, "tcp_server");
+
+    statsSlot = TlsAlloc();
+    if (TLS_OUT_OF_INDEXES == statsSlot)
+    {
+        printf("Error in TlsAlloc: %d.\n", GetLastError());
+        status = -1;
+        goto out_metrics;
+    }
+
+    if (0 != ioContext.init())
+    {
+        status = -1;
+        goto out_tls;
+    }
+
+    /* No thread blocks in a socket call, one per cpu is enough. */
+    GetSystemInfo(&sysInfo);
+    if (0 == workerThreads)
+        workerThreads = sysInfo.dwNumberOfProcessors;
+
+    if (0 != metricsPort && 0 != metrics_serve(&metrics, metricsPort))
+    {
+        status = -1;
+        goto out_context;
+    }
+
+    threads = (HANDLE *)calloc(workerThreads, sizeof(HANDLE));
+    if (NULL == threads)
+    {
+        printf("Out of memory.\n");
+        status = -1;
+        goto out_context;
+    }
+
+    for (i = 0; i < workerThreads; i++)
+    {
+        threads[i] = CreateThread(NULL, THREAD_STACK_SIZE, WorkerThread, NULL,
+                                  STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+        if (NULL == threads[i])
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            status = -1;
+            goto out_threads;
+        }
+
+        threadCount++;
+    }
+
+    listenFd = StartListen(listenPort);
+    if (INVALID_SOCKET == listenFd)
+    {
+        status = -1;
+        goto out_threads;
+    }
+
+    /* Ctrl+C from here on closes the listening socket. */
+    if (0 != graceful_init(&graceful, drainMs, OnStop, NULL))
+    {
+        closesocket(listenFd);
+        status = -1;
+        goto out_threads;
+    }
+
+    baseline = PrivateBytes();
+
+    for (i = 0; i < ACCEPTS_PENDING; i++)
+    {
+        InterlockedIncrement(&accepting);
+        AcceptLoop();
+    }
+
+    printf("Listen on port %d, %d worker threads, Ctrl+C to stop, -D %lu s drain.\n",
+           listenPort, workerThreads, drainMs / 1000);
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(graceful.stopEvent, STATS_INTERVAL_MS))
+        ShowStats(baseline);
+
+    /* The accept loops end when their AcceptEx fails. */
+    while (0 < accepting)
+        Sleep(GRACEFUL_POLL_MS);
+
+    DrainSessions();
+
+out_threads:
+    ioContext.stop(threadCount);
+
+    for (i = 0; i < threadCount; i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    free(threads);
+
+    if (graceful_stopping(&graceful))
+    {
+        log_stop();
+        printf("\nServer stopped.\n");
+        metrics_print(&metrics);
+    }
+
+    graceful_free(&graceful);
+
+out_context:
+    ioContext.free();
+
+out_tls:
+    TlsFree(statsSlot);
+
+out_metrics:
+    metrics_free(&metrics);
+    log_stop();
+    WSACleanup();
+
+    return status;
+}
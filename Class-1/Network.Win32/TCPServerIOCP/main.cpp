@@ -0,0 +1,934 @@
+/**
+ * Win32 event driven tcp server example.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/fileio/i-o-completion-ports].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsarecv].
+ *
+ * Echoes frames like TCPServerThread, but a few worker threads serve all
+ * connections from one completion port. An idle connection only has a
+ * zero byte WSARecv pending, so no buffer is locked for it; a receive
+ * buffer is borrowed from a shared pool when data arrives and returned as
+ * soon as no partial frame is left.
+ *
+ * Idle, read (partial frame) and write (blocked send) timeouts share one
+ * hierarchical timing wheel driven by a timer thread. Workers only store
+ * a new deadline; the wheel is touched when the deadline moves earlier,
+ * later deadlines are picked up when the old entry fires.
+ *
+ * Ctrl+C closes the listening sockets, then every connection is visited
+ * through the wheel: its receive is cancelled and the worker sends GOAWAY
+ * before it waits again. Clients close after their last reply; the ones
+ * still open at the drain deadline are closed like a timeout.
+ *
+ * License - MIT.
+ */
+
+#undef UNICODE
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <psapi.h>
+
+#include "asynclog.h"
+#include "bufpool.h"
+#include "framing.h"
+#include "graceful.h"
+#include "metrics.h"
+#include "timerwheel.h"
+#include "trace.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Psapi.lib")
+
+
+#define SERVER_IP                               "127.0.0.1"
+#define SERVER_PORT                             65533
+#define RECV_BUFFER_SIZE                        (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD)
+#define MAX_CONNECTIONS                         (1024 * 1024)
+#define MAX_RECV_BUFFERS                        4096
+#define THREAD_STACK_SIZE                       (64 * 1024)
+#define STATS_INTERVAL_MS                       5000
+#define TIMER_TICK_MS                           100
+#define TIMER_NEVER                             (~0ull)
+
+
+/* GOAWAY state of a connection. */
+#define GOAWAY_NONE                             0
+#define GOAWAY_PENDING                          1       // Worker sends it next.
+#define GOAWAY_SENT                             2
+
+/* Timeout kinds. */
+#define TIMEOUT_IDLE                            0       // No request.
+#define TIMEOUT_READ                            1       // Frame not complete.
+#define TIMEOUT_WRITE                           2       // Send blocked.
+#define TIMEOUT_KINDS                           3
+
+
+/**
+ * One connection, this is all an idle connection costs in user space.
+ * Only one receive is pending at a time, so only one worker touches it.
+*/
+typedef struct _CONNECTION {
+    OVERLAPPED overlapped;
+    SOCKET fd;
+    char *buffer;                       // Borrowed while a frame is incomplete.
+    UINT32 used;                        // Bytes in buffer.
+    LONG kind;                          // TIMEOUT_xxx of deadline.
+    volatile UINT64 deadline;           // Tick, may be later than timer.expires.
+    volatile LONG timedOut;
+    volatile LONG goaway;               // GOAWAY_xxx.
+    TIMER_ENTRY timer;                  // Guarded by wheelLock.
+} CONNECTION;
+
+
+HANDLE iocp                 = NULL;
+BUFFER_POOL connPool;
+BUFFER_POOL recvPool;
+METRICS metrics;
+GRACEFUL graceful;
+SOCKET *listenFds           = NULL;
+volatile LONG threadStop    = 0;   // Timer thread, accept threads on a startup error.
+
+TIMER_WHEEL timerWheel;
+SRWLOCK wheelLock           = SRWLOCK_INIT;
+volatile LONG timeouts[TIMEOUT_KINDS];
+
+int listenPort              = SERVER_PORT;
+int listenPorts             = 1;
+int workerThreads           = 0;
+int metricsPort             = 0;
+char *tracePath            = NULL;
+DWORD drainMs               = GRACEFUL_DRAIN_MS;
+DWORD timeoutMs[TIMEOUT_KINDS] = { 60000, 10000, 10000 };
+
+
+/**
+ * NowTick - Current time in wheel ticks.
+*/
+static inline UINT64 NowTick(void)
+{
+    return GetTickCount64() / TIMER_TICK_MS;
+}
+
+/**
+ * SetDeadline - Give the connection a new deadline of the given kind.
+ *
+ * A later deadline is only stored, the timer thread moves the entry when
+ * the old one fires. An earlier one must be moved in the wheel now.
+*/
+void SetDeadline(CONNECTION *conn, LONG kind)
+{
+    UINT64 deadline = TIMER_NEVER;
+
+    if (0 != timeoutMs[kind])
+        deadline = NowTick() + (timeoutMs[kind] + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+    conn->kind     = kind;
+    conn->deadline = deadline;
+
+    if (deadline < conn->timer.expires)
+    {
+        AcquireSRWLockExclusive(&wheelLock);
+
+        /* Not pending means it already fired. */
+        if (timer_pending(&conn->timer) && deadline < conn->timer.expires)
+            timer_add(&timerWheel, &conn->timer, deadline);
+
+        ReleaseSRWLockExclusive(&wheelLock);
+    }
+}
+
+/**
+ * OnTimer - An entry fired, re-arm it or time the connection out.
+ *
+ * Runs with wheelLock held, so the connection can not be closed meanwhile.
+ * Cancelling its I/O makes the worker close it.
+*/
+void OnTimer(TIMER_WHEEL *wheel, TIMER_ENTRY *entry, void *context)
+{
+    UINT64 now = *(UINT64 *)context;
+    CONNECTION *conn = CONTAINING_RECORD(entry, CONNECTION, timer);
+
+    if (conn->deadline > now)
+    {
+        timer_add(wheel, entry, conn->deadline);
+        return;
+    }
+
+    InterlockedExchange(&conn->timedOut, 1);
+    InterlockedIncrement(&timeouts[conn->kind]);
+
+    CancelIoEx((HANDLE)conn->fd, NULL);
+}
+
+/**
+ * TimerThread - Advance the wheel once per tick.
+*/
+DWORD WINAPI
+TimerThread(LPVOID lpParam)
+{
+    UINT64 now;
+
+    TRACE_THREAD("timer");
+
+    while (0 == threadStop)
+    {
+        Sleep(TIMER_TICK_MS);
+        now = NowTick();
+
+        TRACE_SCOPE("timer tick");
+
+        AcquireSRWLockExclusive(&wheelLock);
+        timer_wheel_advance(&timerWheel, now, OnTimer, &now);
+        ReleaseSRWLockExclusive(&wheelLock);
+    }
+
+    return 0;
+}
+
+/**
+ * CloseConnection - Close the socket and return all memory to the pools.
+*/
+void CloseConnection(CONNECTION *conn)
+{
+    TRACE_SCOPE("close");
+
+    /* After this the timer thread no longer uses the socket. */
+    AcquireSRWLockExclusive(&wheelLock);
+    timer_cancel(&timerWheel, &conn->timer);
+    ReleaseSRWLockExclusive(&wheelLock);
+
+    closesocket(conn->fd);
+
+    if (NULL != conn->buffer)
+        pool_put(&recvPool, conn->buffer);
+
+    pool_put(&connPool, conn);
+    InterlockedDecrement(&metrics.connections);
+}
+
+/**
+ * PostRecv - Wait for data without holding a buffer.
+*/
+int PostRecv(CONNECTION *conn)
+{
+    int ret;
+    DWORD flags = 0;
+    WSABUF buf;
+
+    buf.buf = NULL;
+    buf.len = 0;
+
+    ZeroMemory(&conn->overlapped, sizeof(conn->overlapped));
+
+    ret = WSARecv(conn->fd, &buf, 1, NULL, &flags, &conn->overlapped, NULL);
+
+    if (SOCKET_ERROR == ret && WSA_IO_PENDING != WSAGetLastError())
+        return -1;
+
+    /* A timeout or drain that came while no receive was pending could not cancel it. */
+    if (conn->timedOut || GOAWAY_PENDING == conn->goaway)
+        CancelIoEx((HANDLE)conn->fd, &conn->overlapped);
+
+    return 0;
+}
+
+/**
+ * EchoFrames - Answer all complete frames in the buffer with one send.
+ *
+ * A partial frame is moved to the start of the buffer. Latency counts
+ * from start, when the last bytes were received. The send blocks this
+ * worker while the client does not read, the write timeout ends it.
+*/
+int EchoFrames(CONNECTION *conn, METRICS_THREAD *stats, UINT64 start)
+{
+    UINT32 offset = 0;
+    UINT64 frames = 0;
+    FRAME_HEADER header;
+    FRAME_WRITER writer;
+
+    TRACE_SCOPE("echo");
+
+    frame_writer_init(&writer);
+
+    while (conn->used - offset >= FRAME_HEADER_SIZE)
+    {
+        memcpy(&header, conn->buffer + offset, FRAME_HEADER_SIZE);
+
+        if (header.length > FRAME_MAX_PAYLOAD || FRAME_TYPE_ECHO != header.type)
+        {
+            LOG_WARN("Bad frame from client: %lld.", conn->fd);
+            stats->errors++;
+            return -1;
+        }
+
+        if (conn->used - offset - FRAME_HEADER_SIZE < header.length)
+            break;
+
+        if (writer.frames >= FRAME_WRITER_FRAMES)
+        {
+            SetDeadline(conn, TIMEOUT_WRITE);
+
+            if (0 != frame_writer_flush(&writer, conn->fd))
+                return -1;
+        }
+
+        frame_writer_add(&writer, FRAME_TYPE_ECHO, header.flags,
+                         conn->buffer + offset + FRAME_HEADER_SIZE, header.length);
+
+        offset += FRAME_HEADER_SIZE + header.length;
+        frames++;
+    }
+
+    if (0 < writer.count)
+        SetDeadline(conn, TIMEOUT_WRITE);
+
+    if (0 != frame_writer_flush(&writer, conn->fd))
+        return -1;
+
+    if (0 < frames)
+    {
+        stats->bytesOut += offset;
+        metrics_requests(&metrics, stats, start, frames);
+    }
+
+    if (0 < offset)
+    {
+        memmove(conn->buffer, conn->buffer + offset, conn->used - offset);
+        conn->used -= offset;
+    }
+
+    return 0;
+}
+
+/**
+ * ReadConnection - Drain the socket after the zero byte receive completed.
+ *
+ * Return -1 if the connection is closed or broken.
+*/
+int ReadConnection(CONNECTION *conn, METRICS_THREAD *stats)
+{
+    int ret;
+    BOOL first = TRUE;
+    u_long pending;
+
+    TRACE_SCOPE("read");
+
+    while (TRUE)
+    {
+        if (SOCKET_ERROR == ioctlsocket(conn->fd, FIONREAD, &pending))
+            return -1;
+
+        /* Drained. On the first pass recv() tells if the peer closed. */
+        if (0 == pending && !first)
+            break;
+
+        if (NULL == conn->buffer)
+        {
+            conn->buffer = (char *)pool_get(&recvPool);
+
+            if (NULL == conn->buffer)
+            {
+                LOG_RATE(LOG_LEVEL_WARN, 10, "Out of receive buffers, drop client: %lld.", conn->fd);
+                stats->errors++;
+                return -1;
+            }
+        }
+
+        if (pending > RECV_BUFFER_SIZE - conn->used || 0 == pending)
+            pending = RECV_BUFFER_SIZE - conn->used;
+
+        /* The socket is blocking, but never asked for more than is there. */
+        ret = recv(conn->fd, conn->buffer + conn->used, (int)pending, 0);
+
+        if (0 >= ret)
+            return -1;
+
+        conn->used += ret;
+        first = FALSE;
+        stats->bytesIn += ret;
+
+        if (0 != EchoFrames(conn, stats, metrics_now()))
+            return -1;
+    }
+
+    /* Idle again, give the buffer back. */
+    if (0 == conn->used)
+    {
+        pool_put(&recvPool, conn->buffer);
+        conn->buffer = NULL;
+
+        SetDeadline(conn, TIMEOUT_IDLE);
+        return 0;
+    }
+
+    /* The read timeout counts from the first byte of the frame. */
+    if (TIMEOUT_READ != conn->kind)
+        SetDeadline(conn, TIMEOUT_READ);
+
+    return 0;
+}
+
+/**
+ * SendGoaway - Tell the client to send no new requests, it closes after the last reply.
+*/
+int SendGoaway(CONNECTION *conn)
+{
+    InterlockedExchange(&conn->goaway, GOAWAY_SENT);
+
+    return frame_send(conn->fd, FRAME_TYPE_GOAWAY, 0, NULL, 0);
+}
+
+/**
+ * WorkerThread - Serve completions until a NULL overlapped is posted.
+*/
+DWORD WINAPI
+WorkerThread(LPVOID lpParam)
+{
+    BOOL ok, aborted;
+    DWORD bytes;
+    ULONG_PTR key;
+    LPOVERLAPPED overlapped;
+    CONNECTION *conn;
+    METRICS_THREAD *stats;
+
+    stats = metrics_attach(&metrics);
+    if (NULL == stats)
+    {
+        LOG_ERROR("Error in metrics_attach.");
+        return (DWORD)-1;
+    }
+
+    TRACE_THREAD("worker");
+
+    while (TRUE)
+    {
+        ok = GetQueuedCompletionStatus(iocp, &bytes, &key, &overlapped, INFINITE);
+
+        if (NULL == overlapped)
+            break;
+
+        conn = CONTAINING_RECORD(overlapped, CONNECTION, overlapped);
+        aborted = !ok && ERROR_OPERATION_ABORTED == GetLastError();
+
+        if ((!ok && !aborted) || conn->timedOut)
+        {
+            CloseConnection(conn);
+            continue;
+        }
+
+        /* A receive cancelled by the drain only asks for the GOAWAY. */
+        if ((GOAWAY_PENDING == conn->goaway && 0 != SendGoaway(conn)) ||
+            (ok && 0 != ReadConnection(conn, stats)) || 0 != PostRecv(conn))
+            CloseConnection(conn);
+    }
+
+    metrics_detach(&metrics, stats);
+
+    return 0;
+}
+
+/**
+ * AcceptThread - Accept on one port and hand connections to the port.
+*/
+DWORD WINAPI
+AcceptThread(LPVOID lpParam)
+{
+    SOCKET server_fd = (SOCKET)lpParam;
+    SOCKET client_fd;
+    CONNECTION *conn;
+    METRICS_THREAD *stats;
+
+    stats = metrics_attach(&metrics);
+    if (NULL == stats)
+    {
+        LOG_ERROR("Error in metrics_attach.");
+        return (DWORD)-1;
+    }
+
+    TRACE_THREAD("accept");
+
+    while (TRUE)
+    {
+        client_fd = accept(server_fd, NULL, NULL);
+
+        if (INVALID_SOCKET == client_fd)
+        {
+            /* Closed by OnStop, or by StopThreads. */
+            if (graceful_stopping(&graceful) || 0 != threadStop)
+                break;
+
+            LOG_RATE(LOG_LEVEL_ERROR, 10, "Error in accept: %d.", WSAGetLastError());
+            stats->errors++;
+            continue;
+        }
+
+        stats->accepts++;
+        TRACE_INSTANT("accept");
+
+        conn = (CONNECTION *)pool_get(&connPool);
+
+        if (NULL == conn)
+        {
+            LOG_RATE(LOG_LEVEL_WARN, 10, "Too many connections.");
+            closesocket(client_fd);
+            stats->errors++;
+            continue;
+        }
+
+        ZeroMemory(conn, sizeof(*conn));
+        conn->fd = client_fd;
+        timer_init(&conn->timer);
+
+        InterlockedIncrement(&metrics.connections);
+
+        /* timer.expires is 0, this only stores the deadline. */
+        SetDeadline(conn, TIMEOUT_IDLE);
+
+        AcquireSRWLockExclusive(&wheelLock);
+        timer_add(&timerWheel, &conn->timer, conn->deadline);
+        ReleaseSRWLockExclusive(&wheelLock);
+
+        if (NULL == CreateIoCompletionPort((HANDLE)client_fd, iocp, 0, 0) || 0 != PostRecv(conn))
+        {
+            LOG_RATE(LOG_LEVEL_ERROR, 10, "Error in PostRecv from client: %lld.", client_fd);
+            stats->errors++;
+            CloseConnection(conn);
+        }
+    }
+
+    metrics_detach(&metrics, stats);
+
+    return 0;
+}
+
+/**
+ * OnDrain - Wheel visitor, have the worker send GOAWAY.
+*/
+void OnDrain(TIMER_WHEEL *wheel, TIMER_ENTRY *entry, void *context)
+{
+    CONNECTION *conn = CONTAINING_RECORD(entry, CONNECTION, timer);
+
+    if (GOAWAY_NONE == InterlockedCompareExchange(&conn->goaway, GOAWAY_PENDING, GOAWAY_NONE))
+        CancelIoEx((HANDLE)conn->fd, &conn->overlapped);
+}
+
+/**
+ * OnDeadline - Wheel visitor, close the connection like a timeout.
+*/
+void OnDeadline(TIMER_WHEEL *wheel, TIMER_ENTRY *entry, void *context)
+{
+    CONNECTION *conn = CONTAINING_RECORD(entry, CONNECTION, timer);
+
+    InterlockedExchange(&conn->timedOut, 1);
+    CancelIoEx((HANDLE)conn->fd, NULL);
+}
+
+/**
+ * DrainConnections - GOAWAY to every connection, wait for the clients to close.
+*/
+void DrainConnections(void)
+{
+    int left;
+    UINT32 count;
+    ULONGLONG deadline;
+
+    /* The wheel lock keeps the connections from closing meanwhile. */
+    AcquireSRWLockExclusive(&wheelLock);
+    count = timer_wheel_foreach(&timerWheel, OnDrain, NULL);
+    ReleaseSRWLockExclusive(&wheelLock);
+
+    LOG_INFO("Stopping, draining %u connections for at most %lu ms.", count, drainMs);
+
+    left = graceful_drain(&graceful, &metrics.connections, drainMs);
+    if (0 == left)
+    {
+        LOG_INFO("All connections drained.");
+        return;
+    }
+
+    LOG_WARN("Drain deadline, closing %d connections.", left);
+
+    AcquireSRWLockExclusive(&wheelLock);
+    timer_wheel_foreach(&timerWheel, OnDeadline, NULL);
+    ReleaseSRWLockExclusive(&wheelLock);
+
+    /* Workers still use the connections, give them time to close. */
+    deadline = graceful_deadline(&graceful, GRACEFUL_LEAVE_MS);
+
+    while (0 < metrics.connections && GetTickCount64() < deadline)
+        Sleep(GRACEFUL_POLL_MS);
+}
+
+/**
+ * OnStop - First Ctrl+C, the blocked accept() calls fail.
+*/
+void OnStop(void *context)
+{
+    for (int i = 0; i < listenPorts; i++)
+    {
+        if (INVALID_SOCKET != listenFds[i])
+            closesocket(listenFds[i]);
+    }
+}
+
+/**
+ * PrivateBytes - Committed private memory of this process.
+*/
+SIZE_T PrivateBytes(void)
+{
+    PROCESS_MEMORY_COUNTERS_EX counters;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&counters, sizeof(counters)))
+        return 0;
+
+    return counters.PrivateUsage;
+}
+
+/**
+ * StopThreads - Join the threads started before a startup error.
+ *
+ * The cleanup frees what they use, they must be gone first. Accept
+ * threads fail on their closed socket, each worker gets a NULL
+ * completion.
+*/
+void StopThreads(HANDLE *threads, int threadCount)
+{
+    InterlockedExchange(&threadStop, 1);
+
+    for (int i = 0; i < listenPorts; i++)
+    {
+        if (INVALID_SOCKET != listenFds[i])
+            closesocket(listenFds[i]);
+
+        listenFds[i] = INVALID_SOCKET;
+    }
+
+    for (int i = 0; i < threadCount && i < workerThreads; i++)
+        PostQueuedCompletionStatus(iocp, 0, 0, NULL);
+
+    for (int i = 0; i < threadCount; i++)
+        WaitForSingleObject(threads[i], INFINITE);
+}
+
+/**
+ * ShowStats - Print the memory cost of the open connections.
+*/
+void ShowStats(SIZE_T baseline)
+{
+    LONG count       = metrics.connections;
+    SIZE_T privBytes = PrivateBytes();
+
+    TRACE_COUNTER("connections", count);
+    TRACE_COUNTER("recv buffers", recvPool.inUse);
+
+    LOG_INFO("Connections: %ld, recv buffers: %ld in use, %ld peak, %zu KB committed.",
+             count, recvPool.inUse, recvPool.peakInUse, pool_committed(&recvPool) / 1024);
+
+    if (0 < count && privBytes > baseline)
+        LOG_INFO("Private: %zu KB, %.0f bytes per connection (object %zu bytes).",
+                 privBytes / 1024, (double)(privBytes - baseline) / count, sizeof(CONNECTION));
+
+    LOG_INFO("Timeouts: %ld idle, %ld read, %ld write, %u timers pending.",
+             timeouts[TIMEOUT_IDLE], timeouts[TIMEOUT_READ], timeouts[TIMEOUT_WRITE], timerWheel.count);
+}
+
+/**
+ * StartListen - Listen on one port of the loopback address.
+*/
+SOCKET StartListen(int port)
+{
+    SOCKET server_fd;
+    struct sockaddr_in addr;
+
+    server_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == server_fd)
+    {
+        printf("Error in socket: %d.\n", WSAGetLastError());
+        return INVALID_SOCKET;
+    }
+
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons((u_short)port);
+    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+    if (SOCKET_ERROR == bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        SOCKET_ERROR == listen(server_fd, SOMAXCONN))
+    {
+        printf("Error in listen on port %d: %d.\n", port, WSAGetLastError());
+        closesocket(server_fd);
+        return INVALID_SOCKET;
+    }
+
+    return server_fd;
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'p': listenPort    = atoi(argv[i + 1]); break;
+        case 'P': listenPorts   = atoi(argv[i + 1]); break;
+        case 't': workerThreads = atoi(argv[i + 1]); break;
+        case 'I': timeoutMs[TIMEOUT_IDLE]  = 1000 * atoi(argv[i + 1]); break;
+        case 'R': timeoutMs[TIMEOUT_READ]  = 1000 * atoi(argv[i + 1]); break;
+        case 'W': timeoutMs[TIMEOUT_WRITE] = 1000 * atoi(argv[i + 1]); break;
+        case 'm': metricsPort   = atoi(argv[i + 1]); break;
+        case 'D': drainMs       = 1000 * atoi(argv[i + 1]); break;
+        case 'x': tracePath     = argv[i + 1]; break;
+        default:
+            return -1;
+        }
+    }
+
+    if (listenPort < 1 || listenPorts < 1 || listenPort + listenPorts > 65536 || workerThreads < 0 ||
+        metricsPort < 0 || metricsPort > 65535 || 0 > (LONG)drainMs)
+        return -1;
+
+    for (int k = 0; k < TIMEOUT_KINDS; k++)
+    {
+        if (0 > (LONG)timeoutMs[k])
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int i, ret;
+    int status = 0;
+    WSADATA wsaData;
+    SYSTEM_INFO sysInfo;
+    HANDLE thrdHandle;
+    HANDLE *threads = NULL;
+    int threadCount = 0;
+    SIZE_T baseline;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-p port] [-P ports] [-t threads] [-I s] [-R s] [-W s] [-m port] [-D s] [-x file]\n", argv[0]);
+        printf("  -p port      First listen port, default %d.\n", SERVER_PORT);
+        printf("  -P ports     Listen on this many ports from -p, default 1.\n");
+        printf("  -t threads   Worker threads, default 2 per cpu.\n");
+        printf("  -I seconds   Idle timeout, default 60, 0 is off.\n");
+        printf("  -R seconds   Timeout to complete a frame, default 10, 0 is off.\n");
+        printf("  -W seconds   Timeout of a blocked send, default 10, 0 is off.\n");
+        printf("  -m port      Serve metrics on this port, default off.\n");
+        printf("  -D seconds   Drain deadline after Ctrl+C, default %d.\n", GRACEFUL_DRAIN_MS / 1000);
+        printf("  -x file      Write a Chrome trace of the handlers at the end, default off.\n");
+        return -1;
+    }
+
+    ret = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (0 != ret)
+    {
+        printf("Error in WSAStartup: %d.\n", ret);
+        return -1;
+    }
+
+    /* Before any thread that logs. */
+    if (0 != log_start())
+    {
+        WSACleanup();
+        return -1;
+    }
+
+    metrics_init(&metrics, "tcp_server");
+    metrics_value(&metrics, "recv_buffers", "gauge", "Receive buffers in use.", &recvPool.inUse);
+    metrics_value(&metrics, "idle_timeouts_total", "counter", "Connections closed idle.", &timeouts[TIMEOUT_IDLE]);
+    metrics_value(&metrics, "read_timeouts_total", "counter", "Frames not completed in time.", &timeouts[TIMEOUT_READ]);
+    metrics_value(&metrics, "write_timeouts_total", "counter", "Sends blocked too long.", &timeouts[TIMEOUT_WRITE]);
+
+    if (0 != pool_init(&connPool, sizeof(CONNECTION), MAX_CONNECTIONS) ||
+        0 != pool_init(&recvPool, RECV_BUFFER_SIZE, MAX_RECV_BUFFERS))
+    {
+        status = -1;
+        goto out_pool;
+    }
+
+    /* Workers blocked in send let the port release another one. */
+    GetSystemInfo(&sysInfo);
+    if (0 == workerThreads)
+        workerThreads = 2 * sysInfo.dwNumberOfProcessors;
+
+    timer_wheel_init(&timerWheel, NowTick());
+
+    if (0 != metricsPort && 0 != metrics_serve(&metrics, metricsPort))
+    {
+        status = -1;
+        goto out_pool;
+    }
+
+    /* Workers, the timer thread, then the accept threads. */
+    threads   = (HANDLE *)calloc(workerThreads + 1 + listenPorts, sizeof(HANDLE));
+    listenFds = (SOCKET *)calloc(listenPorts, sizeof(SOCKET));
+    if (NULL == threads || NULL == listenFds)
+    {
+        printf("Out of memory.\n");
+        status = -1;
+        goto out_pool;
+    }
+
+    for (i = 0; i < listenPorts; i++)
+        listenFds[i] = INVALID_SOCKET;
+
+    iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (NULL == iocp)
+    {
+        printf("Error in CreateIoCompletionPort: %d.\n", GetLastError());
+        status = -1;
+        goto out_pool;
+    }
+
+    /* Before the threads, their first events name them. */
+    if (NULL != tracePath)
+        trace_start();
+
+    for (i = 0; i < workerThreads; i++)
+    {
+        thrdHandle = CreateThread(NULL, THREAD_STACK_SIZE, WorkerThread, NULL,
+                                  STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+        if (NULL == thrdHandle)
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            StopThreads(threads, threadCount);
+            status = -1;
+            goto out_port;
+        }
+
+        threads[threadCount++] = thrdHandle;
+    }
+
+    thrdHandle = CreateThread(NULL, THREAD_STACK_SIZE, TimerThread, NULL,
+                              STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+    if (NULL == thrdHandle)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        StopThreads(threads, threadCount);
+        status = -1;
+        goto out_port;
+    }
+
+    threads[threadCount++] = thrdHandle;
+
+    for (i = 0; i < listenPorts; i++)
+    {
+        listenFds[i] = StartListen(listenPort + i);
+        if (INVALID_SOCKET == listenFds[i])
+        {
+            StopThreads(threads, threadCount);
+            status = -1;
+            goto out_listen;
+        }
+
+        thrdHandle = CreateThread(NULL, THREAD_STACK_SIZE, AcceptThread, (LPVOID)listenFds[i],
+                                  STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+        if (NULL == thrdHandle)
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            StopThreads(threads, threadCount);
+            status = -1;
+            goto out_listen;
+        }
+
+        threads[threadCount++] = thrdHandle;
+    }
+
+    /* Ctrl+C from here on closes the listening sockets. */
+    if (0 != graceful_init(&graceful, drainMs, OnStop, NULL))
+    {
+        StopThreads(threads, threadCount);
+        status = -1;
+        goto out_listen;
+    }
+
+    printf("Server startup!\n");
+    printf("Server address: %s, Port: %d-%d, %d workers.\n",
+           SERVER_IP, listenPort, listenPort + listenPorts - 1, workerThreads);
+    printf("Timeouts: idle %lu s, read %lu s, write %lu s.\n", timeoutMs[TIMEOUT_IDLE] / 1000,
+           timeoutMs[TIMEOUT_READ] / 1000, timeoutMs[TIMEOUT_WRITE] / 1000);
+    if (0 != metricsPort)
+        printf("Metrics: http://%s:%d/metrics.\n", SERVER_IP, metricsPort);
+    printf("Press CTRL+C to stop, connections are drained for %lu s.\n", drainMs / 1000);
+
+    /* Everything above is fixed cost, the rest is per connection. */
+    baseline = PrivateBytes();
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(graceful.stopEvent, STATS_INTERVAL_MS))
+        ShowStats(baseline);
+
+    /* Accept threads first, no connection is added after this. */
+    for (i = workerThreads + 1; i < threadCount; i++)
+        WaitForSingleObject(threads[i], INFINITE);
+
+    DrainConnections();
+
+    InterlockedExchange(&threadStop, 1);
+
+    for (i = 0; i < workerThreads; i++)
+        PostQueuedCompletionStatus(iocp, 0, 0, NULL);
+
+    for (i = 0; i < workerThreads + 1; i++)
+        WaitForSingleObject(threads[i], INFINITE);
+
+    ShowStats(baseline);
+
+    /* Final stats after the last log line. */
+    log_stop();
+
+    printf("\nServer stopped.\n");
+    metrics_print(&metrics);
+
+    if (NULL != tracePath)
+    {
+        trace_stop();
+        trace_export(tracePath);
+    }
+
+    graceful_free(&graceful);
+
+out_listen:
+    /* On error only, otherwise OnStop closed them. */
+    for (i = 0; !graceful_stopping(&graceful) && i < listenPorts; i++)
+    {
+        if (INVALID_SOCKET != listenFds[i])
+            closesocket(listenFds[i]);
+    }
+
+out_port:
+    for (i = 0; i < threadCount; i++)
+        CloseHandle(threads[i]);
+
+    CloseHandle(iocp);
+
+out_pool:
+    free(threads);
+    free(listenFds);
+
+    log_stop();
+    metrics_free(&metrics);
+    pool_destroy(&recvPool);
+    pool_destroy(&connPool);
+
+    WSACleanup();
+
+    return status;
+}
@@ -15,71 +15,650 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
+#include "asynclog.h"
+#include "fileserve.h"
+#include "framing.h"
+#include "graceful.h"
+#include "metrics.h"
+#include "secure.h"
+#include "shmring.h"
+
 
 #pragma comment(lib, "Ws2_32.lib")
 
 
-#define DATA_BUFLEN                             512
+#define UNKNOWN_TYPE                            "Unknown frame type."
 #define SERVER_IP                               "127.0.0.1"
 #define SERVER_PORT                             "65533"
 
 
+int secureMode          = SECURE_MODE_NONE;
+const char *securePsk   = SECURE_DEFAULT_PSK;
+int fileMode            = FILE_SERVE_ZEROCOPY;
+const char *fileRoot    = NULL;
+int metricsPort         = 0;
+DWORD drainMs           = GRACEFUL_DRAIN_MS;
+const char *shmName     = NULL;
+
+
 /**
- * ClientHandler - TCP Client Thread working function.
+ * A connection, on the stack of its ClientHandler thread. The main thread
+ * finds it here to send GOAWAY and to close it at the drain deadline.
 */
-DWORD WINAPI
-ClientHandler(LPVOID lpParam)
+typedef struct _SESSION {
+    struct _SESSION *next;
+    struct _SESSION *prev;
+    SOCKET fd;
+    SHM_CHANNEL *shm;                   // Shared memory client, fd is not used.
+    INT64 id;                           // For the log: the socket or the channel serial.
+    SRWLOCK lock;                       // Held while a batch is served.
+    SECURE_CHANNEL *secure;
+    BOOL goaway;                        // Guarded by lock.
+    volatile LONG closed;               // Whoever sets it closes the socket.
+} SESSION;
+
+
+METRICS metrics;
+GRACEFUL graceful;
+SHM_LISTENER shmListener;
+
+SRWLOCK sessionLock     = SRWLOCK_INIT;
+SESSION sessions;                       // List head.
+
+
+/**
+ * SessionFlush - Send the queued replies on the transport of the session.
+*/
+int SessionFlush(SESSION *session, FRAME_WRITER *writer)
 {
-    int ret                         = -1;
-    int status                      = 0;
-    char recvbuf[DATA_BUFLEN + 1]   = { 0 };
-    SOCKET client_fd                = *(SOCKET *)lpParam;
+    if (NULL != session->shm)
+        return shm_writer_flush(session->shm, writer);
+
+    return frame_writer_flush(writer, session->fd);
+}
+
+/**
+ * SessionSend - Send a single frame on the transport of the session.
+*/
+int SessionSend(SESSION *session, UINT16 type, UINT16 flags, const char *payload, UINT32 length)
+{
+    if (NULL != session->shm)
+        return shm_frame_send(session->shm, type, flags, payload, length);
+
+    return frame_send(session->fd, type, flags, payload, length);
+}
+
+/**
+ * ReplyError - Send an error frame right away, after the queued replies.
+*/
+int ReplyError(SESSION *session, FRAME_WRITER *writer, UINT16 flags)
+{
+    int length = (int)strlen(UNKNOWN_TYPE);
+    char payload[sizeof(UNKNOWN_TYPE) + SECURE_TAG_SIZE];
+    SECURE_CHANNEL *secure = session->secure;
+
+    /* Keep the order the frames were sealed in. */
+    if (0 != SessionFlush(session, writer))
+        return -1;
+
+    memcpy(payload, UNKNOWN_TYPE, length);
+
+    if (NULL != secure)
+        length = secure_seal(secure, FRAME_TYPE_ERROR, flags, payload, length);
+
+    if (0 > length)
+        return -1;
+
+    return SessionSend(session, FRAME_TYPE_ERROR, flags, payload, length);
+}
+
+/**
+ * ReplyFrame - Queue the reply of one frame, flush first if the batch is full.
+ *
+ * An encrypted echo is sealed in place, its tag goes where the tag of the
+ * request was.
+*/
+int ReplyFrame(SESSION *session, FRAME_WRITER *writer, FRAME_VIEW *frame)
+{
+    int length = (int)frame->length;
+    SECURE_CHANNEL *secure = session->secure;
+
+    if (FRAME_TYPE_ECHO != frame->type)
+        return ReplyError(session, writer, frame->flags);
+
+    if (writer->frames >= FRAME_WRITER_FRAMES && 0 != SessionFlush(session, writer))
+        return -1;
+
+    if (NULL != secure)
+        length = secure_seal(secure, FRAME_TYPE_ECHO, frame->flags, frame->payload, frame->length);
+
+    if (0 > length)
+        return -1;
+
+    return frame_writer_add(writer, FRAME_TYPE_ECHO, frame->flags, frame->payload, length);
+}
+
+/**
+ * SendGoaway - Tell the client to send no new requests, once.
+ *
+ * The caller holds session->lock, so the frame does not cut into a batch
+ * and is sealed in the order it is sent.
+*/
+int SendGoaway(SESSION *session)
+{
+    int length = 0;
+    char tag[SECURE_TAG_SIZE];
+
+    if (session->goaway)
+        return 0;
+
+    session->goaway = TRUE;
+
+    if (NULL != session->secure)
+        length = secure_seal(session->secure, FRAME_TYPE_GOAWAY, 0, tag, 0);
+
+    if (0 > length)
+        return -1;
+
+    return SessionSend(session, FRAME_TYPE_GOAWAY, 0, tag, length);
+}
+
+/**
+ * SessionAdd - Make the connection visible to the drain.
+ *
+ * Either the drain sees it or it sees the server stopping, a connection
+ * accepted just before the stop gets its GOAWAY here. Only the thread of
+ * the session waits if this send blocks, the drain never waits for the
+ * lock of a session.
+*/
+void SessionAdd(SESSION *session)
+{
+    AcquireSRWLockExclusive(&sessionLock);
+
+    session->next       = &sessions;
+    session->prev       = sessions.prev;
+    sessions.prev->next = session;
+    sessions.prev       = session;
+
+    ReleaseSRWLockExclusive(&sessionLock);
+
+    if (graceful_stopping(&graceful))
+    {
+        AcquireSRWLockExclusive(&session->lock);
+        SendGoaway(session);
+        ReleaseSRWLockExclusive(&session->lock);
+    }
+}
+
+/**
+ * SessionRemove - After this the main thread no longer uses the session.
+*/
+void SessionRemove(SESSION *session)
+{
+    AcquireSRWLockExclusive(&sessionLock);
+
+    session->prev->next = session->next;
+    session->next->prev = session->prev;
+
+    ReleaseSRWLockExclusive(&sessionLock);
+}
+
+/**
+ * ServeFrames - Answer all complete frames received, flush the replies.
+*/
+int ServeFrames(SESSION *session, FRAME_READER *reader, FRAME_WRITER *writer,
+                FILE_SERVER *fileServer, METRICS_THREAD *stats)
+{
+    int ret;
+    FRAME_VIEW frame;
+    SECURE_CHANNEL *secure = session->secure;
+
+    /* Latency counts from the receive to the reply of the batch. */
+    UINT64 start  = metrics_now();
+    UINT64 frames = 0;
+
+    /* Payloads are used in place, straight from the ring. */
+    while (0 < (ret = frame_next(reader, &frame)))
+    {
+        frames++;
+
+        if (NULL != secure && 0 != secure_open(secure, &frame))
+        {
+            LOG_WARN("Bad tag from client: %lld.", session->id);
+            stats->errors++;
+            return -1;
+        }
+
+        /* Queued replies go out before the file, files need a socket. */
+        if (FRAME_TYPE_FILE_GET == frame.type && NULL == session->shm)
+        {
+            if (0 != SessionFlush(session, writer) ||
+                0 != file_serve(fileServer, session->fd, secure, &frame))
+                return -1;
+
+            continue;
+        }
+
+        /* Show receive data, compiled in with LOG_LEVEL_DEBUG only. */
+        LOG_DEBUG("Received: %.*s", (int)frame.length, frame.payload);
+
+        /* Sealed in place, the reply has the size of the request. */
+        stats->bytesOut += FRAME_HEADER_SIZE + frame.length;
+
+        if (0 != ReplyFrame(session, writer, &frame))
+            return -1;
+    }
+
+    if (0 > ret)
+    {
+        LOG_WARN("Bad frame from client: %lld.", session->id);
+        stats->errors++;
+        return -1;
+    }
+
+    if (0 != SessionFlush(session, writer))
+    {
+        stats->errors++;
+        return -1;
+    }
+
+    metrics_requests(&metrics, stats, start, frames);
+
+    /* Replies are sent, the frames can be overwritten now. */
+    frame_release(reader);
+
+    return 0;
+}
+
+/**
+ * RunSession - Receive and answer until the peer shuts down the connection.
+ *
+ * Every receive may carry many pipelined frames or only a part of one,
+ * all complete frames are answered with a single vectored send. Also
+ * runs while draining.
+*/
+int RunSession(SESSION *session, FRAME_READER *reader, FRAME_WRITER *writer,
+               FILE_SERVER *fileServer, METRICS_THREAD *stats)
+{
+    int ret;
+    int status = 0;
 
-    /* Receive until the peer shuts down the connection. */
     do
     {
-        ret = recv(client_fd, recvbuf, DATA_BUFLEN, 0);
+        if (NULL != session->shm)
+            ret = shm_reader_fill(session->shm, reader);
+        else
+            ret = frame_reader_fill(reader, session->fd);
+
         if (0 < ret)
         {
-            /* Echo the buffer back to the sender. */
-            if (SOCKET_ERROR == send(client_fd, "OK", 2, 0))
+            stats->bytesIn += ret;
+
+            AcquireSRWLockExclusive(&session->lock);
+            ret = ServeFrames(session, reader, writer, fileServer, stats);
+
+            /* The drain skips a busy session, the GOAWAY goes after the batch. */
+            if (0 == ret && graceful_stopping(&graceful))
+                ret = SendGoaway(session);
+
+            ReleaseSRWLockExclusive(&session->lock);
+
+            if (0 != ret)
             {
-                printf("Error in send: %d.\n", WSAGetLastError());
                 status = -1;
                 break;
             }
 
-            /* Show receive data. */
-            recvbuf[ret] = 0;
-            printf("Received: %s\n", recvbuf);
+            ret = 1;
         }
         else if (0 == ret)
         {
-            printf("Client %lld will close...\n", client_fd);
+            LOG_INFO("Client %lld will close...", session->id);
             break;
         }
         else
         {
-            printf("Error in recv: %d.\n", WSAGetLastError());
+            if (0 == session->closed)
+            {
+                LOG_ERROR("Error in recv: %d.", WSAGetLastError());
+                stats->errors++;
+            }
+
             status = -1;
             break;
         }
     } while (0 < ret);
 
+    return status;
+}
+
+/**
+ * ClientHandler - TCP Client Thread working function.
+*/
+DWORD WINAPI
+ClientHandler(LPVOID lpParam)
+{
+    int ret                         = -1;
+    int status                      = 0;
+    SOCKET client_fd                = (SOCKET)lpParam;
+
+    SESSION session;
+    FRAME_READER reader;
+    FRAME_WRITER writer;
+    FILE_SERVER fileServer;
+    SECURE_CHANNEL channel;
+    METRICS_THREAD *stats           = NULL;
+
+    ZeroMemory(&session, sizeof(session));
+    session.fd = client_fd;
+    session.id = (INT64)client_fd;
+    InitializeSRWLock(&session.lock);
+
+    stats = metrics_attach(&metrics);
+    if (NULL == stats)
+    {
+        LOG_ERROR("Error in metrics_attach from client: %lld.", client_fd);
+        status = -1;
+        goto out_close;
+    }
+
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+    {
+        LOG_ERROR("Error in frame_reader_init from client: %lld.", client_fd);
+        status = -1;
+        goto out_close;
+    }
+
+    frame_writer_init(&writer);
+    file_server_init(&fileServer, client_fd, fileRoot, fileMode);
+
+    if (SECURE_MODE_NONE != secureMode)
+    {
+        if (0 != secure_server_handshake(&channel, secureMode, securePsk, client_fd, &reader))
+        {
+            LOG_WARN("Handshake failed with client: %lld.", client_fd);
+            stats->errors++;
+            status = -1;
+            goto out_free;
+        }
+
+        session.secure = &channel;
+    }
+
+    SessionAdd(&session);
+
+    status = RunSession(&session, &reader, &writer, &fileServer, stats);
+
+    SessionRemove(&session);
+
     /* shutdown the connection since we're done. */
-    ret = shutdown(client_fd, SD_BOTH);
-    if (SOCKET_ERROR == ret)
+    if (0 == status && 0 == session.closed)
+    {
+        ret = shutdown(client_fd, SD_BOTH);
+        if (SOCKET_ERROR == ret)
+        {
+            LOG_ERROR("Error in shutdown: %d.", WSAGetLastError());
+            status = -1;
+        }
+    }
+
+    if (NULL != session.secure)
+        secure_free(session.secure);
+
+out_free:
+    file_server_free(&fileServer);
+    frame_reader_free(&reader);
+
+out_close:
+    /* Closed by the main thread at the drain deadline. */
+    if (0 == InterlockedExchange(&session.closed, 1))
+        closesocket(client_fd);
+
+    LOG_INFO("Client %lld closed.", client_fd);
+
+    metrics_detach(&metrics, stats);
+    InterlockedDecrement(&metrics.connections);
+
+    return status;
+}
+
+/**
+ * ShmHandler - Shared memory client thread, the same frames in clear text.
+ *
+ * The channel is freed here, the main thread only aborts it.
+*/
+DWORD WINAPI
+ShmHandler(LPVOID lpParam)
+{
+    int status                      = 0;
+    SHM_CHANNEL *shm                = (SHM_CHANNEL *)lpParam;
+
+    SESSION session;
+    FRAME_READER reader;
+    FRAME_WRITER writer;
+    METRICS_THREAD *stats           = NULL;
+
+    ZeroMemory(&session, sizeof(session));
+    session.fd  = INVALID_SOCKET;
+    session.shm = shm;
+    session.id  = shm->serial;
+    InitializeSRWLock(&session.lock);
+
+    stats = metrics_attach(&metrics);
+    if (NULL == stats)
     {
-        printf("Error in shutdown: %d.\n", WSAGetLastError());
+        LOG_ERROR("Error in metrics_attach from shared memory client: %lld.", session.id);
         status = -1;
+        goto out_close;
     }
 
-    closesocket(client_fd);
-    printf("Client %lld closed.\n", client_fd);
+    if (0 != frame_reader_init(&reader, FRAME_RING_SIZE))
+    {
+        LOG_ERROR("Error in frame_reader_init from shared memory client: %lld.", session.id);
+        status = -1;
+        goto out_close;
+    }
+
+    frame_writer_init(&writer);
+
+    SessionAdd(&session);
+
+    status = RunSession(&session, &reader, &writer, NULL, stats);
+
+    SessionRemove(&session);
+
+    frame_reader_free(&reader);
+
+out_close:
+    /* The client reads the end of the stream. */
+    shm_close(shm);
+    free(shm);
+
+    LOG_INFO("Shared memory client %lld closed.", session.id);
+
+    metrics_detach(&metrics, stats);
+    InterlockedDecrement(&metrics.connections);
 
     return status;
 }
 
+/**
+ * ShmAcceptor - Accept shared memory clients until the server stops.
+*/
+DWORD WINAPI
+ShmAcceptor(LPVOID lpParam)
+{
+    HANDLE thrdHandle       = NULL;
+    SHM_CHANNEL *shm        = NULL;
+    METRICS_THREAD *stats   = NULL;
+
+    UNREFERENCED_PARAMETER(lpParam);
+
+    stats = metrics_attach(&metrics);
+    if (NULL == stats)
+    {
+        LOG_ERROR("Error in metrics_attach for shared memory.");
+        return -1;
+    }
+
+    while (!graceful_stopping(&graceful))
+    {
+        shm = (SHM_CHANNEL *)malloc(sizeof(SHM_CHANNEL));
+        if (NULL == shm)
+        {
+            LOG_RATE(LOG_LEVEL_ERROR, 10, "Error in malloc for shared memory client.");
+            stats->errors++;
+            Sleep(GRACEFUL_POLL_MS);
+            continue;
+        }
+
+        /* Fails at once when the listener is stopped. */
+        if (0 != shm_accept(&shmListener, shm))
+        {
+            free(shm);
+
+            if (graceful_stopping(&graceful))
+                break;
+
+            stats->errors++;
+            continue;
+        }
+
+        LOG_INFO("Connect shared memory client: %ld.", shm->serial);
+
+        stats->accepts++;
+        InterlockedIncrement(&metrics.connections);
+
+        thrdHandle = CreateThread(NULL, 0, ShmHandler, shm, 0, NULL);
+
+        if (NULL == thrdHandle)
+        {
+            LOG_RATE(LOG_LEVEL_ERROR, 10, "Error in CreateThread from shared memory client: %ld.", shm->serial);
+            shm_close(shm);
+            free(shm);
+            stats->errors++;
+            InterlockedDecrement(&metrics.connections);
+            continue;
+        }
+
+        CloseHandle(thrdHandle);
+    }
+
+    metrics_detach(&metrics, stats);
+
+    return 0;
+}
+
+/**
+ * DrainGoaway - Send GOAWAY from the main thread, never past the deadline.
+ *
+ * The caller holds session->lock. A socket gets a send timeout up to the
+ * deadline, it stays for the replies of the handler, which are closed at
+ * the deadline anyway. A channel is only written when the frame fits, a
+ * full ring means the client does not read.
+*/
+int DrainGoaway(SESSION *session, ULONGLONG deadline)
+{
+    ULONGLONG now = GetTickCount64();
+    DWORD timeoutMs;
+
+    if (now >= deadline)
+        return -1;
+
+    if (NULL != session->shm)
+    {
+        if (shm_send_space(session->shm) < FRAME_HEADER_SIZE)
+            return -1;
+    }
+    else
+    {
+        timeoutMs = (DWORD)(deadline - now);
+
+        if (SOCKET_ERROR == setsockopt(session->fd, SOL_SOCKET, SO_SNDTIMEO,
+                                       (const char *)&timeoutMs, sizeof(timeoutMs)))
+            return -1;
+    }
+
+    return SendGoaway(session);
+}
+
+/**
+ * DrainSessions - Send GOAWAY to every client and wait for them to close.
+ *
+ * A session serving a batch holds its lock, maybe in a send to a client
+ * that does not read; it is skipped and sends GOAWAY itself after the
+ * batch. Clients that are still connected at the deadline are closed.
+*/
+void DrainSessions(void)
+{
+    int left;
+    ULONGLONG now, deadline, drainEnd;
+    SESSION *session;
+
+    LOG_INFO("Stopping, draining %ld connections for at most %lu ms.", metrics.connections, drainMs);
+
+    drainEnd = graceful_deadline(&graceful, drainMs);
+
+    AcquireSRWLockShared(&sessionLock);
+
+    for (session = sessions.next; &sessions != session; session = session->next)
+    {
+        if (!TryAcquireSRWLockExclusive(&session->lock))
+            continue;
+
+        if (0 != DrainGoaway(session, drainEnd))
+            LOG_WARN("Error sending GOAWAY to client: %lld.", session->id);
+
+        ReleaseSRWLockExclusive(&session->lock);
+    }
+
+    ReleaseSRWLockShared(&sessionLock);
+
+    /* The sends above count against the same deadline. */
+    now  = GetTickCount64();
+    left = graceful_drain(&graceful, &metrics.connections, (now < drainEnd) ? (DWORD)(drainEnd - now) : 0);
+    if (0 == left)
+    {
+        LOG_INFO("All connections drained.");
+        return;
+    }
+
+    LOG_WARN("Drain deadline, closing %d connections.", left);
+
+    /* The blocked receive of the handler fails, it still frees a channel. */
+    AcquireSRWLockShared(&sessionLock);
+
+    for (session = sessions.next; &sessions != session; session = session->next)
+    {
+        if (0 != InterlockedExchange(&session->closed, 1))
+            continue;
+
+        if (NULL != session->shm)
+            shm_abort(session->shm);
+        else
+            closesocket(session->fd);
+    }
+
+    ReleaseSRWLockShared(&sessionLock);
+
+    /* Handlers still use the metrics, give them time to leave. */
+    deadline = graceful_deadline(&graceful, GRACEFUL_LEAVE_MS);
+
+    while (0 < metrics.connections && GetTickCount64() < deadline)
+        Sleep(GRACEFUL_POLL_MS);
+}
+
+/**
+ * OnStop - First Ctrl+C, the blocked accept() and shm_accept() fail.
+*/
+void OnStop(void *context)
+{
+    closesocket(*(SOCKET *)context);
+
+    if (NULL != shmName)
+        shm_listener_stop(&shmListener);
+}
+
 /**
  * StartServer - Start TCP server.
 */
@@ -156,15 +735,63 @@ out_wsa:
     return INVALID_SOCKET;
 }
 
+/**
+ * ParseArgs - Parse the encryption options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'e': secureMode = secure_mode_parse(argv[i + 1]); break;
+        case 'k': securePsk  = argv[i + 1];                    break;
+        case 'r': fileRoot   = argv[i + 1];                    break;
+        case 'f': fileMode   = (0 == strcmp(argv[i + 1], "copy")) ? FILE_SERVE_COPY : FILE_SERVE_ZEROCOPY; break;
+        case 'm': metricsPort = atoi(argv[i + 1]);             break;
+        case 'D': drainMs     = 1000 * atoi(argv[i + 1]);      break;
+        case 's': shmName     = argv[i + 1];                   break;
+        default:
+            return -1;
+        }
+    }
+
+    if (0 > secureMode || 0 > metricsPort || 65535 < metricsPort || 0 > (LONG)drainMs)
+        return -1;
+
+    secureMode = secure_mode_resolve(secureMode);
+
+    if (SECURE_MODE_AESNI == secureMode && !gcm_aesni_supported())
+    {
+        printf("AES-NI is not supported by this cpu.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Main function.
  */
-int main(void)
+int main(int argc, char **argv)
 {
     int status          = 0;
     HANDLE thrdHandle   = NULL;
+    HANDLE shmThread    = NULL;
     SOCKET server_fd    = INVALID_SOCKET;
     SOCKET client_fd    = INVALID_SOCKET;
+    METRICS_THREAD *stats;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-e none|auto|aesni|cng] [-k psk] [-r root] [-f zerocopy|copy] [-m port] [-D seconds] [-s name]\n", argv[0]);
+        return -1;
+    }
+
+    metrics_init(&metrics, "tcp_server");
 
     /* Start TCP Server. */
     server_fd = StartServer();
@@ -175,11 +802,65 @@ int main(void)
         status = -1;
         goto out_end;
     }
+
+    if (NULL != shmName && 0 != shm_listen(&shmListener, shmName, SHM_RING_SIZE))
+    {
+        printf("Start shared memory failed.\n");
+        status = -1;
+        goto out_metrics;
+    }
+
+    /* Accepts are counted by the main thread. */
+    stats = metrics_attach(&metrics);
+    if (NULL == stats || (0 != metricsPort && 0 != metrics_serve(&metrics, metricsPort)))
+    {
+        printf("Start metrics failed.\n");
+        status = -1;
+        goto out_metrics;
+    }
     else
     {
         printf("Server startup!\n");
         printf("Server address: %s, Port: %s.\n", SERVER_IP, SERVER_PORT);
-        printf("Press CTRL+C to quit.\n");
+        printf("Encryption: %s.\n", secure_mode_name(secureMode));
+
+        if (NULL != fileRoot)
+            printf("Serving files from %s (%s).\n", fileRoot, file_mode_name(fileMode));
+        if (0 != metricsPort)
+            printf("Metrics: http://%s:%d/metrics.\n", SERVER_IP, metricsPort);
+        if (NULL != shmName)
+            printf("Shared memory: %s, clear text.\n", shmName);
+        printf("Press CTRL+C to stop, connections are drained for %lu s.\n", drainMs / 1000);
+    }
+
+    if (0 != log_start())
+    {
+        status = -1;
+        goto out_metrics;
+    }
+
+    sessions.next = &sessions;
+    sessions.prev = &sessions;
+
+    /* Ctrl+C closes server_fd and stops the shared memory listener. */
+    if (0 != graceful_init(&graceful, drainMs, OnStop, &server_fd))
+    {
+        status = -1;
+        goto out_log;
+    }
+
+    /* Shared memory clients are accepted on a thread of their own. */
+    if (NULL != shmName)
+    {
+        shmThread = CreateThread(NULL, 0, ShmAcceptor, NULL, 0, NULL);
+
+        if (NULL == shmThread)
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            graceful_free(&graceful);
+            status = -1;
+            goto out_log;
+        }
     }
 
     /* Waitting client. */
@@ -190,35 +871,69 @@ int main(void)
 
         if (INVALID_SOCKET == client_fd)
         {
-            printf("Error in accept: %d.\n", WSAGetLastError());
+            if (graceful_stopping(&graceful))
+                break;
+
+            LOG_RATE(LOG_LEVEL_ERROR, 10, "Error in accept: %d.", WSAGetLastError());
+            stats->errors++;
             continue;
         }
         else
         {
-            printf("Connect client: %lld.\n", client_fd);
+            LOG_INFO("Connect client: %lld.", client_fd);
+
+            stats->accepts++;
+            InterlockedIncrement(&metrics.connections);
 
-            /* Create working thread. */
+            /* Create working thread, the socket is passed by value. */
             thrdHandle = CreateThread(
                 NULL,
                 0,
                 ClientHandler,
-                &client_fd,
+                (LPVOID)client_fd,
                 0,
                 NULL
             );
 
             if (NULL == thrdHandle)
             {
-                printf("Error in CreateThread from client: %lld.\n", client_fd);
+                LOG_RATE(LOG_LEVEL_ERROR, 10, "Error in CreateThread from client: %lld.", client_fd);
+                closesocket(client_fd);
+                stats->errors++;
+                InterlockedDecrement(&metrics.connections);
                 continue;
             }
+
+            CloseHandle(thrdHandle);
         }
+    }
 
-        Sleep(1000);
+    if (NULL != shmThread)
+    {
+        WaitForSingleObject(shmThread, INFINITE);
+        CloseHandle(shmThread);
     }
 
-    /* Cleanup. */
-    closesocket(server_fd);
+    DrainSessions();
+    metrics_detach(&metrics, stats);
+
+    /* Final stats after the last log line. */
+    log_stop();
+
+    printf("\nServer stopped.\n");
+    metrics_print(&metrics);
+
+    graceful_free(&graceful);
+
+out_log:
+    log_stop();
+
+out_metrics:
+    if (!graceful_stopping(&graceful))
+        closesocket(server_fd);
+
+    shm_listener_free(&shmListener);
+    metrics_free(&metrics);
     WSACleanup();
 
 out_end:
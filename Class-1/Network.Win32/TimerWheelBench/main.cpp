@@ -0,0 +1,281 @@
+/**
+ * Win32 timer insert/cancel benchmark.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/api/threadpoolapiset/nf-threadpoolapiset-setthreadpooltimer].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/api/synchapi/nf-synchapi-setwaitabletimer].
+ *
+ * Measures the timing wheel of TCPServerIOCP (Common/timerwheel.h) against
+ * one Windows timer object per connection: thread pool timers and waitable
+ * timers (one system call per set/cancel).
+ *
+ * License - MIT.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include "timerwheel.h"
+#include "timing.h"
+
+
+#define TICKS_PER_SECOND                        10      // 100 ms ticks, as the server.
+#define MAX_TIMEOUT_SECONDS                     600
+#define NS_PER_SEC                              1000000000ull
+#define FILETIME_PER_MS                         10000LL
+
+
+UINT64 rngState = 0x9E3779B97F4A7C15ull;
+
+volatile LONG callbacks = 0;
+
+
+/**
+ * Random - xorshift64, deadlines must not follow insert order.
+*/
+static inline UINT64 Random(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+
+    return rngState;
+}
+
+/**
+ * ShowResult - One line of the result table.
+*/
+void ShowResult(const char *name, UINT64 count, ULONGLONG ns)
+{
+    printf("%-32s %10llu %10.1f %10.2f\n", name, count, (double)ns / count, count * 1e3 / ns);
+}
+
+/**
+ * CountExpired - Wheel callback of the expire test.
+*/
+void CountExpired(TIMER_WHEEL *wheel, TIMER_ENTRY *entry, void *context)
+{
+    (*(UINT64 *)context)++;
+}
+
+/**
+ * BenchWheel - Insert, re-arm, cancel and expire count entries.
+*/
+int BenchWheel(UINT64 count)
+{
+    UINT64 i, expired = 0;
+    UINT64 range = (UINT64)MAX_TIMEOUT_SECONDS * TICKS_PER_SECOND;
+    ULONGLONG start;
+    TIMER_WHEEL *wheel;
+    TIMER_ENTRY *entries;
+
+    wheel   = (TIMER_WHEEL *)malloc(sizeof(TIMER_WHEEL));
+    entries = (TIMER_ENTRY *)calloc((size_t)count, sizeof(TIMER_ENTRY));
+
+    if (NULL == wheel || NULL == entries)
+    {
+        printf("Out of memory.\n");
+        free(wheel);
+        free(entries);
+        return -1;
+    }
+
+    timer_wheel_init(wheel, 0);
+
+    start = timing_now_ns();
+    for (i = 0; i < count; i++)
+        timer_add(wheel, &entries[i], 1 + Random() % range);
+    ShowResult("wheel insert", count, timing_now_ns() - start);
+
+    /* What a connection does on every request: move its deadline. */
+    start = timing_now_ns();
+    for (i = 0; i < count; i++)
+        timer_add(wheel, &entries[Random() % count], 1 + Random() % range);
+    ShowResult("wheel re-arm (random entry)", count, timing_now_ns() - start);
+
+    start = timing_now_ns();
+    for (i = 0; i < count; i++)
+        timer_cancel(wheel, &entries[i]);
+    ShowResult("wheel cancel", count, timing_now_ns() - start);
+
+    /* All expire within 60 s, advance tick by tick as the timer thread. */
+    for (i = 0; i < count; i++)
+        timer_add(wheel, &entries[i], 1 + Random() % (60 * TICKS_PER_SECOND));
+
+    start = timing_now_ns();
+    timer_wheel_advance(wheel, 60 * TICKS_PER_SECOND, CountExpired, &expired);
+    ShowResult("wheel expire (with cascade)", expired, timing_now_ns() - start);
+
+    free(entries);
+    free(wheel);
+
+    return 0;
+}
+
+/**
+ * TimerCallback - Thread pool timer callback, should not run.
+*/
+VOID CALLBACK
+TimerCallback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer)
+{
+    InterlockedIncrement(&callbacks);
+}
+
+/**
+ * BenchThreadpool - One thread pool timer per connection.
+*/
+int BenchThreadpool(UINT64 count)
+{
+    UINT64 i;
+    int status = 0;
+    ULONGLONG start;
+    FILETIME due;
+    ULARGE_INTEGER relative;
+    PTP_TIMER *timers;
+
+    timers = (PTP_TIMER *)calloc((size_t)count, sizeof(PTP_TIMER));
+    if (NULL == timers)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        timers[i] = CreateThreadpoolTimer(TimerCallback, NULL, NULL);
+
+        if (NULL == timers[i])
+        {
+            printf("Error in CreateThreadpoolTimer: %d.\n", GetLastError());
+            status = -1;
+            goto out_close;
+        }
+    }
+
+    start = timing_now_ns();
+    for (i = 0; i < count; i++)
+    {
+        /* Negative is relative to now. */
+        relative.QuadPart  = (ULONGLONG)(-(LONGLONG)((1000 + Random() % (MAX_TIMEOUT_SECONDS * 1000ull)) * FILETIME_PER_MS));
+        due.dwLowDateTime  = relative.LowPart;
+        due.dwHighDateTime = relative.HighPart;
+
+        SetThreadpoolTimer(timers[i], &due, 0, 0);
+    }
+    ShowResult("threadpool SetThreadpoolTimer", count, timing_now_ns() - start);
+
+    start = timing_now_ns();
+    for (i = 0; i < count; i++)
+        SetThreadpoolTimer(timers[i], NULL, 0, 0);
+    ShowResult("threadpool cancel", count, timing_now_ns() - start);
+
+out_close:
+    for (i = 0; i < count && NULL != timers[i]; i++)
+    {
+        WaitForThreadpoolTimerCallbacks(timers[i], TRUE);
+        CloseThreadpoolTimer(timers[i]);
+    }
+
+    free(timers);
+
+    return status;
+}
+
+/**
+ * BenchWaitable - One waitable timer per connection, every call enters the kernel.
+*/
+int BenchWaitable(UINT64 count)
+{
+    UINT64 i;
+    int status = 0;
+    ULONGLONG start;
+    LARGE_INTEGER due;
+    HANDLE *timers;
+
+    timers = (HANDLE *)calloc((size_t)count, sizeof(HANDLE));
+    if (NULL == timers)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        timers[i] = CreateWaitableTimerW(NULL, TRUE, NULL);
+
+        if (NULL == timers[i])
+        {
+            printf("Error in CreateWaitableTimer: %d.\n", GetLastError());
+            status = -1;
+            goto out_close;
+        }
+    }
+
+    start = timing_now_ns();
+    for (i = 0; i < count; i++)
+    {
+        due.QuadPart = -(LONGLONG)((1000 + Random() % (MAX_TIMEOUT_SECONDS * 1000ull)) * FILETIME_PER_MS);
+        SetWaitableTimer(timers[i], &due, 0, NULL, NULL, FALSE);
+    }
+    ShowResult("kernel SetWaitableTimer", count, timing_now_ns() - start);
+
+    start = timing_now_ns();
+    for (i = 0; i < count; i++)
+        CancelWaitableTimer(timers[i]);
+    ShowResult("kernel CancelWaitableTimer", count, timing_now_ns() - start);
+
+out_close:
+    for (i = 0; i < count && NULL != timers[i]; i++)
+        CloseHandle(timers[i]);
+
+    free(timers);
+
+    return status;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    UINT64 wheelCount  = 1000000;
+    UINT64 systemCount = 100000;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            goto out_usage;
+
+        switch (argv[i][1])
+        {
+        case 'n': wheelCount  = _strtoui64(argv[i + 1], NULL, 10); break;
+        case 'c': systemCount = _strtoui64(argv[i + 1], NULL, 10); break;
+        default:
+            goto out_usage;
+        }
+    }
+
+    if (0 == wheelCount || 0 == systemCount)
+        goto out_usage;
+
+    printf("Timing wheel: %d levels x %d slots, %zu bytes per entry, %zu bytes per wheel.\n\n",
+           TIMER_WHEEL_LEVELS, TIMER_WHEEL_SLOTS, sizeof(TIMER_ENTRY), sizeof(TIMER_WHEEL));
+    printf("%-32s %10s %10s %10s\n", "Operation", "Count", "ns/op", "Mops/s");
+
+    if (0 != BenchWheel(wheelCount) ||
+        0 != BenchThreadpool(systemCount) ||
+        0 != BenchWaitable(systemCount))
+        return -1;
+
+    if (0 != callbacks)
+        printf("\n%ld thread pool timers fired during the test.\n", callbacks);
+
+    return 0;
+
+out_usage:
+    printf("Usage: %s [-n wheel timers] [-c system timers]\n", argv[0]);
+    printf("  -n count     Wheel entries, default 1000000.\n");
+    printf("  -c count     Thread pool and waitable timers, default 100000.\n");
+
+    return -1;
+}
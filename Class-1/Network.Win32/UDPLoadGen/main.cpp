@@ -0,0 +1,500 @@
+/**
+ * Win32 udp traffic generator example, using Registered I/O (RIO).
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-rio_extension_function_table].
+ * Ref 2: [https://docs.microsoft.com/en-us/previous-versions/windows/it-pro/windows-server-2012-r2-and-2012/hh997032(v=ws.11)].
+ *
+ * Every datagram carries a sequence number and its send time, the server
+ * echoes it back. Sends and receives are queued with RIO_MSG_DEFER and
+ * committed once per batch, so one system call moves a whole batch of
+ * datagrams, and completions are polled without any system call.
+ *
+ * License - MIT.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <vector>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+
+#include "histogram.h"
+#include "timing.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+
+
+#define SERVER_IP                               "127.0.0.1"
+#define SERVER_PORT                             "65533"
+#define SLOT_SIZE                               2048        // Bytes per RIO buffer slot.
+#define SEND_SLOTS                              1024
+#define RECV_SLOTS                              1024
+#define MAX_BATCH                               256
+#define SOCKET_BUFLEN                           (8 << 20)
+#define DRAIN_MS                                1000        // Wait for late replies.
+#define PROBE_MAGIC                             0x55445031  // "UDP1"
+
+
+#pragma pack(push, 1)
+typedef struct _UDP_PROBE {
+    UINT32 magic;
+    UINT32 size;
+    UINT64 seq;
+    UINT64 sendNs;
+} UDP_PROBE;
+#pragma pack(pop)
+
+typedef struct _UDP_CONFIG {
+    const char *host;
+    const char *port;
+    double rate;                // Datagrams per second.
+    int msgSize;
+    int batch;
+    int duration;
+} UDP_CONFIG;
+
+typedef struct _UDP_STATS {
+    ULONGLONG sent;
+    ULONGLONG sendErrors;
+    ULONGLONG received;
+    ULONGLONG duplicates;
+    ULONGLONG reordered;
+    ULONGLONG invalid;
+    ULONGLONG repostErrors;     // Receive slots lost, fewer echoes fit.
+    ULONGLONG highestSeq;
+    ULONGLONG batches;
+} UDP_STATS;
+
+
+UDP_CONFIG config;
+UDP_STATS stats;
+
+RIO_EXTENSION_FUNCTION_TABLE rio;
+
+
+/**
+ * OpenRioSocket - Create a RIO capable udp socket connected to the server.
+*/
+SOCKET OpenRioSocket(const char *host, const char *port)
+{
+    int ret;
+    int bufLen = SOCKET_BUFLEN;
+    DWORD bytes = 0;
+    GUID functionTableId = WSAID_MULTIPLE_RIO;
+    SOCKET fd = INVALID_SOCKET;
+
+    struct addrinfo *addr_data = NULL;
+    struct addrinfo hints;
+
+    ZeroMemory(&hints, sizeof(hints));
+
+    hints.ai_family     = AF_INET;
+    hints.ai_socktype   = SOCK_DGRAM;
+    hints.ai_protocol   = IPPROTO_UDP;
+
+    ret = getaddrinfo(host, port, &hints, &addr_data);
+    if (0 != ret)
+    {
+        printf("Error in getaddrinfo: %d.\n", ret);
+        return INVALID_SOCKET;
+    }
+
+    fd = WSASocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO);
+    if (INVALID_SOCKET == fd)
+    {
+        printf("Error in WSASocket: %d.\n", WSAGetLastError());
+        goto out_addr;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char *)&bufLen, sizeof(bufLen));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char *)&bufLen, sizeof(bufLen));
+
+    /* A connected udp socket lets RIOSend/RIOReceive skip the address. */
+    ret = connect(fd, addr_data->ai_addr, (int)addr_data->ai_addrlen);
+    if (SOCKET_ERROR == ret)
+    {
+        printf("Error in connect: %d.\n", WSAGetLastError());
+        goto out_sock;
+    }
+
+    /* Load the RIO function table. */
+    rio.cbSize = sizeof(rio);
+
+    ret = WSAIoctl(
+        fd,
+        SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,
+        &functionTableId,
+        sizeof(GUID),
+        &rio,
+        sizeof(rio),
+        &bytes,
+        NULL,
+        NULL
+    );
+
+    if (SOCKET_ERROR == ret)
+    {
+        printf("Error in WSAIoctl(RIO): %d.\n", WSAGetLastError());
+        goto out_sock;
+    }
+
+    freeaddrinfo(addr_data);
+
+    return fd;
+
+out_sock:
+    closesocket(fd);
+
+out_addr:
+    freeaddrinfo(addr_data);
+
+    return INVALID_SOCKET;
+}
+
+/**
+ * TrackSequence - Update loss, duplicate and reorder counters.
+*/
+static void TrackSequence(std::vector<UINT64> &seen, UINT64 seq)
+{
+    UINT64 bit = 1ull << (seq & 63);
+
+    if ((seq >> 6) >= seen.size())
+        seen.resize((size_t)(seq >> 6) * 2 + 1, 0);
+
+    if (seen[(size_t)(seq >> 6)] & bit)
+    {
+        stats.duplicates++;
+        return;
+    }
+
+    seen[(size_t)(seq >> 6)] |= bit;
+    stats.received++;
+
+    if (seq < stats.highestSeq)
+        stats.reordered++;
+    else
+        stats.highestSeq = seq;
+}
+
+/**
+ * Usage - Show command line options.
+*/
+void Usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -h host      Server address, default %s.\n", SERVER_IP);
+    printf("  -p port      Server port, default %s.\n", SERVER_PORT);
+    printf("  -r rate      Datagrams per second, default 10000.\n");
+    printf("  -s size      Datagram size in bytes, default 64.\n");
+    printf("  -b batch     Datagrams per RIO commit, default 32.\n");
+    printf("  -T seconds   Send duration, default 10.\n");
+}
+
+/**
+ * ParseArgs - Parse command line options into config.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    config.host     = SERVER_IP;
+    config.port     = SERVER_PORT;
+    config.rate     = 10000;
+    config.msgSize  = 64;
+    config.batch    = 32;
+    config.duration = 10;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'h': config.host     = argv[i + 1];       break;
+        case 'p': config.port     = argv[i + 1];       break;
+        case 'r': config.rate     = atof(argv[i + 1]); break;
+        case 's': config.msgSize  = atoi(argv[i + 1]); break;
+        case 'b': config.batch    = atoi(argv[i + 1]); break;
+        case 'T': config.duration = atoi(argv[i + 1]); break;
+        default:
+            return -1;
+        }
+    }
+
+    if (config.rate <= 0 || config.duration < 1 ||
+        config.msgSize < (int)sizeof(UDP_PROBE) || config.msgSize > SLOT_SIZE ||
+        config.batch < 1 || config.batch > MAX_BATCH)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Main function.
+ */
+int main(int argc, char **argv)
+{
+    int status = 0;
+    ULONG i, count;
+    WSADATA wsaData;
+    SOCKET fd = INVALID_SOCKET;
+    RIO_CQ sendCq = RIO_INVALID_CQ;
+    RIO_CQ recvCq = RIO_INVALID_CQ;
+    RIO_RQ rq = RIO_INVALID_RQ;
+    RIO_BUFFERID sendId = RIO_INVALID_BUFFERID;
+    RIO_BUFFERID recvId = RIO_INVALID_BUFFERID;
+    char *sendArea = NULL;
+    char *recvArea = NULL;
+    RIO_BUF buf;
+    RIORESULT results[MAX_BATCH];
+
+    std::vector<ULONG> freeSlots;
+    std::vector<UINT64> seen;
+    LatencyHistogram rtt;
+
+    ULONGLONG now, startNs, endNs, drainNs, due, toSend;
+    UDP_PROBE *probe;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    if (0 != WSAStartup(MAKEWORD(2, 2), &wsaData))
+    {
+        printf("Error in WSAStartup.\n");
+        return -1;
+    }
+
+    fd = OpenRioSocket(config.host, config.port);
+    if (INVALID_SOCKET == fd)
+    {
+        status = -1;
+        goto out_wsa;
+    }
+
+    /* Completion queues are polled, no notification needed. */
+    sendCq = rio.RIOCreateCompletionQueue(SEND_SLOTS, NULL);
+    recvCq = rio.RIOCreateCompletionQueue(RECV_SLOTS, NULL);
+
+    if (RIO_INVALID_CQ == sendCq || RIO_INVALID_CQ == recvCq)
+    {
+        printf("Error in RIOCreateCompletionQueue: %d.\n", WSAGetLastError());
+        status = -1;
+        goto out_rio;
+    }
+
+    rq = rio.RIOCreateRequestQueue(fd, RECV_SLOTS, 1, SEND_SLOTS, 1, recvCq, sendCq, NULL);
+    if (RIO_INVALID_RQ == rq)
+    {
+        printf("Error in RIOCreateRequestQueue: %d.\n", WSAGetLastError());
+        status = -1;
+        goto out_rio;
+    }
+
+    /* Registered buffers stay locked, so allocate them page aligned. */
+    sendArea = (char *)VirtualAlloc(NULL, SEND_SLOTS * SLOT_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    recvArea = (char *)VirtualAlloc(NULL, RECV_SLOTS * SLOT_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (NULL == sendArea || NULL == recvArea)
+    {
+        printf("Error in VirtualAlloc: %d.\n", GetLastError());
+        status = -1;
+        goto out_rio;
+    }
+
+    sendId = rio.RIORegisterBuffer(sendArea, SEND_SLOTS * SLOT_SIZE);
+    recvId = rio.RIORegisterBuffer(recvArea, RECV_SLOTS * SLOT_SIZE);
+
+    if (RIO_INVALID_BUFFERID == sendId || RIO_INVALID_BUFFERID == recvId)
+    {
+        printf("Error in RIORegisterBuffer: %d.\n", WSAGetLastError());
+        status = -1;
+        goto out_rio;
+    }
+
+    /* Post every receive slot, commit once. */
+    for (i = 0; i < RECV_SLOTS; i++)
+    {
+        buf.BufferId = recvId;
+        buf.Offset   = i * SLOT_SIZE;
+        buf.Length   = SLOT_SIZE;
+
+        rio.RIOReceive(rq, &buf, 1, RIO_MSG_DEFER, (PVOID)(ULONG_PTR)i);
+    }
+
+    rio.RIOReceive(rq, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL);
+
+    for (i = 0; i < SEND_SLOTS; i++)
+    {
+        freeSlots.push_back(SEND_SLOTS - 1 - i);
+        memset(sendArea + i * SLOT_SIZE, 'u', SLOT_SIZE);
+    }
+
+    printf("UDP load %s:%s, %.0f pkt/s, %d bytes, batch %d, %d s.\n",
+           config.host, config.port, config.rate, config.msgSize, config.batch, config.duration);
+
+    startNs = timing_now_ns();
+    endNs   = startNs + (ULONGLONG)config.duration * 1000000000ull;
+    drainNs = endNs + (ULONGLONG)DRAIN_MS * 1000000ull;
+
+    while ((now = timing_now_ns()) < drainNs)
+    {
+        /* Send everything the schedule says is due, one commit per batch. */
+        if (now < endNs)
+        {
+            due    = (ULONGLONG)((now - startNs) * config.rate / 1e9);
+            toSend = due - stats.sent - stats.sendErrors;
+
+            while (0 < toSend && !freeSlots.empty())
+            {
+                count = 0;
+
+                while (count < (ULONG)config.batch && 0 < toSend && !freeSlots.empty())
+                {
+                    ULONG slot = freeSlots.back();
+                    freeSlots.pop_back();
+
+                    probe = (UDP_PROBE *)(sendArea + slot * SLOT_SIZE);
+                    probe->magic  = PROBE_MAGIC;
+                    probe->size   = config.msgSize;
+                    probe->seq    = stats.sent + stats.sendErrors + count;
+                    probe->sendNs = timing_now_ns();
+
+                    buf.BufferId = sendId;
+                    buf.Offset   = slot * SLOT_SIZE;
+                    buf.Length   = config.msgSize;
+
+                    if (!rio.RIOSend(rq, &buf, 1, RIO_MSG_DEFER, (PVOID)(ULONG_PTR)slot))
+                    {
+                        freeSlots.push_back(slot);
+                        break;
+                    }
+
+                    count++;
+                    toSend--;
+                }
+
+                if (0 == count)
+                    break;
+
+                rio.RIOSend(rq, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL);
+                stats.sent += count;
+                stats.batches++;
+            }
+        }
+
+        /* Reclaim send slots. */
+        count = rio.RIODequeueCompletion(sendCq, results, MAX_BATCH);
+
+        if (RIO_CORRUPT_CQ == count)
+        {
+            printf("Send completion queue corrupt.\n");
+            status = -1;
+            break;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            if (0 != results[i].Status)
+            {
+                stats.sendErrors++;
+                stats.sent--;
+            }
+
+            freeSlots.push_back((ULONG)results[i].RequestContext);
+        }
+
+        /* Match echoes, then repost their receive slots. */
+        count = rio.RIODequeueCompletion(recvCq, results, MAX_BATCH);
+
+        if (RIO_CORRUPT_CQ == count)
+        {
+            printf("Receive completion queue corrupt.\n");
+            status = -1;
+            break;
+        }
+
+        now = timing_now_ns();
+
+        for (i = 0; i < count; i++)
+        {
+            ULONG slot = (ULONG)results[i].RequestContext;
+            probe = (UDP_PROBE *)(recvArea + slot * SLOT_SIZE);
+
+            if (0 == results[i].Status &&
+                results[i].BytesTransferred >= sizeof(UDP_PROBE) &&
+                PROBE_MAGIC == probe->magic)
+            {
+                rtt.record(now - probe->sendNs);
+                TrackSequence(seen, probe->seq);
+            }
+            else
+            {
+                stats.invalid++;
+            }
+
+            buf.BufferId = recvId;
+            buf.Offset   = slot * SLOT_SIZE;
+            buf.Length   = SLOT_SIZE;
+
+            if (!rio.RIOReceive(rq, &buf, 1, RIO_MSG_DEFER, (PVOID)(ULONG_PTR)slot))
+                stats.repostErrors++;
+        }
+
+        if (0 < count)
+            rio.RIOReceive(rq, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL);
+        else
+            YieldProcessor();
+    }
+
+    if (0 == status)
+    {
+        ULONGLONG lost = stats.sent - stats.received;
+
+        printf("\nSent:        %llu (%.0f pkt/s, %llu batches, %llu errors).\n",
+               stats.sent, stats.sent / (double)config.duration, stats.batches, stats.sendErrors);
+        printf("Received:    %llu unique, %llu invalid, %llu receive slots lost.\n",
+               stats.received, stats.invalid, stats.repostErrors);
+        printf("Lost:        %llu (%.3f %%).\n", lost, stats.sent ? 100.0 * lost / stats.sent : 0.0);
+        printf("Duplicated:  %llu.\n", stats.duplicates);
+        printf("Reordered:   %llu.\n\n", stats.reordered);
+
+        rtt.print("Round trip", 1000.0, "us");
+    }
+
+out_rio:
+    /**
+     * The socket first, it ends the receives and sends still posted and
+     * releases the request queue; the buffers are theirs until then.
+    */
+    if (INVALID_SOCKET != fd)
+        closesocket(fd);
+
+    if (RIO_INVALID_CQ != sendCq)
+        rio.RIOCloseCompletionQueue(sendCq);
+
+    if (RIO_INVALID_CQ != recvCq)
+        rio.RIOCloseCompletionQueue(recvCq);
+
+    if (RIO_INVALID_BUFFERID != sendId)
+        rio.RIODeregisterBuffer(sendId);
+
+    if (RIO_INVALID_BUFFERID != recvId)
+        rio.RIODeregisterBuffer(recvId);
+
+    if (NULL != sendArea)
+        VirtualFree(sendArea, 0, MEM_RELEASE);
+
+    if (NULL != recvArea)
+        VirtualFree(recvArea, 0, MEM_RELEASE);
+
+out_wsa:
+    WSACleanup();
+
+    return status;
+}
@@ -15,22 +15,37 @@
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mstcpip.h>
+
+#include "asynclog.h"
+#include "graceful.h"
+#include "metrics.h"
 
 
 #pragma comment(lib, "Ws2_32.lib")
 
 
-#define DATA_BUFLEN                             512
+#define DATA_BUFLEN                             2048
+#define SOCKET_BUFLEN                           (8 << 20)
 #define SERVER_IP                               "127.0.0.1"
 #define SERVER_PORT                             "65533"
 
 
+int metricsPort         = 0;
+DWORD drainMs           = GRACEFUL_DRAIN_MS;
+
+METRICS metrics;
+GRACEFUL graceful;
+
+
 /**
  * StartServer - Start UDP server.
 */
 SOCKET StartServer()
 {
     int ret;
+    DWORD bytes;
+    BOOL connReset = FALSE;
     WSADATA wsaData;
     SOCKET server_fd = INVALID_SOCKET;
 
@@ -78,6 +93,16 @@ SOCKET StartServer()
 
     freeaddrinfo(addr_data);
 
+    /* An ICMP port unreachable from a client that left would fail the next recvfrom. */
+    ret = WSAIoctl(server_fd, SIO_UDP_CONNRESET, &connReset, sizeof(connReset), NULL, 0, &bytes, NULL, NULL);
+    if (SOCKET_ERROR == ret)
+        printf("Error in WSAIoctl(SIO_UDP_CONNRESET): %d.\n", WSAGetLastError());
+
+    /* A large receive buffer absorbs bursts from the load generator. */
+    ret = SOCKET_BUFLEN;
+    setsockopt(server_fd, SOL_SOCKET, SO_RCVBUF, (const char *)&ret, sizeof(ret));
+    setsockopt(server_fd, SOL_SOCKET, SO_SNDBUF, (const char *)&ret, sizeof(ret));
+
     return server_fd;
 
 out_bind:
@@ -93,18 +118,86 @@ out_wsa:
     return INVALID_SOCKET;
 }
 
+/**
+ * DatagramError - Whether a recvfrom() or sendto() error only lost one datagram.
+*/
+BOOL DatagramError(int error)
+{
+    return WSAECONNRESET == error || WSAENETRESET == error || WSAEMSGSIZE == error || WSAEWOULDBLOCK == error;
+}
+
+/**
+ * OnStop - First Ctrl+C, wake the blocked recvfrom() with an empty datagram.
+*/
+void OnStop(void *context)
+{
+    SOCKET fd;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (INVALID_SOCKET == fd)
+        return;
+
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons((u_short)atoi(SERVER_PORT));
+    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+    sendto(fd, "", 0, 0, (struct sockaddr *)&addr, sizeof(addr));
+    closesocket(fd);
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'm': metricsPort = atoi(argv[i + 1]);        break;
+        case 'D': drainMs     = 1000 * atoi(argv[i + 1]); break;
+        default:
+            return -1;
+        }
+    }
+
+    if (0 > metricsPort || 65535 < metricsPort || 0 > (LONG)drainMs)
+        return -1;
+
+    return 0;
+}
+
 /**
  * Main function.
  */
-int main(void)
+int main(int argc, char **argv)
 {
     int status          = 0;
-    HANDLE thrdHandle   = NULL;
+    int error;
     SOCKET server_fd    = INVALID_SOCKET;
     char recvbuf[DATA_BUFLEN + 1] = { 0 };
 
     struct sockaddr_in clt_addr;
     int len = sizeof(clt_addr);
+    int msgLen = 0;
+    UINT64 start;
+    ULONGLONG deadline  = 0;
+    BOOL draining       = FALSE;
+    u_long nonBlocking  = 1;
+    METRICS_THREAD *stats;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-m port] [-D seconds]\n", argv[0]);
+        return -1;
+    }
+
+    metrics_init(&metrics, "udp_server");
 
     /* Start TCP Server. */
     server_fd = StartServer();
@@ -115,42 +208,132 @@ int main(void)
         status = -1;
         goto out_end;
     }
-    else
+
+    stats = metrics_attach(&metrics);
+    if (NULL == stats || (0 != metricsPort && 0 != metrics_serve(&metrics, metricsPort)))
+    {
+        printf("Start metrics failed.\n");
+        status = -1;
+        goto out_metrics;
+    }
+
+    printf("Server startup!\n");
+    printf("Server address: %s, Port: %s.\n", SERVER_IP, SERVER_PORT);
+    if (0 != metricsPort)
+        printf("Metrics: http://%s:%d/metrics.\n", SERVER_IP, metricsPort);
+    printf("Press CTRL+C to stop, queued datagrams are answered for %lu s.\n\n", drainMs / 1000);
+
+    if (0 != log_start())
+    {
+        status = -1;
+        goto out_metrics;
+    }
+
+    if (0 != graceful_init(&graceful, drainMs, OnStop, NULL))
     {
-        printf("Server startup!\n");
-        printf("Server address: %s, Port: %s.\n", SERVER_IP, SERVER_PORT);
-        printf("Press CTRL+C to quit.\n\n");
+        status = -1;
+        goto out_log;
     }
 
-    /* Receive until the peer shuts down the connection. */
+    /* Serve until Ctrl+C, then answer the datagrams already queued. */
     do
     {
         /* Receive data. */
+        len    = sizeof(clt_addr);
         status = recvfrom(server_fd, recvbuf, DATA_BUFLEN, 0, (struct sockaddr *)&clt_addr, &len);
         if (0 > status)
         {
-            printf("Error in recvfrom: %d.\n", WSAGetLastError());
-            break;        
+            error = WSAGetLastError();
+
+            /* Drained. */
+            if (draining && WSAEWOULDBLOCK == error)
+            {
+                status = 0;
+                break;
+            }
+
+            /* A vanished client or an oversized datagram, serve the others. */
+            if (DatagramError(error))
+            {
+                LOG_RATE(LOG_LEVEL_WARN, 10, "Error in recvfrom: %d, datagram dropped.", error);
+                stats->errors++;
+                continue;
+            }
+
+            LOG_ERROR("Error in recvfrom: %d.", error);
+            stats->errors++;
+            break;
         }
 
-        /* Show receive data. */
-        recvbuf[status] = 0;
-        printf("Client: %s, Received: %s\n", inet_ntoa(clt_addr.sin_addr), recvbuf);
+        if (graceful_stopping(&graceful) && !draining)
+        {
+            LOG_INFO("Stopping, answering queued datagrams for at most %lu ms.", drainMs);
+
+            draining = TRUE;
+            deadline = graceful_deadline(&graceful, drainMs);
+            ioctlsocket(server_fd, FIONBIO, &nonBlocking);
+        }
+
+        if (draining)
+        {
+            if (GetTickCount64() >= deadline || 2 <= graceful.signals)
+            {
+                LOG_WARN("Drain deadline, queued datagrams are dropped.");
+                status = 0;
+                break;
+            }
+
+            /* The wake up datagram of OnStop. */
+            if (0 == status)
+                continue;
+        }
 
-        /* Echo the buffer back to the sender. */
-        status = sendto(server_fd, "OK", 2, 0, (struct sockaddr *)&clt_addr, len);
+        start  = metrics_now();
+        msgLen = status;
+        stats->bytesIn += msgLen;
+
+        /* Echo the datagram back to the sender. */
+        status = sendto(server_fd, recvbuf, msgLen, 0, (struct sockaddr *)&clt_addr, len);
 
         if (0 > status)
         {
-            printf("Error in sendto: %d.\n", WSAGetLastError());
+            error = WSAGetLastError();
+
+            if (DatagramError(error))
+            {
+                LOG_RATE(LOG_LEVEL_WARN, 10, "Error in sendto: %d, reply dropped.", error);
+                stats->errors++;
+                continue;
+            }
+
+            LOG_ERROR("Error in sendto: %d.", error);
+            stats->errors++;
             break;
         }
 
-        Sleep(200);
+        stats->bytesOut += status;
+        metrics_requests(&metrics, stats, start, 1);
+
+        /* Show receive data, compiled in with LOG_LEVEL_DEBUG only. */
+        LOG_DEBUG("Client: %s, Received %d bytes: %.*s", inet_ntoa(clt_addr.sin_addr), msgLen, msgLen, recvbuf);
     } while (1);
 
-    /* Cleanup. */
+    metrics_detach(&metrics, stats);
+
+    /* Final stats after the last log line. */
+    log_stop();
+
+    printf("\nServer stopped.\n");
+    metrics_print(&metrics);
+
+    graceful_free(&graceful);
+
+out_log:
+    log_stop();
+
+out_metrics:
     closesocket(server_fd);
+    metrics_free(&metrics);
     WSACleanup();
 
 out_end:
@@ -0,0 +1,316 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      cpukernel.cpp
+ *
+ * Abstract:
+ *      FMA, integer, cache and branch stress kernels.
+ *
+ * Reference:
+ * https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+*/
+
+#include <iostream>
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "cpukernel.h"
+
+
+#define FMA_CHUNK                       4096        // Iterations of 8 chains.
+#define INT_CHUNK                       4096        // Iterations of 4 chains.
+#define CACHE_CHUNK                     512         // Accesses.
+#define BRANCH_CHUNK                    1024        // Branches.
+
+#define FMA_MUL                         0.999999
+#define FMA_ADD                         0.000001    // Chains stay near 1, no denormals.
+
+
+static const char *kernelNames[] = { "fma", "int", "cache", "branch", "mix" };
+
+
+/**
+ * cpu_isa_supported - Instruction set of fma, AVX2 comes with FMA3.
+*/
+int cpu_isa_supported(int isa)
+{
+    int regs[4];
+
+    if (!mem_isa_supported(isa))
+        return 0;
+
+    if (MEM_ISA_AVX2 != isa)
+        return 1;
+
+    __cpuid(regs, 1);
+
+    return 0 != (regs[2] & (1 << 12));
+}
+
+static inline UINT64 xorshift(UINT64 x)
+{
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return x;
+}
+
+/* 8 independent chains cover the latency of two FMA ports. */
+
+static double fma_scalar(void)
+{
+    double a0 = 1.0, a1 = 1.1, a2 = 1.2, a3 = 1.3, a4 = 1.4, a5 = 1.5, a6 = 1.6, a7 = 1.7;
+
+    for (int i = 0; i < FMA_CHUNK; i++)
+    {
+        a0 = a0 * FMA_MUL + FMA_ADD;
+        a1 = a1 * FMA_MUL + FMA_ADD;
+        a2 = a2 * FMA_MUL + FMA_ADD;
+        a3 = a3 * FMA_MUL + FMA_ADD;
+        a4 = a4 * FMA_MUL + FMA_ADD;
+        a5 = a5 * FMA_MUL + FMA_ADD;
+        a6 = a6 * FMA_MUL + FMA_ADD;
+        a7 = a7 * FMA_MUL + FMA_ADD;
+    }
+
+    return a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7;
+}
+
+static double fma_avx2(void)
+{
+    __m256d m = _mm256_set1_pd(FMA_MUL), c = _mm256_set1_pd(FMA_ADD);
+    __m256d a0 = _mm256_set1_pd(1.0), a1 = _mm256_set1_pd(1.1), a2 = _mm256_set1_pd(1.2), a3 = _mm256_set1_pd(1.3);
+    __m256d a4 = _mm256_set1_pd(1.4), a5 = _mm256_set1_pd(1.5), a6 = _mm256_set1_pd(1.6), a7 = _mm256_set1_pd(1.7);
+    double out[4];
+
+    for (int i = 0; i < FMA_CHUNK; i++)
+    {
+        a0 = _mm256_fmadd_pd(a0, m, c);
+        a1 = _mm256_fmadd_pd(a1, m, c);
+        a2 = _mm256_fmadd_pd(a2, m, c);
+        a3 = _mm256_fmadd_pd(a3, m, c);
+        a4 = _mm256_fmadd_pd(a4, m, c);
+        a5 = _mm256_fmadd_pd(a5, m, c);
+        a6 = _mm256_fmadd_pd(a6, m, c);
+        a7 = _mm256_fmadd_pd(a7, m, c);
+    }
+
+    a0 = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3)),
+                       _mm256_add_pd(_mm256_add_pd(a4, a5), _mm256_add_pd(a6, a7)));
+    _mm256_storeu_pd(out, a0);
+
+    return out[0] + out[1] + out[2] + out[3];
+}
+
+static double fma_avx512(void)
+{
+    __m512d m = _mm512_set1_pd(FMA_MUL), c = _mm512_set1_pd(FMA_ADD);
+    __m512d a0 = _mm512_set1_pd(1.0), a1 = _mm512_set1_pd(1.1), a2 = _mm512_set1_pd(1.2), a3 = _mm512_set1_pd(1.3);
+    __m512d a4 = _mm512_set1_pd(1.4), a5 = _mm512_set1_pd(1.5), a6 = _mm512_set1_pd(1.6), a7 = _mm512_set1_pd(1.7);
+
+    for (int i = 0; i < FMA_CHUNK; i++)
+    {
+        a0 = _mm512_fmadd_pd(a0, m, c);
+        a1 = _mm512_fmadd_pd(a1, m, c);
+        a2 = _mm512_fmadd_pd(a2, m, c);
+        a3 = _mm512_fmadd_pd(a3, m, c);
+        a4 = _mm512_fmadd_pd(a4, m, c);
+        a5 = _mm512_fmadd_pd(a5, m, c);
+        a6 = _mm512_fmadd_pd(a6, m, c);
+        a7 = _mm512_fmadd_pd(a7, m, c);
+    }
+
+    a0 = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(a0, a1), _mm512_add_pd(a2, a3)),
+                       _mm512_add_pd(_mm512_add_pd(a4, a5), _mm512_add_pd(a6, a7)));
+
+    return _mm512_reduce_add_pd(a0);
+}
+
+/**
+ * int_chains - Multiply, add, shift and xor, 4 operations per step.
+*/
+static UINT64 int_chains(UINT64 seed)
+{
+    UINT64 x0 = seed, x1 = seed ^ 0x5555, x2 = seed ^ 0xaaaa, x3 = seed ^ 0xffff;
+
+    for (UINT64 i = 0; i < INT_CHUNK; i++)
+    {
+        x0 = x0 * 0x9e3779b97f4a7c15ull + i;
+        x1 = x1 * 0xbf58476d1ce4e5b9ull + i;
+        x2 = x2 * 0x94d049bb133111ebull + i;
+        x3 = x3 * 0xd6e8feb86659fd93ull + i;
+        x0 ^= x0 >> 29;
+        x1 ^= x1 >> 31;
+        x2 ^= x2 >> 27;
+        x3 ^= x3 >> 33;
+    }
+
+    return x0 ^ x1 ^ x2 ^ x3;
+}
+
+/**
+ * cache_thrash - Read modify write of random words, the loads do not
+ * wait on each other, so many misses are in flight.
+*/
+static UINT64 cache_thrash(UINT64 *buffer, UINT64 *random)
+{
+    const UINT64 mask = CPU_CACHE_BUFFER / sizeof(UINT64) - 1;
+    UINT64 r = *random;
+
+    for (int i = 0; i < CACHE_CHUNK; i++)
+    {
+        r = xorshift(r);
+        buffer[r & mask] += r;
+    }
+
+    *random = r;
+
+    return buffer[r & mask];
+}
+
+/**
+ * branch_random - A switch on 2 random bits, 3 of 4 jumps go wrong.
+*/
+static UINT64 branch_random(UINT64 *random)
+{
+    UINT64 r = *random, a = 0;
+
+    for (int i = 0; i < BRANCH_CHUNK; i++)
+    {
+        r = xorshift(r);
+
+        switch (r & 3)
+        {
+        case 0:  a += r;            break;
+        case 1:  a ^= r >> 7;       break;
+        case 2:  a -= r << 3;       break;
+        default: a = a * 3 + 1;     break;
+        }
+    }
+
+    *random = r;
+
+    return a;
+}
+
+/**
+ * cpu_kernel_init - State of a kernel for one thread.
+*/
+int cpu_kernel_init(CPU_KERNEL *state, int kernel, int isa, UINT32 seed)
+{
+    ZeroMemory(state, sizeof(*state));
+
+    if (!cpu_isa_supported(isa))
+        return -1;
+
+    state->kernel = kernel;
+    state->isa    = isa;
+    state->random = ((UINT64)seed + 1) * 0x9e3779b97f4a7c15ull;
+
+    if (CPU_KERNEL_CACHE == kernel || CPU_KERNEL_MIX == kernel)
+    {
+        state->buffer = (UINT64 *)VirtualAlloc(NULL, CPU_CACHE_BUFFER, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (NULL == state->buffer)
+        {
+            printf("Error in VirtualAlloc: %d.\n", GetLastError());
+            return -1;
+        }
+
+        memset(state->buffer, 1, CPU_CACHE_BUFFER);
+    }
+
+    return 0;
+}
+
+/**
+ * cpu_kernel_free - Free the buffer of cache.
+*/
+void cpu_kernel_free(CPU_KERNEL *state)
+{
+    if (NULL != state->buffer)
+        VirtualFree(state->buffer, 0, MEM_RELEASE);
+
+    state->buffer = NULL;
+}
+
+/**
+ * cpu_kernel_run - One chunk, return the operations done, *ran gets the
+ * kernel, mix runs the next one every time.
+*/
+UINT64 cpu_kernel_run(CPU_KERNEL *state, int *ran)
+{
+    int kernel = state->kernel;
+    int lanes  = 1;
+
+    if (CPU_KERNEL_MIX == kernel)
+    {
+        kernel      = state->next;
+        state->next = (state->next + 1) % CPU_KERNEL_MIX;
+    }
+
+    *ran = kernel;
+
+    switch (kernel)
+    {
+    case CPU_KERNEL_FMA:
+        if (MEM_ISA_AVX512 == state->isa)
+        {
+            state->sink += fma_avx512();
+            lanes        = 8;
+        }
+        else if (MEM_ISA_AVX2 == state->isa)
+        {
+            state->sink += fma_avx2();
+            lanes        = 4;
+        }
+        else
+        {
+            state->sink += fma_scalar();
+        }
+
+        return (UINT64)FMA_CHUNK * 8 * 2 * lanes;
+
+    case CPU_KERNEL_INT:
+        state->random = xorshift(state->random);
+        state->sink  += (double)int_chains(state->random);
+        return (UINT64)INT_CHUNK * 4 * 4;
+
+    case CPU_KERNEL_CACHE:
+        state->sink += (double)cache_thrash(state->buffer, &state->random);
+        return CACHE_CHUNK;
+
+    default:
+        state->sink += (double)branch_random(&state->random);
+        return BRANCH_CHUNK;
+    }
+}
+
+/**
+ * cpu_kernel_name - Name of a kernel.
+*/
+const char *cpu_kernel_name(int kernel)
+{
+    if (0 > kernel || CPU_KERNEL_COUNT <= kernel)
+        return "unknown";
+
+    return kernelNames[kernel];
+}
+
+/**
+ * cpu_kernel_parse - Kernel from its name.
+*/
+int cpu_kernel_parse(const char *name, int *kernel)
+{
+    for (int i = 0; i < CPU_KERNEL_COUNT; i++)
+    {
+        if (0 == strcmp(name, kernelNames[i]))
+        {
+            *kernel = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,70 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      cpukernel.h
+ *
+ * Abstract:
+ *      Stress kernels that load different parts of a core, for heat and
+ *      clock throttling that depends on the work:
+ *
+ *      fma    - Independent multiply add chains, scalar, AVX2 + FMA or
+ *               AVX-512. Wide vectors draw the most power, many cores
+ *               lower their clock for AVX-512.
+ *      int    - Integer multiply, xor and shift chains.
+ *      cache  - Random read modify write over a buffer past the L2.
+ *      branch - A switch on random bits, most jumps are mispredicted.
+ *      mix    - The four in turn.
+ *
+ *      Every run is a short chunk, some microseconds, and tells the
+ *      operations it did: flops for fma, operations for int, accesses for
+ *      cache and branches for branch. The instruction set applies to fma,
+ *      it is checked with mem_isa_supported() of memkernel.h.
+ *
+ * Reference:
+ * https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+*/
+
+#ifndef __CPUKERNEL_H__
+#define __CPUKERNEL_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+#include "memkernel.h"
+
+
+#define CPU_KERNEL_FMA                  0
+#define CPU_KERNEL_INT                  1
+#define CPU_KERNEL_CACHE                2
+#define CPU_KERNEL_BRANCH               3
+#define CPU_KERNEL_MIX                  4           // Runs the ones above.
+#define CPU_KERNEL_COUNT                5
+
+#define CPU_CACHE_BUFFER                (8 * 1024 * 1024)
+
+
+typedef struct _CPU_KERNEL {
+    int kernel;
+    int isa;                            // MEM_ISA_*, of fma.
+    int next;                           // Of mix.
+    UINT64 random;                      // xorshift state.
+    UINT64 *buffer;                     // Of cache.
+    double sink;
+} CPU_KERNEL;
+
+
+int cpu_isa_supported(int isa);
+
+int cpu_kernel_init(CPU_KERNEL *state, int kernel, int isa, UINT32 seed);
+void cpu_kernel_free(CPU_KERNEL *state);
+UINT64 cpu_kernel_run(CPU_KERNEL *state, int *ran);
+
+const char *cpu_kernel_name(int kernel);
+int cpu_kernel_parse(const char *name, int *kernel);
+
+
+#endif /* __CPUKERNEL_H__ */
@@ -0,0 +1,132 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      cpuload.cpp
+ *
+ * Abstract:
+ *      Load profiles and per processor busy time.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/winternl/nf-winternl-ntquerysysteminformation
+*/
+
+#include <iostream>
+#include <math.h>
+#include <winternl.h>
+
+#include "cpuload.h"
+
+#pragma comment(lib, "ntdll.lib")
+
+
+static const char *shapeNames[] = { "const", "ramp", "sine", "step" };
+
+
+/**
+ * load_profile_at - Load wanted at a time since the start, 0 to 1.
+*/
+double load_profile_at(const LOAD_PROFILE *profile, UINT64 elapsedMs)
+{
+    double span = profile->high - profile->low;
+    double phase;
+
+    if (LOAD_CONST == profile->shape || 0 == profile->periodMs)
+        return profile->high;
+
+    phase = (double)(elapsedMs % profile->periodMs) / profile->periodMs;
+
+    switch (profile->shape)
+    {
+    case LOAD_RAMP:
+        if (elapsedMs >= profile->periodMs)
+            return profile->high;
+
+        return profile->low + span * phase;
+
+    case LOAD_SINE:
+        /* Starts at low, high at half the period. */
+        return profile->low + span * (1 - cos(2 * 3.14159265358979 * phase)) / 2;
+
+    case LOAD_STEP:
+        return profile->low + span * (int)(phase * LOAD_STEP_LEVELS) / (LOAD_STEP_LEVELS - 1);
+
+    default:
+        return profile->high;
+    }
+}
+
+/**
+ * load_shape_name - Name of a profile shape.
+*/
+const char *load_shape_name(int shape)
+{
+    if (0 > shape || LOAD_SHAPES <= shape)
+        return "unknown";
+
+    return shapeNames[shape];
+}
+
+/**
+ * load_shape_parse - Profile shape from its name.
+*/
+int load_shape_parse(const char *name, int *shape)
+{
+    for (int i = 0; i < LOAD_SHAPES; i++)
+    {
+        if (0 == strcmp(name, shapeNames[i]))
+        {
+            *shape = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * cpu_sample_read - Busy and total time of the processors of the group.
+ *
+ * Kernel time includes the idle time, busy is kernel plus user minus idle.
+*/
+int cpu_sample_read(CPU_SAMPLE *sample)
+{
+    SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION info[CPU_SAMPLE_MAX];
+    ULONG length = 0;
+    NTSTATUS status;
+
+    status = NtQuerySystemInformation(SystemProcessorPerformanceInformation, info, sizeof(info), &length);
+    if (0 > status)
+    {
+        printf("Error in NtQuerySystemInformation: 0x%x.\n", (unsigned)status);
+        return -1;
+    }
+
+    sample->count = (int)(length / sizeof(info[0]));
+
+    for (int i = 0; i < sample->count; i++)
+    {
+        sample->total[i] = info[i].KernelTime.QuadPart + info[i].UserTime.QuadPart;
+        sample->busy[i]  = sample->total[i] - info[i].IdleTime.QuadPart;
+    }
+
+    return 0;
+}
+
+/**
+ * cpu_sample_usage - Busy share of a processor between two samples, 0 to 1,
+ * -1 if no time was counted.
+*/
+double cpu_sample_usage(const CPU_SAMPLE *before, const CPU_SAMPLE *after, int processor)
+{
+    UINT64 total;
+
+    if (processor >= before->count || processor >= after->count)
+        return -1;
+
+    total = after->total[processor] - before->total[processor];
+    if (0 == total)
+        return -1;
+
+    return (double)(after->busy[processor] - before->busy[processor]) / total;
+}
@@ -0,0 +1,62 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      cpuload.h
+ *
+ * Abstract:
+ *      Load profiles over time, constant, ramp, sine and step, and the busy
+ *      time of every processor read from the system, for a load generator
+ *      that corrects itself against what the processors really did.
+ *
+ *      cpu_sample_read() returns the idle, kernel and user time of the
+ *      processors of the group of the calling thread, the same numbers
+ *      Task Manager shows per logical processor.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/winternl/nf-winternl-ntquerysysteminformation
+*/
+
+#ifndef __CPULOAD_H__
+#define __CPULOAD_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define LOAD_CONST                      0           // High all the time.
+#define LOAD_RAMP                       1           // Low to high in a period, then high.
+#define LOAD_SINE                       2           // Between low and high, one wave a period.
+#define LOAD_STEP                       3           // Stairs from low to high every period.
+#define LOAD_SHAPES                     4
+
+#define LOAD_STEP_LEVELS                5
+#define CPU_SAMPLE_MAX                  64          // Processors in a group.
+
+
+typedef struct _LOAD_PROFILE {
+    int shape;
+    double low;                         // 0 to 1.
+    double high;                        // 0 to 1.
+    UINT64 periodMs;
+} LOAD_PROFILE;
+
+typedef struct _CPU_SAMPLE {
+    int count;
+    UINT64 busy[CPU_SAMPLE_MAX];        // 100 ns units.
+    UINT64 total[CPU_SAMPLE_MAX];
+} CPU_SAMPLE;
+
+
+double load_profile_at(const LOAD_PROFILE *profile, UINT64 elapsedMs);
+const char *load_shape_name(int shape);
+int load_shape_parse(const char *name, int *shape);
+
+int cpu_sample_read(CPU_SAMPLE *sample);
+double cpu_sample_usage(const CPU_SAMPLE *before, const CPU_SAMPLE *after, int processor);
+
+
+#endif /* __CPULOAD_H__ */
@@ -0,0 +1,349 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      footprint.cpp
+ *
+ * Abstract:
+ *      Memory footprint held on a goal by feedback.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/psapi/nf-psapi-getprocessmemoryinfo
+*/
+
+#include <iostream>
+#include <psapi.h>
+
+#include "footprint.h"
+#include "largepage.h"
+
+#pragma comment(lib, "Psapi.lib")
+
+
+#define PAGE_BYTES                      4096
+
+
+/**
+ * footprint_init - Controller with no memory held yet.
+ *
+ * Ramp goes from low to target, oscillate between them. low is ignored
+ * by hold.
+*/
+int footprint_init(FOOTPRINT *fp, int source, int profile, UINT64 target, UINT64 low, UINT64 periodMs, int pageKind)
+{
+    if (low > target || (FOOTPRINT_HOLD != profile && 0 == periodMs))
+        return -1;
+
+    ZeroMemory(fp, sizeof(*fp));
+
+    fp->source      = source;
+    fp->profile     = profile;
+    fp->pageKind    = pageKind;
+    fp->target      = target;
+    fp->low         = low;
+    fp->periodMs    = periodMs;
+
+    return 0;
+}
+
+/**
+ * footprint_chunk_size - Bytes of a chunk, one page of the kind at least.
+*/
+static SIZE_T footprint_chunk_size(int kind)
+{
+    SIZE_T size = page_size(kind);
+
+    return (FOOTPRINT_CHUNK > size) ? FOOTPRINT_CHUNK : size;
+}
+
+/**
+ * footprint_free_chunk - Free the last chunk of either allocator.
+*/
+static void footprint_free_chunk(FOOTPRINT *fp)
+{
+    FOOTPRINT_BLOCK *chunk = &fp->chunks[--fp->chunkCount];
+
+    if (!page_free(chunk->base))
+        VirtualFree(chunk->base, 0, MEM_RELEASE);
+
+    fp->held -= chunk->size;
+}
+
+/**
+ * footprint_release - Free all held memory.
+*/
+void footprint_release(FOOTPRINT *fp)
+{
+    while (0 < fp->chunkCount)
+        footprint_free_chunk(fp);
+
+    free(fp->chunks);
+
+    fp->chunks      = NULL;
+    fp->chunkCount  = 0;
+    fp->chunkMax    = 0;
+}
+
+/**
+ * footprint_goal - Bytes wanted at a time since the start.
+*/
+UINT64 footprint_goal(const FOOTPRINT *fp, UINT64 elapsedMs)
+{
+    UINT64 span = fp->target - fp->low;
+    UINT64 half = fp->periodMs / 2;
+    UINT64 phase;
+
+    switch (fp->profile)
+    {
+    case FOOTPRINT_RAMP:
+        if (elapsedMs >= fp->periodMs)
+            return fp->target;
+
+        return fp->low + (UINT64)((double)span * elapsedMs / fp->periodMs);
+
+    case FOOTPRINT_OSCILLATE:
+        /* Triangle, up in the first half of the period, down in the second. */
+        phase = elapsedMs % fp->periodMs;
+
+        if (0 == half)
+            return fp->target;
+
+        if (phase < half)
+            return fp->low + (UINT64)((double)span * phase / half);
+
+        return fp->target - (UINT64)((double)span * (phase - half) / half);
+
+    default:
+        return fp->target;
+    }
+}
+
+/**
+ * footprint_measure - Memory of the process and the system now.
+*/
+int footprint_measure(FOOTPRINT_SAMPLE *sample)
+{
+    PROCESS_MEMORY_COUNTERS_EX pmc;
+    MEMORYSTATUSEX status;
+
+    ZeroMemory(&pmc, sizeof(pmc));
+    pmc.cb = sizeof(pmc);
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&pmc, sizeof(pmc)))
+    {
+        printf("Error in GetProcessMemoryInfo: %d.\n", GetLastError());
+        return -1;
+    }
+
+    ZeroMemory(&status, sizeof(status));
+    status.dwLength = sizeof(status);
+
+    if (!GlobalMemoryStatusEx(&status))
+    {
+        printf("Error in GlobalMemoryStatusEx: %d.\n", GetLastError());
+        return -1;
+    }
+
+    sample->workingSet  = pmc.WorkingSetSize;
+    sample->commit      = pmc.PrivateUsage;
+    sample->systemUsed  = status.ullTotalPhys - status.ullAvailPhys;
+    sample->systemTotal = status.ullTotalPhys;
+
+    return 0;
+}
+
+/**
+ * footprint_touch - Write a byte of every page, trimmed pages come back.
+ *
+ * Large and huge pages are locked, they are never trimmed. A chunk that
+ * fell back to small pages is not locked and is touched.
+*/
+static void footprint_touch(FOOTPRINT *fp)
+{
+    for (int i = 0; i < fp->chunkCount; i++)
+    {
+        volatile char *chunk = fp->chunks[i].base;
+
+        if (PAGES_SMALL != fp->chunks[i].kind)
+            continue;
+
+        for (SIZE_T offset = 0; offset < fp->chunks[i].size; offset += PAGE_BYTES)
+            chunk[offset] = 1;
+    }
+}
+
+/**
+ * footprint_grow - Allocate and touch chunks, stop at the first refused.
+*/
+static void footprint_grow(FOOTPRINT *fp, int count, SIZE_T size)
+{
+    FOOTPRINT_BLOCK *chunks;
+    char *chunk;
+    int kind = PAGES_SMALL;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (fp->chunkCount == fp->chunkMax)
+        {
+            chunks = (FOOTPRINT_BLOCK *)realloc(fp->chunks, (fp->chunkMax + 64) * sizeof(FOOTPRINT_BLOCK));
+            if (NULL == chunks)
+                return;
+
+            fp->chunks    = chunks;
+            fp->chunkMax += 64;
+        }
+
+        if (PAGES_SMALL == fp->pageKind)
+            chunk = (char *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        else
+            chunk = (char *)page_alloc(size, fp->pageKind, -1, &kind);
+
+        /* Commit limit of the system or of a job. */
+        if (NULL == chunk)
+        {
+            fp->failures++;
+            return;
+        }
+
+        /* A fallback kind rounds to its own pages, the size stays. */
+        memset(chunk, 1, size);
+
+        fp->chunks[fp->chunkCount].base = chunk;
+        fp->chunks[fp->chunkCount].size = page_round(size, kind);
+        fp->chunks[fp->chunkCount].kind = kind;
+
+        fp->held += fp->chunks[fp->chunkCount++].size;
+    }
+}
+
+/**
+ * footprint_step - Measure, then allocate or free toward the goal.
+ *
+ * Half the gap is closed per step: the measure lags the allocations,
+ * and with the system as source other processes move it too, so the
+ * full gap would overshoot and swing. With huge pages a chunk is 1 GiB,
+ * the goal is held to a chunk and a step moves one at least.
+*/
+int footprint_step(FOOTPRINT *fp, UINT64 elapsedMs, FOOTPRINT_SAMPLE *sample)
+{
+    SIZE_T size = footprint_chunk_size(fp->pageKind);
+    INT64 maxStep = (FOOTPRINT_MAX_STEP > size) ? FOOTPRINT_MAX_STEP : (INT64)size;
+    INT64 delta;
+    int count;
+
+    footprint_touch(fp);
+
+    if (0 != footprint_measure(sample))
+        return -1;
+
+    sample->goal = footprint_goal(fp, elapsedMs);
+
+    /* Locked large pages are not in the working set, it would never rise. */
+    if (FOOTPRINT_SYSTEM == fp->source)
+        sample->measured = sample->systemUsed;
+    else if (PAGES_SMALL != fp->pageKind)
+        sample->measured = sample->commit;
+    else
+        sample->measured = sample->workingSet;
+
+    delta = ((INT64)sample->goal - (INT64)sample->measured) / 2;
+
+    if (delta > maxStep)
+        delta = maxStep;
+    else if (delta < -maxStep)
+        delta = -maxStep;
+
+    count = (int)(delta / (INT64)size);
+
+    if (0 < count)
+    {
+        footprint_grow(fp, count, size);
+    }
+    else
+    {
+        for (; 0 > count && 0 < fp->chunkCount; count++)
+            footprint_free_chunk(fp);
+    }
+
+    sample->held = fp->held;
+
+    return 0;
+}
+
+/**
+ * footprint_parse_size - MiB, or percent of the physical memory with '%'.
+*/
+int footprint_parse_size(const char *value, UINT64 *bytes)
+{
+    MEMORYSTATUSEX status;
+    char *end = NULL;
+    UINT64 number = _strtoui64(value, &end, 10);
+
+    if (end == value || 0 == number)
+        return -1;
+
+    if (0 == strcmp(end, "%"))
+    {
+        if (100 < number)
+            return -1;
+
+        ZeroMemory(&status, sizeof(status));
+        status.dwLength = sizeof(status);
+
+        if (!GlobalMemoryStatusEx(&status))
+            return -1;
+
+        *bytes = status.ullTotalPhys / 100 * number;
+        return 0;
+    }
+
+    if ('\0' != *end)
+        return -1;
+
+    *bytes = number * 1024 * 1024;
+
+    return 0;
+}
+
+/**
+ * footprint_limit_job - Run the process in a job with a memory limit.
+ *
+ * The limit is on committed memory, allocations fail past it. Windows 8
+ * and later nest jobs, so this works inside another job too.
+*/
+int footprint_limit_job(UINT64 bytes)
+{
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION info;
+    HANDLE job = CreateJobObject(NULL, NULL);
+    int status = -1;
+
+    if (NULL == job)
+    {
+        printf("Error in CreateJobObject: %d.\n", GetLastError());
+        return -1;
+    }
+
+    ZeroMemory(&info, sizeof(info));
+    info.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_JOB_MEMORY;
+    info.JobMemoryLimit                   = (SIZE_T)bytes;
+
+    if (!SetInformationJobObject(job, JobObjectExtendedLimitInformation, &info, sizeof(info)))
+    {
+        printf("Error in SetInformationJobObject: %d.\n", GetLastError());
+        goto out;
+    }
+
+    if (!AssignProcessToJobObject(job, GetCurrentProcess()))
+    {
+        printf("Error in AssignProcessToJobObject: %d.\n", GetLastError());
+        goto out;
+    }
+
+    status = 0;
+
+out:
+    /* The job lives on while the process is in it. */
+    CloseHandle(job);
+
+    return status;
+}
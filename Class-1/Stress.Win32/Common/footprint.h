@@ -0,0 +1,91 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      footprint.h
+ *
+ * Abstract:
+ *      Holds a memory footprint on a goal with a feedback loop: every step
+ *      measures the resident memory, of the process or of the whole
+ *      system, and allocates or frees chunks to close the gap. Large and
+ *      huge pages are locked and not counted in the working set, the
+ *      process is then measured by its private bytes. A chunk is at
+ *      least one page, 1 GiB with huge pages.
+ *
+ *      The goal holds, ramps up to the target or oscillates between a low
+ *      level and the target. Held chunks are touched every step, pages
+ *      the memory manager trimmed come back and are measured again.
+ *
+ *      footprint_limit_job() puts the process in a job with a memory
+ *      limit, allocations past it fail as they do for a service in one.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/psapi/nf-psapi-getprocessmemoryinfo
+ * https://docs.microsoft.com/en-us/windows/win32/api/sysinfoapi/nf-sysinfoapi-globalmemorystatusex
+ * https://docs.microsoft.com/en-us/windows/win32/procthread/job-objects
+*/
+
+#ifndef __FOOTPRINT_H__
+#define __FOOTPRINT_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define FOOTPRINT_SELF                  0           // Working set, private bytes with large pages.
+#define FOOTPRINT_SYSTEM                1           // Physical memory in use, all processes.
+
+#define FOOTPRINT_HOLD                  0           // Target from the start.
+#define FOOTPRINT_RAMP                  1           // Straight up to the target in a period.
+#define FOOTPRINT_OSCILLATE             2           // Low to target and back every period.
+
+#define FOOTPRINT_CHUNK                 (4 * 1024 * 1024)   // At least one page of the kind.
+#define FOOTPRINT_MAX_STEP              (256 * 1024 * 1024) // At least one chunk.
+
+
+typedef struct _FOOTPRINT_BLOCK {
+    char *base;
+    SIZE_T size;                        // Bytes committed, whole pages.
+    int kind;                           // Pages granted, see largepage.h.
+} FOOTPRINT_BLOCK;
+
+typedef struct _FOOTPRINT {
+    int source;                         // FOOTPRINT_SELF or FOOTPRINT_SYSTEM.
+    int profile;                        // FOOTPRINT_HOLD, _RAMP or _OSCILLATE.
+    int pageKind;                       // Pages of the chunks, see largepage.h.
+    UINT64 target;                      // Bytes.
+    UINT64 low;                         // Bytes, bottom of the oscillation.
+    UINT64 periodMs;                    // Ramp time or oscillation period.
+    FOOTPRINT_BLOCK *chunks;
+    int chunkCount;
+    int chunkMax;
+    UINT64 held;                        // Bytes of the chunks.
+    int failures;                       // Allocations refused.
+} FOOTPRINT;
+
+typedef struct _FOOTPRINT_SAMPLE {
+    UINT64 goal;                        // Bytes wanted now.
+    UINT64 measured;                    // Of the source.
+    UINT64 held;                        // Bytes of the chunks.
+    UINT64 workingSet;                  // Of the process.
+    UINT64 commit;                      // Private bytes of the process.
+    UINT64 systemUsed;                  // Physical memory in use.
+    UINT64 systemTotal;
+} FOOTPRINT_SAMPLE;
+
+
+int footprint_init(FOOTPRINT *fp, int source, int profile, UINT64 target, UINT64 low, UINT64 periodMs, int pageKind);
+void footprint_release(FOOTPRINT *fp);
+
+UINT64 footprint_goal(const FOOTPRINT *fp, UINT64 elapsedMs);
+int footprint_measure(FOOTPRINT_SAMPLE *sample);
+int footprint_step(FOOTPRINT *fp, UINT64 elapsedMs, FOOTPRINT_SAMPLE *sample);
+
+int footprint_parse_size(const char *value, UINT64 *bytes);
+int footprint_limit_job(UINT64 bytes);
+
+
+#endif /* __FOOTPRINT_H__ */
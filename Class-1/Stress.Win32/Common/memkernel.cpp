@@ -0,0 +1,443 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      memkernel.cpp
+ *
+ * Abstract:
+ *      Bandwidth kernels and pointer chase.
+ *
+ * Reference:
+ * https://www.cs.virginia.edu/stream/ref.html
+*/
+
+#include <iostream>
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "memkernel.h"
+
+
+#define XCR0_AVX                        0x06        // XMM and YMM state.
+#define XCR0_AVX512                     0xe6        // Plus opmask and ZMM state.
+
+
+static const char *kernelNames[] = { "read", "write", "copy", "triad" };
+static const char *isaNames[]    = { "scalar", "avx2", "avx512" };
+static const int kernelArrays[]  = { 1, 1, 2, 3 };
+
+
+/**
+ * mem_isa_supported - Check cpuid and the state the OS saves.
+*/
+int mem_isa_supported(int isa)
+{
+    int regs[4];
+    UINT64 xcr0;
+
+    if (MEM_ISA_SCALAR == isa)
+        return 1;
+
+    /* OSXSAVE and AVX. */
+    __cpuid(regs, 1);
+    if ((1 << 27 | 1 << 28) != (regs[2] & (1 << 27 | 1 << 28)))
+        return 0;
+
+    xcr0 = _xgetbv(0);
+    __cpuidex(regs, 7, 0);
+
+    if (MEM_ISA_AVX2 == isa)
+        return XCR0_AVX == (xcr0 & XCR0_AVX) && 0 != (regs[1] & (1 << 5));
+
+    if (MEM_ISA_AVX512 == isa)
+        return XCR0_AVX512 == (xcr0 & XCR0_AVX512) && 0 != (regs[1] & (1 << 16));
+
+    return 0;
+}
+
+/**
+ * mem_isa_best - Widest instruction set this cpu and OS run.
+*/
+int mem_isa_best(void)
+{
+    for (int isa = MEM_ISA_COUNT - 1; isa > MEM_ISA_SCALAR; isa--)
+    {
+        if (mem_isa_supported(isa))
+            return isa;
+    }
+
+    return MEM_ISA_SCALAR;
+}
+
+/**
+ * mem_kernel_arrays - Arrays a kernel works on.
+*/
+int mem_kernel_arrays(int kernel)
+{
+    return kernelArrays[kernel];
+}
+
+/* Scalar, SSE2 streaming stores stand in for the non-temporal version. */
+
+static double read_scalar(const double *a, SIZE_T count)
+{
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+
+    for (SIZE_T i = 0; i < count; i += 4)
+    {
+        s0 += a[i];
+        s1 += a[i + 1];
+        s2 += a[i + 2];
+        s3 += a[i + 3];
+    }
+
+    return s0 + s1 + s2 + s3;
+}
+
+static void write_scalar(double *a, SIZE_T count, double s, BOOL nontemporal)
+{
+    __m128d v = _mm_set1_pd(s);
+
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 2)
+            _mm_stream_pd(a + i, v);
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i++)
+        a[i] = s;
+}
+
+static void copy_scalar(const double *a, double *b, SIZE_T count, BOOL nontemporal)
+{
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 2)
+            _mm_stream_pd(b + i, _mm_load_pd(a + i));
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i++)
+        b[i] = a[i];
+}
+
+static void triad_scalar(double *a, const double *b, const double *c, SIZE_T count, double s, BOOL nontemporal)
+{
+    __m128d vs = _mm_set1_pd(s);
+
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 2)
+            _mm_stream_pd(a + i, _mm_add_pd(_mm_load_pd(b + i), _mm_mul_pd(vs, _mm_load_pd(c + i))));
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i++)
+        a[i] = b[i] + s * c[i];
+}
+
+/* AVX2, 32 byte vectors. */
+
+static double read_avx2(const double *a, SIZE_T count)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    double lanes[4];
+
+    for (SIZE_T i = 0; i < count; i += 16)
+    {
+        s0 = _mm256_add_pd(s0, _mm256_load_pd(a + i));
+        s1 = _mm256_add_pd(s1, _mm256_load_pd(a + i + 4));
+        s2 = _mm256_add_pd(s2, _mm256_load_pd(a + i + 8));
+        s3 = _mm256_add_pd(s3, _mm256_load_pd(a + i + 12));
+    }
+
+    _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static void write_avx2(double *a, SIZE_T count, double s, BOOL nontemporal)
+{
+    __m256d v = _mm256_set1_pd(s);
+
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 4)
+            _mm256_stream_pd(a + i, v);
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i += 4)
+        _mm256_store_pd(a + i, v);
+}
+
+static void copy_avx2(const double *a, double *b, SIZE_T count, BOOL nontemporal)
+{
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 4)
+            _mm256_stream_pd(b + i, _mm256_load_pd(a + i));
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i += 4)
+        _mm256_store_pd(b + i, _mm256_load_pd(a + i));
+}
+
+static void triad_avx2(double *a, const double *b, const double *c, SIZE_T count, double s, BOOL nontemporal)
+{
+    __m256d vs = _mm256_set1_pd(s);
+
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 4)
+            _mm256_stream_pd(a + i, _mm256_add_pd(_mm256_load_pd(b + i), _mm256_mul_pd(vs, _mm256_load_pd(c + i))));
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i += 4)
+        _mm256_store_pd(a + i, _mm256_add_pd(_mm256_load_pd(b + i), _mm256_mul_pd(vs, _mm256_load_pd(c + i))));
+}
+
+/* AVX-512, 64 byte vectors, one cache line per store. */
+
+static double read_avx512(const double *a, SIZE_T count)
+{
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+
+    for (SIZE_T i = 0; i < count; i += 16)
+    {
+        s0 = _mm512_add_pd(s0, _mm512_load_pd(a + i));
+        s1 = _mm512_add_pd(s1, _mm512_load_pd(a + i + 8));
+    }
+
+    return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+}
+
+static void write_avx512(double *a, SIZE_T count, double s, BOOL nontemporal)
+{
+    __m512d v = _mm512_set1_pd(s);
+
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 8)
+            _mm512_stream_pd(a + i, v);
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i += 8)
+        _mm512_store_pd(a + i, v);
+}
+
+static void copy_avx512(const double *a, double *b, SIZE_T count, BOOL nontemporal)
+{
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 8)
+            _mm512_stream_pd(b + i, _mm512_load_pd(a + i));
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i += 8)
+        _mm512_store_pd(b + i, _mm512_load_pd(a + i));
+}
+
+static void triad_avx512(double *a, const double *b, const double *c, SIZE_T count, double s, BOOL nontemporal)
+{
+    __m512d vs = _mm512_set1_pd(s);
+
+    if (nontemporal)
+    {
+        for (SIZE_T i = 0; i < count; i += 8)
+            _mm512_stream_pd(a + i, _mm512_add_pd(_mm512_load_pd(b + i), _mm512_mul_pd(vs, _mm512_load_pd(c + i))));
+        return;
+    }
+
+    for (SIZE_T i = 0; i < count; i += 8)
+        _mm512_store_pd(a + i, _mm512_add_pd(_mm512_load_pd(b + i), _mm512_mul_pd(vs, _mm512_load_pd(c + i))));
+}
+
+/**
+ * mem_kernel_run - One pass of a kernel over count doubles per array.
+ *
+ * Return the bytes the kernel reads and writes, counted as STREAM does:
+ * the read for ownership of cached stores is not counted. The read
+ * kernel adds its sum to *sink.
+*/
+UINT64 mem_kernel_run(int kernel, int isa, BOOL nontemporal, double *a, double *b, double *c, SIZE_T count, double *sink)
+{
+    const double s = 3.0;
+
+    switch (kernel)
+    {
+    case MEM_KERNEL_READ:
+        if (MEM_ISA_AVX512 == isa)
+            *sink += read_avx512(a, count);
+        else if (MEM_ISA_AVX2 == isa)
+            *sink += read_avx2(a, count);
+        else
+            *sink += read_scalar(a, count);
+        break;
+
+    case MEM_KERNEL_WRITE:
+        if (MEM_ISA_AVX512 == isa)
+            write_avx512(a, count, s, nontemporal);
+        else if (MEM_ISA_AVX2 == isa)
+            write_avx2(a, count, s, nontemporal);
+        else
+            write_scalar(a, count, s, nontemporal);
+        break;
+
+    case MEM_KERNEL_COPY:
+        if (MEM_ISA_AVX512 == isa)
+            copy_avx512(a, b, count, nontemporal);
+        else if (MEM_ISA_AVX2 == isa)
+            copy_avx2(a, b, count, nontemporal);
+        else
+            copy_scalar(a, b, count, nontemporal);
+        break;
+
+    case MEM_KERNEL_TRIAD:
+        if (MEM_ISA_AVX512 == isa)
+            triad_avx512(a, b, c, count, s, nontemporal);
+        else if (MEM_ISA_AVX2 == isa)
+            triad_avx2(a, b, c, count, s, nontemporal);
+        else
+            triad_scalar(a, b, c, count, s, nontemporal);
+        break;
+
+    default:
+        return 0;
+    }
+
+    /* Streaming stores are weakly ordered, finish them before timing. */
+    if (nontemporal)
+        _mm_sfence();
+
+    return (UINT64)count * sizeof(double) * kernelArrays[kernel];
+}
+
+/**
+ * chase_init - Link the cache lines of a buffer in a random cycle.
+ *
+ * The first 8 bytes of every line point to the next line, the order is
+ * random so the prefetchers cannot guess it. Return the first line, NULL
+ * if out of memory.
+*/
+void *chase_init(void *buffer, SIZE_T bytes, UINT32 seed)
+{
+    SIZE_T lines = bytes / MEM_LINE;
+    SIZE_T j, tmp;
+    SIZE_T *order;
+    char *base = (char *)buffer;
+
+    if (0 == lines)
+        return NULL;
+
+    order = (SIZE_T *)malloc(lines * sizeof(SIZE_T));
+    if (NULL == order)
+    {
+        printf("Out of memory.\n");
+        return NULL;
+    }
+
+    for (SIZE_T i = 0; i < lines; i++)
+        order[i] = i;
+
+    /* Fisher-Yates with xorshift. */
+    for (SIZE_T i = lines - 1; i > 0; i--)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        j        = seed % (i + 1);
+        tmp      = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    for (SIZE_T i = 0; i < lines; i++)
+        *(void **)(base + order[i] * MEM_LINE) = base + order[(i + 1) % lines] * MEM_LINE;
+
+    base += order[0] * MEM_LINE;
+    free(order);
+
+    return base;
+}
+
+/**
+ * chase_run - Follow the chain, every load waits for the one before.
+*/
+void *chase_run(void *start, UINT64 steps)
+{
+    void **p = (void **)start;
+
+    for (UINT64 i = 0; i < steps; i += 4)
+    {
+        p = (void **)*p;
+        p = (void **)*p;
+        p = (void **)*p;
+        p = (void **)*p;
+    }
+
+    return p;
+}
+
+/**
+ * mem_kernel_name - Name of a kernel.
+*/
+const char *mem_kernel_name(int kernel)
+{
+    if (0 > kernel || MEM_KERNEL_COUNT <= kernel)
+        return "unknown";
+
+    return kernelNames[kernel];
+}
+
+/**
+ * mem_isa_name - Name of an instruction set.
+*/
+const char *mem_isa_name(int isa)
+{
+    if (0 > isa || MEM_ISA_COUNT <= isa)
+        return "unknown";
+
+    return isaNames[isa];
+}
+
+/**
+ * mem_kernel_parse - Kernel from its name.
+*/
+int mem_kernel_parse(const char *name, int *kernel)
+{
+    for (int i = 0; i < MEM_KERNEL_COUNT; i++)
+    {
+        if (0 == strcmp(name, kernelNames[i]))
+        {
+            *kernel = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * mem_isa_parse - Instruction set from its name.
+*/
+int mem_isa_parse(const char *name, int *isa)
+{
+    for (int i = 0; i < MEM_ISA_COUNT; i++)
+    {
+        if (0 == strcmp(name, isaNames[i]))
+        {
+            *isa = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,62 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      memkernel.h
+ *
+ * Abstract:
+ *      Memory bandwidth kernels in the manner of STREAM, read, write, copy
+ *      and triad, in scalar, AVX2 and AVX-512 versions with cached or
+ *      non-temporal stores, and a pointer chase for the load latency.
+ *
+ *      Non-temporal stores go around the caches: no read for ownership
+ *      of the destination lines, and the caches keep the source. They
+ *      only pay once the arrays are much larger than the last level cache.
+ *
+ *      Arrays must be 64 byte aligned, counts a multiple of 8 doubles.
+ *
+ * Reference:
+ * https://www.cs.virginia.edu/stream/ref.html
+ * https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+*/
+
+#ifndef __MEMKERNEL_H__
+#define __MEMKERNEL_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define MEM_KERNEL_READ                 0           // sum += a[i]
+#define MEM_KERNEL_WRITE                1           // a[i] = s
+#define MEM_KERNEL_COPY                 2           // b[i] = a[i]
+#define MEM_KERNEL_TRIAD                3           // a[i] = b[i] + s * c[i]
+#define MEM_KERNEL_COUNT                4
+
+#define MEM_ISA_SCALAR                  0
+#define MEM_ISA_AVX2                    1
+#define MEM_ISA_AVX512                  2
+#define MEM_ISA_COUNT                   3
+
+#define MEM_LINE                        64
+
+
+int mem_isa_supported(int isa);
+int mem_isa_best(void);
+
+int mem_kernel_arrays(int kernel);
+UINT64 mem_kernel_run(int kernel, int isa, BOOL nontemporal, double *a, double *b, double *c, SIZE_T count, double *sink);
+
+void *chase_init(void *buffer, SIZE_T bytes, UINT32 seed);
+void *chase_run(void *start, UINT64 steps);
+
+const char *mem_kernel_name(int kernel);
+const char *mem_isa_name(int isa);
+int mem_kernel_parse(const char *name, int *kernel);
+int mem_isa_parse(const char *name, int *isa);
+
+
+#endif /* __MEMKERNEL_H__ */
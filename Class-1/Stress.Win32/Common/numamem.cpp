@@ -0,0 +1,218 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      numamem.cpp
+ *
+ * Abstract:
+ *      NUMA nodes, node affinity and node local allocation.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualallocexnuma
+*/
+
+#include <iostream>
+#include <psapi.h>
+
+#include "numamem.h"
+
+#pragma comment(lib, "Psapi.lib")
+
+
+#define PAGE_BYTES                      4096
+#define MASK_BITS                       ((int)sizeof(KAFFINITY) * 8)
+
+
+/**
+ * numa_info_init - Nodes that have processors.
+*/
+int numa_info_init(NUMA_INFO *info)
+{
+    ULONG highest = 0;
+    GROUP_AFFINITY affinity;
+
+    ZeroMemory(info, sizeof(*info));
+
+    if (!GetNumaHighestNodeNumber(&highest))
+    {
+        printf("Error in GetNumaHighestNodeNumber: %d.\n", GetLastError());
+        return -1;
+    }
+
+    for (ULONG node = 0; node <= highest && info->nodeCount < NUMA_MAX_NODES; node++)
+    {
+        /* Nodes with memory only, or none at all, have an empty mask. */
+        if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) || 0 == affinity.Mask)
+            continue;
+
+        NUMA_NODE *entry = &info->nodes[info->nodeCount++];
+
+        entry->node     = (USHORT)node;
+        entry->affinity = affinity;
+
+        for (int bit = 0; bit < MASK_BITS; bit++)
+            entry->cpuCount += 0 != (affinity.Mask & ((KAFFINITY)1 << bit));
+    }
+
+    if (0 == info->nodeCount)
+    {
+        printf("No NUMA node with processors.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * numa_info_print - One line per node.
+*/
+void numa_info_print(const NUMA_INFO *info)
+{
+    ULONGLONG available;
+
+    for (int i = 0; i < info->nodeCount; i++)
+    {
+        const NUMA_NODE *entry = &info->nodes[i];
+
+        if (!GetNumaAvailableMemoryNodeEx(entry->node, &available))
+            available = 0;
+
+        printf("Node %u: group %u, %d cpus, mask 0x%llx, %llu MB free.\n",
+               entry->node, entry->affinity.Group, entry->cpuCount,
+               (unsigned long long)entry->affinity.Mask, available / (1024 * 1024));
+    }
+}
+
+/**
+ * numa_run_on_node - Move the calling thread to the processors of a node.
+*/
+int numa_run_on_node(const NUMA_INFO *info, int index, GROUP_AFFINITY *previous)
+{
+    if (0 > index || info->nodeCount <= index)
+        return -1;
+
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &info->nodes[index].affinity, previous))
+    {
+        printf("Error in SetThreadGroupAffinity: %d.\n", GetLastError());
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * numa_run_restore - Give the calling thread its previous affinity back.
+*/
+void numa_run_restore(const GROUP_AFFINITY *previous)
+{
+    SetThreadGroupAffinity(GetCurrentThread(), previous, NULL);
+}
+
+/**
+ * numa_alloc - Committed memory on a node, index -1 for no node.
+ *
+ * NUMA_ALLOC_TOUCH moves the calling thread to the node for the first
+ * write of every page, then back. NUMA_ALLOC_BIND only prefers the node,
+ * the pages come from it whichever thread touches them.
+*/
+void *numa_alloc(const NUMA_INFO *info, SIZE_T size, int index, int method)
+{
+    char *ptr;
+    GROUP_AFFINITY previous;
+
+    if (0 <= index && NUMA_ALLOC_BIND == method)
+    {
+        ptr = (char *)VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT,
+                                         PAGE_READWRITE, info->nodes[index].node);
+        if (NULL == ptr)
+            printf("Error in VirtualAllocExNuma: %d.\n", GetLastError());
+
+        return ptr;
+    }
+
+    ptr = (char *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (NULL == ptr)
+    {
+        printf("Error in VirtualAlloc: %d.\n", GetLastError());
+        return NULL;
+    }
+
+    if (0 > index)
+        return ptr;
+
+    if (0 != numa_run_on_node(info, index, &previous))
+    {
+        VirtualFree(ptr, 0, MEM_RELEASE);
+        return NULL;
+    }
+
+    for (SIZE_T offset = 0; offset < size; offset += PAGE_BYTES)
+        ptr[offset] = 0;
+
+    numa_run_restore(&previous);
+
+    return ptr;
+}
+
+/**
+ * numa_free - Free what numa_alloc() gave.
+*/
+void numa_free(void *ptr)
+{
+    if (NULL != ptr)
+        VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+/**
+ * numa_page_nodes - Count the node of up to samples pages of a range.
+ *
+ * counts[n] gets the pages on node n. Return the resident pages seen,
+ * pages not touched yet have no node, -1 on error.
+*/
+int numa_page_nodes(const void *ptr, SIZE_T size, int samples, int *counts, int countSize)
+{
+    SIZE_T pages = (size + PAGE_BYTES - 1) / PAGE_BYTES;
+    SIZE_T step;
+    int resident = 0;
+    PSAPI_WORKING_SET_EX_INFORMATION *entries;
+
+    if (0 == pages || samples < 1)
+        return 0;
+
+    samples = (SIZE_T)samples > pages ? (int)pages : samples;
+    step    = pages / samples;
+
+    entries = (PSAPI_WORKING_SET_EX_INFORMATION *)calloc(samples, sizeof(*entries));
+    if (NULL == entries)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < samples; i++)
+        entries[i].VirtualAddress = (char *)ptr + i * step * PAGE_BYTES;
+
+    if (!QueryWorkingSetEx(GetCurrentProcess(), entries, samples * sizeof(*entries)))
+    {
+        printf("Error in QueryWorkingSetEx: %d.\n", GetLastError());
+        free(entries);
+        return -1;
+    }
+
+    ZeroMemory(counts, countSize * sizeof(int));
+
+    for (int i = 0; i < samples; i++)
+    {
+        if (!entries[i].VirtualAttributes.Valid)
+            continue;
+
+        resident++;
+
+        if ((int)entries[i].VirtualAttributes.Node < countSize)
+            counts[entries[i].VirtualAttributes.Node]++;
+    }
+
+    free(entries);
+
+    return resident;
+}
@@ -0,0 +1,62 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      numamem.h
+ *
+ * Abstract:
+ *      NUMA nodes, running threads on a node and allocating memory on a
+ *      node, either bound with VirtualAllocExNuma or placed by first
+ *      touch from a thread of the node.
+ *
+ *      Windows gives a page from the node of the thread that touches it
+ *      first, unless the range was allocated with a preferred node. Both
+ *      are best effort, a full node falls back to the others, so
+ *      numa_page_nodes() reads back where the pages really are.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/memory/allocating-memory-from-a-numa-node
+ * https://docs.microsoft.com/en-us/windows/win32/api/psapi/nf-psapi-queryworkingsetex
+*/
+
+#ifndef __NUMAMEM_H__
+#define __NUMAMEM_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define NUMA_ALLOC_TOUCH                0           // VirtualAlloc, first touch from the node.
+#define NUMA_ALLOC_BIND                 1           // VirtualAllocExNuma, preferred node.
+
+#define NUMA_MAX_NODES                  64
+
+
+typedef struct _NUMA_NODE {
+    USHORT node;                        // Node number, may have gaps.
+    int cpuCount;
+    GROUP_AFFINITY affinity;            // Processors of the node in its group.
+} NUMA_NODE;
+
+typedef struct _NUMA_INFO {
+    int nodeCount;                      // Nodes with processors.
+    NUMA_NODE nodes[NUMA_MAX_NODES];
+} NUMA_INFO;
+
+
+int numa_info_init(NUMA_INFO *info);
+void numa_info_print(const NUMA_INFO *info);
+
+int numa_run_on_node(const NUMA_INFO *info, int index, GROUP_AFFINITY *previous);
+void numa_run_restore(const GROUP_AFFINITY *previous);
+
+void *numa_alloc(const NUMA_INFO *info, SIZE_T size, int index, int method);
+void numa_free(void *ptr);
+
+int numa_page_nodes(const void *ptr, SIZE_T size, int samples, int *counts, int countSize);
+
+
+#endif /* __NUMAMEM_H__ */
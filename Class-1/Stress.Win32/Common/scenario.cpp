@@ -0,0 +1,373 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      scenario.cpp
+ *
+ * Abstract:
+ *      Scenario files of MixStress.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-createprocessa
+*/
+
+#include <iostream>
+
+#include "scenario.h"
+
+
+#define SCENARIO_LINE                   2048
+
+
+typedef struct _LOAD_KIND {
+    const char *kind;
+    const char *program;
+    const char *options;                // Of the intensity and seconds.
+    const char *named;                  // Of the load name, NULL for none.
+    double low;                         // Of the intensity.
+    double high;
+} LOAD_KIND;
+
+
+/* Every disk load has a file of its own, DiskStress opens it exclusively. */
+static const LOAD_KIND loadKinds[] = {
+    { "cpu",     "CpuStress.exe",    "-u %s -T %d",             NULL,        0, 100 },
+    { "memory",  "MemoryStress.exe", "-b pressure -R %s -T %d", NULL,        1, 1e9 },
+    { "disk",    "DiskStress.exe",   "-r %s -T %d",             "-f %s.dat", 0, 1e9 },
+    { "network", "TCPLoadGen.exe",   "-r %s -w 0 -T %d",        NULL,        0, 1e9 },
+};
+
+
+/**
+ * scenario_token - Cut the next word off a line, quotes keep spaces.
+*/
+static int scenario_token(char **line, char *token, size_t size)
+{
+    char *p = *line;
+    size_t n = 0;
+    BOOL quoted = FALSE;
+
+    while (' ' == *p || '\t' == *p)
+        p++;
+
+    if ('\0' == *p)
+        return -1;
+
+    for (; '\0' != *p && (quoted || (' ' != *p && '\t' != *p)); p++)
+    {
+        if ('"' == *p)
+        {
+            quoted = !quoted;
+            continue;
+        }
+
+        if (n + 1 < size)
+            token[n++] = *p;
+    }
+
+    token[n] = '\0';
+
+    while (' ' == *p || '\t' == *p)
+        p++;
+
+    *line = p;
+
+    return 0;
+}
+
+/**
+ * scenario_intensity - Check the intensity of a load, N or N%.
+*/
+static int scenario_intensity(const LOAD_KIND *kind, const char *value)
+{
+    char *end;
+    double number = strtod(value, &end);
+
+    if (end == value || ('\0' != *end && 0 != strcmp(end, "%")))
+        return -1;
+
+    /* Memory takes a share of RAM, cpu is a share anyway. */
+    if ('%' == *end)
+    {
+        if (0 != strcmp(kind->kind, "memory") && 0 != strcmp(kind->kind, "cpu"))
+            return -1;
+
+        return number > 0 && number <= 100 ? 0 : -1;
+    }
+
+    return number >= kind->low && number <= kind->high ? 0 : -1;
+}
+
+/**
+ * scenario_name - A name not yet used in the phase, cpu, cpu2, cpu3.
+*/
+static void scenario_name(SCENARIO_PHASE *phase, SCENARIO_LOAD *load, const char *base)
+{
+    int used;
+
+    for (int n = 1; ; n++)
+    {
+        if (1 == n)
+            snprintf(load->name, sizeof(load->name), "%s", base);
+        else
+            snprintf(load->name, sizeof(load->name), "%.24s%d", base, n);
+
+        used = 0;
+
+        for (int i = 0; i < phase->loadCount; i++)
+            used |= 0 == strcmp(phase->loads[i].name, load->name);
+
+        if (!used)
+            return;
+    }
+}
+
+/**
+ * scenario_command - Full command line of a load, *command holds the
+ * options when called.
+*/
+static int scenario_command(const SCENARIO *s, SCENARIO_LOAD *load, BOOL known)
+{
+    char options[SCENARIO_COMMAND];
+    char path[MAX_PATH];
+    int n;
+
+    snprintf(options, sizeof(options), "%s", load->command);
+    snprintf(path, sizeof(path), "%s", load->program);
+
+    /* Programs of the scenario come from the programs directory. */
+    if (NULL == strpbrk(load->program, "\\/:"))
+    {
+        snprintf(path, sizeof(path), "%s\\%s", s->programs, load->program);
+
+        if (!known && INVALID_FILE_ATTRIBUTES == GetFileAttributesA(path))
+            snprintf(path, sizeof(path), "%s", load->program);
+    }
+
+    n = snprintf(load->command, sizeof(load->command), "\"%s\" %s", path, options);
+
+    return n > 0 && n < (int)sizeof(load->command) ? 0 : -1;
+}
+
+/**
+ * scenario_program - Split a command line into program and options.
+*/
+static int scenario_program(SCENARIO_LOAD *load, char *rest)
+{
+    if (0 != scenario_token(&rest, load->program, sizeof(load->program)))
+        return -1;
+
+    snprintf(load->command, sizeof(load->command), "%s", rest);
+
+    return 0;
+}
+
+/**
+ * scenario_line - One statement.
+*/
+static const char *scenario_line(SCENARIO *s, char *line)
+{
+    char keyword[SCENARIO_NAME], word[MAX_PATH];
+    SCENARIO_PHASE *phase = 0 < s->phaseCount ? &s->phases[s->phaseCount - 1] : NULL;
+    SCENARIO_LOAD *load;
+    const LOAD_KIND *kind = NULL;
+
+    scenario_token(&line, keyword, sizeof(keyword));
+
+    if (0 == strcmp(keyword, "programs"))
+    {
+        if (0 != scenario_token(&line, word, sizeof(word)))
+            return "programs needs a directory";
+
+        snprintf(s->programs, sizeof(s->programs), "%s", word);
+        return NULL;
+    }
+
+    if (0 == strcmp(keyword, "service"))
+    {
+        if (SCENARIO_SERVICES <= s->serviceCount)
+            return "too many services";
+
+        load = &s->services[s->serviceCount];
+        if (0 != scenario_program(load, line))
+            return "service needs a command line";
+
+        snprintf(load->name, sizeof(load->name), "service%d", s->serviceCount + 1);
+        s->serviceCount++;
+        return NULL;
+    }
+
+    if (0 == strcmp(keyword, "phase"))
+    {
+        if (SCENARIO_PHASES <= s->phaseCount)
+            return "too many phases";
+
+        phase = &s->phases[s->phaseCount];
+
+        if (0 != scenario_token(&line, phase->name, sizeof(phase->name)) ||
+            0 != scenario_token(&line, word, sizeof(word)) || 0 >= (phase->seconds = atoi(word)))
+            return "phase needs a name and seconds";
+
+        s->phaseCount++;
+        return NULL;
+    }
+
+    for (int i = 0; i < _countof(loadKinds); i++)
+    {
+        if (0 == strcmp(keyword, loadKinds[i].kind))
+            kind = &loadKinds[i];
+    }
+
+    if (NULL == kind && 0 != strcmp(keyword, "exec"))
+        return "unknown statement";
+
+    if (NULL == phase)
+        return "load before the first phase";
+
+    if (SCENARIO_LOADS <= phase->loadCount)
+        return "too many loads in the phase";
+
+    load = &phase->loads[phase->loadCount];
+
+    if (0 != scenario_token(&line, word, sizeof(word)))
+        return NULL == kind ? "exec needs a name and a command line" : "load needs an intensity";
+
+    if (NULL == kind)
+    {
+        scenario_name(phase, load, word);
+
+        if (0 != scenario_program(load, line))
+            return "exec needs a name and a command line";
+    }
+    else
+    {
+        if (0 != scenario_intensity(kind, word))
+            return "intensity out of range";
+
+        scenario_name(phase, load, kind->kind);
+        snprintf(load->program, sizeof(load->program), "%s", kind->program);
+
+        /* The options of the file come last, they can override. */
+        snprintf(load->command, sizeof(load->command), kind->options, word, phase->seconds);
+
+        if (NULL != kind->named)
+        {
+            snprintf(word, sizeof(word), kind->named, load->name);
+            strncat_s(load->command, sizeof(load->command), " ", _TRUNCATE);
+            strncat_s(load->command, sizeof(load->command), word, _TRUNCATE);
+        }
+
+        if ('\0' != *line)
+        {
+            strncat_s(load->command, sizeof(load->command), " ", _TRUNCATE);
+            strncat_s(load->command, sizeof(load->command), line, _TRUNCATE);
+        }
+    }
+
+    phase->loadCount++;
+
+    return NULL;
+}
+
+/**
+ * scenario_load - Read a scenario file, programs overrides the programs
+ * line when not NULL.
+*/
+int scenario_load(SCENARIO *s, const char *path, const char *programs)
+{
+    char line[SCENARIO_LINE];
+    const char *error;
+    FILE *fp = NULL;
+    char *p;
+    int number = 0;
+
+    ZeroMemory(s, sizeof(*s));
+
+    if (0 != fopen_s(&fp, path, "r"))
+    {
+        printf("Cannot open %s.\n", path);
+        return -1;
+    }
+
+    while (NULL != fgets(line, sizeof(line), fp))
+    {
+        number++;
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        for (p = line; ' ' == *p || '\t' == *p; p++)
+            ;
+
+        if ('\0' == *p || '#' == *p)
+            continue;
+
+        error = scenario_line(s, p);
+        if (NULL != error)
+        {
+            printf("%s:%d: %s.\n", path, number, error);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+
+    if (0 == s->phaseCount)
+    {
+        printf("%s: no phase.\n", path);
+        return -1;
+    }
+
+    if (NULL != programs)
+        snprintf(s->programs, sizeof(s->programs), "%s", programs);
+
+    /* Next to MixStress.exe by default. */
+    if ('\0' == s->programs[0])
+    {
+        GetModuleFileNameA(NULL, s->programs, sizeof(s->programs));
+
+        p = strrchr(s->programs, '\\');
+        if (NULL != p)
+            *p = '\0';
+    }
+
+    for (int i = 0; i < s->serviceCount; i++)
+    {
+        if (0 != scenario_command(s, &s->services[i], FALSE))
+            goto out_long;
+    }
+
+    for (int i = 0; i < s->phaseCount; i++)
+    {
+        for (int j = 0; j < s->phases[i].loadCount; j++)
+        {
+            SCENARIO_LOAD *load = &s->phases[i].loads[j];
+            BOOL known = FALSE;
+
+            for (int k = 0; k < _countof(loadKinds); k++)
+                known |= 0 == strcmp(load->program, loadKinds[k].program);
+
+            if (0 != scenario_command(s, load, known))
+                goto out_long;
+        }
+    }
+
+    return 0;
+
+out_long:
+    printf("%s: command line longer than %d.\n", path, SCENARIO_COMMAND - 1);
+    return -1;
+}
+
+/**
+ * scenario_seconds - Length of all phases.
+*/
+int scenario_seconds(const SCENARIO *s)
+{
+    int seconds = 0;
+
+    for (int i = 0; i < s->phaseCount; i++)
+        seconds += s->phases[i].seconds;
+
+    return seconds;
+}
@@ -0,0 +1,78 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      scenario.h
+ *
+ * Abstract:
+ *      Scenario files of MixStress: phases of a duration, each running
+ *      some load generators together. One statement per line, # starts a
+ *      comment:
+ *
+ *      programs <dir>              Where the programs are.
+ *      service <command line>      Runs through all phases, a server.
+ *      phase <name> <seconds>      Starts a phase, the loads follow.
+ *      cpu <percent> [options]     CpuStress -u percent.
+ *      memory <MiB|N%> [options]   MemoryStress -b pressure -R size.
+ *      disk <MB/s> [options]       DiskStress -r rate, 0 is no limit.
+ *      network <req/s> [options]   TCPLoadGen -r rate, 0 is closed loop.
+ *      exec <name> <command line>  Any other program.
+ *
+ *      The loads get -T with the seconds of the phase, the options are
+ *      added to their command line as they are. A disk load also gets
+ *      -f <name>.dat, so disk and disk2 do not share a file. Every load
+ *      must end by itself, exec ones too. A phase without loads is a pause.
+ *
+ *      Programs are looked up in the programs directory: -d of MixStress,
+ *      else the programs line, else the directory of MixStress. exec and
+ *      service programs not found there are left to the search of
+ *      CreateProcess.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-createprocessa
+*/
+
+#ifndef __SCENARIO_H__
+#define __SCENARIO_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define SCENARIO_PHASES                 32
+#define SCENARIO_LOADS                  16          // Per phase.
+#define SCENARIO_SERVICES               4
+#define SCENARIO_NAME                   32
+#define SCENARIO_COMMAND                1024
+
+
+typedef struct _SCENARIO_LOAD {
+    char name[SCENARIO_NAME];           // Unique in the phase.
+    char program[MAX_PATH];             // As written, CpuStress.exe.
+    char command[SCENARIO_COMMAND];     // Full path and options.
+} SCENARIO_LOAD;
+
+typedef struct _SCENARIO_PHASE {
+    char name[SCENARIO_NAME];
+    int seconds;
+    int loadCount;
+    SCENARIO_LOAD loads[SCENARIO_LOADS];
+} SCENARIO_PHASE;
+
+typedef struct _SCENARIO {
+    char programs[MAX_PATH];            // No trailing backslash.
+    int serviceCount;
+    SCENARIO_LOAD services[SCENARIO_SERVICES];
+    int phaseCount;
+    SCENARIO_PHASE phases[SCENARIO_PHASES];
+} SCENARIO;
+
+
+int scenario_load(SCENARIO *s, const char *path, const char *programs);
+int scenario_seconds(const SCENARIO *s);
+
+
+#endif /* __SCENARIO_H__ */
@@ -0,0 +1,276 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      telemetry.cpp
+ *
+ * Abstract:
+ *      Clock, temperature and power sampling to CSV.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/perfctrs/collecting-performance-data
+*/
+
+#include "telemetry.h"
+#include "timing.h"
+
+#pragma comment(lib, "pdh.lib")
+
+
+#define COUNTER_PERFORMANCE             0
+#define COUNTER_FREQUENCY               1
+#define COUNTER_UTILITY                 2
+#define COUNTER_TEMPERATURE             3
+#define COUNTER_PASSIVE                 4
+#define COUNTER_POWER_METER             5
+#define COUNTER_ENERGY_METER            6
+
+#define KELVIN                          273.15
+
+
+/* English names, they work whatever the language of the system. */
+static const wchar_t *counterPaths[TELEMETRY_COUNTERS] = {
+    L"\\Processor Information(*)\\% Processor Performance",
+    L"\\Processor Information(*)\\Processor Frequency",
+    L"\\Processor Information(*)\\% Processor Utility",
+    L"\\Thermal Zone Information(*)\\Temperature",
+    L"\\Thermal Zone Information(*)\\% Passive Limit",
+    L"\\Power Meter(*)\\Power",
+    L"\\Energy Meter(*)\\Power",
+};
+
+static const char *counterMetrics[TELEMETRY_COUNTERS] = {
+    "perf_pct", "base_mhz", "utility_pct", "temp_c", "passive_pct", "power_mw", "power_mw",
+};
+
+
+/**
+ * telemetry_now - Seconds since telemetry_start().
+*/
+static double telemetry_now(TELEMETRY *t)
+{
+    return (double)(timing_now_ns() - t->start) / TIMING_NS_PER_SEC;
+}
+
+/**
+ * telemetry_row - One row, the caller holds the lock.
+*/
+static void telemetry_row(TELEMETRY *t, double seconds, const char *metric, const char *instance, double value)
+{
+    /* Processor instances are "group,number", quoted. */
+    fprintf(t->csv, "%.3f,%s,\"%s\",%.3f\n", seconds, metric, instance, value);
+    t->rows++;
+}
+
+/**
+ * telemetry_array - Values of all instances of a counter, free() it.
+ *
+ * Not capped at 100, % Processor Performance is above it under turbo.
+*/
+static PDH_FMT_COUNTERVALUE_ITEM_A *telemetry_array(PDH_HCOUNTER counter, DWORD *count)
+{
+    PDH_FMT_COUNTERVALUE_ITEM_A *items = NULL;
+    DWORD format = PDH_FMT_DOUBLE | PDH_FMT_NOCAP100;
+    DWORD size = 0;
+
+    *count = 0;
+
+    if (NULL == counter || (DWORD)PDH_MORE_DATA != PdhGetFormattedCounterArrayA(counter, format, &size, count, NULL))
+        return NULL;
+
+    items = (PDH_FMT_COUNTERVALUE_ITEM_A *)malloc(size);
+    if (NULL == items)
+        return NULL;
+
+    if (ERROR_SUCCESS != PdhGetFormattedCounterArrayA(counter, format, &size, count, items))
+    {
+        free(items);
+        *count = 0;
+        return NULL;
+    }
+
+    return items;
+}
+
+/**
+ * telemetry_sample - Collect the counters and write their rows.
+ *
+ * The effective clock, mhz, is the nominal frequency of an instance
+ * times its performance, matched by instance name.
+*/
+static void telemetry_sample(TELEMETRY *t)
+{
+    PDH_FMT_COUNTERVALUE_ITEM_A *items[TELEMETRY_COUNTERS];
+    PDH_FMT_COUNTERVALUE_ITEM_A *perf, *freq;
+    DWORD counts[TELEMETRY_COUNTERS];
+    double seconds, value;
+
+    if (ERROR_SUCCESS != PdhCollectQueryData(t->query))
+        return;
+
+    seconds = telemetry_now(t);
+
+    for (int i = 0; i < TELEMETRY_COUNTERS; i++)
+        items[i] = telemetry_array(t->counters[i], &counts[i]);
+
+    AcquireSRWLockExclusive(&t->lock);
+
+    for (int i = 0; i < TELEMETRY_COUNTERS; i++)
+    {
+        for (DWORD j = 0; j < counts[i]; j++)
+        {
+            if (PDH_CSTATUS_VALID_DATA != items[i][j].FmtValue.CStatus)
+                continue;
+
+            value = items[i][j].FmtValue.doubleValue;
+
+            /* Thermal zones report Kelvin. */
+            if (COUNTER_TEMPERATURE == i)
+                value -= KELVIN;
+
+            telemetry_row(t, seconds, counterMetrics[i], items[i][j].szName, value);
+        }
+    }
+
+    for (DWORD j = 0; j < counts[COUNTER_PERFORMANCE]; j++)
+    {
+        perf = &items[COUNTER_PERFORMANCE][j];
+
+        for (DWORD k = 0; k < counts[COUNTER_FREQUENCY]; k++)
+        {
+            freq = &items[COUNTER_FREQUENCY][k];
+
+            if (0 != strcmp(perf->szName, freq->szName) ||
+                PDH_CSTATUS_VALID_DATA != perf->FmtValue.CStatus || PDH_CSTATUS_VALID_DATA != freq->FmtValue.CStatus)
+                continue;
+
+            telemetry_row(t, seconds, "mhz", perf->szName, freq->FmtValue.doubleValue * perf->FmtValue.doubleValue / 100);
+            break;
+        }
+    }
+
+    fflush(t->csv);
+    ReleaseSRWLockExclusive(&t->lock);
+
+    for (int i = 0; i < TELEMETRY_COUNTERS; i++)
+        free(items[i]);
+}
+
+/**
+ * TelemetryMain - Sample every interval until telemetry_stop().
+*/
+static DWORD WINAPI TelemetryMain(LPVOID lpParam)
+{
+    TELEMETRY *t = (TELEMETRY *)lpParam;
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(t->stopEvent, t->intervalMs))
+        telemetry_sample(t);
+
+    return 0;
+}
+
+/**
+ * telemetry_start - Open the CSV and sample every interval in a thread.
+*/
+int telemetry_start(TELEMETRY *t, const char *path, DWORD intervalMs)
+{
+    PDH_STATUS status;
+    int found = 0;
+
+    ZeroMemory(t, sizeof(*t));
+    InitializeSRWLock(&t->lock);
+    t->intervalMs = intervalMs;
+
+    if (0 != fopen_s(&t->csv, path, "w"))
+    {
+        printf("Cannot open %s.\n", path);
+        return -1;
+    }
+
+    fprintf(t->csv, "time_s,metric,instance,value\n");
+
+    status = PdhOpenQueryW(NULL, 0, &t->query);
+    if (ERROR_SUCCESS != status)
+    {
+        printf("Error in PdhOpenQuery: 0x%x.\n", (unsigned)status);
+        goto out_csv;
+    }
+
+    for (int i = 0; i < TELEMETRY_COUNTERS; i++)
+    {
+        if (ERROR_SUCCESS == PdhAddEnglishCounterW(t->query, counterPaths[i], 0, &t->counters[i]))
+            found++;
+        else
+            t->counters[i] = NULL;
+    }
+
+    printf("Telemetry: %d of %d counters to %s every %lu ms.\n", found, TELEMETRY_COUNTERS, path, intervalMs);
+
+    /* Rates need a first sample to compare with. */
+    PdhCollectQueryData(t->query);
+
+    t->start = timing_now_ns();
+
+    t->stopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (NULL == t->stopEvent)
+    {
+        printf("Error in CreateEvent: %d.\n", GetLastError());
+        goto out_query;
+    }
+
+    t->thread = CreateThread(NULL, 0, TelemetryMain, t, 0, NULL);
+    if (NULL == t->thread)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        goto out_event;
+    }
+
+    return 0;
+
+out_event:
+    CloseHandle(t->stopEvent);
+
+out_query:
+    PdhCloseQuery(t->query);
+
+out_csv:
+    fclose(t->csv);
+    t->csv = NULL;
+
+    return -1;
+}
+
+/**
+ * telemetry_stop - Stop sampling and close the CSV.
+*/
+void telemetry_stop(TELEMETRY *t)
+{
+    if (NULL == t->csv)
+        return;
+
+    SetEvent(t->stopEvent);
+    WaitForSingleObject(t->thread, INFINITE);
+
+    CloseHandle(t->thread);
+    CloseHandle(t->stopEvent);
+    PdhCloseQuery(t->query);
+
+    printf("Telemetry: %llu rows.\n", t->rows);
+
+    fclose(t->csv);
+    t->csv = NULL;
+}
+
+/**
+ * telemetry_record - A row of the program, timed now. Does nothing when
+ * telemetry is not started.
+*/
+void telemetry_record(TELEMETRY *t, const char *metric, const char *instance, double value)
+{
+    if (NULL == t->csv)
+        return;
+
+    AcquireSRWLockExclusive(&t->lock);
+    telemetry_row(t, telemetry_now(t), metric, instance, value);
+    ReleaseSRWLockExclusive(&t->lock);
+}
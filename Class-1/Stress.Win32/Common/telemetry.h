@@ -0,0 +1,62 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      telemetry.h
+ *
+ * Abstract:
+ *      Samples what the processors really did during a stress run and
+ *      writes it as a time series CSV: the effective clock of every
+ *      logical processor, its utility, thermal zone temperatures and
+ *      passive (thermal) limits, and the power of the energy meters.
+ *
+ *      The numbers come from performance counters (PDH), the ones of
+ *      Task Manager and Performance Monitor. The effective clock is the
+ *      nominal frequency times "% Processor Performance", which Windows
+ *      computes from the APERF / MPERF ratio of the core. Counter sets a
+ *      machine does not have, thermal zones or energy meters often, are
+ *      left out.
+ *
+ *      Rows are "time_s,metric,instance,value". The program under test
+ *      adds its own rows with telemetry_record(), on the same time base.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/perfctrs/using-the-pdh-functions-to-consume-counter-data
+*/
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <iostream>
+#include <windows.h>
+#include <pdh.h>
+
+
+#define TELEMETRY_INTERVAL              1000        // ms
+#define TELEMETRY_COUNTERS              7
+
+
+typedef struct _TELEMETRY {
+    PDH_HQUERY query;
+    PDH_HCOUNTER counters[TELEMETRY_COUNTERS];  // NULL if the set is missing.
+    FILE *csv;
+    SRWLOCK lock;                       // Rows of both threads.
+    HANDLE thread;
+    HANDLE stopEvent;
+    DWORD intervalMs;
+    UINT64 start;                       // ns, timing_now_ns().
+    UINT64 rows;
+} TELEMETRY;
+
+
+int telemetry_start(TELEMETRY *t, const char *path, DWORD intervalMs);
+void telemetry_stop(TELEMETRY *t);
+
+void telemetry_record(TELEMETRY *t, const char *metric, const char *instance, double value);
+
+
+#endif /* __TELEMETRY_H__ */
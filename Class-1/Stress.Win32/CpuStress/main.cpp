@@ -1,50 +1,621 @@
 /**
  * main.cpp - cpu stress.
- * 
- * You can view the effect through the task manager。 
- * 
+ *
+ * You can view the effect through the task manager。
+ *
+ * One thread per processor, pinned to it, is busy for a share of every
+ * short period and sleeps the rest. The share is corrected every 200 ms
+ * against the busy time the system counted for the processor, so the
+ * processor as a whole, other work included, runs at the wanted load.
+ * The load can follow a profile over time, see Common/cpuload.h.
+ *
+ * The busy time runs a stress kernel, FMA, integer, cache, branch or a
+ * mix of them, see Common/cpukernel.h, and the rate of every kernel per
+ * busy core second is reported: it falls when the clock is throttled.
+ *
+ * With -o the clock, temperature and power are sampled to a CSV with
+ * the load and the rates, see Common/telemetry.h.
+ *
  * License - MIT.
 */
 
 #include <iostream>
+#include <math.h>
+#include <signal.h>
 #include <Windows.h>
 
-// It adds ((500 / 10) == 50%) extra load on top of the original CPU load.
-#define CPU_LOADING             500
-#define CPU_CORES               8
+#include "asynclog.h"
+#include "cpuload.h"
+#include "cpukernel.h"
+#include "telemetry.h"
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION   0x00000002
+#endif
 
+
+#define LOAD_TARGET             50          // %
+#define PROFILE_PERIOD          60          // s
+#define DUTY_PERIOD             500         // us
+#define CONTROL_INTERVAL        200         // ms
+#define REPORT_INTERVAL         1000        // ms
+#define MAX_CREDIT              50          // ms, busy time owed at most.
+#define FEEDBACK_GAIN           0.5
+#define DUTY_ONE                1000000     // Duty in parts per million.
+
+#define KERNEL_SPIN             -1          // Busy time only reads the clock.
+
+
+typedef struct _LOAD_THREAD {
+    HANDLE handle;
+    int processor;                      // Number in the group.
+    int status;
+    volatile LONG duty;                 // Busy share of every period, ppm.
+    double usage;                       // Of the processor, last interval.
+    double usageSum;
+    double gapSum;                      // Of |goal - usage|.
+    int samples;
+    volatile LONG64 ops[CPU_KERNEL_MIX];    // Per kernel.
+    volatile LONG64 busy[CPU_KERNEL_MIX];   // Per kernel, qpc ticks.
+} LOAD_THREAD;
+
+
+LOAD_THREAD *threads    = NULL;
+LARGE_INTEGER qpcFreq;
+bool quitEvent          = false;
+WORD group              = 0;
+
+int threadCount         = 0;
+int dutyPeriod          = DUTY_PERIOD;
+int durationSec         = 0;
+BOOL feedback           = TRUE;
+int stressKernel        = CPU_KERNEL_MIX;
+int stressIsa           = -1;
+LONG64 lastOps[CPU_KERNEL_MIX];
+LONG64 lastBusy[CPU_KERNEL_MIX];
+
+TELEMETRY telemetry;
+const char *csvPath     = NULL;
+int csvInterval         = TELEMETRY_INTERVAL;
+LOAD_PROFILE profile    = { LOAD_CONST, 0.0, LOAD_TARGET / 100.0, PROFILE_PERIOD * 1000 };
+
+
+/**
+ * Every period the thread owes duty times the time since the last one
+ * as busy time, and spins until it paid. A sleep the timer made longer
+ * than asked is paid back by a longer spin next time, so the share holds
+ * with periods shorter than the timer steps.
+*/
 DWORD WINAPI
 CpuStressHandler(LPVOID lpParam)
 {
-    DWORD oldTime = 0;
+    LOAD_THREAD *thread = (LOAD_THREAD *)lpParam;
+    LONGLONG period     = qpcFreq.QuadPart * dutyPeriod / 1000000;
+    LONGLONG maxCredit  = qpcFreq.QuadPart * MAX_CREDIT / 1000;
+    LONGLONG credit     = 0;
+    LONGLONG last, start, chunk, spun, idle;
+    LARGE_INTEGER now, wait;
+    GROUP_AFFINITY affinity;
+    CPU_KERNEL kernel;
+    HANDLE timer;
+    UINT64 done;
+    double duty;
+    int ran;
+
+    ZeroMemory(&affinity, sizeof(affinity));
+    affinity.Group = group;
+    affinity.Mask  = (KAFFINITY)1 << thread->processor;
+
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL))
+    {
+        LOG_ERROR("Error in SetThreadGroupAffinity: %d.", GetLastError());
+        thread->status = -1;
+        return 0;
+    }
+
+    /* After pinning, the buffer of cache comes from the node of the processor. */
+    if (KERNEL_SPIN != stressKernel && 0 != cpu_kernel_init(&kernel, stressKernel, stressIsa, thread->processor))
+    {
+        LOG_ERROR("Error in cpu_kernel_init thread: %d.", thread->processor);
+        thread->status = -1;
+        return 0;
+    }
+
+    /* Windows 10 1803+, 0.5 ms steps instead of the 15.6 ms tick. */
+    timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (NULL == timer)
+        timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+
+    if (NULL == timer)
+    {
+        LOG_ERROR("Error in CreateWaitableTimer: %d.", GetLastError());
+        thread->status = -1;
+        goto out_kernel;
+    }
+
+    QueryPerformanceCounter(&now);
+    last = now.QuadPart;
+
+    while (!quitEvent)
+    {
+        duty = thread->duty / (double)DUTY_ONE;
+
+        QueryPerformanceCounter(&now);
+        credit += (LONGLONG)((now.QuadPart - last) * duty);
+        last    = now.QuadPart;
+
+        /* Time the thread was preempted is not owed. */
+        if (credit > maxCredit)
+            credit = maxCredit;
+
+        start = now.QuadPart;
+
+        /* Kernel chunks are some us, the spin ends a little late. */
+        while (now.QuadPart - start < credit)
+        {
+            if (KERNEL_SPIN == stressKernel)
+            {
+                QueryPerformanceCounter(&now);
+                continue;
+            }
+
+            chunk = now.QuadPart;
+            done  = cpu_kernel_run(&kernel, &ran);
+            QueryPerformanceCounter(&now);
+
+            InterlockedAdd64(&thread->ops[ran], done);
+            InterlockedAdd64(&thread->busy[ran], now.QuadPart - chunk);
+        }
+
+        spun    = now.QuadPart - start;
+        credit -= spun;
+
+        if (DUTY_ONE == thread->duty)
+            continue;
+
+        idle = period - spun;
+        if (idle <= 0)
+            idle = (LONGLONG)(period * (1 - duty));
+
+        wait.QuadPart = -(idle * 10000000 / qpcFreq.QuadPart);
+
+        if (0 != wait.QuadPart)
+        {
+            SetWaitableTimer(timer, &wait, 0, NULL, NULL, FALSE);
+            WaitForSingleObject(timer, INFINITE);
+        }
+    }
+
+    CloseHandle(timer);
+
+out_kernel:
+    if (KERNEL_SPIN != stressKernel)
+        cpu_kernel_free(&kernel);
+
+    return 0;
+}
+
+void SignalHandler(int s)
+{
+    if (SIGINT == s) {
+        LOG_INFO("It will exit...");
+        quitEvent = true;
+    }
+}
+
+/**
+ * CreateThreads - One thread per processor of the group of the process.
+*/
+int CreateThreads(void)
+{
+    GROUP_AFFINITY affinity;
+    int count = 0;
+
+    if (!GetThreadGroupAffinity(GetCurrentThread(), &affinity))
+    {
+        printf("Error in GetThreadGroupAffinity: %d.\n", GetLastError());
+        return -1;
+    }
+
+    group = affinity.Group;
+
+    if (1 < GetActiveProcessorGroupCount())
+        printf("Loading the processors of group %d only.\n", group);
+
+    for (int i = 0; i < CPU_SAMPLE_MAX; i++)
+    {
+        if (0 != (affinity.Mask & ((KAFFINITY)1 << i)) && (0 == threadCount || count < threadCount))
+            count++;
+    }
+
+    threads = (LOAD_THREAD *)calloc(count, sizeof(LOAD_THREAD));
+    if (NULL == threads)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    threadCount = 0;
+
+    for (int i = 0; i < CPU_SAMPLE_MAX && threadCount < count; i++)
+    {
+        if (0 == (affinity.Mask & ((KAFFINITY)1 << i)))
+            continue;
+
+        threads[threadCount].processor = i;
+        threads[threadCount].duty      = (LONG)(load_profile_at(&profile, 0) * DUTY_ONE);
+        threads[threadCount].handle    = CreateThread(NULL, 0, CpuStressHandler, &threads[threadCount], 0, NULL);
+
+        if (NULL == threads[threadCount].handle)
+        {
+            LOG_ERROR("Error in create thread: %d.", i);
+            threads[threadCount].status = -1;
+        }
+
+        threadCount++;
+    }
+
+    return 0;
+}
+
+/**
+ * Control - Set the duty of every thread from the usage of its processor.
+ *
+ * The change of the goal goes straight to the duty, half the gap of the
+ * last interval on top of it. Other work on the processor takes from
+ * the duty, it comes back when the work ends.
+*/
+void Control(double goal, double lastGoal, const CPU_SAMPLE *before, const CPU_SAMPLE *after)
+{
+    LOAD_THREAD *thread;
+    double duty;
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        thread = &threads[i];
+        duty   = thread->duty / (double)DUTY_ONE;
+
+        thread->usage = cpu_sample_usage(before, after, thread->processor);
+
+        if (0 > thread->usage)
+            continue;
+
+        thread->usageSum += thread->usage;
+        thread->gapSum   += fabs(lastGoal - thread->usage);
+        thread->samples++;
+
+        if (feedback)
+            duty += goal - lastGoal + FEEDBACK_GAIN * (lastGoal - thread->usage);
+        else
+            duty = goal;
+
+        duty = duty < 0 ? 0 : (duty > 1 ? 1 : duty);
+        InterlockedExchange(&thread->duty, (LONG)(duty * DUTY_ONE));
+    }
+}
+
+/**
+ * KernelUsed - Kernel runs in the busy time.
+*/
+bool KernelUsed(int kernel)
+{
+    return stressKernel == kernel || CPU_KERNEL_MIX == stressKernel;
+}
+
+/**
+ * KernelTotals - Operations and busy ticks of a kernel over the threads.
+*/
+void KernelTotals(int kernel, LONG64 *ops, LONG64 *busy)
+{
+    *ops  = 0;
+    *busy = 0;
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        *ops  += threads[i].ops[kernel];
+        *busy += threads[i].busy[kernel];
+    }
+}
+
+/**
+ * KernelRate - Giga operations per busy core second.
+*/
+double KernelRate(LONG64 ops, LONG64 busy)
+{
+    return 0 < busy ? ops / ((double)busy / qpcFreq.QuadPart) / 1e9 : 0;
+}
+
+/**
+ * PrintHeader - Columns of PrintLine().
+*/
+void PrintHeader(void)
+{
+    printf("%-8s %7s %7s %7s %7s %7s", "Time(s)", "Goal", "Mean", "Min", "Max", "Duty");
+
+    for (int k = 0; k < CPU_KERNEL_MIX; k++)
+    {
+        if (KernelUsed(k))
+            printf(" %8s", cpu_kernel_name(k));
+    }
+
+    printf("\n");
+}
+
+/**
+ * PrintLine - Goal and usage over the processors, and the rate of the
+ * kernels since the last line, one line.
+*/
+void PrintLine(double seconds, double goal)
+{
+    double sum = 0, duty = 0, low = 1, high = 0, rate;
+    char instance[32];
+    LONG64 ops, busy;
+    int count = 0;
+
+    telemetry_record(&telemetry, "goal_pct", "", 100 * goal);
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (0 > threads[i].usage)
+            continue;
+
+        /* Named as the processor instances of the counters. */
+        snprintf(instance, sizeof(instance), "%d,%d", group, threads[i].processor);
+        telemetry_record(&telemetry, "usage_pct", instance, 100 * threads[i].usage);
+        telemetry_record(&telemetry, "duty_pct", instance, 100.0 * threads[i].duty / DUTY_ONE);
+
+        sum  += threads[i].usage;
+        duty += threads[i].duty / (double)DUTY_ONE;
+        low   = threads[i].usage < low ? threads[i].usage : low;
+        high  = threads[i].usage > high ? threads[i].usage : high;
+        count++;
+    }
+
+    if (0 == count)
+        return;
+
+    printf("%-8.1f %7.1f %7.1f %7.1f %7.1f %7.1f", seconds, 100 * goal,
+           100 * sum / count, 100 * low, 100 * high, 100 * duty / count);
+
+    for (int k = 0; k < CPU_KERNEL_MIX; k++)
+    {
+        if (!KernelUsed(k))
+            continue;
+
+        KernelTotals(k, &ops, &busy);
+        rate = KernelRate(ops - lastOps[k], busy - lastBusy[k]);
+
+        printf(" %8.3f", rate);
+        telemetry_record(&telemetry, "rate_g", cpu_kernel_name(k), rate);
+
+        lastOps[k]  = ops;
+        lastBusy[k] = busy;
+    }
+
+    printf("\n");
+}
+
+/**
+ * PrintReport - Mean usage and gap to the goal per processor, and the
+ * rate of every kernel per busy core and over all cores.
+*/
+void PrintReport(double seconds)
+{
+    LONG64 ops, busy;
+
+    printf("\n%-6s %8s %8s %8s\n", "CPU", "Usage", "Gap", "Duty");
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (0 == threads[i].samples)
+            continue;
+
+        printf("%-6d %7.1f%% %7.1f%% %7.1f%%\n", threads[i].processor,
+               100 * threads[i].usageSum / threads[i].samples,
+               100 * threads[i].gapSum / threads[i].samples,
+               100.0 * threads[i].duty / DUTY_ONE);
+    }
 
-    while (1)
+    if (KERNEL_SPIN == stressKernel)
+        return;
+
+    printf("\n%-8s %12s %12s %12s %12s\n", "Kernel", "Giga ops", "Busy s", "Per core/s", "All cores/s");
+
+    for (int k = 0; k < CPU_KERNEL_MIX; k++)
     {
-        oldTime = GetTickCount();
+        if (!KernelUsed(k))
+            continue;
+
+        KernelTotals(k, &ops, &busy);
+        printf("%-8s %12.2f %12.2f %12.3f %12.3f\n", cpu_kernel_name(k), ops / 1e9,
+               (double)busy / qpcFreq.QuadPart, KernelRate(ops, busy), ops / seconds / 1e9);
+    }
+}
+
+/**
+ * ParseLoad - Percent to a share, 0 to 100.
+*/
+int ParseLoad(const char *value, double *load)
+{
+    int percent = atoi(value);
+
+    if (percent < 0 || percent > 100)
+        return -1;
+
+    *load = percent / 100.0;
+
+    return 0;
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    int seconds = PROFILE_PERIOD;
 
-        while ((GetTickCount() - oldTime) < CPU_LOADING);
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
 
-        Sleep(1000 - CPU_LOADING);
+        switch (argv[i][1])
+        {
+        case 'u':
+            if (0 != ParseLoad(argv[i + 1], &profile.high))
+                return -1;
+            break;
+        case 'l':
+            if (0 != ParseLoad(argv[i + 1], &profile.low))
+                return -1;
+            break;
+        case 'w':
+            if (0 != load_shape_parse(argv[i + 1], &profile.shape))
+                return -1;
+            break;
+        case 'f':
+            if (0 == strcmp(argv[i + 1], "total"))
+                feedback = TRUE;
+            else if (0 == strcmp(argv[i + 1], "open"))
+                feedback = FALSE;
+            else
+                return -1;
+            break;
+        case 'k':
+            if (0 == strcmp(argv[i + 1], "spin"))
+                stressKernel = KERNEL_SPIN;
+            else if (0 != cpu_kernel_parse(argv[i + 1], &stressKernel))
+                return -1;
+            break;
+        case 's':
+            if (0 != mem_isa_parse(argv[i + 1], &stressIsa))
+                return -1;
+            break;
+        case 'o': csvPath     = argv[i + 1];        break;
+        case 'I': csvInterval = atoi(argv[i + 1]);  break;
+        case 'r': seconds     = atoi(argv[i + 1]);  break;
+        case 'd': dutyPeriod  = atoi(argv[i + 1]);  break;
+        case 'n': threadCount = atoi(argv[i + 1]);  break;
+        case 'T': durationSec = atoi(argv[i + 1]);  break;
+        default:
+            return -1;
+        }
     }
 
+    profile.periodMs = (UINT64)seconds * 1000;
+
+    if (seconds < 1 || csvInterval < 10 || dutyPeriod < 50 || threadCount < 0 || durationSec < 0 || profile.low > profile.high)
+        return -1;
+
     return 0;
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    HANDLE thdHandle[CPU_CORES];
-    
-    for (int i = 0; i < CPU_CORES; i++) {
-        thdHandle[i] = CreateThread(NULL, 0, CpuStressHandler, NULL, 0, NULL);
+    CPU_SAMPLE before, after;
+    ULONGLONG start, elapsed, lastReport = 0;
+    double goal, lastGoal;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-u %%] [-l %%] [-w const|ramp|sine|step] [-r s] [-d us] [-f total|open] [-k kernel] [-s isa] [-n threads] [-o csv] [-I ms] [-T s]\n", argv[0]);
+        printf("  -u percent   Load, the top of the profile, default %d.\n", LOAD_TARGET);
+        printf("  -l percent   Bottom of the profile, default 0.\n");
+        printf("  -w shape     Load constant, ramped up, a sine or steps, default const.\n");
+        printf("  -r seconds   Ramp time or period of the sine and the steps, default %d.\n", PROFILE_PERIOD);
+        printf("  -d us        Busy and idle period, default %d.\n", DUTY_PERIOD);
+        printf("  -f mode      Correct to the total load of the processor or not, default total.\n");
+        printf("  -k kernel    Busy time runs fma, int, cache, branch, mix or spin, default mix.\n");
+        printf("  -s isa       fma in scalar, avx2 or avx512, default the widest supported.\n");
+        printf("  -n threads   Processors to load, default all.\n");
+        printf("  -o file      Sample clock, temperature and power with the load to a CSV.\n");
+        printf("  -I ms        Sample interval, default %d.\n", TELEMETRY_INTERVAL);
+        printf("  -T seconds   Run time, default until Ctrl + C.\n");
+        return -1;
+    }
+
+    if (0 > stressIsa)
+        stressIsa = mem_isa_best();
+
+    if (!cpu_isa_supported(stressIsa))
+    {
+        printf("%s is not supported by this cpu.\n", mem_isa_name(stressIsa));
+        return -1;
+    }
+
+    if (0 != log_start())
+        return -1;
+
+    QueryPerformanceFrequency(&qpcFreq);
+    signal(SIGINT, SignalHandler);
+
+    /* Before the threads, the CSV starts with the machine at rest. */
+    if (NULL != csvPath && 0 != telemetry_start(&telemetry, csvPath, csvInterval))
+    {
+        log_stop();
+        return -1;
+    }
 
-        if (NULL == thdHandle[i])
-            printf("Error in create thread: %d.\n", i);
+    if (0 != cpu_sample_read(&before) || 0 != CreateThreads())
+    {
+        telemetry_stop(&telemetry);
+        log_stop();
+        return -1;
     }
 
+    printf("%d threads, %s load %.0f%% to %.0f%%, %d us periods, %s loop, %s kernel (%s).\n", threadCount,
+           load_shape_name(profile.shape), 100 * profile.low, 100 * profile.high, dutyPeriod,
+           feedback ? "closed" : "open", KERNEL_SPIN == stressKernel ? "spin" : cpu_kernel_name(stressKernel),
+           mem_isa_name(stressIsa));
+
     printf("Press 'Ctrl + C' to quit.\n");
+    PrintHeader();
+
+    start    = GetTickCount64();
+    lastGoal = load_profile_at(&profile, 0);
+
+    while (!quitEvent)
+    {
+        Sleep(CONTROL_INTERVAL);
+
+        elapsed = GetTickCount64() - start;
+
+        if (0 < durationSec && elapsed >= (ULONGLONG)durationSec * 1000)
+            quitEvent = true;
+
+        if (0 != cpu_sample_read(&after))
+            break;
+
+        goal = load_profile_at(&profile, elapsed);
+        Control(goal, lastGoal, &before, &after);
+
+        if (elapsed - lastReport >= REPORT_INTERVAL)
+        {
+            PrintLine(elapsed / 1000.0, lastGoal);
+            lastReport = elapsed;
+        }
+
+        before   = after;
+        lastGoal = goal;
+    }
+
+    quitEvent = true;
+
+    /* More threads than one wait can take. */
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (NULL == threads[i].handle)
+            continue;
+
+        WaitForSingleObject(threads[i].handle, INFINITE);
+        CloseHandle(threads[i].handle);
+    }
+
+    telemetry_stop(&telemetry);
+    PrintReport((GetTickCount64() - start) / 1000.0);
 
-    WaitForMultipleObjects(CPU_CORES, thdHandle, TRUE, INFINITE);
+    log_stop();
+    free(threads);
 
     return 0;
 }
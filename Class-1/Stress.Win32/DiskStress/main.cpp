@@ -0,0 +1,630 @@
+/**
+ * main.cpp - disk stress.
+ *
+ * You can view the effect through the task manager or the resource
+ * monitor.
+ *
+ * Every thread keeps a queue of unbuffered, overlapped reads and writes
+ * in flight on one test file, random or sequential, at a read / write
+ * mix and up to a total rate. Throughput and IOPS are reported every
+ * second, latency percentiles at the end. Any failed I/O is counted and
+ * makes the exit code nonzero, a run is a check of the drive too.
+ *
+ * License - MIT.
+*/
+
+#include <iostream>
+#include <signal.h>
+#include <Windows.h>
+
+#include "asynclog.h"
+#include "histogram.h"
+#include "timing.h"
+
+
+#define FILE_NAME               "DiskStress.dat"
+#define FILE_SIZE               1024        // MiB
+#define BLOCK_SIZE              64          // KiB
+#define THREAD_COUNT            1
+#define QUEUE_DEPTH             4
+#define WRITE_PERCENT           50
+#define REPORT_INTERVAL         1000        // ms
+#define FILL_BLOCK              (4 * 1024 * 1024)
+#define MAX_QUEUE_DEPTH         32
+
+#define MIB                     (1024 * 1024)
+#define MB                      1e6
+
+
+typedef struct _IO_SLOT {
+    OVERLAPPED overlapped;
+    BYTE *buffer;
+    UINT64 issued;                      // ns, timing_now_ns().
+    BOOL write;
+    BOOL failed;                        // Failed to start.
+    BOOL idle;                          // Completed, waits for the rate.
+} IO_SLOT;
+
+typedef struct _IO_THREAD {
+    HANDLE handle;
+    int index;
+    int status;
+    UINT64 random;                      // xorshift state.
+    UINT64 cursor;                      // Next block of sequential.
+    volatile LONG64 readBytes;
+    volatile LONG64 writeBytes;
+    volatile LONG64 reads;
+    volatile LONG64 writes;
+    volatile LONG64 errors;
+    LatencyHistogram readLatency;       // ns
+    LatencyHistogram writeLatency;
+} IO_THREAD;
+
+
+IO_THREAD *threads      = NULL;
+HANDLE file             = INVALID_HANDLE_VALUE;
+UINT64 startTime;                       // ns, timing_now_ns().
+bool quitEvent          = false;
+BOOL fileCreated        = FALSE;
+
+const char *filePath    = FILE_NAME;
+UINT64 fileSize         = (UINT64)FILE_SIZE * MIB;
+DWORD blockSize         = BLOCK_SIZE * 1024;
+int threadCount         = THREAD_COUNT;
+int queueDepth          = QUEUE_DEPTH;
+int writePercent        = WRITE_PERCENT;
+BOOL sequential         = FALSE;
+double rateLimit        = 0;        // MB/s of all threads, 0 is none.
+int durationSec         = 0;
+
+
+static inline UINT64 xorshift(UINT64 x)
+{
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return x;
+}
+
+/**
+ * IssueIo - Start the next read or write of a slot.
+*/
+void IssueIo(IO_THREAD *thread, IO_SLOT *slot)
+{
+    UINT64 blocks = fileSize / blockSize;
+    UINT64 region = blocks / threadCount;
+    UINT64 block;
+    BOOL done;
+
+    thread->random = xorshift(thread->random);
+
+    /* Sequential threads walk their own part of the file. */
+    if (sequential)
+    {
+        block          = thread->index * region + thread->cursor;
+        thread->cursor = (thread->cursor + 1) % region;
+    }
+    else
+    {
+        block = (thread->random >> 8) % blocks;
+    }
+
+    slot->write  = (int)(thread->random % 100) < writePercent;
+    slot->failed = FALSE;
+
+    slot->overlapped.Offset     = (DWORD)(block * blockSize);
+    slot->overlapped.OffsetHigh = (DWORD)((block * blockSize) >> 32);
+
+    slot->issued = timing_now_ns();
+
+    if (slot->write)
+        done = WriteFile(file, slot->buffer, blockSize, NULL, &slot->overlapped);
+    else
+        done = ReadFile(file, slot->buffer, blockSize, NULL, &slot->overlapped);
+
+    /* Make the failure come back through the event like a completion. */
+    if (!done && ERROR_IO_PENDING != GetLastError())
+    {
+        LOG_ERROR("Error in %s at %llu: %d.", slot->write ? "WriteFile" : "ReadFile", block * blockSize, GetLastError());
+        slot->failed = TRUE;
+        SetEvent(slot->overlapped.hEvent);
+    }
+}
+
+/**
+ * CompleteIo - Count a finished slot, done at now.
+*/
+void CompleteIo(IO_THREAD *thread, IO_SLOT *slot, UINT64 now)
+{
+    DWORD bytes = 0;
+    UINT64 ns;
+
+    if (slot->failed || !GetOverlappedResult(file, &slot->overlapped, &bytes, FALSE) || bytes != blockSize)
+    {
+        if (!slot->failed)
+            LOG_ERROR("Error in %s: %d, %lu bytes.", slot->write ? "write" : "read", GetLastError(), bytes);
+
+        InterlockedIncrement64(&thread->errors);
+        return;
+    }
+
+    ns = now - slot->issued;
+
+    if (slot->write)
+    {
+        thread->writeLatency.record(ns);
+        InterlockedIncrement64(&thread->writes);
+        InterlockedAdd64(&thread->writeBytes, bytes);
+    }
+    else
+    {
+        thread->readLatency.record(ns);
+        InterlockedIncrement64(&thread->reads);
+        InterlockedAdd64(&thread->readBytes, bytes);
+    }
+}
+
+/**
+ * ThrottleDelay - Milliseconds the thread is ahead of its share of the
+ * rate, 0 when it may issue now.
+*/
+DWORD ThrottleDelay(IO_THREAD *thread, UINT64 issuedBytes)
+{
+    double rate = rateLimit * MB / threadCount;
+    double allowed;
+
+    if (0 >= rateLimit)
+        return 0;
+
+    allowed = rate * (timing_now_ns() - startTime) / TIMING_NS_PER_SEC;
+    if ((double)issuedBytes <= allowed)
+        return 0;
+
+    return 1 + (DWORD)(((double)issuedBytes - allowed) * 1000 / rate);
+}
+
+/**
+ * Keeps the queue full: a completed slot gets the next I/O right away,
+ * or as soon as the rate allows.
+ *
+ * The wait for the rate is the wait for completions too, an I/O done
+ * meanwhile is timed when it is done and not when the rate lets the
+ * thread go on. Every slot done is handled after a wake up, not only the
+ * lowest one WaitForMultipleObjects names.
+*/
+DWORD WINAPI
+DiskStressHandler(LPVOID lpParam)
+{
+    IO_THREAD *thread = (IO_THREAD *)lpParam;
+    IO_SLOT slots[MAX_QUEUE_DEPTH];
+    HANDLE events[MAX_QUEUE_DEPTH];
+    int idle[MAX_QUEUE_DEPTH];
+    int idleCount      = 0;
+    UINT64 issuedBytes = 0;
+    UINT64 now;
+    DWORD result;
+    DWORD delay        = 0;
+    int i;
+
+    ZeroMemory(slots, sizeof(slots));
+
+    for (i = 0; i < queueDepth; i++)
+    {
+        slots[i].buffer            = (BYTE *)VirtualAlloc(NULL, blockSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        slots[i].overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        events[i]                  = slots[i].overlapped.hEvent;
+
+        if (NULL == slots[i].buffer || NULL == events[i])
+        {
+            LOG_ERROR("Error in VirtualAlloc or CreateEvent: %d.", GetLastError());
+            thread->status = -1;
+            goto out;
+        }
+
+        /* Random data, a drive that compresses gets no easy blocks. */
+        for (DWORD j = 0; j < blockSize / sizeof(UINT64); j++)
+        {
+            thread->random                 = xorshift(thread->random);
+            ((UINT64 *)slots[i].buffer)[j] = thread->random;
+        }
+    }
+
+    for (i = 0; i < queueDepth; i++)
+    {
+        IssueIo(thread, &slots[i]);
+        issuedBytes += blockSize;
+    }
+
+    while (!quitEvent)
+    {
+        while (0 < idleCount && 0 == (delay = ThrottleDelay(thread, issuedBytes)))
+        {
+            i = idle[--idleCount];
+            slots[i].idle = FALSE;
+
+            IssueIo(thread, &slots[i]);
+            issuedBytes += blockSize;
+        }
+
+        /* 100 ms at most, quitEvent is checked that often. */
+        result = WaitForMultipleObjects(queueDepth, events, FALSE, (0 < idleCount && delay < 100) ? delay : 100);
+        if (WAIT_TIMEOUT == result)
+            continue;
+
+        if (result >= WAIT_OBJECT_0 + (DWORD)queueDepth)
+        {
+            LOG_ERROR("Error in WaitForMultipleObjects: %d.", GetLastError());
+            thread->status = -1;
+            break;
+        }
+
+        /* One time for all slots done, before any wait for the rate. */
+        now = timing_now_ns();
+
+        for (i = 0; i < queueDepth; i++)
+        {
+            if (slots[i].idle || WAIT_OBJECT_0 != WaitForSingleObject(events[i], 0))
+                continue;
+
+            CompleteIo(thread, &slots[i], now);
+
+            /* Idle events stay reset, the wait wakes for slots in flight only. */
+            ResetEvent(events[i]);
+            slots[i].idle     = TRUE;
+            idle[idleCount++] = i;
+        }
+    }
+
+    /* The buffers stay in use until every I/O in flight is done. */
+    for (i = 0; i < queueDepth; i++)
+    {
+        DWORD bytes;
+
+        if (slots[i].failed || slots[i].idle)
+            continue;
+
+        CancelIoEx(file, &slots[i].overlapped);
+        GetOverlappedResult(file, &slots[i].overlapped, &bytes, TRUE);
+    }
+
+out:
+    for (i = 0; i < queueDepth; i++)
+    {
+        if (NULL != slots[i].buffer)
+            VirtualFree(slots[i].buffer, 0, MEM_RELEASE);
+
+        if (NULL != slots[i].overlapped.hEvent)
+            CloseHandle(slots[i].overlapped.hEvent);
+    }
+
+    return 0;
+}
+
+/**
+ * PrepareFile - Open the test file and write it full, reads must hit
+ * real blocks and not holes the file system answers with zeros.
+*/
+int PrepareFile(void)
+{
+    LARGE_INTEGER size;
+    OVERLAPPED overlapped;
+    UINT64 offset;
+    BYTE *buffer = NULL;
+    DWORD bytes;
+    int status   = -1;
+
+    file = CreateFileA(filePath, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        LOG_ERROR("Error in CreateFile %s: %d.", filePath, GetLastError());
+        return -1;
+    }
+
+    fileCreated = ERROR_ALREADY_EXISTS != GetLastError();
+
+    if (!GetFileSizeEx(file, &size))
+    {
+        LOG_ERROR("Error in GetFileSizeEx: %d.", GetLastError());
+        return -1;
+    }
+
+    if ((UINT64)size.QuadPart >= fileSize)
+        return 0;
+
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    buffer            = (BYTE *)VirtualAlloc(NULL, FILL_BLOCK, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+    if (NULL == overlapped.hEvent || NULL == buffer)
+    {
+        LOG_ERROR("Error in VirtualAlloc or CreateEvent: %d.", GetLastError());
+        goto out;
+    }
+
+    memset(buffer, 0x5a, FILL_BLOCK);
+    printf("Writing %llu MiB to %s.\n", fileSize / MIB, filePath);
+
+    for (offset = 0; offset < fileSize && !quitEvent; offset += bytes)
+    {
+        bytes = (DWORD)min((UINT64)FILL_BLOCK, fileSize - offset);
+
+        overlapped.Offset     = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+        if (!WriteFile(file, buffer, bytes, NULL, &overlapped) && ERROR_IO_PENDING != GetLastError())
+        {
+            LOG_ERROR("Error in WriteFile: %d.", GetLastError());
+            goto out;
+        }
+
+        if (!GetOverlappedResult(file, &overlapped, &bytes, TRUE))
+        {
+            LOG_ERROR("Error in GetOverlappedResult: %d.", GetLastError());
+            goto out;
+        }
+    }
+
+    status = quitEvent ? -1 : 0;
+
+out:
+    if (NULL != buffer)
+        VirtualFree(buffer, 0, MEM_RELEASE);
+
+    if (NULL != overlapped.hEvent)
+        CloseHandle(overlapped.hEvent);
+
+    return status;
+}
+
+/**
+ * CloseFile - Close the test file, delete it if this run created it.
+*/
+void CloseFile(void)
+{
+    if (INVALID_HANDLE_VALUE == file)
+        return;
+
+    CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+
+    if (fileCreated)
+        DeleteFileA(filePath);
+}
+
+/**
+ * CreateThreads - Start the I/O threads.
+*/
+int CreateThreads(void)
+{
+    threads = new IO_THREAD[threadCount];
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        threads[i].handle       = NULL;
+        threads[i].index        = i;
+        threads[i].status       = 0;
+        threads[i].random       = ((UINT64)i + 1) * 0x9e3779b97f4a7c15ull;
+        threads[i].cursor       = 0;
+        threads[i].readBytes    = 0;
+        threads[i].writeBytes   = 0;
+        threads[i].reads        = 0;
+        threads[i].writes       = 0;
+        threads[i].errors       = 0;
+    }
+
+    startTime = timing_now_ns();
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        threads[i].handle = CreateThread(NULL, 0, DiskStressHandler, &threads[i], 0, NULL);
+        if (NULL == threads[i].handle)
+        {
+            LOG_ERROR("Error in CreateThread: %d.", GetLastError());
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Totals - Sums of all threads.
+*/
+void Totals(LONG64 *readBytes, LONG64 *writeBytes, LONG64 *ios, LONG64 *errors)
+{
+    *readBytes = *writeBytes = *ios = *errors = 0;
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        *readBytes  += threads[i].readBytes;
+        *writeBytes += threads[i].writeBytes;
+        *ios        += threads[i].reads + threads[i].writes;
+        *errors     += threads[i].errors;
+    }
+}
+
+/**
+ * PrintReport - Throughput, IOPS and latency of the whole run.
+*/
+LONG64 PrintReport(double seconds)
+{
+    LatencyHistogram readLatency, writeLatency;
+    LONG64 readBytes, writeBytes, ios, errors;
+
+    Totals(&readBytes, &writeBytes, &ios, &errors);
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        readLatency.merge(threads[i].readLatency);
+        writeLatency.merge(threads[i].writeLatency);
+    }
+
+    if (seconds <= 0)
+        seconds = 1;
+
+    printf("\nReport, %.1f s:\n", seconds);
+    printf("    read   %10.1f MB/s  %10.0f IOPS\n", readBytes / MB / seconds, readLatency.count() / seconds);
+    printf("    write  %10.1f MB/s  %10.0f IOPS\n", writeBytes / MB / seconds, writeLatency.count() / seconds);
+    printf("    errors %10lld\n", errors);
+
+    if (0 < readLatency.count())
+        readLatency.print("Read latency", 1000.0, "us");
+
+    if (0 < writeLatency.count())
+        writeLatency.print("Write latency", 1000.0, "us");
+
+    return errors;
+}
+
+void SignalHandler(int s)
+{
+    if (SIGINT == s) {
+        LOG_INFO("It will exit...");
+        quitEvent = true;
+    }
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    int sizeMib = FILE_SIZE, blockKib = BLOCK_SIZE;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'p':
+            if (0 == strcmp(argv[i + 1], "rand"))
+                sequential = FALSE;
+            else if (0 == strcmp(argv[i + 1], "seq"))
+                sequential = TRUE;
+            else
+                return -1;
+            break;
+        case 'f': filePath     = argv[i + 1];        break;
+        case 's': sizeMib      = atoi(argv[i + 1]);  break;
+        case 'b': blockKib     = atoi(argv[i + 1]);  break;
+        case 't': threadCount  = atoi(argv[i + 1]);  break;
+        case 'q': queueDepth   = atoi(argv[i + 1]);  break;
+        case 'w': writePercent = atoi(argv[i + 1]);  break;
+        case 'r': rateLimit    = atof(argv[i + 1]);  break;
+        case 'T': durationSec  = atoi(argv[i + 1]);  break;
+        default:
+            return -1;
+        }
+    }
+
+    fileSize  = (UINT64)sizeMib * MIB;
+    blockSize = (DWORD)blockKib * 1024;
+
+    /* Unbuffered I/O needs whole sectors, 4 KiB covers all drives. */
+    if (0 >= blockKib || 0 != blockKib % 4 || blockKib > 64 * 1024 || 0 >= sizeMib || threadCount < 1 ||
+        queueDepth < 1 || queueDepth > MAX_QUEUE_DEPTH || writePercent < 0 || writePercent > 100 ||
+        rateLimit < 0 || durationSec < 0 || fileSize / blockSize < (UINT64)threadCount)
+        return -1;
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    LONG64 readBytes, writeBytes, ios, errors, lastRead = 0, lastWrite = 0, lastIos = 0;
+    ULONGLONG start, elapsed;
+    int status = 0;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-f file] [-s MiB] [-b KiB] [-p rand|seq] [-w %%] [-t threads] [-q depth] [-r MB/s] [-T s]\n", argv[0]);
+        printf("  -f file      Test file, overwritten, default %s.\n", FILE_NAME);
+        printf("  -s MiB       Size of the test file, default %d.\n", FILE_SIZE);
+        printf("  -b KiB       Block size, a multiple of 4, default %d.\n", BLOCK_SIZE);
+        printf("  -p pattern   Random or sequential blocks, default rand.\n");
+        printf("  -w percent   Share of writes, default %d.\n", WRITE_PERCENT);
+        printf("  -t threads   I/O threads, default %d.\n", THREAD_COUNT);
+        printf("  -q depth     I/O in flight per thread, default %d, max %d.\n", QUEUE_DEPTH, MAX_QUEUE_DEPTH);
+        printf("  -r MB/s      Limit of all threads, default 0 (none).\n");
+        printf("  -T seconds   Run time, default until Ctrl + C.\n");
+        return -1;
+    }
+
+    if (0 != log_start())
+        return -1;
+
+    signal(SIGINT, SignalHandler);
+
+    if (0 != PrepareFile())
+    {
+        CloseFile();
+        log_stop();
+        return -1;
+    }
+
+    printf("%d threads, %d deep, %s %lu KiB blocks, %d%% writes on %llu MiB of %s",
+           threadCount, queueDepth, sequential ? "sequential" : "random", blockSize / 1024, writePercent,
+           fileSize / MIB, filePath);
+
+    if (0 < rateLimit)
+        printf(", at most %.0f MB/s", rateLimit);
+
+    printf(".\n");
+
+    if (0 != CreateThreads())
+    {
+        quitEvent = true;
+        status    = -1;
+    }
+    else
+    {
+        printf("Press 'Ctrl + C' to quit.\n");
+        printf("%8s %12s %12s %10s %8s\n", "Time s", "Read MB/s", "Write MB/s", "IOPS", "Errors");
+    }
+
+    start = GetTickCount64();
+
+    while (!quitEvent)
+    {
+        Sleep(REPORT_INTERVAL);
+
+        elapsed = GetTickCount64() - start;
+
+        if (0 < durationSec && elapsed >= (ULONGLONG)durationSec * 1000)
+            quitEvent = true;
+
+        Totals(&readBytes, &writeBytes, &ios, &errors);
+
+        printf("%8.0f %12.1f %12.1f %10lld %8lld\n", elapsed / 1000.0, (readBytes - lastRead) / MB,
+               (writeBytes - lastWrite) / MB, ios - lastIos, errors);
+
+        lastRead  = readBytes;
+        lastWrite = writeBytes;
+        lastIos   = ios;
+    }
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (NULL == threads[i].handle)
+            continue;
+
+        WaitForSingleObject(threads[i].handle, INFINITE);
+        CloseHandle(threads[i].handle);
+
+        if (0 != threads[i].status)
+            status = -1;
+    }
+
+    if (0 != PrintReport((GetTickCount64() - start) / 1000.0))
+        status = -1;
+
+    CloseFile();
+    log_stop();
+    delete[] threads;
+
+    return status;
+}
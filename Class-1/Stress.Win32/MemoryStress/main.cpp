@@ -1,8 +1,25 @@
 /**
  * main.cpp - memory stress.
- * 
+ *
  * You can view the effect through the task manager.
- * 
+ *
+ * Every thread can run on a NUMA node and get its memory from the same
+ * node, another node or a fixed one, bound or placed by first touch.
+ * The write bandwidth is reported per pair of thread and memory node.
+ *
+ * The benchmark modes measure instead of loading: read, write, copy and
+ * triad bandwidth and pointer chase latency over working sets from the
+ * L1 cache to memory, see Common/memkernel.h.
+ *
+ * Memory can be on large or huge pages, see Common/largepage.h.
+ *
+ * The pressure mode holds the resident memory of the process or of the
+ * system on a goal that holds, ramps or oscillates, see
+ * Common/footprint.h.
+ *
+ * With -o the clock, temperature and power are sampled to a CSV with
+ * the bandwidth or the footprint, see Common/telemetry.h.
+ *
  * License - MIT.
 */
 
@@ -10,24 +27,144 @@
 #include <signal.h>
 #include <Windows.h>
 
+#include "asynclog.h"
+#include "numamem.h"
+#include "memkernel.h"
+#include "largepage.h"
+#include "footprint.h"
+#include "telemetry.h"
+#include "timing.h"
+
 
 #define THREAD_COUNT            16
-#define TOTAL_MEMORY            1024        // MiB
-#define CAPACITY_PER_SINGLE     65536       // KiB
+#define BENCH_THREAD_COUNT      1
+#define THREAD_MEMORY           64          // MiB
+#define PASS_INTERVAL           4000        // ms
+#define REPORT_INTERVAL         10          // s
+#define PAGE_SAMPLES            256
+#define MAX_THREADS             1024
+
+#define NODE_SPREAD             -1          // Threads round robin over the nodes.
+#define NODE_NONE               -2          // Threads not pinned.
+
+#define MEM_LOCAL               -1          // Node of the thread.
+#define MEM_REMOTE              -2          // Next node after the one of the thread.
+#define MEM_ANY                 -3          // No node, wherever the thread runs.
+
+#define BENCH_STRESS            -1          // No benchmark, load memory.
+#define BENCH_BANDWIDTH         -2          // All bandwidth kernels.
+#define BENCH_ALL               -3          // Bandwidth kernels and latency.
+#define BENCH_PRESSURE          -4          // No benchmark, hold a footprint.
+#define BENCH_LATENCY           MEM_KERNEL_COUNT
+
+#define BENCH_MIN_SIZE          (16 * 1024)
+#define BENCH_CASE_MS           250
+#define CHASE_STEPS             4096
+
+#define PRESSURE_TICK           100         // ms
+#define PRESSURE_PERIOD         60          // s
+
+
+typedef struct _STRESS_THREAD {
+    HANDLE handle;
+    int index;
+    int cpuNode;                        // Index in numa.nodes, -1 not pinned.
+    int memNode;                        // Index in numa.nodes, -1 no node.
+    int status;
+    int pages;                          // Resident pages sampled.
+    int placedPages;                    // Of them on the wanted node.
+    int pageKind;                       // Pages the memory got.
+    volatile LONG64 bytes;              // Written.
+    volatile LONG64 ns;                 // Time spent writing.
+    char *buffer;                       // Benchmark memory, kept over the cases.
+    UINT64 accesses;                    // Pointer chase loads.
+    double sink;
+} STRESS_THREAD;
+
+
+NUMA_INFO numa;
+STRESS_THREAD *threads  = NULL;
+bool quitEvent          = false;
+HANDLE startEvent       = NULL;
+volatile LONG ready     = 0;
+volatile LONG stop      = 0;
+
+int threadCount         = 0;
+int threadMemory        = THREAD_MEMORY;
+int cpuPolicy           = NODE_SPREAD;
+int memPolicy           = MEM_LOCAL;
+int allocMethod         = NUMA_ALLOC_TOUCH;
+int passInterval        = PASS_INTERVAL;
+int durationSec         = 0;
+int benchMode           = BENCH_STRESS;
+int benchIsa            = -1;
+int pageKind            = PAGES_SMALL;
+BOOL nonTemporal        = FALSE;
+
+int pressureSource      = FOOTPRINT_SELF;
+int pressureProfile     = FOOTPRINT_HOLD;
+int pressurePeriod      = PRESSURE_PERIOD;
+UINT64 pressureTarget   = 0;
+UINT64 pressureLow      = 0;
+UINT64 jobLimit         = 0;
+
+TELEMETRY telemetry;
+const char *csvPath     = NULL;
+int csvInterval         = TELEMETRY_INTERVAL;
+
+int caseKernel          = 0;
+SIZE_T caseSize         = 0;
+
+/**
+ * AllocBuffer - Memory of a thread on its node and pages.
+ *
+ * Large and huge pages are physical as soon as they are allocated, they
+ * come from the memory node, first touch does not apply to them.
+*/
+char *AllocBuffer(STRESS_THREAD *thread, SIZE_T size)
+{
+    int node = 0 <= thread->memNode ? numa.nodes[thread->memNode].node : -1;
 
+    thread->pageKind = PAGES_SMALL;
 
-#ifdef USE_MALLOC
+    if (PAGES_SMALL == pageKind)
+        return (char *)numa_alloc(&numa, size, thread->memNode, allocMethod);
 
-#define AllocApi(size)          malloc(size)
-#define FreeApi(ptr)            free(ptr)
-#else   /* USE_MALLOC */
+    return (char *)page_alloc(size, pageKind, node, &thread->pageKind);
+}
 
-#define AllocApi(size)          _aligned_malloc((size), 32)
-#define FreeApi(ptr)            _aligned_free(ptr)
-#endif  /* USE_MALLOC */
+/**
+ * FreeBuffer - Free what AllocBuffer() gave.
+*/
+void FreeBuffer(char *ptr)
+{
+    if (!page_free(ptr))
+        numa_free(ptr);
+}
 
+/**
+ * PrintPages - Pages the threads got, with fallbacks.
+*/
+void PrintPages(void)
+{
+    int counts[PAGES_COUNT] = { 0 };
 
-bool quitEvent = false;
+    if (PAGES_SMALL == pageKind)
+        return;
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (0 == threads[i].status)
+            counts[threads[i].pageKind]++;
+    }
+
+    printf("\nPages asked %s, got:", page_kind_name(pageKind));
+
+    for (int kind = PAGES_COUNT - 1; kind >= PAGES_SMALL; kind--)
+        printf(" %d %s", counts[kind], page_kind_name(kind));
+
+    printf(".\n");
+}
 
 /**
  * The requested memory is virtual memory, and if the virtual memory is not
@@ -36,81 +173,714 @@ bool quitEvent = false;
 DWORD WINAPI
 MemoryStressHandler(LPVOID lpParam)
 {
-    int i = 0;
+    STRESS_THREAD *thread = (STRESS_THREAD *)lpParam;
+    SIZE_T size = (SIZE_T)threadMemory * 1024 * 1024;
     UINT bitToggle = 0xffffffff;
+    int counts[NUMA_MAX_NODES];
+    int wanted;
+    UINT64 t0;
+    GROUP_AFFINITY previous;
+    char *ptr;
 
-    char** ptrs = (char**)malloc(sizeof(void*) * TOTAL_MEMORY);
+    if (0 <= thread->cpuNode && 0 != numa_run_on_node(&numa, thread->cpuNode, &previous))
+    {
+        thread->status = -1;
+        return 0;
+    }
+
+    ptr = AllocBuffer(thread, size);
+    if (NULL == ptr)
+    {
+        LOG_ERROR("Error in AllocBuffer thread: %d.", thread->index);
+        thread->status = -1;
+        return 0;
+    }
+
+    /* Bound memory gets its pages here, touched memory already has them. */
+    memset(ptr, 0, size);
 
-    Sleep(100);
+    wanted = 0 <= thread->memNode ? thread->memNode : thread->cpuNode;
+    thread->pages = numa_page_nodes(ptr, size, PAGE_SAMPLES, counts, NUMA_MAX_NODES);
 
-    for (i = 0; i < TOTAL_MEMORY; i++)
+    if (0 <= wanted && numa.nodes[wanted].node < NUMA_MAX_NODES)
+        thread->placedPages = counts[numa.nodes[wanted].node];
+
+    while (!quitEvent)
     {
-        char* ptr = (char*)AllocApi(CAPACITY_PER_SINGLE);
+        bitToggle = ~bitToggle;
+
+        t0 = timing_now_ns();
+        memset(ptr, bitToggle, size);
 
-        if (ptr)
+        InterlockedAdd64(&thread->bytes, size);
+        InterlockedAdd64(&thread->ns, (LONG64)(timing_now_ns() - t0));
+
+        if (0 < passInterval)
+            Sleep(passInterval);
+    }
+
+    FreeBuffer(ptr);
+
+    return 0;
+}
+
+/**
+ * BenchHandler - One case: a kernel on caseSize bytes until stopped.
+*/
+DWORD WINAPI
+BenchHandler(LPVOID lpParam)
+{
+    STRESS_THREAD *thread = (STRESS_THREAD *)lpParam;
+    SIZE_T size = (SIZE_T)threadMemory * 1024 * 1024;
+    SIZE_T count = 0;
+    double *a = NULL, *b = NULL, *c = NULL;
+    void *chase = NULL;
+    GROUP_AFFINITY previous;
+    UINT64 t0;
+
+    if (0 <= thread->cpuNode && 0 != numa_run_on_node(&numa, thread->cpuNode, &previous))
+        thread->status = -1;
+
+    if (0 == thread->status && NULL == thread->buffer)
+    {
+        thread->buffer = AllocBuffer(thread, size);
+
+        if (NULL == thread->buffer)
+            thread->status = -1;
+        else
+            memset(thread->buffer, 0, size);
+    }
+
+    if (0 == thread->status && BENCH_LATENCY == caseKernel)
+    {
+        chase = chase_init(thread->buffer, caseSize, thread->index + 1);
+        if (NULL == chase)
+            thread->status = -1;
+        else
+            chase = chase_run(chase, caseSize / MEM_LINE);
+    }
+    else if (0 == thread->status)
+    {
+        /* Equal arrays, a multiple of 16 doubles keeps them aligned. */
+        count = caseSize / sizeof(double) / mem_kernel_arrays(caseKernel) / 16 * 16;
+        a     = (double *)thread->buffer;
+        b     = a + count;
+        c     = b + count;
+
+        mem_kernel_run(caseKernel, benchIsa, nonTemporal, a, b, c, count, &thread->sink);
+    }
+
+    thread->bytes    = 0;
+    thread->accesses = 0;
+
+    InterlockedIncrement(&ready);
+    WaitForSingleObject(startEvent, INFINITE);
+
+    t0 = timing_now_ns();
+
+    while (0 == thread->status && 0 == stop)
+    {
+        if (BENCH_LATENCY == caseKernel)
         {
-            ptrs[i] = ptr;
+            chase = chase_run(chase, CHASE_STEPS);
+            thread->accesses += CHASE_STEPS;
         }
         else
         {
-            ptrs[i] = nullptr;
-            printf("Error in AllocApi id: %d.\n", i);
+            thread->bytes += mem_kernel_run(caseKernel, benchIsa, nonTemporal, a, b, c, count, &thread->sink);
         }
     }
 
-    while (!quitEvent)
+    thread->ns    = (LONG64)(timing_now_ns() - t0);
+    thread->sink += (double)(UINT_PTR)chase;
+
+    return 0;
+}
+
+/**
+ * RunBenchCase - All threads on one kernel and size, one result line.
+*/
+int RunBenchCase(int kernel, SIZE_T size)
+{
+    int started = 0;
+    int status = 0;
+    double rate = 0.0;
+    double latency = 0.0;
+    char sizeName[16], instance[48];
+
+    caseKernel = kernel;
+    caseSize   = size;
+    ready      = 0;
+    stop       = 0;
+    ResetEvent(startEvent);
+
+    for (int i = 0; i < threadCount; i++)
     {
-        bitToggle = ~bitToggle;
+        threads[i].handle = CreateThread(NULL, 0, BenchHandler, &threads[i], 0, NULL);
 
-        for (i = 0; i < TOTAL_MEMORY; i++)
+        if (NULL == threads[i].handle)
         {
-            if (ptrs[i])
-            {
-                memset(ptrs[i], bitToggle, CAPACITY_PER_SINGLE);
-            }
+            LOG_ERROR("Error in create thread: %d.", i);
+            status = -1;
+            break;
         }
 
-        Sleep(4000);
+        started++;
+    }
+
+    while (ready < started)
+        Sleep(1);
+
+    SetEvent(startEvent);
+    Sleep(BENCH_CASE_MS);
+    InterlockedExchange(&stop, 1);
+
+    for (int i = 0; i < started; i++)
+    {
+        WaitForSingleObject(threads[i].handle, INFINITE);
+        CloseHandle(threads[i].handle);
+
+        if (0 != threads[i].status)
+            status = -1;
+        else if (0 < threads[i].ns)
+            rate += (double)threads[i].bytes / threads[i].ns;
+
+        if (0 < threads[i].accesses)
+            latency += (double)threads[i].ns / threads[i].accesses / started;
+    }
+
+    if (0 != status)
+        return status;
+
+    if (size >= 1024 * 1024)
+        snprintf(sizeName, sizeof(sizeName), "%lluM", (unsigned long long)(size >> 20));
+    else
+        snprintf(sizeName, sizeof(sizeName), "%lluK", (unsigned long long)(size >> 10));
+
+    if (BENCH_LATENCY == kernel)
+    {
+        printf("%-8s %-7s %-7s %7s %10s %10.2f\n", "latency", "-", "-", sizeName, "-", latency);
+        telemetry_record(&telemetry, "latency_ns", sizeName, latency);
+    }
+    else
+    {
+        printf("%-8s %-7s %-7s %7s %10.2f %10s\n", mem_kernel_name(kernel), mem_isa_name(benchIsa),
+               nonTemporal ? "nt" : "cached", sizeName, rate, "-");
+
+        snprintf(instance, sizeof(instance), "%s %s %s", mem_kernel_name(kernel), nonTemporal ? "nt" : "cached", sizeName);
+        telemetry_record(&telemetry, "gbps", instance, rate);
     }
 
-    for (i = 0; i < TOTAL_MEMORY; i++)
+    return 0;
+}
+
+/**
+ * RunBenchmarks - Every selected kernel over doubling working sets.
+*/
+int RunBenchmarks(void)
+{
+    int status = 0;
+    int first = 0 > benchMode ? 0 : benchMode;
+    int last = BENCH_ALL == benchMode ? BENCH_LATENCY : (BENCH_BANDWIDTH == benchMode ? MEM_KERNEL_COUNT - 1 : benchMode);
+    SIZE_T maxSize = (SIZE_T)threadMemory * 1024 * 1024;
+
+    startEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (NULL == startEvent)
     {
-        if (ptrs[i])
+        LOG_ERROR("Error in CreateEvent: %d.", GetLastError());
+        return -1;
+    }
+
+    printf("\n%d threads, working set per thread, GB/s of all threads, ns per load.\n", threadCount);
+    printf("%-8s %-7s %-7s %7s %10s %10s\n", "Kernel", "ISA", "Store", "Size", "GB/s", "ns/access");
+
+    for (int kernel = first; kernel <= last && !quitEvent; kernel++)
+    {
+        for (SIZE_T size = BENCH_MIN_SIZE; size <= maxSize && !quitEvent; size *= 2)
         {
-            FreeApi(ptrs[i]);
-            ptrs[i] = nullptr;
+            if (0 != RunBenchCase(kernel, size))
+            {
+                status = -1;
+                break;
+            }
         }
     }
 
-    free(ptrs);
+    PrintPages();
 
-    return 0;
+    for (int i = 0; i < threadCount; i++)
+        FreeBuffer(threads[i].buffer);
+
+    CloseHandle(startEvent);
+
+    return status;
 }
 
 void SignalHandler(int s)
 {
     if (SIGINT == s) {
-        printf("It will exit...\n");
+        LOG_INFO("It will exit...");
         quitEvent = true;
     }
 }
 
-int main()
+/**
+ * NodeIndex - Index in numa.nodes of a node number.
+*/
+int NodeIndex(int node)
 {
-    HANDLE thdHandle[THREAD_COUNT];
+    for (int i = 0; i < numa.nodeCount; i++)
+    {
+        if (numa.nodes[i].node == node)
+            return i;
+    }
 
-    signal(SIGINT, SignalHandler);
-    
-    for (int i = 0; i < THREAD_COUNT; i++) {
-        thdHandle[i] = CreateThread(NULL, 0, MemoryStressHandler, NULL, 0, NULL);
+    return -1;
+}
+
+/**
+ * PlaceThreads - Thread and memory node of every thread.
+*/
+void PlaceThreads(void)
+{
+    for (int i = 0; i < threadCount; i++)
+    {
+        STRESS_THREAD *thread = &threads[i];
+
+        thread->index = i;
+
+        if (NODE_NONE == cpuPolicy)
+            thread->cpuNode = -1;
+        else if (NODE_SPREAD == cpuPolicy)
+            thread->cpuNode = i % numa.nodeCount;
+        else
+            thread->cpuNode = cpuPolicy;
 
-        if (NULL == thdHandle[i])
-            printf("Error in create thread: %d.\n", i);
+        switch (memPolicy)
+        {
+        case MEM_ANY:
+            thread->memNode = -1;
+            break;
+        case MEM_LOCAL:
+            thread->memNode = thread->cpuNode;
+            break;
+        case MEM_REMOTE:
+            thread->memNode = 0 > thread->cpuNode ? -1 : (thread->cpuNode + 1) % numa.nodeCount;
+            break;
+        default:
+            thread->memNode = memPolicy;
+            break;
+        }
+    }
+}
+
+/**
+ * NodeName - Node number of an index, "any" for no node.
+*/
+void NodeName(int index, char *name, int size)
+{
+    if (0 > index)
+        snprintf(name, size, "any");
+    else
+        snprintf(name, size, "%u", numa.nodes[index].node);
+}
+
+/**
+ * PrintReport - Write bandwidth per pair of thread node and memory node.
+ *
+ * The rate of a thread is its bytes over its time spent writing, rates
+ * of threads on the same pair are added.
+*/
+void PrintReport(void)
+{
+    printf("\n%-8s %-8s %7s %8s %8s %10s %10s\n",
+           "CPU", "Memory", "Threads", "MB", "Placed", "GB/s", "Per thread");
+
+    for (int cpu = -1; cpu < numa.nodeCount; cpu++)
+    {
+        for (int mem = -1; mem < numa.nodeCount; mem++)
+        {
+            int count = 0, pages = 0, placed = 0;
+            double rate = 0.0;
+            char cpuName[16], memName[16], pair[40];
+
+            for (int i = 0; i < threadCount; i++)
+            {
+                STRESS_THREAD *thread = &threads[i];
+
+                if (thread->cpuNode != cpu || thread->memNode != mem || 0 != thread->status)
+                    continue;
+
+                count++;
+                pages  += thread->pages;
+                placed += thread->placedPages;
+
+                if (0 < thread->ns)
+                    rate += (double)thread->bytes / thread->ns;
+            }
+
+            if (0 == count)
+                continue;
+
+            NodeName(cpu, cpuName, sizeof(cpuName));
+            NodeName(mem, memName, sizeof(memName));
+
+            snprintf(pair, sizeof(pair), "%s>%s", cpuName, memName);
+            telemetry_record(&telemetry, "write_gbps", pair, rate);
+
+            if (0 > cpu && 0 > mem)
+                printf("%-8s %-8s %7d %8d %8s %10.2f %10.2f\n", cpuName, memName, count,
+                       count * threadMemory, "-", rate, rate / count);
+            else
+                printf("%-8s %-8s %7d %8d %7.1f%% %10.2f %10.2f\n", cpuName, memName, count,
+                       count * threadMemory, 0 < pages ? 100.0 * placed / pages : 0.0, rate, rate / count);
+        }
+    }
+}
+
+/**
+ * ParseNode - Node number or one of the names, into an index or policy.
+*/
+int ParseNode(const char *value, const char **names, const int *policies, int nameCount, int *result)
+{
+    for (int i = 0; i < nameCount; i++)
+    {
+        if (0 == strcmp(value, names[i]))
+        {
+            *result = policies[i];
+            return 0;
+        }
+    }
+
+    if (value[0] < '0' || value[0] > '9')
+        return -1;
+
+    *result = NodeIndex(atoi(value));
+
+    if (0 > *result)
+    {
+        printf("Node %s has no processors.\n", value);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    static const char *cpuNames[]   = { "spread", "none" };
+    static const int cpuPolicies[]  = { NODE_SPREAD, NODE_NONE };
+    static const char *memNames[]   = { "local", "remote", "any" };
+    static const int memPolicies[]  = { MEM_LOCAL, MEM_REMOTE, MEM_ANY };
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'n':
+            if (0 != ParseNode(argv[i + 1], cpuNames, cpuPolicies, 2, &cpuPolicy))
+                return -1;
+            break;
+        case 'a':
+            if (0 != ParseNode(argv[i + 1], memNames, memPolicies, 3, &memPolicy))
+                return -1;
+            break;
+        case 'p':
+            if (0 == strcmp(argv[i + 1], "touch"))
+                allocMethod = NUMA_ALLOC_TOUCH;
+            else if (0 == strcmp(argv[i + 1], "bind"))
+                allocMethod = NUMA_ALLOC_BIND;
+            else
+                return -1;
+            break;
+        case 'b':
+            if (0 == strcmp(argv[i + 1], "stress"))
+                benchMode = BENCH_STRESS;
+            else if (0 == strcmp(argv[i + 1], "bandwidth"))
+                benchMode = BENCH_BANDWIDTH;
+            else if (0 == strcmp(argv[i + 1], "latency"))
+                benchMode = BENCH_LATENCY;
+            else if (0 == strcmp(argv[i + 1], "all"))
+                benchMode = BENCH_ALL;
+            else if (0 == strcmp(argv[i + 1], "pressure"))
+                benchMode = BENCH_PRESSURE;
+            else if (0 != mem_kernel_parse(argv[i + 1], &benchMode))
+                return -1;
+            break;
+        case 's':
+            if (0 != mem_isa_parse(argv[i + 1], &benchIsa))
+                return -1;
+            break;
+        case 'S':
+            if (0 == strcmp(argv[i + 1], "nt"))
+                nonTemporal = TRUE;
+            else if (0 == strcmp(argv[i + 1], "cached"))
+                nonTemporal = FALSE;
+            else
+                return -1;
+            break;
+        case 'P':
+            if (0 != page_kind_parse(argv[i + 1], &pageKind))
+                return -1;
+            break;
+        case 'R':
+            if (0 != footprint_parse_size(argv[i + 1], &pressureTarget))
+                return -1;
+            break;
+        case 'L':
+            if (0 != footprint_parse_size(argv[i + 1], &pressureLow))
+                return -1;
+            break;
+        case 'J':
+            if (0 != footprint_parse_size(argv[i + 1], &jobLimit))
+                return -1;
+            break;
+        case 'W':
+            if (0 == strcmp(argv[i + 1], "hold"))
+                pressureProfile = FOOTPRINT_HOLD;
+            else if (0 == strcmp(argv[i + 1], "ramp"))
+                pressureProfile = FOOTPRINT_RAMP;
+            else if (0 == strcmp(argv[i + 1], "oscillate"))
+                pressureProfile = FOOTPRINT_OSCILLATE;
+            else
+                return -1;
+            break;
+        case 'g':
+            if (0 == strcmp(argv[i + 1], "self"))
+                pressureSource = FOOTPRINT_SELF;
+            else if (0 == strcmp(argv[i + 1], "system"))
+                pressureSource = FOOTPRINT_SYSTEM;
+            else
+                return -1;
+            break;
+        case 'r': pressurePeriod = atoi(argv[i + 1]); break;
+        case 'o': csvPath      = argv[i + 1];        break;
+        case 'I': csvInterval  = atoi(argv[i + 1]);  break;
+        case 't': threadCount  = atoi(argv[i + 1]);  break;
+        case 'm': threadMemory = atoi(argv[i + 1]);  break;
+        case 'i': passInterval = atoi(argv[i + 1]);  break;
+        case 'T': durationSec  = atoi(argv[i + 1]);  break;
+        default:
+            return -1;
+        }
+    }
+
+    if (0 == threadCount)
+        threadCount = BENCH_STRESS == benchMode ? THREAD_COUNT : BENCH_THREAD_COUNT;
+
+    if (threadCount < 1 || threadCount > MAX_THREADS || threadMemory < 1 || passInterval < 0 || durationSec < 0 || csvInterval < 10)
+        return -1;
+
+    if (BENCH_PRESSURE == benchMode && (0 == pressureTarget || pressurePeriod < 1))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * RunStress - Load memory until Ctrl + C or the run time is over.
+*/
+int RunStress(void)
+{
+    int elapsed = 0;
+
+    for (int i = 0; i < threadCount; i++) {
+        threads[i].handle = CreateThread(NULL, 0, MemoryStressHandler, &threads[i], 0, NULL);
+
+        if (NULL == threads[i].handle)
+        {
+            LOG_ERROR("Error in create thread: %d.", i);
+            threads[i].status = -1;
+        }
     }
 
     printf("Press 'Ctrl + C' to quit.\n");
 
-    WaitForMultipleObjects(THREAD_COUNT, thdHandle, TRUE, INFINITE);
+    while (!quitEvent)
+    {
+        Sleep(1000);
+        elapsed++;
+
+        if (0 < durationSec && elapsed >= durationSec)
+            quitEvent = true;
+        else if (0 == elapsed % REPORT_INTERVAL)
+            PrintReport();
+    }
+
+    /* More threads than one wait can take. */
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (NULL == threads[i].handle)
+            continue;
+
+        WaitForSingleObject(threads[i].handle, INFINITE);
+        CloseHandle(threads[i].handle);
+    }
+
+    PrintReport();
+    PrintPages();
+
+    return 0;
+}
+
+/**
+ * RunPressure - Hold the footprint on its goal until Ctrl + C or the run
+ * time is over, one line a second.
+*/
+int RunPressure(void)
+{
+    FOOTPRINT fp;
+    FOOTPRINT_SAMPLE sample;
+    UINT64 low = pressureLow;
+    UINT64 gap, gapSum = 0, gapMax = 0;
+    ULONGLONG start, elapsed;
+    int steps = 0;
+    const double mib = 1024.0 * 1024.0;
+
+    if (FOOTPRINT_OSCILLATE == pressureProfile && 0 == low)
+        low = pressureTarget / 2;
+
+    if (0 != footprint_init(&fp, pressureSource, pressureProfile, pressureTarget, low,
+                            (UINT64)pressurePeriod * 1000, pageKind))
+    {
+        printf("The low level is above the target.\n");
+        return -1;
+    }
+
+    if (0 != jobLimit && 0 != footprint_limit_job(jobLimit))
+        return -1;
+
+    printf("Press 'Ctrl + C' to quit.\n");
+    printf("%-8s %10s %10s %10s %10s %10s %8s %8s\n",
+           "Time(s)", "Goal", "Measured", "Held", "WorkingSet", "Commit", "System", "Refused");
+
+    start = GetTickCount64();
+
+    while (!quitEvent)
+    {
+        elapsed = GetTickCount64() - start;
+
+        if (0 < durationSec && elapsed >= (ULONGLONG)durationSec * 1000)
+            break;
+
+        if (0 != footprint_step(&fp, elapsed, &sample))
+            break;
+
+        gap     = sample.goal > sample.measured ? sample.goal - sample.measured : sample.measured - sample.goal;
+        gapSum += gap;
+        gapMax  = gap > gapMax ? gap : gapMax;
+
+        if (0 == steps++ % (1000 / PRESSURE_TICK))
+        {
+            telemetry_record(&telemetry, "goal_mib", "", sample.goal / mib);
+            telemetry_record(&telemetry, "measured_mib", "", sample.measured / mib);
+            telemetry_record(&telemetry, "held_mib", "", sample.held / mib);
+
+            printf("%-8.1f %10.0f %10.0f %10.0f %10.0f %10.0f %7.1f%% %8d\n",
+                   elapsed / 1000.0, sample.goal / mib, sample.measured / mib, sample.held / mib,
+                   sample.workingSet / mib, sample.commit / mib,
+                   100.0 * sample.systemUsed / sample.systemTotal, fp.failures);
+        }
+
+        Sleep(PRESSURE_TICK);
+    }
+
+    if (0 < steps)
+        printf("\nGap to the goal MiB: mean %.1f, max %.1f.\n", gapSum / mib / steps, gapMax / mib);
+
+    footprint_release(&fp);
 
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    int status = 0;
+
+    /* The node names need the nodes. */
+    if (0 != numa_info_init(&numa))
+        return -1;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-b mode] [-s isa] [-S cached|nt] [-t threads] [-m MiB] [-n spread|none|node] [-a local|remote|any|node] [-p touch|bind] [-P small|large|huge] [-i ms] [-o csv] [-I ms] [-T s]\n", argv[0]);
+        printf("       %s -b pressure -R MiB|pct%% [-W hold|ramp|oscillate] [-L MiB|pct%%] [-r s] [-g self|system] [-J MiB|pct%%] [-P pages] [-T s]\n", argv[0]);
+        printf("  -b mode      stress (default), read, write, copy, triad, bandwidth, latency, all or pressure.\n");
+        printf("  -s isa       Kernels in scalar, avx2 or avx512, default the widest supported.\n");
+        printf("  -S store     Cached or non-temporal stores of the kernels, default cached.\n");
+        printf("  -t threads   Threads, default %d, %d for the benchmarks.\n", THREAD_COUNT, BENCH_THREAD_COUNT);
+        printf("  -m MiB       Memory per thread, the largest working set, default %d.\n", THREAD_MEMORY);
+        printf("  -n node      Threads round robin over the nodes, not pinned or on one node.\n");
+        printf("  -a node      Memory on the node of the thread, the next node, no node or one node.\n");
+        printf("  -p method    First touch from the node or bound to it, default touch.\n");
+        printf("  -P pages     Small (4 KiB), large (2 MiB) or huge (1 GiB) pages, default small.\n");
+        printf("  -i ms        Pause between passes, default %d, 0 writes all the time.\n", PASS_INTERVAL);
+        printf("  -T seconds   Run time, default until Ctrl + C.\n");
+        printf("  -o file      Sample clock, temperature and power with the results to a CSV.\n");
+        printf("  -I ms        Sample interval, default %d.\n", TELEMETRY_INTERVAL);
+        printf("  -R size      Pressure target, MiB or percent of the physical memory.\n");
+        printf("  -W profile   Goal holds the target, ramps up to it or oscillates, default hold.\n");
+        printf("  -L size      Ramp start and oscillation bottom, default 0 and half the target.\n");
+        printf("  -r seconds   Ramp time or oscillation period, default %d.\n", PRESSURE_PERIOD);
+        printf("  -g source    Goal for the working set of this process or the memory in use, default self.\n");
+        printf("  -J size      Run in a job with this memory limit.\n");
+        return -1;
+    }
+
+    numa_info_print(&numa);
+
+    if (0 > benchIsa)
+        benchIsa = mem_isa_best();
+
+    if (!mem_isa_supported(benchIsa))
+    {
+        printf("%s is not supported by this cpu.\n", mem_isa_name(benchIsa));
+        return -1;
+    }
+
+    if (1 == numa.nodeCount && MEM_REMOTE == memPolicy)
+        printf("Only one node, remote memory is local.\n");
+
+    threads = (STRESS_THREAD *)calloc(threadCount, sizeof(STRESS_THREAD));
+    if (NULL == threads)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    if (0 != log_start())
+    {
+        free(threads);
+        return -1;
+    }
+
+    signal(SIGINT, SignalHandler);
+
+    PlaceThreads();
+
+    if (NULL != csvPath && 0 != telemetry_start(&telemetry, csvPath, csvInterval))
+    {
+        log_stop();
+        free(threads);
+        return -1;
+    }
+
+    if (BENCH_STRESS == benchMode)
+        status = RunStress();
+    else if (BENCH_PRESSURE == benchMode)
+        status = RunPressure();
+    else
+        status = RunBenchmarks();
+
+    telemetry_stop(&telemetry);
+    log_stop();
+    free(threads);
+
+    return status;
+}
@@ -0,0 +1,640 @@
+/**
+ * main.cpp - mixed stress.
+ *
+ * Runs the load generators together, CpuStress, MemoryStress, DiskStress,
+ * TCPLoadGen or any other program, in phases read from a scenario file,
+ * see Common/scenario.h. A burn-in of new hardware with mixed load.
+ *
+ * The loads of a phase are created suspended in one job and resumed back
+ * to back, so they start within some microseconds of each other. Their
+ * output goes to a log file each. The report has, per phase and load,
+ * the exit code, run time, CPU time, peak memory and I/O of the process,
+ * and the last lines of its log, the own report of the program. A load
+ * that fails, or runs past its phase, fails the scenario.
+ *
+ * With -o the clock, temperature and power are sampled to a CSV for the
+ * whole scenario, with a row at every phase change, see
+ * Common/telemetry.h.
+ *
+ * License - MIT.
+*/
+
+#include <iostream>
+#include <stdarg.h>
+#include <signal.h>
+#include <Windows.h>
+#include <psapi.h>
+
+#include "scenario.h"
+#include "telemetry.h"
+#include "timing.h"
+
+#pragma comment(lib, "psapi.lib")
+
+
+#define LOG_DIR                 "MixStress-logs"
+#define GRACE_TIME              30          // s
+#define SERVICE_SETTLE          2000        // ms
+#define PROGRESS_INTERVAL       10000       // ms
+#define TAIL_LINES              20
+#define TAIL_SIZE               8192
+
+#define RUN_PENDING             0
+#define RUN_RUNNING             1
+#define RUN_EXITED              2
+#define RUN_KILLED              3           // Ran past the phase.
+#define RUN_NO_START            4
+#define RUN_STOPPED             5           // Service at the end.
+
+#define MB                      1e6
+#define MIB                     (1024.0 * 1024.0)
+
+
+typedef struct _RUN {
+    SCENARIO_LOAD *load;
+    PROCESS_INFORMATION pi;
+    HANDLE log;
+    char logPath[MAX_PATH];
+    int state;
+    DWORD exitCode;
+    UINT64 start;                       // ns, timing_now_ns().
+    double seconds;
+    double cpuSeconds;
+    double peakMib;
+    IO_COUNTERS io;
+} RUN;
+
+
+SCENARIO *scenario      = NULL;
+RUN services[SCENARIO_SERVICES];
+HANDLE job              = NULL;
+FILE *report            = NULL;
+volatile bool quitEvent = false;
+
+const char *scenarioPath    = NULL;
+const char *programsDir     = NULL;
+const char *logDir          = LOG_DIR;
+int graceSec                = GRACE_TIME;
+
+TELEMETRY telemetry;
+const char *csvPath     = NULL;
+int csvInterval         = TELEMETRY_INTERVAL;
+
+static const char *stateNames[] = { "pending", "running", "ok", "killed", "no start", "stopped" };
+
+
+/**
+ * Report - Print to the console and to the report file.
+*/
+void Report(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+
+    if (NULL == report)
+        return;
+
+    va_start(args, format);
+    vfprintf(report, format, args);
+    va_end(args);
+}
+
+/**
+ * Seconds - Between two timing_now_ns() readings.
+*/
+double Seconds(UINT64 from, UINT64 to)
+{
+    return (double)(to - from) / TIMING_NS_PER_SEC;
+}
+
+/**
+ * StartRun - Create the process of a load suspended, in the job, its
+ * output to a log file.
+*/
+int StartRun(RUN *run, SCENARIO_LOAD *load, const char *logName)
+{
+    char command[SCENARIO_COMMAND];
+    STARTUPINFOA si;
+    BOOL created;
+
+    ZeroMemory(run, sizeof(*run));
+    run->load  = load;
+    run->state = RUN_NO_START;
+
+    snprintf(run->logPath, sizeof(run->logPath), "%s\\%s.log", logDir, logName);
+    snprintf(command, sizeof(command), "%s", load->command);
+
+    run->log = CreateFileA(run->logPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == run->log)
+    {
+        printf("Error in CreateFile %s: %d.\n", run->logPath, GetLastError());
+        run->log = NULL;
+        return -1;
+    }
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb         = sizeof(si);
+    si.dwFlags    = STARTF_USESTDHANDLES;
+    si.hStdOutput = run->log;
+    si.hStdError  = run->log;
+
+    /* Only this log is inherited, the loads start one after the other. */
+    SetHandleInformation(run->log, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    created = CreateProcessA(NULL, command, NULL, NULL, TRUE, CREATE_SUSPENDED, NULL, NULL, &si, &run->pi);
+    SetHandleInformation(run->log, HANDLE_FLAG_INHERIT, 0);
+
+    if (!created)
+    {
+        printf("Error in CreateProcess %s: %d.\n", load->command, GetLastError());
+        goto out_log;
+    }
+
+    if (!AssignProcessToJobObject(job, run->pi.hProcess))
+    {
+        printf("Error in AssignProcessToJobObject: %d.\n", GetLastError());
+        TerminateProcess(run->pi.hProcess, 1);
+        CloseHandle(run->pi.hThread);
+        CloseHandle(run->pi.hProcess);
+        goto out_log;
+    }
+
+    run->state = RUN_PENDING;
+
+    return 0;
+
+out_log:
+    CloseHandle(run->log);
+    run->log = NULL;
+
+    return -1;
+}
+
+/**
+ * ResumeRuns - Let the started loads go, back to back. Return the
+ * microseconds between the first and the last.
+*/
+double ResumeRuns(RUN *runs, int count)
+{
+    UINT64 first = timing_now_ns();
+    UINT64 last  = first;
+    int resumed  = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (RUN_PENDING != runs[i].state)
+            continue;
+
+        runs[i].start = timing_now_ns();
+        ResumeThread(runs[i].pi.hThread);
+
+        runs[i].state = RUN_RUNNING;
+        last          = runs[i].start;
+        resumed++;
+    }
+
+    return 1 < resumed ? Seconds(first, last) * 1e6 : 0;
+}
+
+/**
+ * FinishRun - Collect what the process did and close it.
+*/
+void FinishRun(RUN *run, int state)
+{
+    PROCESS_MEMORY_COUNTERS memory;
+    FILETIME created, exited, kernel, user;
+    UINT64 now;
+
+    if (RUN_RUNNING != run->state)
+        return;
+
+    now = timing_now_ns();
+
+    if (RUN_KILLED == state || RUN_STOPPED == state)
+    {
+        TerminateProcess(run->pi.hProcess, 1);
+        WaitForSingleObject(run->pi.hProcess, INFINITE);
+    }
+
+    run->seconds = Seconds(run->start, now);
+    run->state   = state;
+
+    GetExitCodeProcess(run->pi.hProcess, &run->exitCode);
+
+    if (GetProcessTimes(run->pi.hProcess, &created, &exited, &kernel, &user))
+    {
+        run->cpuSeconds = (((UINT64)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+                           ((UINT64)user.dwHighDateTime << 32 | user.dwLowDateTime)) / 1e7;
+    }
+
+    ZeroMemory(&memory, sizeof(memory));
+    if (GetProcessMemoryInfo(run->pi.hProcess, &memory, sizeof(memory)))
+        run->peakMib = memory.PeakWorkingSetSize / MIB;
+
+    GetProcessIoCounters(run->pi.hProcess, &run->io);
+
+    CloseHandle(run->pi.hThread);
+    CloseHandle(run->pi.hProcess);
+    CloseHandle(run->log);
+    run->log = NULL;
+}
+
+/**
+ * RunFailed - A load that did not end by itself with 0.
+*/
+BOOL RunFailed(const RUN *run)
+{
+    if (RUN_STOPPED == run->state)
+        return FALSE;
+
+    return RUN_EXITED != run->state || 0 != run->exitCode;
+}
+
+/**
+ * ReportTail - The last lines of the log of a load.
+*/
+void ReportTail(const RUN *run)
+{
+    char text[TAIL_SIZE + 1];
+    LARGE_INTEGER size, offset;
+    HANDLE log;
+    DWORD bytes = 0;
+    char *p, *next = NULL;
+    int lines = 0;
+
+    log = CreateFileA(run->logPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == log)
+        return;
+
+    if (GetFileSizeEx(log, &size))
+    {
+        offset.QuadPart = max(0, size.QuadPart - TAIL_SIZE);
+
+        if (SetFilePointerEx(log, offset, NULL, FILE_BEGIN))
+            ReadFile(log, text, TAIL_SIZE, &bytes, NULL);
+    }
+
+    CloseHandle(log);
+    text[bytes] = '\0';
+
+    /* Back from the end over TAIL_LINES line breaks. */
+    for (p = text + bytes; p > text; p--)
+    {
+        if ('\n' == p[-1] && p != text + bytes && ++lines == TAIL_LINES)
+            break;
+    }
+
+    Report("\n  %s, %s:\n", run->load->name, run->logPath);
+
+    for (char *line = strtok_s(p, "\r\n", &next); NULL != line; line = strtok_s(NULL, "\r\n", &next))
+        Report("    %s\n", line);
+}
+
+/**
+ * ReportRuns - Table of the loads of a phase.
+*/
+void ReportRuns(const RUN *runs, int count)
+{
+    Report("\n  %-12s %-8s %6s %8s %8s %9s %9s %9s %9s\n", "Load", "Status", "Exit", "Time s", "CPU s",
+           "Peak MiB", "Read MB", "Write MB", "Other MB");
+
+    for (int i = 0; i < count; i++)
+    {
+        Report("  %-12s %-8s %6d %8.1f %8.1f %9.1f %9.1f %9.1f %9.1f\n", runs[i].load->name,
+               RunFailed(&runs[i]) && RUN_EXITED == runs[i].state ? "failed" : stateNames[runs[i].state],
+               (int)runs[i].exitCode, runs[i].seconds, runs[i].cpuSeconds, runs[i].peakMib,
+               runs[i].io.ReadTransferCount / MB, runs[i].io.WriteTransferCount / MB,
+               runs[i].io.OtherTransferCount / MB);
+    }
+}
+
+/**
+ * ServicesAlive - Name of a service that ended, NULL if all run.
+*/
+const char *ServicesAlive(void)
+{
+    for (int i = 0; i < scenario->serviceCount; i++)
+    {
+        if (RUN_RUNNING == services[i].state && WAIT_TIMEOUT != WaitForSingleObject(services[i].pi.hProcess, 0))
+        {
+            FinishRun(&services[i], RUN_EXITED);
+            return services[i].load->name;
+        }
+
+        if (RUN_RUNNING != services[i].state && RUN_STOPPED != services[i].state)
+            return services[i].load->name;
+    }
+
+    return NULL;
+}
+
+/**
+ * StartServices - Start the services and give them time to listen.
+*/
+int StartServices(void)
+{
+    const char *service;
+
+    if (0 == scenario->serviceCount)
+        return 0;
+
+    for (int i = 0; i < scenario->serviceCount; i++)
+        StartRun(&services[i], &scenario->services[i], scenario->services[i].name);
+
+    ResumeRuns(services, scenario->serviceCount);
+    Sleep(SERVICE_SETTLE);
+
+    service = ServicesAlive();
+    if (NULL != service)
+    {
+        printf("Service %s did not start, see %s.\n", service, logDir);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * StopServices - End the services, they run until stopped.
+*/
+void StopServices(void)
+{
+    for (int i = 0; i < scenario->serviceCount; i++)
+        FinishRun(&services[i], RUN_STOPPED);
+}
+
+/**
+ * RunPhase - Run the loads of a phase together and wait for them.
+ * Return the loads that failed.
+*/
+int RunPhase(int index)
+{
+    SCENARIO_PHASE *phase = &scenario->phases[index];
+    RUN runs[SCENARIO_LOADS];
+    HANDLE handles[SCENARIO_LOADS];
+    RUN *waiting[SCENARIO_LOADS];
+    UINT64 start, now;
+    ULONGLONG lastProgress = 0;
+    double deadline = (double)phase->seconds + graceSec;
+    double skew, elapsed;
+    char logName[MAX_PATH];
+    const char *service;
+    int count, failed = 0;
+    DWORD result;
+
+    Report("\nPhase %d/%d %s, %d s, %d loads.\n", index + 1, scenario->phaseCount, phase->name,
+           phase->seconds, phase->loadCount);
+
+    for (int i = 0; i < phase->loadCount; i++)
+    {
+        snprintf(logName, sizeof(logName), "%02d-%s-%s", index + 1, phase->name, phase->loads[i].name);
+        StartRun(&runs[i], &phase->loads[i], logName);
+    }
+
+    telemetry_record(&telemetry, "phase", phase->name, index + 1);
+
+    skew = ResumeRuns(runs, phase->loadCount);
+    start = timing_now_ns();
+
+    if (1 < phase->loadCount)
+        Report("  Started within %.0f us.\n", skew);
+
+    while (true)
+    {
+        now     = timing_now_ns();
+        elapsed = Seconds(start, now);
+
+        /* The loads got the Ctrl + C too, wait for their reports. */
+        if (quitEvent && deadline > elapsed + graceSec)
+            deadline = elapsed + graceSec;
+
+        count = 0;
+
+        for (int i = 0; i < phase->loadCount; i++)
+        {
+            if (RUN_RUNNING != runs[i].state)
+                continue;
+
+            if (elapsed >= deadline)
+            {
+                FinishRun(&runs[i], RUN_KILLED);
+                continue;
+            }
+
+            handles[count]   = runs[i].pi.hProcess;
+            waiting[count++] = &runs[i];
+        }
+
+        /* A pause phase has nothing to wait for but the time. */
+        if (0 == count && (0 < phase->loadCount || quitEvent || elapsed >= phase->seconds))
+            break;
+
+        if ((ULONGLONG)(elapsed * 1000) - lastProgress >= PROGRESS_INTERVAL)
+        {
+            lastProgress = (ULONGLONG)(elapsed * 1000);
+            printf("  %6.0f s, %d of %d loads running.\n", elapsed, count, phase->loadCount);
+        }
+
+        if (0 == count)
+        {
+            Sleep(1000);
+            continue;
+        }
+
+        result = WaitForMultipleObjects(count, handles, FALSE, 1000);
+
+        if (result < WAIT_OBJECT_0 + (DWORD)count)
+            FinishRun(waiting[result - WAIT_OBJECT_0], RUN_EXITED);
+    }
+
+    telemetry_record(&telemetry, "phase", phase->name, 0);
+
+    if (0 < phase->loadCount)
+        ReportRuns(runs, phase->loadCount);
+
+    for (int i = 0; i < phase->loadCount; i++)
+    {
+        ReportTail(&runs[i]);
+
+        if (RunFailed(&runs[i]))
+            failed++;
+    }
+
+    service = ServicesAlive();
+    if (NULL != service)
+    {
+        Report("\n  Service %s ended during the phase.\n", service);
+        failed++;
+    }
+
+    Report("\nPhase %s %s.\n", phase->name, 0 == failed ? "passed" : "FAILED");
+
+    return failed;
+}
+
+/**
+ * CreateJob - The loads die with this program, even if it is killed.
+*/
+int CreateJob(void)
+{
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limit;
+
+    job = CreateJobObjectW(NULL, NULL);
+    if (NULL == job)
+    {
+        printf("Error in CreateJobObject: %d.\n", GetLastError());
+        return -1;
+    }
+
+    ZeroMemory(&limit, sizeof(limit));
+    limit.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+
+    if (!SetInformationJobObject(job, JobObjectExtendedLimitInformation, &limit, sizeof(limit)))
+    {
+        printf("Error in SetInformationJobObject: %d.\n", GetLastError());
+        CloseHandle(job);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * ReportPlan - Phases and command lines, before anything runs.
+*/
+void ReportPlan(void)
+{
+    Report("Scenario %s, %d phases, %d s, programs in %s.\n", scenarioPath, scenario->phaseCount,
+           scenario_seconds(scenario), scenario->programs);
+
+    for (int i = 0; i < scenario->serviceCount; i++)
+        Report("  %-12s %s\n", scenario->services[i].name, scenario->services[i].command);
+
+    for (int i = 0; i < scenario->phaseCount; i++)
+    {
+        Report("  Phase %s, %d s:\n", scenario->phases[i].name, scenario->phases[i].seconds);
+
+        for (int j = 0; j < scenario->phases[i].loadCount; j++)
+            Report("    %-10s %s\n", scenario->phases[i].loads[j].name, scenario->phases[i].loads[j].command);
+    }
+}
+
+void SignalHandler(int s)
+{
+    if (SIGINT == s) {
+        printf("It will exit...\n");
+        quitEvent = true;
+    }
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'f': scenarioPath = argv[i + 1];       break;
+        case 'd': programsDir  = argv[i + 1];       break;
+        case 'L': logDir       = argv[i + 1];       break;
+        case 'g': graceSec     = atoi(argv[i + 1]); break;
+        case 'o': csvPath      = argv[i + 1];       break;
+        case 'I': csvInterval  = atoi(argv[i + 1]); break;
+        default:
+            return -1;
+        }
+    }
+
+    if (NULL == scenarioPath || graceSec < 1 || csvInterval < 10)
+        return -1;
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char reportPath[MAX_PATH];
+    int phases = 0, failed = 0, status = -1;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s -f scenario [-d dir] [-L dir] [-g s] [-o csv] [-I ms]\n", argv[0]);
+        printf("  -f file      Scenario to run, see README.md.\n");
+        printf("  -d dir       Directory of the programs, default the one of %s.\n", argv[0]);
+        printf("  -L dir       Logs of the loads and report.txt, default %s.\n", LOG_DIR);
+        printf("  -g seconds   Time a load may run past its phase, default %d.\n", GRACE_TIME);
+        printf("  -o file      Sample clock, temperature and power with the phases to a CSV.\n");
+        printf("  -I ms        Sample interval, default %d.\n", TELEMETRY_INTERVAL);
+        return -1;
+    }
+
+    scenario = (SCENARIO *)calloc(1, sizeof(SCENARIO));
+    if (NULL == scenario)
+        return -1;
+
+    if (0 != scenario_load(scenario, scenarioPath, programsDir))
+        goto out_scenario;
+
+    if (!CreateDirectoryA(logDir, NULL) && ERROR_ALREADY_EXISTS != GetLastError())
+    {
+        printf("Error in CreateDirectory %s: %d.\n", logDir, GetLastError());
+        goto out_scenario;
+    }
+
+    snprintf(reportPath, sizeof(reportPath), "%s\\report.txt", logDir);
+    if (0 != fopen_s(&report, reportPath, "w"))
+    {
+        printf("Cannot open %s.\n", reportPath);
+        goto out_scenario;
+    }
+
+    signal(SIGINT, SignalHandler);
+
+    ReportPlan();
+
+    if (0 != CreateJob())
+        goto out_report;
+
+    if (NULL != csvPath && 0 != telemetry_start(&telemetry, csvPath, csvInterval))
+        goto out_job;
+
+    if (0 != StartServices())
+    {
+        failed++;
+        goto out_services;
+    }
+
+    printf("Press 'Ctrl + C' to quit.\n");
+
+    for (phases = 0; phases < scenario->phaseCount && !quitEvent; phases++)
+        failed += RunPhase(phases);
+
+out_services:
+    StopServices();
+    telemetry_stop(&telemetry);
+
+    if (0 == failed && phases == scenario->phaseCount)
+        status = 0;
+
+    Report("\nScenario %s, %d of %d phases run, %d loads failed: %s.\n", scenarioPath, phases,
+           scenario->phaseCount, failed, 0 == status ? "PASSED" : "FAILED");
+
+out_job:
+    CloseHandle(job);
+
+out_report:
+    fclose(report);
+
+out_scenario:
+    free(scenario);
+
+    return status;
+}
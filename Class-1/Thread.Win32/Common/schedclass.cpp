@@ -0,0 +1,208 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      schedclass.cpp
+ *
+ * Abstract:
+ *      Thread scheduling classes over MMCSS, thread priorities, EcoQoS and
+ *      background mode.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/avrt/nf-avrt-avsetmmthreadcharacteristicsa
+*/
+
+#include <iostream>
+#include <avrt.h>
+
+#include "schedclass.h"
+
+#pragma comment(lib, "Avrt.lib")
+
+
+static const char *classNames[] = { "normal", "latency", "batch", "idle" };
+
+
+/**
+ * set_ecoqos - Turn power throttling of the calling thread on or off.
+*/
+static BOOL set_ecoqos(BOOL on)
+{
+    THREAD_POWER_THROTTLING_STATE throttling;
+
+    ZeroMemory(&throttling, sizeof(throttling));
+    throttling.Version     = THREAD_POWER_THROTTLING_CURRENT_VERSION;
+    throttling.ControlMask = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+    throttling.StateMask   = on ? THREAD_POWER_THROTTLING_EXECUTION_SPEED : 0;
+
+    return SetThreadInformation(GetCurrentThread(), ThreadPowerThrottling, &throttling, sizeof(throttling));
+}
+
+/**
+ * sched_class_enter - Put the calling thread in a scheduling class.
+ *
+ * Return 0 if at least part of the class was applied, see state->applied.
+*/
+int sched_class_enter(SCHED_STATE *state, int schedClass)
+{
+    HANDLE thread = GetCurrentThread();
+
+    ZeroMemory(state, sizeof(*state));
+    state->schedClass = schedClass;
+
+    switch (schedClass)
+    {
+    case SCHED_CLASS_LATENCY:
+        /* MMCSS needs no privilege, it runs the thread in the realtime range. */
+        state->mmcssTask = AvSetMmThreadCharacteristicsA(SCHED_MMCSS_TASK, &state->mmcssIndex);
+
+        if (NULL != state->mmcssTask)
+        {
+            state->applied |= SCHED_APPLIED_MMCSS;
+
+            if (AvSetMmThreadPriority(state->mmcssTask, AVRT_PRIORITY_CRITICAL))
+                state->applied |= SCHED_APPLIED_PRIORITY;
+        }
+        else if (SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL))
+        {
+            state->applied |= SCHED_APPLIED_PRIORITY;
+        }
+        break;
+
+    case SCHED_CLASS_BATCH:
+        if (SetThreadPriority(thread, THREAD_PRIORITY_LOWEST))
+            state->applied |= SCHED_APPLIED_PRIORITY;
+
+        /* Windows 10 1709+, older systems keep the priority only. */
+        if (set_ecoqos(TRUE))
+            state->applied |= SCHED_APPLIED_ECOQOS;
+        break;
+
+    case SCHED_CLASS_IDLE:
+        if (SetThreadPriority(thread, THREAD_MODE_BACKGROUND_BEGIN))
+            state->applied |= SCHED_APPLIED_BACKGROUND;
+        else if (SetThreadPriority(thread, THREAD_PRIORITY_IDLE))
+            state->applied |= SCHED_APPLIED_PRIORITY;
+        break;
+
+    default:
+        state->schedClass = SCHED_CLASS_NORMAL;
+
+        if (SetThreadPriority(thread, THREAD_PRIORITY_NORMAL))
+            state->applied |= SCHED_APPLIED_PRIORITY;
+        break;
+    }
+
+    return 0 != state->applied ? 0 : -1;
+}
+
+/**
+ * sched_class_leave - Back to a normal thread.
+*/
+void sched_class_leave(SCHED_STATE *state)
+{
+    HANDLE thread = GetCurrentThread();
+
+    if (NULL != state->mmcssTask)
+        AvRevertMmThreadCharacteristics(state->mmcssTask);
+
+    if (0 != (state->applied & SCHED_APPLIED_BACKGROUND))
+        SetThreadPriority(thread, THREAD_MODE_BACKGROUND_END);
+
+    if (0 != (state->applied & SCHED_APPLIED_ECOQOS))
+        set_ecoqos(FALSE);
+
+    SetThreadPriority(thread, THREAD_PRIORITY_NORMAL);
+
+    ZeroMemory(state, sizeof(*state));
+}
+
+/**
+ * sched_class_describe - What the class got, e.g. "mmcss+critical".
+*/
+void sched_class_describe(const SCHED_STATE *state, char *text, int size)
+{
+    const char *priority = NULL;
+
+    switch (state->schedClass)
+    {
+    case SCHED_CLASS_LATENCY:
+        if (0 != (state->applied & SCHED_APPLIED_MMCSS))
+            priority = 0 != (state->applied & SCHED_APPLIED_PRIORITY) ? "mmcss+critical" : "mmcss";
+        else
+            priority = 0 != (state->applied & SCHED_APPLIED_PRIORITY) ? "time critical" : NULL;
+        break;
+    case SCHED_CLASS_BATCH:
+        if (0 != (state->applied & SCHED_APPLIED_PRIORITY))
+            priority = 0 != (state->applied & SCHED_APPLIED_ECOQOS) ? "lowest+ecoqos" : "lowest";
+        else
+            priority = 0 != (state->applied & SCHED_APPLIED_ECOQOS) ? "ecoqos" : NULL;
+        break;
+    case SCHED_CLASS_IDLE:
+        if (0 != (state->applied & SCHED_APPLIED_BACKGROUND))
+            priority = "background";
+        else
+            priority = 0 != (state->applied & SCHED_APPLIED_PRIORITY) ? "idle" : NULL;
+        break;
+    default:
+        priority = "normal";
+        break;
+    }
+
+    snprintf(text, size, "%s", NULL != priority ? priority : "not applied");
+}
+
+/**
+ * sched_process_class - Set the priority class of the process.
+ *
+ * REALTIME_PRIORITY_CLASS needs SeIncreaseBasePriorityPrivilege, without
+ * it Windows gives HIGH_PRIORITY_CLASS. Return 0 if granted, 1 if the
+ * process got a lower class, -1 on error.
+*/
+int sched_process_class(DWORD priorityClass)
+{
+    DWORD granted;
+
+    if (!SetPriorityClass(GetCurrentProcess(), priorityClass))
+    {
+        printf("Error in SetPriorityClass: %d.\n", GetLastError());
+        return -1;
+    }
+
+    granted = GetPriorityClass(GetCurrentProcess());
+    if (granted != priorityClass)
+    {
+        printf("Priority class 0x%x not granted, running at 0x%x.\n", priorityClass, granted);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * sched_class_name - Name of a class.
+*/
+const char *sched_class_name(int schedClass)
+{
+    if (0 > schedClass || SCHED_CLASS_COUNT <= schedClass)
+        return "unknown";
+
+    return classNames[schedClass];
+}
+
+/**
+ * sched_class_parse - Class from its name.
+*/
+int sched_class_parse(const char *name, int *schedClass)
+{
+    for (int i = 0; i < SCHED_CLASS_COUNT; i++)
+    {
+        if (0 == strcmp(name, classNames[i]))
+        {
+            *schedClass = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
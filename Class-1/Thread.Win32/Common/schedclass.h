@@ -0,0 +1,72 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      schedclass.h
+ *
+ * Abstract:
+ *      Scheduling classes for threads: latency critical, normal, batch and
+ *      idle, each built from the strongest Windows mechanism that works,
+ *      falling back to the next one without privileges.
+ *
+ *       - latency: MMCSS "Pro Audio" task at critical priority, the thread
+ *         runs in the realtime range while it has work. Without MMCSS it
+ *         gets THREAD_PRIORITY_TIME_CRITICAL.
+ *       - batch: THREAD_PRIORITY_LOWEST and EcoQoS (power throttling), the
+ *         thread yields to everything else and may run on efficient cores.
+ *       - idle: background mode, idle cpu priority and very low I/O and
+ *         memory priority.
+ *
+ *      The classes apply to the calling thread, background mode can only
+ *      be set by the thread itself. sched_class_leave() undoes them.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/procthread/multimedia-class-scheduler-service
+ * https://docs.microsoft.com/en-us/windows/win32/procthread/scheduling-priorities
+ * https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-setthreadinformation
+*/
+
+#ifndef __SCHEDCLASS_H__
+#define __SCHEDCLASS_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define SCHED_CLASS_NORMAL              0
+#define SCHED_CLASS_LATENCY             1
+#define SCHED_CLASS_BATCH               2
+#define SCHED_CLASS_IDLE                3
+#define SCHED_CLASS_COUNT               4
+
+/* What was applied, a class may get only part of it. */
+#define SCHED_APPLIED_PRIORITY          0x01
+#define SCHED_APPLIED_MMCSS             0x02
+#define SCHED_APPLIED_ECOQOS            0x04
+#define SCHED_APPLIED_BACKGROUND        0x08
+
+#define SCHED_MMCSS_TASK                "Pro Audio"
+
+
+typedef struct _SCHED_STATE {
+    int schedClass;
+    DWORD applied;                      // SCHED_APPLIED_* bits.
+    HANDLE mmcssTask;
+    DWORD mmcssIndex;
+} SCHED_STATE;
+
+
+int sched_class_enter(SCHED_STATE *state, int schedClass);
+void sched_class_leave(SCHED_STATE *state);
+void sched_class_describe(const SCHED_STATE *state, char *text, int size);
+
+int sched_process_class(DWORD priorityClass);
+
+const char *sched_class_name(int schedClass);
+int sched_class_parse(const char *name, int *schedClass);
+
+
+#endif /* __SCHEDCLASS_H__ */
@@ -0,0 +1,432 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      topology.cpp
+ *
+ * Abstract:
+ *      Processor topology from GetLogicalProcessorInformationEx, placement
+ *      policies over processor groups.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/winnt/ns-winnt-system_logical_processor_information_ex
+*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "topology.h"
+
+
+#define NEXT_INFO(info)                 ((SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)((char *)(info) + (info)->Size))
+#define MASK_BITS                       ((int)sizeof(KAFFINITY) * 8)
+
+
+static const char *placeNames[] = { "compact", "scatter", "core", "nosmt" };
+
+
+/**
+ * topo_query - All records of one relation, free() the result.
+*/
+static SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *topo_query(LOGICAL_PROCESSOR_RELATIONSHIP relation, DWORD *length)
+{
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *buffer;
+
+    *length = 0;
+    GetLogicalProcessorInformationEx(relation, NULL, length);
+
+    if (ERROR_INSUFFICIENT_BUFFER != GetLastError())
+    {
+        printf("Error in GetLogicalProcessorInformationEx: %d.\n", GetLastError());
+        return NULL;
+    }
+
+    buffer = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)malloc(*length);
+    if (NULL == buffer)
+    {
+        printf("Out of memory.\n");
+        return NULL;
+    }
+
+    if (!GetLogicalProcessorInformationEx(relation, buffer, length))
+    {
+        printf("Error in GetLogicalProcessorInformationEx: %d.\n", GetLastError());
+        free(buffer);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+/**
+ * mark_cpus - Call set(cpu) for every processor of a group mask.
+*/
+template <typename SET>
+static void mark_cpus(TOPO_CPU *all, const int *base, int groupCount, const GROUP_AFFINITY *mask, SET set)
+{
+    if (mask->Group >= groupCount)
+        return;
+
+    for (int bit = 0; bit < MASK_BITS; bit++)
+    {
+        if (0 != (mask->Mask & ((KAFFINITY)1 << bit)))
+            set(&all[base[mask->Group] + bit]);
+    }
+}
+
+/**
+ * topo_init - Read the processors, cores, L3 domains and NUMA nodes.
+*/
+int topo_init(TOPOLOGY *topo)
+{
+    int status = -1;
+    int base[TOPO_MAX_GROUPS + 1];
+    int total = 0;
+    int masks, sibling, value;
+    DWORD length;
+    TOPO_CPU *all = NULL;
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *buffer, *info, *end;
+
+    ZeroMemory(topo, sizeof(*topo));
+
+    /* Processor numbers are per group, give every group a base index. */
+    buffer = topo_query(RelationGroup, &length);
+    if (NULL == buffer)
+        return -1;
+
+    topo->groupCount = buffer->Group.ActiveGroupCount < TOPO_MAX_GROUPS ?
+                       buffer->Group.ActiveGroupCount : TOPO_MAX_GROUPS;
+
+    for (int g = 0; g < topo->groupCount; g++)
+    {
+        base[g] = total;
+        total  += MASK_BITS;
+    }
+
+    base[topo->groupCount] = total;
+    free(buffer);
+
+    all = (TOPO_CPU *)malloc(total * sizeof(TOPO_CPU));
+    if (NULL == all)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    for (int g = 0; g < topo->groupCount; g++)
+    {
+        for (int bit = 0; bit < MASK_BITS; bit++)
+        {
+            all[base[g] + bit].group  = (WORD)g;
+            all[base[g] + bit].number = (BYTE)bit;
+            all[base[g] + bit].core   = -1;
+            all[base[g] + bit].l3     = -1;
+            all[base[g] + bit].node   = 0;
+        }
+    }
+
+    buffer = topo_query(RelationAll, &length);
+    if (NULL == buffer)
+        goto out_free;
+
+    end = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)((char *)buffer + length);
+
+    for (info = buffer; info < end; info = NEXT_INFO(info))
+    {
+        switch (info->Relationship)
+        {
+        case RelationProcessorCore:
+            sibling = 0;
+            value   = topo->coreCount++;
+
+            for (int i = 0; i < info->Processor.GroupCount; i++)
+            {
+                mark_cpus(all, base, topo->groupCount, &info->Processor.GroupMask[i], [&](TOPO_CPU *cpu) {
+                    cpu->core       = value;
+                    cpu->smt        = sibling++;
+                    cpu->efficiency = info->Processor.EfficiencyClass;
+                });
+            }
+
+            if (sibling > topo->maxSmt)
+                topo->maxSmt = sibling;
+            break;
+
+        case RelationCache:
+            if (3 != info->Cache.Level || CacheInstruction == info->Cache.Type)
+                break;
+
+            /* Before Windows 11 GroupCount is 0 and there is one mask. */
+            masks = 0 == info->Cache.GroupCount ? 1 : info->Cache.GroupCount;
+            value = topo->l3Count++;
+
+            for (int i = 0; i < masks; i++)
+                mark_cpus(all, base, topo->groupCount, &info->Cache.GroupMasks[i], [&](TOPO_CPU *cpu) { cpu->l3 = value; });
+            break;
+
+        case RelationNumaNode:
+            masks = 0 == info->NumaNode.GroupCount ? 1 : info->NumaNode.GroupCount;
+            value = (int)info->NumaNode.NodeNumber;
+            topo->nodeCount++;
+
+            for (int i = 0; i < masks; i++)
+                mark_cpus(all, base, topo->groupCount, &info->NumaNode.GroupMasks[i], [&](TOPO_CPU *cpu) { cpu->node = value; });
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    free(buffer);
+
+    for (int i = 0; i < total; i++)
+    {
+        if (0 <= all[i].core)
+            topo->cpuCount++;
+    }
+
+    topo->cpus = (TOPO_CPU *)malloc(topo->cpuCount * sizeof(TOPO_CPU));
+    if (NULL == topo->cpus)
+    {
+        printf("Out of memory.\n");
+        goto out_free;
+    }
+
+    /* Keep the processors that exist, in group and number order. */
+    for (int i = 0, n = 0; i < total; i++)
+    {
+        if (0 <= all[i].core)
+            topo->cpus[n++] = all[i];
+    }
+
+    if (0 == topo->nodeCount)
+        topo->nodeCount = 1;
+
+    status = 0;
+
+out_free:
+    free(all);
+
+    if (0 != status)
+        topo_free(topo);
+
+    return status;
+}
+
+/**
+ * topo_free - Release the processor list.
+*/
+void topo_free(TOPOLOGY *topo)
+{
+    free(topo->cpus);
+    ZeroMemory(topo, sizeof(*topo));
+}
+
+/**
+ * topo_print - Summary, then the processors of every L3 domain.
+*/
+void topo_print(const TOPOLOGY *topo)
+{
+    int first, cores, cpus;
+    const TOPO_CPU *cpu;
+
+    printf("%d logical cpus, %d cores, up to %d SMT, %d L3 domains, %d NUMA nodes, %d groups.\n",
+           topo->cpuCount, topo->coreCount, topo->maxSmt, topo->l3Count, topo->nodeCount, topo->groupCount);
+
+    for (int l3 = -1; l3 < topo->l3Count; l3++)
+    {
+        first = -1;
+        cores = 0;
+        cpus  = 0;
+
+        for (int i = 0; i < topo->cpuCount; i++)
+        {
+            cpu = &topo->cpus[i];
+            if (l3 != cpu->l3)
+                continue;
+
+            if (0 > first)
+                first = i;
+
+            cpus++;
+            if (0 == cpu->smt)
+                cores++;
+        }
+
+        if (0 > first)
+            continue;
+
+        cpu = &topo->cpus[first];
+
+        printf("  L3 %2d: node %d, group %u, %d cores, %d cpus from %u:%u.\n",
+               l3, cpu->node, cpu->group, cores, cpus, cpu->group, cpu->number);
+    }
+}
+
+/**
+ * place_init - Order the processors for a policy.
+*/
+int place_init(PLACEMENT *place, const TOPOLOGY *topo, int policy)
+{
+    int slot = 0;
+    int maxNode = 0;
+    UINT64 key;
+    const TOPO_CPU *cpu;
+    std::vector<std::pair<UINT64, int>> order;
+    std::vector<int> coreRank(topo->coreCount, -1);
+    std::vector<int> l3Rank(topo->l3Count + 1, -1);
+    std::vector<int> coresInL3(topo->l3Count + 1, 0);
+    std::vector<int> l3sInNode;
+
+    ZeroMemory(place, sizeof(*place));
+    place->policy = policy;
+
+    if (PLACE_NONE == policy)
+        return 0;
+
+    for (int i = 0; i < topo->cpuCount; i++)
+    {
+        if (topo->cpus[i].node > maxNode)
+            maxNode = topo->cpus[i].node;
+    }
+
+    l3sInNode.assign(maxNode + 1, 0);
+
+    /* Rank of every core in its L3 domain, of every L3 domain in its node. */
+    for (int i = 0; i < topo->cpuCount; i++)
+    {
+        cpu = &topo->cpus[i];
+
+        if (0 > coreRank[cpu->core])
+            coreRank[cpu->core] = coresInL3[cpu->l3 + 1]++;
+
+        if (0 > l3Rank[cpu->l3 + 1])
+            l3Rank[cpu->l3 + 1] = l3sInNode[cpu->node]++;
+    }
+
+    for (int i = 0; i < topo->cpuCount; i++)
+    {
+        cpu = &topo->cpus[i];
+
+        switch (policy)
+        {
+        case PLACE_SCATTER:
+            key = (UINT64)cpu->smt << 48 | (UINT64)coreRank[cpu->core] << 32 |
+                  (UINT64)l3Rank[cpu->l3 + 1] << 16 | (UINT64)cpu->node;
+            break;
+        case PLACE_NOSMT:
+            key = (UINT64)cpu->smt << 48 | (UINT64)cpu->node << 32 |
+                  (UINT64)(cpu->l3 + 1) << 16 | (UINT64)cpu->core;
+            break;
+        case PLACE_CORE:
+            if (0 != cpu->smt)
+                continue;
+            /* Fall through, cores in compact order. */
+        default:
+            key = (UINT64)cpu->node << 48 | (UINT64)(cpu->l3 + 1) << 32 |
+                  (UINT64)cpu->core << 16 | (UINT64)cpu->smt;
+            break;
+        }
+
+        order.push_back(std::make_pair(key, i));
+    }
+
+    std::stable_sort(order.begin(), order.end());
+
+    place->slots = (GROUP_AFFINITY *)calloc(order.size(), sizeof(GROUP_AFFINITY));
+    place->nodes = (int *)calloc(order.size(), sizeof(int));
+    if (NULL == place->slots || NULL == place->nodes)
+    {
+        printf("Out of memory.\n");
+        place_free(place);
+        return -1;
+    }
+
+    for (auto &entry : order)
+    {
+        cpu = &topo->cpus[entry.second];
+
+        place->slots[slot].Group = cpu->group;
+        place->slots[slot].Mask  = (KAFFINITY)1 << cpu->number;
+        place->nodes[slot]       = cpu->node;
+
+        /* A whole core, its siblings are in the same group. */
+        if (PLACE_CORE == policy)
+        {
+            for (int i = 0; i < topo->cpuCount; i++)
+            {
+                if (topo->cpus[i].core == cpu->core)
+                    place->slots[slot].Mask |= (KAFFINITY)1 << topo->cpus[i].number;
+            }
+        }
+
+        slot++;
+    }
+
+    place->count = slot;
+
+    return 0;
+}
+
+/**
+ * place_free - Release the slots.
+*/
+void place_free(PLACEMENT *place)
+{
+    free(place->slots);
+    free(place->nodes);
+    ZeroMemory(place, sizeof(*place));
+}
+
+/**
+ * place_thread - Pin thread number index to its slot, into its group.
+*/
+int place_thread(const PLACEMENT *place, HANDLE thread, int index)
+{
+    if (PLACE_NONE == place->policy || 0 == place->count)
+        return 0;
+
+    if (!SetThreadGroupAffinity(thread, &place->slots[index % place->count], NULL))
+    {
+        printf("Error in SetThreadGroupAffinity: %d.\n", GetLastError());
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * place_name - Name of a policy.
+*/
+const char *place_name(int policy)
+{
+    if (0 > policy || PLACE_COUNT <= policy)
+        return "none";
+
+    return placeNames[policy];
+}
+
+/**
+ * place_parse - Policy from its name, "none" is PLACE_NONE.
+*/
+int place_parse(const char *name, int *policy)
+{
+    if (0 == strcmp(name, "none"))
+    {
+        *policy = PLACE_NONE;
+        return 0;
+    }
+
+    for (int i = 0; i < PLACE_COUNT; i++)
+    {
+        if (0 == strcmp(name, placeNames[i]))
+        {
+            *policy = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,94 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      topology.h
+ *
+ * Abstract:
+ *      Processor topology and thread placement policies.
+ *
+ *      The logical processors are read with GetLogicalProcessorInformationEx
+ *      and tagged with their physical core, SMT sibling index, L3 cache
+ *      domain and NUMA node. They are addressed as (processor group,
+ *      number), so machines with more than 64 logical processors work: a
+ *      thread is pinned with SetThreadGroupAffinity, which also moves it
+ *      to another group.
+ *
+ *      A placement orders the processors for a policy, thread i gets slot
+ *      i modulo the slot count:
+ *
+ *       - compact: SMT siblings first, then the cores of the same L3 and
+ *         node, threads share caches.
+ *       - scatter: round robin over nodes, L3 domains and cores, SMT
+ *         siblings last, threads get the most cache and memory bandwidth.
+ *       - core: one slot per physical core with all its siblings, the
+ *         thread may run on any of them.
+ *       - nosmt: one logical processor per core until every core has a
+ *         thread, only then the second siblings.
+ *
+ * Reference:
+ * https://docs.microsoft.com/en-us/windows/win32/api/sysinfoapi/nf-sysinfoapi-getlogicalprocessorinformationex
+ * https://docs.microsoft.com/en-us/windows/win32/procthread/processor-groups
+*/
+
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define PLACE_NONE                      -1      // Not pinned.
+#define PLACE_COMPACT                   0
+#define PLACE_SCATTER                   1
+#define PLACE_CORE                      2
+#define PLACE_NOSMT                     3
+#define PLACE_COUNT                     4
+
+#define TOPO_MAX_GROUPS                 64
+
+
+/* One logical processor. */
+typedef struct _TOPO_CPU {
+    WORD group;
+    BYTE number;                        // In its group.
+    BYTE efficiency;                    // Core efficiency class, higher is faster.
+    int core;                           // Physical core index.
+    int smt;                            // Sibling index in the core, 0 first.
+    int l3;                             // L3 domain index, -1 without L3.
+    int node;                           // NUMA node number.
+} TOPO_CPU;
+
+typedef struct _TOPOLOGY {
+    int cpuCount;
+    int coreCount;
+    int l3Count;
+    int nodeCount;
+    int groupCount;
+    int maxSmt;                         // Siblings per core, at most.
+    TOPO_CPU *cpus;                     // By group, then number.
+} TOPOLOGY;
+
+typedef struct _PLACEMENT {
+    int policy;
+    int count;
+    GROUP_AFFINITY *slots;
+    int *nodes;                         // NUMA node of each slot.
+} PLACEMENT;
+
+
+int topo_init(TOPOLOGY *topo);
+void topo_free(TOPOLOGY *topo);
+void topo_print(const TOPOLOGY *topo);
+
+int place_init(PLACEMENT *place, const TOPOLOGY *topo, int policy);
+void place_free(PLACEMENT *place);
+int place_thread(const PLACEMENT *place, HANDLE thread, int index);
+const char *place_name(int policy);
+int place_parse(const char *name, int *policy);
+
+
+#endif /* __TOPOLOGY_H__ */
@@ -0,0 +1,678 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      worksteal.cpp
+ *
+ * Abstract:
+ *      Work stealing task pool, Chase-Lev deques and parked workers.
+ *
+ * Reference:
+ * https://fzn.fr/readings/ppopp13.pdf
+*/
+
+#include <iostream>
+
+#include "worksteal.h"
+
+#pragma comment(lib, "Synchronization.lib")
+
+
+#define TASK_DEQUE_MASK                 (TASK_DEQUE_SIZE - 1)
+
+
+/* One parallel_for() call, on the stack of its caller. */
+typedef struct _RANGE {
+    RANGE_ROUTINE routine;
+    void *context;
+    INT64 grain;
+} RANGE;
+
+
+static void task_run(TASK_POOL *pool, TASK_WORKER *worker, TASK *task);
+
+
+/**
+ * next_random - xorshift32, picks the first victim to steal from.
+*/
+static inline UINT32 next_random(UINT32 *seed)
+{
+    UINT32 x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *seed = x;
+}
+
+/**
+ * current_worker - The worker of the calling thread, NULL for others.
+*/
+static inline TASK_WORKER *current_worker(TASK_POOL *pool)
+{
+    return (TASK_WORKER *)TlsGetValue(pool->slot);
+}
+
+/**
+ * deque_push - Owner only, add a task at the bottom.
+*/
+static int deque_push(TASK_DEQUE *deque, TASK *task)
+{
+    LONG64 bottom = deque->bottom;
+    LONG64 top    = ReadAcquire64(&deque->top);
+
+    if (bottom - top >= TASK_DEQUE_SIZE)
+        return -1;
+
+    deque->tasks[bottom & TASK_DEQUE_MASK] = task;
+
+    /* The task is written before a thief can see the new bottom. */
+    WriteRelease64(&deque->bottom, bottom + 1);
+
+    return 0;
+}
+
+/**
+ * deque_pop - Owner only, take the newest task.
+*/
+static TASK *deque_pop(TASK_DEQUE *deque)
+{
+    LONG64 top;
+    LONG64 bottom = deque->bottom - 1;
+    TASK *task;
+
+    /* Claim the slot before looking at top, thieves look the other way. */
+    InterlockedExchange64(&deque->bottom, bottom);
+    top = deque->top;
+
+    if (top > bottom)
+    {
+        deque->bottom = bottom + 1;
+        return NULL;
+    }
+
+    task = deque->tasks[bottom & TASK_DEQUE_MASK];
+
+    /* The last task, a thief may take it at the same time. */
+    if (top == bottom)
+    {
+        if (top != InterlockedCompareExchange64(&deque->top, top + 1, top))
+            task = NULL;
+
+        deque->bottom = bottom + 1;
+    }
+
+    return task;
+}
+
+/**
+ * deque_steal - Any thread, take the oldest task.
+ *
+ * Return NULL when empty or when another thread won the race.
+*/
+static TASK *deque_steal(TASK_DEQUE *deque)
+{
+    LONG64 top, bottom;
+    TASK *task;
+
+    top = ReadAcquire64(&deque->top);
+    MemoryBarrier();
+    bottom = ReadAcquire64(&deque->bottom);
+
+    if (top >= bottom)
+        return NULL;
+
+    task = deque->tasks[top & TASK_DEQUE_MASK];
+
+    if (top != InterlockedCompareExchange64(&deque->top, top + 1, top))
+        return NULL;
+
+    return task;
+}
+
+/**
+ * task_grow - Add one slab of tasks, keep the first for the caller.
+*/
+static TASK *task_grow(TASK_POOL *pool)
+{
+    TASK *slab;
+    TASK *task;
+    char **slabs;
+
+    AcquireSRWLockExclusive(&pool->growLock);
+
+    task = (TASK *)InterlockedPopEntrySList(&pool->freeTasks);
+
+    if (NULL == task && pool->slabCount == pool->maxSlabs)
+    {
+        slabs = (char **)realloc(pool->slabs, 2 * (pool->maxSlabs + 1) * sizeof(char *));
+
+        if (NULL != slabs)
+        {
+            pool->slabs    = slabs;
+            pool->maxSlabs = 2 * (pool->maxSlabs + 1);
+        }
+    }
+
+    if (NULL == task && pool->slabCount < pool->maxSlabs)
+    {
+        slab = (TASK *)VirtualAlloc(NULL, TASK_SLAB_TASKS * sizeof(TASK), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+        if (NULL != slab)
+        {
+            for (int i = 1; i < TASK_SLAB_TASKS; i++)
+                InterlockedPushEntrySList(&pool->freeTasks, &slab[i].entry);
+
+            pool->slabs[pool->slabCount++] = (char *)slab;
+            task = slab;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&pool->growLock);
+
+    if (NULL == task)
+        printf("Out of memory for tasks.\n");
+
+    return task;
+}
+
+/**
+ * task_alloc - A free task, from the worker cache when there is one.
+*/
+static TASK *task_alloc(TASK_POOL *pool, TASK_WORKER *worker)
+{
+    TASK *task;
+
+    if (NULL != worker && NULL != worker->cache)
+    {
+        task = worker->cache;
+        worker->cache = task->next;
+        worker->cached--;
+        return task;
+    }
+
+    task = (TASK *)InterlockedPopEntrySList(&pool->freeTasks);
+    if (NULL == task)
+        task = task_grow(pool);
+
+    return task;
+}
+
+/**
+ * task_free - Keep the task in the worker cache, or give it to all.
+*/
+static void task_free(TASK_POOL *pool, TASK_WORKER *worker, TASK *task)
+{
+    if (NULL != worker && worker->cached < TASK_CACHE_TASKS)
+    {
+        task->next    = worker->cache;
+        worker->cache = task;
+        worker->cached++;
+        return;
+    }
+
+    InterlockedPushEntrySList(&pool->freeTasks, &task->entry);
+}
+
+/**
+ * pool_wake - Wake a parked worker for a new task.
+ *
+ * Not needed while another worker searches, it will find the task.
+*/
+static void pool_wake(TASK_POOL *pool)
+{
+    /* Pairs with pool_park(): we see it parked or it sees the task. */
+    MemoryBarrier();
+
+    if (0 < pool->parkedCount && 0 == pool->searchingCount)
+    {
+        InterlockedIncrement(&pool->epoch);
+        WakeByAddressSingle((PVOID)&pool->epoch);
+    }
+}
+
+/**
+ * task_submit - Queue a task, run it at once when the deque is full.
+*/
+static void task_submit(TASK_POOL *pool, TASK_WORKER *worker, TASK *task)
+{
+    if (NULL != worker)
+    {
+        if (0 != deque_push(&worker->deque, task))
+        {
+            task_run(pool, worker, task);
+            return;
+        }
+    }
+    else
+    {
+        InterlockedIncrement(&pool->injectCount);
+        InterlockedPushEntrySList(&pool->injected, &task->entry);
+    }
+
+    pool_wake(pool);
+}
+
+/**
+ * task_find - Own deque first, then the injected tasks, then steal.
+*/
+static TASK *task_find(TASK_POOL *pool, TASK_WORKER *worker, UINT32 *seed)
+{
+    int i, victim;
+    int count = pool->workerCount;
+    UINT32 start;
+    TASK *task;
+
+    if (NULL != worker)
+    {
+        task = deque_pop(&worker->deque);
+        if (NULL != task)
+            return task;
+    }
+
+    if (0 < pool->injectCount)
+    {
+        task = (TASK *)InterlockedPopEntrySList(&pool->injected);
+        if (NULL != task)
+        {
+            InterlockedDecrement(&pool->injectCount);
+            return task;
+        }
+    }
+
+    /* A random first victim spreads the thieves. */
+    start = next_random(seed);
+
+    for (i = 0; i < count; i++)
+    {
+        victim = (int)((start + i) % count);
+
+        if (NULL != worker && victim == worker->index)
+            continue;
+
+        task = deque_steal(&pool->workers[victim].deque);
+        if (NULL != task)
+        {
+            if (NULL != worker)
+                worker->stolen++;
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * range_run - Give the upper halves away, run the lowest part.
+*/
+static void range_run(TASK_POOL *pool, TASK_WORKER *worker, TASK *task)
+{
+    RANGE *range = (RANGE *)task->context;
+    INT64 begin  = task->begin;
+    INT64 end    = task->end;
+    INT64 middle;
+    TASK *half;
+
+    while (end - begin > range->grain)
+    {
+        half = task_alloc(pool, worker);
+        if (NULL == half)
+            break;
+
+        middle = begin + (end - begin) / 2;
+
+        half->routine = NULL;
+        half->context = range;
+        half->group   = task->group;
+        half->begin   = middle;
+        half->end     = end;
+
+        InterlockedIncrement(&task->group->pending);
+        task_submit(pool, worker, half);
+
+        end = middle;
+    }
+
+    range->routine(begin, end, range->context);
+}
+
+/**
+ * task_run - Run a task and count it done in its group.
+*/
+static void task_run(TASK_POOL *pool, TASK_WORKER *worker, TASK *task)
+{
+    TASK_GROUP *group = task->group;
+
+    if (NULL != task->routine)
+        task->routine(task->context);
+    else
+        range_run(pool, worker, task);
+
+    task_free(pool, worker, task);
+
+    if (NULL != worker)
+        worker->executed++;
+
+    /* The waiter may return at once, the group is not touched after. */
+    if (0 == InterlockedDecrement(&group->pending))
+        WakeByAddressAll((PVOID)&group->pending);
+}
+
+/**
+ * task_visible - Is there a task to run anywhere?
+*/
+static BOOL task_visible(TASK_POOL *pool)
+{
+    TASK_DEQUE *deque;
+
+    if (0 < pool->injectCount)
+        return TRUE;
+
+    for (int i = 0; i < pool->workerCount; i++)
+    {
+        deque = &pool->workers[i].deque;
+
+        if (ReadAcquire64(&deque->bottom) > ReadAcquire64(&deque->top))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * pool_park - Sleep until a task is spawned or the pool stops.
+*/
+static void pool_park(TASK_POOL *pool, TASK_WORKER *worker)
+{
+    LONG epoch;
+
+    /* Announce, then look once more: the futex pattern. */
+    InterlockedIncrement(&pool->parkedCount);
+    epoch = pool->epoch;
+
+    if (0 == pool->stop && !task_visible(pool))
+    {
+        WaitOnAddress(&pool->epoch, &epoch, sizeof(epoch), INFINITE);
+        worker->parked++;
+    }
+
+    InterlockedDecrement(&pool->parkedCount);
+}
+
+/**
+ * task_worker_main - Worker thread, run tasks until the pool stops.
+*/
+static DWORD WINAPI task_worker_main(LPVOID lpParam)
+{
+    TASK_WORKER *worker = (TASK_WORKER *)lpParam;
+    TASK_POOL *pool     = worker->pool;
+    TASK *task;
+    BOOL searching = FALSE;
+    int idle = 0;
+
+    TlsSetValue(pool->slot, worker);
+
+    while (0 == pool->stop)
+    {
+        task = task_find(pool, worker, &worker->seed);
+
+        if (NULL != task)
+        {
+            /* The last searcher found work, there may be more for a parked one. */
+            if (searching)
+            {
+                searching = FALSE;
+
+                if (0 == InterlockedDecrement(&pool->searchingCount))
+                    pool_wake(pool);
+            }
+
+            task_run(pool, worker, task);
+            idle = 0;
+            continue;
+        }
+
+        if (!searching)
+        {
+            searching = TRUE;
+            InterlockedIncrement(&pool->searchingCount);
+        }
+
+        if (++idle < pool->spinRounds)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        searching = FALSE;
+        InterlockedDecrement(&pool->searchingCount);
+
+        pool_park(pool, worker);
+        idle = 0;
+    }
+
+    if (searching)
+        InterlockedDecrement(&pool->searchingCount);
+
+    return 0;
+}
+
+/**
+ * task_pool_init - Start the workers, one per cpu when workerCount is 0.
+*/
+int task_pool_init(TASK_POOL *pool, int workerCount)
+{
+    SYSTEM_INFO sysInfo;
+    TASK_WORKER *worker;
+
+    ZeroMemory(pool, sizeof(*pool));
+
+    GetSystemInfo(&sysInfo);
+
+    if (0 >= workerCount)
+        workerCount = (int)sysInfo.dwNumberOfProcessors;
+    if (TASK_MAX_WORKERS < workerCount)
+        workerCount = TASK_MAX_WORKERS;
+
+    /* With one cpu a polling worker only delays the others. */
+    pool->spinRounds = 1 < sysInfo.dwNumberOfProcessors ? TASK_SPIN_ROUNDS : 1;
+
+    InitializeSListHead(&pool->freeTasks);
+    InitializeSListHead(&pool->injected);
+    InitializeSRWLock(&pool->growLock);
+
+    pool->slot = TlsAlloc();
+    if (TLS_OUT_OF_INDEXES == pool->slot)
+    {
+        printf("Error in TlsAlloc: %d.\n", GetLastError());
+        return -1;
+    }
+
+    pool->workers = (TASK_WORKER *)_aligned_malloc(workerCount * sizeof(TASK_WORKER), SYSTEM_CACHE_ALIGNMENT_SIZE);
+    if (NULL == pool->workers)
+    {
+        printf("Out of memory.\n");
+        goto out_tls;
+    }
+
+    ZeroMemory(pool->workers, workerCount * sizeof(TASK_WORKER));
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        worker = &pool->workers[i];
+
+        worker->pool  = pool;
+        worker->index = i;
+        worker->seed  = 0x9e3779b9u * (UINT32)(i + 1);
+    }
+
+    /* Workers only look at the deques of started workers. */
+    for (int i = 0; i < workerCount; i++)
+    {
+        worker = &pool->workers[i];
+
+        worker->thread = CreateThread(NULL, 0, task_worker_main, worker, 0, NULL);
+        if (NULL == worker->thread)
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            task_pool_destroy(pool);
+            return -1;
+        }
+
+        InterlockedIncrement(&pool->workerCount);
+    }
+
+    return 0;
+
+out_tls:
+    TlsFree(pool->slot);
+    pool->slot = TLS_OUT_OF_INDEXES;
+
+    return -1;
+}
+
+/**
+ * task_pool_destroy - Stop the workers and free all tasks.
+ *
+ * Every group must have been waited for.
+*/
+void task_pool_destroy(TASK_POOL *pool)
+{
+    if (NULL != pool->workers)
+    {
+        InterlockedExchange(&pool->stop, 1);
+        InterlockedIncrement(&pool->epoch);
+        WakeByAddressAll((PVOID)&pool->epoch);
+
+        for (int i = 0; i < pool->workerCount; i++)
+        {
+            WaitForSingleObject(pool->workers[i].thread, INFINITE);
+            CloseHandle(pool->workers[i].thread);
+        }
+
+        _aligned_free(pool->workers);
+    }
+
+    for (int i = 0; i < pool->slabCount; i++)
+        VirtualFree(pool->slabs[i], 0, MEM_RELEASE);
+
+    free(pool->slabs);
+
+    if (TLS_OUT_OF_INDEXES != pool->slot)
+        TlsFree(pool->slot);
+
+    ZeroMemory(pool, sizeof(*pool));
+    pool->slot = TLS_OUT_OF_INDEXES;
+}
+
+/**
+ * task_spawn - Run routine(context) on the pool as part of group.
+*/
+int task_spawn(TASK_POOL *pool, TASK_GROUP *group, TASK_ROUTINE routine, void *context)
+{
+    TASK_WORKER *worker = current_worker(pool);
+    TASK *task;
+
+    task = task_alloc(pool, worker);
+    if (NULL == task)
+        return -1;
+
+    task->routine = routine;
+    task->context = context;
+    task->group   = group;
+
+    InterlockedIncrement(&group->pending);
+    task_submit(pool, worker, task);
+
+    return 0;
+}
+
+/**
+ * task_wait - Run tasks until all tasks of group are done.
+ *
+ * Sleeps only when there is nothing left to help with.
+*/
+void task_wait(TASK_POOL *pool, TASK_GROUP *group)
+{
+    TASK_WORKER *worker = current_worker(pool);
+    UINT32 seed = GetCurrentThreadId() | 1;
+    TASK *task;
+    LONG pending;
+    int idle = 0;
+
+    while (0 != (pending = ReadAcquire(&group->pending)))
+    {
+        task = task_find(pool, worker, NULL != worker ? &worker->seed : &seed);
+
+        if (NULL != task)
+        {
+            task_run(pool, worker, task);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < pool->spinRounds)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        /* Woken by the last task of the group. */
+        WaitOnAddress(&group->pending, &pending, sizeof(pending), INFINITE);
+        idle = 0;
+    }
+}
+
+/**
+ * parallel_for - Call routine on parts of [begin, end) of about grain items.
+ *
+ * Return once the whole range is done, -1 if no task could be allocated.
+*/
+int parallel_for(TASK_POOL *pool, INT64 begin, INT64 end, INT64 grain, RANGE_ROUTINE routine, void *context)
+{
+    TASK_WORKER *worker = current_worker(pool);
+    TASK_GROUP group    = { 0 };
+    RANGE range;
+    TASK *task;
+
+    if (begin >= end)
+        return 0;
+
+    range.routine = routine;
+    range.context = context;
+    range.grain   = 0 < grain ? grain : 1;
+
+    task = task_alloc(pool, worker);
+    if (NULL == task)
+        return -1;
+
+    task->routine = NULL;
+    task->context = &range;
+    task->group   = &group;
+    task->begin   = begin;
+    task->end     = end;
+
+    group.pending = 1;
+    task_submit(pool, worker, task);
+    task_wait(pool, &group);
+
+    return 0;
+}
+
+/**
+ * task_pool_stats - Tasks run, stolen and worker parks so far.
+*/
+void task_pool_stats(TASK_POOL *pool, UINT64 *executed, UINT64 *stolen, UINT64 *parked)
+{
+    *executed = 0;
+    *stolen   = 0;
+    *parked   = 0;
+
+    for (int i = 0; i < pool->workerCount; i++)
+    {
+        *executed += pool->workers[i].executed;
+        *stolen   += pool->workers[i].stolen;
+        *parked   += pool->workers[i].parked;
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * License - MIT.
+ *
+ * Module Name:
+ *      worksteal.h
+ *
+ * Abstract:
+ *      Work stealing task pool for fine grained parallel work.
+ *
+ *      Every worker thread owns a Chase-Lev deque: it pushes and pops its
+ *      own tasks at the bottom without a lock, idle workers steal from the
+ *      top of a random victim with one compare exchange. Tasks spawned by
+ *      other threads go to a shared injection list.
+ *
+ *      A worker that finds no task polls a while, then parks on the pool
+ *      epoch with WaitOnAddress. Spawning only wakes a worker when one is
+ *      parked and none is searching, so a busy pool makes no system call
+ *      per task.
+ *
+ *      Tasks belong to a group, task_wait() returns once all tasks of the
+ *      group are done and runs tasks itself meanwhile. parallel_for()
+ *      splits a range in halves, thieves take the largest halves first.
+ *
+ * Reference:
+ * https://www.dre.vanderbilt.edu/~schmidt/PDF/work-stealing-dequeue.pdf
+ * https://docs.microsoft.com/en-us/windows/win32/api/synchapi/nf-synchapi-waitonaddress
+*/
+
+#ifndef __WORKSTEAL_H__
+#define __WORKSTEAL_H__
+
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <windows.h>
+
+
+#define TASK_MAX_WORKERS                256
+#define TASK_DEQUE_SIZE                 4096            // Power of 2, a full deque runs the task inline.
+#define TASK_SLAB_TASKS                 1024
+#define TASK_CACHE_TASKS                256             // Free tasks kept by one worker.
+#define TASK_SPIN_ROUNDS                64              // Steal rounds before parking.
+
+
+typedef void (*TASK_ROUTINE)(void *context);
+typedef void (*RANGE_ROUTINE)(INT64 begin, INT64 end, void *context);
+
+/* Tasks to wait for, start with { 0 }. */
+typedef struct _TASK_GROUP {
+    volatile LONG pending;
+} TASK_GROUP;
+
+typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) _TASK {
+    SLIST_ENTRY entry;                  // Free or injection list, must be first.
+    struct _TASK *next;                 // Free cache of a worker.
+    TASK_ROUTINE routine;               // NULL for a parallel_for range.
+    void *context;
+    TASK_GROUP *group;
+    INT64 begin;
+    INT64 end;
+} TASK;
+
+/* Owner pushes and pops at bottom, thieves take from top. */
+typedef struct _TASK_DEQUE {
+    DECLSPEC_CACHEALIGN volatile LONG64 top;
+    DECLSPEC_CACHEALIGN volatile LONG64 bottom;
+    TASK *volatile tasks[TASK_DEQUE_SIZE];
+} TASK_DEQUE;
+
+typedef struct _TASK_WORKER {
+    TASK_DEQUE deque;
+    struct _TASK_POOL *pool;
+    HANDLE thread;
+    int index;
+    UINT32 seed;                        // Victim choice.
+    TASK *cache;
+    int cached;
+    UINT64 executed;
+    UINT64 stolen;
+    UINT64 parked;
+} TASK_WORKER;
+
+typedef struct _TASK_POOL {
+    SLIST_HEADER freeTasks;             // Must stay 16 bytes aligned.
+    SLIST_HEADER injected;
+    volatile LONG injectCount;
+    DECLSPEC_CACHEALIGN volatile LONG epoch;        // Bumped to wake parked workers.
+    volatile LONG parkedCount;
+    volatile LONG searchingCount;       // Workers looking for a task, not parked.
+    volatile LONG stop;
+    TASK_WORKER *workers;
+    volatile LONG workerCount;          // Started workers.
+    int spinRounds;
+    DWORD slot;                         // TLS, the worker of the current thread.
+    SRWLOCK growLock;
+    char **slabs;
+    int slabCount;
+    int maxSlabs;
+} TASK_POOL;
+
+
+int task_pool_init(TASK_POOL *pool, int workerCount);
+void task_pool_destroy(TASK_POOL *pool);
+
+int task_spawn(TASK_POOL *pool, TASK_GROUP *group, TASK_ROUTINE routine, void *context);
+void task_wait(TASK_POOL *pool, TASK_GROUP *group);
+int parallel_for(TASK_POOL *pool, INT64 begin, INT64 end, INT64 grain, RANGE_ROUTINE routine, void *context);
+
+void task_pool_stats(TASK_POOL *pool, UINT64 *executed, UINT64 *stolen, UINT64 *parked);
+
+
+#endif /* __WORKSTEAL_H__ */
@@ -0,0 +1,389 @@
+/**
+ * Win32 thread placement benchmark.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/procthread/processor-groups].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/procthread/numa-support].
+ *
+ * Pins worker threads by the placement policies of Common/topology.h and
+ * runs a compute bound and a memory bound loop under each of them:
+ *
+ *  - compute: four independent multiply chains per thread, the execution
+ *    units of a core are the limit, SMT siblings compete for them.
+ *  - memory: every thread sums its own buffer, much larger than the
+ *    caches, the memory channels of the nodes are the limit.
+ *
+ * Buffers are written after the thread is pinned, so their pages come
+ * from the NUMA node of the thread.
+ *
+ * License - MIT.
+ */
+
+#include <iostream>
+#include <windows.h>
+
+#include "topology.h"
+#include "timing.h"
+
+
+#define LOAD_ALL                                -1
+#define LOAD_COMPUTE                            0
+#define LOAD_MEMORY                             1
+#define LOAD_COUNT                              2
+
+#define POLICY_ALL                              -2
+#define COMPUTE_BATCH                           4096
+#define MAX_THREADS                             1024
+
+
+typedef struct _WORKER {
+    HANDLE thread;
+    int index;
+    int load;
+    int status;
+    UINT64 units;                       // Multiplies or bytes.
+    UINT64 sink;                        // Keeps the loops from being optimized away.
+} WORKER;
+
+
+static const char *loadNames[] = { "compute", "memory" };
+static const char *unitNames[] = { "Gmul/s", "GB/s" };
+
+TOPOLOGY topo;
+PLACEMENT place;
+HANDLE startEvent           = NULL;
+volatile LONG ready         = 0;
+volatile LONG stop          = 0;
+
+int threadCount             = 0;
+int policy                  = POLICY_ALL;
+int loadMode                = LOAD_ALL;
+int durationSec             = 3;
+int bufferMB                = 256;
+
+
+/**
+ * Compute - Four independent chains, COMPUTE_BATCH multiplies each.
+*/
+static UINT64 Compute(UINT64 seed)
+{
+    UINT64 a = seed, b = seed + 1, c = seed + 2, d = seed + 3;
+
+    for (int i = 0; i < COMPUTE_BATCH; i++)
+    {
+        a = a * 6364136223846793005ull + 1;
+        b = b * 6364136223846793005ull + 3;
+        c = c * 6364136223846793005ull + 5;
+        d = d * 6364136223846793005ull + 7;
+    }
+
+    return a ^ b ^ c ^ d;
+}
+
+/**
+ * Sum - Read the whole buffer once.
+*/
+static UINT64 Sum(const UINT64 *buffer, SIZE_T words)
+{
+    UINT64 a = 0, b = 0, c = 0, d = 0;
+
+    for (SIZE_T i = 0; i + 4 <= words; i += 4)
+    {
+        a += buffer[i];
+        b += buffer[i + 1];
+        c += buffer[i + 2];
+        d += buffer[i + 3];
+    }
+
+    return a + b + c + d;
+}
+
+/**
+ * WorkerMain - Pin, prepare, then run the load until stopped.
+*/
+DWORD WINAPI WorkerMain(LPVOID lpParam)
+{
+    WORKER *worker = (WORKER *)lpParam;
+    UINT64 *buffer = NULL;
+    SIZE_T bytes   = (SIZE_T)bufferMB * 1024 * 1024;
+    SIZE_T words   = bytes / sizeof(UINT64);
+    UINT64 units   = 0;
+    UINT64 sink    = worker->index;
+
+    worker->status = place_thread(&place, GetCurrentThread(), worker->index);
+
+    if (LOAD_MEMORY == worker->load)
+    {
+        buffer = (UINT64 *)VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (NULL == buffer)
+        {
+            printf("Error in VirtualAlloc: %d.\n", GetLastError());
+            worker->status = -1;
+        }
+        else
+        {
+            /* First touch from the pinned thread, the pages are local. */
+            for (SIZE_T i = 0; i < words; i++)
+                buffer[i] = i;
+        }
+    }
+
+    InterlockedIncrement(&ready);
+    WaitForSingleObject(startEvent, INFINITE);
+
+    while (0 == worker->status && 0 == stop)
+    {
+        if (LOAD_COMPUTE == worker->load)
+        {
+            sink   = Compute(sink);
+            units += 4 * COMPUTE_BATCH;
+        }
+        else
+        {
+            sink  += Sum(buffer, words);
+            units += bytes;
+        }
+    }
+
+    worker->units = units;
+    worker->sink  = sink;
+
+    if (NULL != buffer)
+        VirtualFree(buffer, 0, MEM_RELEASE);
+
+    return 0;
+}
+
+/**
+ * SlotCore - Physical core of the first processor of a slot.
+*/
+int SlotCore(const GROUP_AFFINITY *slot)
+{
+    for (int i = 0; i < topo.cpuCount; i++)
+    {
+        if (topo.cpus[i].group == slot->Group && 0 != (slot->Mask & ((KAFFINITY)1 << topo.cpus[i].number)))
+            return topo.cpus[i].core;
+    }
+
+    return -1;
+}
+
+/**
+ * PrintSpread - Cores and nodes the threads are pinned to.
+*/
+void PrintSpread(void)
+{
+    int cores = 0, nodes = 0;
+    int core, node;
+    BOOL seen;
+
+    if (PLACE_NONE == place.policy)
+    {
+        printf(" %6s %6s\n", "-", "-");
+        return;
+    }
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        core = SlotCore(&place.slots[i % place.count]);
+        node = place.nodes[i % place.count];
+
+        seen = FALSE;
+        for (int j = 0; j < i && !seen; j++)
+            seen = core == SlotCore(&place.slots[j % place.count]);
+        cores += !seen;
+
+        seen = FALSE;
+        for (int j = 0; j < i && !seen; j++)
+            seen = node == place.nodes[j % place.count];
+        nodes += !seen;
+    }
+
+    printf(" %6d %6d\n", cores, nodes);
+}
+
+/**
+ * RunCase - All threads on one load under the current placement.
+*/
+int RunCase(int load)
+{
+    int i;
+    int status = 0;
+    int started = 0;
+    UINT64 t0, t1;
+    double seconds;
+    UINT64 units = 0;
+    WORKER *workers;
+
+    workers = (WORKER *)calloc(threadCount, sizeof(WORKER));
+    if (NULL == workers)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    ready = 0;
+    stop  = 0;
+    ResetEvent(startEvent);
+
+    for (i = 0; i < threadCount; i++)
+    {
+        workers[i].index = i;
+        workers[i].load  = load;
+
+        workers[i].thread = CreateThread(NULL, 0, WorkerMain, &workers[i], 0, NULL);
+        if (NULL == workers[i].thread)
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            status = -1;
+            break;
+        }
+
+        started++;
+    }
+
+    while (ready < started)
+        Sleep(10);
+
+    t0 = timing_now_ns();
+    SetEvent(startEvent);
+
+    Sleep(durationSec * 1000);
+
+    /* Every thread finishes its current batch or pass. */
+    InterlockedExchange(&stop, 1);
+
+    for (i = 0; i < started; i++)
+    {
+        WaitForSingleObject(workers[i].thread, INFINITE);
+        CloseHandle(workers[i].thread);
+
+        units += workers[i].units;
+        if (0 != workers[i].status)
+            status = -1;
+    }
+
+    t1 = timing_now_ns();
+    seconds = (double)(t1 - t0) / TIMING_NS_PER_SEC;
+
+    if (0 == status)
+    {
+        printf("%-8s %-8s %8d %10.2f %-7s %10.3f",
+               place_name(place.policy), loadNames[load], threadCount,
+               units / seconds / 1e9, unitNames[load], units / seconds / 1e9 / threadCount);
+        PrintSpread();
+    }
+
+    free(workers);
+
+    return status;
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'p':
+            if (0 == strcmp(argv[i + 1], "all"))
+                policy = POLICY_ALL;
+            else if (0 != place_parse(argv[i + 1], &policy))
+                return -1;
+            break;
+        case 'l':
+            if (0 == strcmp(argv[i + 1], "all"))
+                loadMode = LOAD_ALL;
+            else if (0 == strcmp(argv[i + 1], "compute"))
+                loadMode = LOAD_COMPUTE;
+            else if (0 == strcmp(argv[i + 1], "memory"))
+                loadMode = LOAD_MEMORY;
+            else
+                return -1;
+            break;
+        case 't': threadCount = atoi(argv[i + 1]);  break;
+        case 'T': durationSec = atoi(argv[i + 1]);  break;
+        case 'm': bufferMB    = atoi(argv[i + 1]);  break;
+        default:
+            return -1;
+        }
+    }
+
+    if (threadCount < 0 || threadCount > MAX_THREADS || durationSec < 1 || bufferMB < 1)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Main function.
+*/
+int main(int argc, char **argv)
+{
+    int status = 0;
+    int first, last;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-p all|none|compact|scatter|core|nosmt] [-l all|compute|memory] [-t threads] [-T s] [-m MB]\n", argv[0]);
+        printf("  -p policy    Placement, default all of them.\n");
+        printf("  -l load      compute, memory or all (default).\n");
+        printf("  -t threads   Worker threads, default 1 per physical core.\n");
+        printf("  -T seconds   Time per case, default 3.\n");
+        printf("  -m MB        Buffer per thread of the memory load, default 256.\n");
+        return -1;
+    }
+
+    if (0 != topo_init(&topo))
+        return -1;
+
+    topo_print(&topo);
+
+    if (0 == threadCount)
+        threadCount = topo.coreCount;
+
+    startEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (NULL == startEvent)
+    {
+        printf("Error in CreateEvent: %d.\n", GetLastError());
+        status = -1;
+        goto out_topo;
+    }
+
+    printf("\n%-8s %-8s %8s %10s %-7s %10s %6s %6s\n",
+           "Policy", "Load", "Threads", "Total", "Unit", "Per thread", "Cores", "Nodes");
+
+    first = POLICY_ALL == policy ? PLACE_NONE : policy;
+    last  = POLICY_ALL == policy ? PLACE_COUNT - 1 : policy;
+
+    for (int load = 0; load < LOAD_COUNT; load++)
+    {
+        if (LOAD_ALL != loadMode && load != loadMode)
+            continue;
+
+        for (int p = first; p <= last; p++)
+        {
+            if (0 != place_init(&place, &topo, p))
+            {
+                status = -1;
+                continue;
+            }
+
+            if (0 != RunCase(load))
+                status = -1;
+
+            place_free(&place);
+        }
+    }
+
+    CloseHandle(startEvent);
+
+out_topo:
+    topo_free(&topo);
+
+    return status;
+}
@@ -0,0 +1,589 @@
+/**
+ * Win32 scheduling class benchmark.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/procthread/multimedia-class-scheduler-service].
+ * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/cmpapi/using-the-compression-api].
+ *
+ * Measures the latency of network I/O threads while batch threads keep
+ * every cpu busy with compression, with the scheduling classes of
+ * Common/schedclass.h on either side:
+ *
+ *  - I/O: a sender thread sends a UDP datagram over loopback at a fixed
+ *    rate, a receiver thread takes it. The latency is from the time the
+ *    datagram was due to its arrival, so a late sender counts as well.
+ *  - batch: threads compressing a buffer with XPRESS Huffman in a loop.
+ *
+ * License - MIT.
+ */
+
+#undef UNICODE
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <compressapi.h>
+
+#include "schedclass.h"
+#include "histogram.h"
+#include "timing.h"
+
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Cabinet.lib")
+
+
+#define CLASS_UNSET                             -2
+#define BATCH_NONE                              -1
+
+#define BATCH_INPUT_SIZE                        (1024 * 1024)
+#define MAX_BATCH_THREADS                       1024
+#define RECV_TIMEOUT_MS                         100
+#define NS_PER_SEC                              1000000000ull
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION   0x00000002
+#endif
+
+
+/* I/O class and batch class of one case. */
+typedef struct _SCHED_CASE {
+    int ioClass;
+    int batchClass;
+} SCHED_CASE;
+
+typedef struct _BATCH {
+    HANDLE thread;
+    int batchClass;
+    int status;
+    UINT64 bytes;                       // Input compressed.
+    char applied[32];
+} BATCH;
+
+typedef struct _IO {
+    SOCKET fd;
+    struct sockaddr_in addr;
+    int ioClass;
+    int status;
+    UINT64 sent;
+    UINT64 received;
+    LatencyHistogram hist;              // Due to arrival in ns.
+    char applied[32];
+} IO;
+
+
+/* Idle system first, then every class against every other. */
+static const SCHED_CASE matrix[] = {
+    { SCHED_CLASS_NORMAL,   BATCH_NONE          },
+    { SCHED_CLASS_NORMAL,   SCHED_CLASS_NORMAL  },
+    { SCHED_CLASS_LATENCY,  SCHED_CLASS_NORMAL  },
+    { SCHED_CLASS_NORMAL,   SCHED_CLASS_BATCH   },
+    { SCHED_CLASS_LATENCY,  SCHED_CLASS_BATCH   },
+    { SCHED_CLASS_NORMAL,   SCHED_CLASS_IDLE    },
+};
+
+BYTE *batchInput            = NULL;
+volatile LONG stop          = 0;
+
+int ioClass                 = CLASS_UNSET;
+int batchClass              = CLASS_UNSET;
+int batchCount              = 0;
+int rate                    = 1000;
+int durationSec             = 5;
+DWORD processClass          = NORMAL_PRIORITY_CLASS;
+
+
+/**
+ * FillBatchInput - Text like data, XPRESS gets it to about half.
+*/
+static void FillBatchInput(BYTE *buffer, SIZE_T size)
+{
+    UINT32 seed = 12345;
+
+    for (SIZE_T i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+
+        /* Mostly a small alphabet, now and then a copy of earlier data. */
+        if (i > 64 && 0 == (seed >> 28))
+            buffer[i] = buffer[i - 1 - ((seed >> 8) & 63)];
+        else
+            buffer[i] = 'a' + ((seed >> 16) % 20);
+    }
+}
+
+/**
+ * BatchMain - Compress the input over and over.
+*/
+DWORD WINAPI BatchMain(LPVOID lpParam)
+{
+    BATCH *batch                = (BATCH *)lpParam;
+    COMPRESSOR_HANDLE compressor = NULL;
+    SIZE_T outputSize           = BATCH_INPUT_SIZE + BATCH_INPUT_SIZE / 2;
+    SIZE_T compressedSize       = 0;
+    BYTE *output                = NULL;
+    SCHED_STATE state;
+
+    sched_class_enter(&state, batch->batchClass);
+    sched_class_describe(&state, batch->applied, sizeof(batch->applied));
+
+    output = (BYTE *)malloc(outputSize);
+    if (NULL == output)
+    {
+        printf("Out of memory.\n");
+        batch->status = -1;
+        goto out_state;
+    }
+
+    if (!CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, NULL, &compressor))
+    {
+        printf("Error in CreateCompressor: %d.\n", GetLastError());
+        batch->status = -1;
+        goto out_free;
+    }
+
+    while (0 == stop)
+    {
+        if (!Compress(compressor, batchInput, BATCH_INPUT_SIZE, output, outputSize, &compressedSize))
+        {
+            printf("Error in Compress: %d.\n", GetLastError());
+            batch->status = -1;
+            break;
+        }
+
+        batch->bytes += BATCH_INPUT_SIZE;
+    }
+
+    CloseCompressor(compressor);
+
+out_free:
+    free(output);
+
+out_state:
+    sched_class_leave(&state);
+
+    return 0;
+}
+
+/**
+ * SenderMain - Send a datagram with its due time at every period.
+*/
+DWORD WINAPI SenderMain(LPVOID lpParam)
+{
+    IO *io          = (IO *)lpParam;
+    UINT64 period   = NS_PER_SEC / rate;
+    UINT64 due, now;
+    HANDLE timer;
+    SOCKET fd;
+    LARGE_INTEGER wait;
+    SCHED_STATE state;
+
+    sched_class_enter(&state, io->ioClass);
+
+    /* Windows 10 1803+, 0.5 ms steps instead of the 15.6 ms tick. */
+    timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (NULL == timer)
+        timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+
+    if (NULL == timer)
+    {
+        printf("Error in CreateWaitableTimer: %d.\n", GetLastError());
+        io->status = -1;
+        goto out_state;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (INVALID_SOCKET == fd)
+    {
+        printf("Error in socket: %d.\n", WSAGetLastError());
+        io->status = -1;
+        goto out_timer;
+    }
+
+    due = timing_now_ns() + period;
+
+    while (0 == stop)
+    {
+        now = timing_now_ns();
+
+        if (due > now)
+        {
+            wait.QuadPart = -(LONGLONG)((due - now) / 100);
+            SetWaitableTimer(timer, &wait, 0, NULL, NULL, FALSE);
+            WaitForSingleObject(timer, INFINITE);
+        }
+
+        if (SOCKET_ERROR == sendto(fd, (const char *)&due, sizeof(due), 0,
+                                   (struct sockaddr *)&io->addr, sizeof(io->addr)))
+        {
+            printf("Error in sendto: %d.\n", WSAGetLastError());
+            io->status = -1;
+            break;
+        }
+
+        io->sent++;
+
+        /* Keep the schedule, late datagrams are sent at once. */
+        due += period;
+    }
+
+    closesocket(fd);
+
+out_timer:
+    CloseHandle(timer);
+
+out_state:
+    sched_class_leave(&state);
+
+    return 0;
+}
+
+/**
+ * ReceiverMain - Record the delay of every datagram.
+*/
+DWORD WINAPI ReceiverMain(LPVOID lpParam)
+{
+    IO *io = (IO *)lpParam;
+    UINT64 due, now;
+    int ret;
+    SCHED_STATE state;
+
+    sched_class_enter(&state, io->ioClass);
+    sched_class_describe(&state, io->applied, sizeof(io->applied));
+
+    /* After the stop, take what is still queued until a timeout. */
+    for (;;)
+    {
+        ret = recv(io->fd, (char *)&due, sizeof(due), 0);
+        now = timing_now_ns();
+
+        if (SOCKET_ERROR == ret)
+        {
+            if (WSAETIMEDOUT == WSAGetLastError())
+            {
+                if (0 != stop)
+                    break;
+
+                continue;
+            }
+
+            printf("Error in recv: %d.\n", WSAGetLastError());
+            io->status = -1;
+            break;
+        }
+
+        if (sizeof(due) != ret)
+            continue;
+
+        io->hist.record(now > due ? now - due : 0);
+        io->received++;
+    }
+
+    sched_class_leave(&state);
+
+    return 0;
+}
+
+/**
+ * OpenReceiver - UDP socket on a free loopback port.
+*/
+int OpenReceiver(IO *io)
+{
+    int len         = sizeof(io->addr);
+    DWORD timeout   = RECV_TIMEOUT_MS;
+
+    io->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (INVALID_SOCKET == io->fd)
+    {
+        printf("Error in socket: %d.\n", WSAGetLastError());
+        return -1;
+    }
+
+    ZeroMemory(&io->addr, sizeof(io->addr));
+    io->addr.sin_family         = AF_INET;
+    io->addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    io->addr.sin_port           = 0;
+
+    if (SOCKET_ERROR == bind(io->fd, (struct sockaddr *)&io->addr, sizeof(io->addr)) ||
+        SOCKET_ERROR == getsockname(io->fd, (struct sockaddr *)&io->addr, &len))
+    {
+        printf("Error in bind: %d.\n", WSAGetLastError());
+        goto out_close;
+    }
+
+    /* The receiver checks the stop flag between timeouts. */
+    if (SOCKET_ERROR == setsockopt(io->fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)))
+    {
+        printf("Error in setsockopt: %d.\n", WSAGetLastError());
+        goto out_close;
+    }
+
+    return 0;
+
+out_close:
+    closesocket(io->fd);
+    io->fd = INVALID_SOCKET;
+
+    return -1;
+}
+
+/**
+ * RunCase - I/O threads against batch threads for durationSec.
+*/
+int RunCase(const SCHED_CASE *sc)
+{
+    int i;
+    int status      = 0;
+    int started     = 0;
+    int threads     = BATCH_NONE == sc->batchClass ? 0 : batchCount;
+    HANDLE sender   = NULL;
+    HANDLE receiver = NULL;
+    UINT64 bytes    = 0;
+    UINT64 t0, t1;
+    BATCH *batches  = NULL;
+    IO *io;
+
+    io = new IO();
+    io->ioClass = sc->ioClass;
+
+    if (0 != OpenReceiver(io))
+    {
+        delete io;
+        return -1;
+    }
+
+    if (threads > 0)
+    {
+        batches = (BATCH *)calloc(threads, sizeof(BATCH));
+        if (NULL == batches)
+        {
+            printf("Out of memory.\n");
+            status = -1;
+            goto out_io;
+        }
+    }
+
+    stop = 0;
+
+    for (i = 0; i < threads; i++)
+    {
+        batches[i].batchClass = sc->batchClass;
+
+        batches[i].thread = CreateThread(NULL, 0, BatchMain, &batches[i], 0, NULL);
+        if (NULL == batches[i].thread)
+        {
+            printf("Error in CreateThread: %d.\n", GetLastError());
+            status = -1;
+            break;
+        }
+
+        started++;
+    }
+
+    t0 = timing_now_ns();
+
+    receiver = CreateThread(NULL, 0, ReceiverMain, io, 0, NULL);
+    sender   = NULL != receiver ? CreateThread(NULL, 0, SenderMain, io, 0, NULL) : NULL;
+
+    if (NULL == sender)
+    {
+        printf("Error in CreateThread: %d.\n", GetLastError());
+        status = -1;
+    }
+    else
+    {
+        Sleep(durationSec * 1000);
+    }
+
+    InterlockedExchange(&stop, 1);
+
+    if (NULL != sender)
+    {
+        WaitForSingleObject(sender, INFINITE);
+        CloseHandle(sender);
+    }
+
+    if (NULL != receiver)
+    {
+        WaitForSingleObject(receiver, INFINITE);
+        CloseHandle(receiver);
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        WaitForSingleObject(batches[i].thread, INFINITE);
+        CloseHandle(batches[i].thread);
+
+        bytes += batches[i].bytes;
+        if (0 != batches[i].status)
+            status = -1;
+    }
+
+    t1 = timing_now_ns();
+
+    if (0 != io->status)
+        status = -1;
+
+    if (0 == status)
+    {
+        printf("%-8s %-8s %7d %8llu %8.1f %8.1f %8.1f %9.1f %8.1f  %-15s %s\n",
+               sched_class_name(sc->ioClass),
+               BATCH_NONE == sc->batchClass ? "-" : sched_class_name(sc->batchClass),
+               threads,
+               (unsigned long long)(io->sent - io->received),
+               io->hist.percentile(50.0) / 1e3,
+               io->hist.percentile(99.0) / 1e3,
+               io->hist.percentile(99.9) / 1e3,
+               io->hist.max_value() / 1e3,
+               bytes / ((double)(t1 - t0) / NS_PER_SEC) / 1e6,
+               io->applied,
+               threads > 0 ? batches[0].applied : "-");
+    }
+
+    free(batches);
+
+out_io:
+    closesocket(io->fd);
+    delete io;
+
+    return status;
+}
+
+/**
+ * ParseClass - Class name, "none" for no batch threads where allowed.
+*/
+static int ParseClass(const char *name, int *schedClass, BOOL allowNone)
+{
+    if (allowNone && 0 == strcmp(name, "none"))
+    {
+        *schedClass = BATCH_NONE;
+        return 0;
+    }
+
+    return sched_class_parse(name, schedClass);
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'i':
+            if (0 != ParseClass(argv[i + 1], &ioClass, FALSE))
+                return -1;
+            break;
+        case 'b':
+            if (0 != ParseClass(argv[i + 1], &batchClass, TRUE))
+                return -1;
+            break;
+        case 'P':
+            if (0 == strcmp(argv[i + 1], "normal"))
+                processClass = NORMAL_PRIORITY_CLASS;
+            else if (0 == strcmp(argv[i + 1], "high"))
+                processClass = HIGH_PRIORITY_CLASS;
+            else if (0 == strcmp(argv[i + 1], "realtime"))
+                processClass = REALTIME_PRIORITY_CLASS;
+            else
+                return -1;
+            break;
+        case 'c': batchCount  = atoi(argv[i + 1]);  break;
+        case 'r': rate        = atoi(argv[i + 1]);  break;
+        case 'T': durationSec = atoi(argv[i + 1]);  break;
+        default:
+            return -1;
+        }
+    }
+
+    if (batchCount < 0 || batchCount > MAX_BATCH_THREADS || rate < 1 || rate > 100000 || durationSec < 1)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Main function.
+*/
+int main(int argc, char **argv)
+{
+    int status = 0;
+    WSADATA wsaData;
+    SYSTEM_INFO info;
+    SCHED_CASE single;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-i class] [-b class|none] [-c threads] [-r rate] [-T s] [-P normal|high|realtime]\n", argv[0]);
+        printf("  class        normal, latency, batch or idle.\n");
+        printf("  -i class     Class of the I/O threads, default the case matrix.\n");
+        printf("  -b class     Class of the batch threads, none for an idle system.\n");
+        printf("  -c threads   Batch threads, default 1 per cpu.\n");
+        printf("  -r rate      Datagrams per second, default 1000.\n");
+        printf("  -T seconds   Time per case, default 5.\n");
+        printf("  -P class     Priority class of the process, default normal.\n");
+        return -1;
+    }
+
+    if (0 != WSAStartup(MAKEWORD(2, 2), &wsaData))
+    {
+        printf("Error in WSAStartup.\n");
+        return -1;
+    }
+
+    if (NORMAL_PRIORITY_CLASS != processClass && 0 > sched_process_class(processClass))
+    {
+        status = -1;
+        goto out_wsa;
+    }
+
+    if (0 == batchCount)
+    {
+        GetSystemInfo(&info);
+        batchCount = info.dwNumberOfProcessors;
+    }
+
+    batchInput = (BYTE *)malloc(BATCH_INPUT_SIZE);
+    if (NULL == batchInput)
+    {
+        printf("Out of memory.\n");
+        status = -1;
+        goto out_wsa;
+    }
+
+    FillBatchInput(batchInput, BATCH_INPUT_SIZE);
+
+    printf("%d datagrams/s, %d batch threads, %d s per case, latency in us.\n\n", rate, batchCount, durationSec);
+    printf("%-8s %-8s %7s %8s %8s %8s %8s %9s %8s  %-15s %s\n",
+           "I/O", "Batch", "Threads", "Lost", "p50", "p99", "p99.9", "max", "MB/s", "I/O got", "Batch got");
+
+    if (CLASS_UNSET == ioClass && CLASS_UNSET == batchClass)
+    {
+        for (int i = 0; i < (int)(sizeof(matrix) / sizeof(matrix[0])); i++)
+        {
+            if (0 != RunCase(&matrix[i]))
+                status = -1;
+        }
+    }
+    else
+    {
+        single.ioClass    = CLASS_UNSET == ioClass ? SCHED_CLASS_NORMAL : ioClass;
+        single.batchClass = CLASS_UNSET == batchClass ? SCHED_CLASS_NORMAL : batchClass;
+
+        status = RunCase(&single);
+    }
+
+    free(batchInput);
+
+out_wsa:
+    WSACleanup();
+
+    return status;
+}
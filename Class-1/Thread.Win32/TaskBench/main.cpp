@@ -0,0 +1,352 @@
+/**
+ * Win32 work stealing vs thread per task benchmark.
+ * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/procthread/creating-threads].
+ * Ref 2: [https://www.dre.vanderbilt.edu/~schmidt/PDF/work-stealing-dequeue.pdf].
+ *
+ * Runs the same fine grained work three ways and compares the time:
+ *
+ *  - serial: one loop in the main thread, the baseline.
+ *  - steal: the work stealing pool of Common/worksteal.h, task_spawn()
+ *    per task or parallel_for() over the items.
+ *  - thread: CreateThread per task, like ThreadBase, waited for in groups
+ *    of MAXIMUM_WAIT_OBJECTS.
+ *
+ * Every item writes its result to its own slot, the checksum of the slots
+ * must match the serial one.
+ *
+ * License - MIT.
+ */
+
+#include <iostream>
+#include <windows.h>
+
+#include "worksteal.h"
+#include "timing.h"
+
+
+#define MODE_ALL                                -1
+#define MODE_SERIAL                             0
+#define MODE_STEAL                              1
+#define MODE_THREAD                             2
+#define MODE_COUNT                              3
+
+#define LOAD_SPAWN                              0
+#define LOAD_FOR                                1
+#define LOAD_COUNT                              2
+
+#define TASK_STACK_SIZE                         (64 * 1024)
+
+
+/* Items [begin, end) of one thread mode task. */
+typedef struct _CHUNK {
+    INT64 begin;
+    INT64 end;
+} CHUNK;
+
+
+static const char *modeNames[] = { "serial", "steal", "thread" };
+static const char *loadNames[] = { "spawn", "for" };
+
+TASK_POOL taskPool;
+UINT64 *results             = NULL;
+
+int mode                    = MODE_ALL;
+int workerCount             = 0;
+int itemCount               = 100000;
+int workCount               = 1000;
+int grain                   = 64;
+int repeatCount             = 3;
+
+
+/**
+ * Work - A few ns of integer work per iteration, the result depends on all.
+*/
+static inline UINT64 Work(UINT64 x, int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        x ^= x >> 29;
+    }
+
+    return x;
+}
+
+/**
+ * RunItems - Items [begin, end), the body of every mode.
+*/
+static void RunItems(INT64 begin, INT64 end, void *context)
+{
+    for (INT64 i = begin; i < end; i++)
+        results[i] = Work((UINT64)i, workCount);
+}
+
+/**
+ * ItemTask - One item as a pool task.
+*/
+static void ItemTask(void *context)
+{
+    INT64 i = (INT64)(INT_PTR)context;
+
+    results[i] = Work((UINT64)i, workCount);
+}
+
+/**
+ * ChunkThread - One task as a thread.
+*/
+DWORD WINAPI ChunkThread(LPVOID lpParam)
+{
+    CHUNK *chunk = (CHUNK *)lpParam;
+
+    RunItems(chunk->begin, chunk->end, NULL);
+
+    return 0;
+}
+
+/**
+ * Checksum - Mix of all results.
+*/
+UINT64 Checksum(void)
+{
+    UINT64 sum = 0;
+
+    for (int i = 0; i < itemCount; i++)
+        sum = sum * 31 + results[i];
+
+    return sum;
+}
+
+/**
+ * RunThreads - A thread per chunk of size items, MAXIMUM_WAIT_OBJECTS at a time.
+*/
+int RunThreads(int size)
+{
+    int i, count;
+    int status = 0;
+    INT64 next = 0;
+    HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+    CHUNK chunks[MAXIMUM_WAIT_OBJECTS];
+
+    while (next < itemCount)
+    {
+        for (count = 0; count < MAXIMUM_WAIT_OBJECTS && next < itemCount; count++)
+        {
+            chunks[count].begin = next;
+            chunks[count].end   = next + size < itemCount ? next + size : itemCount;
+            next = chunks[count].end;
+
+            threads[count] = CreateThread(NULL, TASK_STACK_SIZE, ChunkThread, &chunks[count],
+                                          STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+            if (NULL == threads[count])
+            {
+                printf("Error in CreateThread: %d.\n", GetLastError());
+                status = -1;
+                break;
+            }
+        }
+
+        WaitForMultipleObjects(count, threads, TRUE, INFINITE);
+
+        for (i = 0; i < count; i++)
+            CloseHandle(threads[i]);
+
+        if (0 != status)
+            break;
+    }
+
+    return status;
+}
+
+/**
+ * RunOnce - One run of a workload in a mode.
+*/
+int RunOnce(int runMode, int load)
+{
+    TASK_GROUP group = { 0 };
+
+    switch (runMode)
+    {
+    case MODE_SERIAL:
+        RunItems(0, itemCount, NULL);
+        return 0;
+
+    case MODE_STEAL:
+        if (LOAD_FOR == load)
+            return parallel_for(&taskPool, 0, itemCount, grain, RunItems, NULL);
+
+        for (int i = 0; i < itemCount; i++)
+        {
+            if (0 != task_spawn(&taskPool, &group, ItemTask, (void *)(INT_PTR)i))
+            {
+                task_wait(&taskPool, &group);
+                return -1;
+            }
+        }
+
+        task_wait(&taskPool, &group);
+        return 0;
+
+    default:
+        return RunThreads(LOAD_FOR == load ? grain : 1);
+    }
+}
+
+/**
+ * RunCase - Best time of the repeats, -1 on error or a wrong checksum.
+*/
+double RunCase(int runMode, int load, UINT64 expected)
+{
+    UINT64 start;
+    double elapsed;
+    double best = -1.0;
+
+    for (int r = 0; r < repeatCount; r++)
+    {
+        ZeroMemory(results, itemCount * sizeof(UINT64));
+
+        start = timing_now_ns();
+
+        if (0 != RunOnce(runMode, load))
+            return -1.0;
+
+        elapsed = (timing_now_ns() - start) / 1000.0;
+
+        if (MODE_SERIAL != runMode && expected != Checksum())
+        {
+            printf("Checksum mismatch in %s %s.\n", modeNames[runMode], loadNames[load]);
+            return -1.0;
+        }
+
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/**
+ * ParseArgs - Parse the command line options.
+*/
+int ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if ('-' != argv[i][0] || i + 1 >= argc)
+            return -1;
+
+        switch (argv[i][1])
+        {
+        case 'm':
+            if (0 == strcmp(argv[i + 1], "all"))
+                mode = MODE_ALL;
+            else if (0 == strcmp(argv[i + 1], "steal"))
+                mode = MODE_STEAL;
+            else if (0 == strcmp(argv[i + 1], "thread"))
+                mode = MODE_THREAD;
+            else
+                return -1;
+            break;
+        case 't': workerCount = atoi(argv[i + 1]);  break;
+        case 'n': itemCount   = atoi(argv[i + 1]);  break;
+        case 'w': workCount   = atoi(argv[i + 1]);  break;
+        case 'g': grain       = atoi(argv[i + 1]);  break;
+        case 'r': repeatCount = atoi(argv[i + 1]);  break;
+        default:
+            return -1;
+        }
+    }
+
+    if (workerCount < 0 || workerCount > TASK_MAX_WORKERS || itemCount < 1 ||
+        workCount < 0 || grain < 1 || repeatCount < 1)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Main function.
+*/
+int main(int argc, char **argv)
+{
+    int status = 0;
+    int runMode, load, tasks;
+    double serialUs, us;
+    UINT64 expected;
+    UINT64 executed = 0, stolen = 0, parked = 0;
+    UINT64 executed0, stolen0, parked0;
+
+    if (0 != ParseArgs(argc, argv))
+    {
+        printf("Usage: %s [-m all|steal|thread] [-t workers] [-n items] [-w work] [-g grain] [-r repeats]\n", argv[0]);
+        printf("  -m mode      Compared with serial: steal, thread or all (default).\n");
+        printf("  -t workers   Pool workers, default 1 per cpu.\n");
+        printf("  -n items     Items, one task each in the spawn workload, default 100000.\n");
+        printf("  -w work      Work iterations per item, default 1000.\n");
+        printf("  -g grain     Items per task in the for workload, default 64.\n");
+        printf("  -r repeats   Runs per case, the best one counts, default 3.\n");
+        return -1;
+    }
+
+    results = (UINT64 *)malloc(itemCount * sizeof(UINT64));
+    if (NULL == results)
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    if (0 != task_pool_init(&taskPool, workerCount))
+    {
+        status = -1;
+        goto out_free;
+    }
+
+    printf("%ld workers, %d items, %d work iterations, grain %d, best of %d.\n\n",
+           taskPool.workerCount, itemCount, workCount, grain, repeatCount);
+
+    printf("%-8s %-8s %10s %10s %10s %8s %10s %8s\n",
+           "Mode", "Load", "Tasks", "Time ms", "ns/item", "Speedup", "Stolen", "Parked");
+
+    for (load = 0; load < LOAD_COUNT; load++)
+    {
+        RunItems(0, itemCount, NULL);
+        expected = Checksum();
+
+        serialUs = RunCase(MODE_SERIAL, load, expected);
+
+        for (runMode = 0; runMode < MODE_COUNT; runMode++)
+        {
+            if (MODE_SERIAL != runMode && MODE_ALL != mode && runMode != mode)
+                continue;
+
+            task_pool_stats(&taskPool, &executed0, &stolen0, &parked0);
+
+            us = MODE_SERIAL == runMode ? serialUs : RunCase(runMode, load, expected);
+            if (0 > us)
+            {
+                status = -1;
+                continue;
+            }
+
+            task_pool_stats(&taskPool, &executed, &stolen, &parked);
+
+            tasks = MODE_SERIAL == runMode ? 1 :
+                    LOAD_SPAWN == load ? itemCount : (itemCount + grain - 1) / grain;
+
+            printf("%-8s %-8s %10d %10.2f %10.1f %8.2f",
+                   modeNames[runMode], loadNames[load], tasks, us / 1000.0,
+                   us * 1000.0 / itemCount, serialUs / us);
+
+            if (MODE_STEAL == runMode)
+                printf(" %10llu %8llu\n", (stolen - stolen0) / repeatCount, (parked - parked0) / repeatCount);
+            else
+                printf(" %10s %8s\n", "-", "-");
+        }
+    }
+
+    task_pool_destroy(&taskPool);
+
+out_free:
+    free(results);
+
+    return status;
+}
@@ -2,6 +2,7 @@
  * Win32 set thread cpu affinity example.
  * Ref 1: [https://docs.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-setthreadaffinitymask].
  * Ref 2: [https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-setthreadpriority].
+ * Ref 3: [https://docs.microsoft.com/en-us/windows/win32/api/processtopologyapi/nf-processtopologyapi-setthreadgroupaffinity].
  * 
  * License - MIT.
 */
@@ -63,6 +64,32 @@ int SetThrdAffinity(HANDLE &hThread, DWORD_PTR dwThreadAffinityMask)
     return 0;
 }
 
+/**
+ * SetThrdGroupAffinity - Set thread cpu affinity in a processor group.
+ *
+ * A DWORD_PTR mask only covers the 64 cpus of one group, machines with
+ * more cpus have several groups. The thread moves to the given group.
+ * See Common/topology.h for placement by cores, caches and NUMA nodes.
+*/
+int SetThrdGroupAffinity(HANDLE &hThread, WORD group, KAFFINITY mask)
+{
+    GROUP_AFFINITY affinity;
+
+    ZeroMemory(&affinity, sizeof(affinity));
+    affinity.Group = group;
+    affinity.Mask  = mask;
+
+    if (!SetThreadGroupAffinity(hThread, &affinity, NULL))
+    {
+        printf("Error in SetThreadGroupAffinity: %d.\n", GetLastError());
+        return -1;
+    }
+
+    printf("Set thread group %u affinity mask %lld OK!\n", group, mask);
+
+    return 0;
+}
+
 /**
  * LaunchApplication - Launch Application.
 */
@@ -152,6 +179,11 @@ int main(void)
         SetThrdAffinity(hThrd, dwThreadAffinityMask);
         SetThrdPriority(hThrd, nPriority);
 
+        /**
+         * Style 3: Processor group and mask, for more than 64 cpus.
+        */
+        SetThrdGroupAffinity(hThrd, 0, 1);
+
         Sleep(1000);
         CloseHandle(hThrd);
     }
@@ -6,11 +6,15 @@
 
 #include <Windows.h>
 #include "opencl.hpp"
+#include "timing.h"
+#include "trace.h"
 
 #define MAX_CALIBRATION_COUNT       100     // Calibration times.
 
 
 UINT percentage = 0;
+char *tracePath = NULL;
+volatile LONG stop = 0;
 
 
 /**
@@ -34,6 +38,8 @@ DWORD WINAPI GpuWorkload(LPVOID lpParam)
     if (percentage > 100)
         return 1;
 
+    TRACE_THREAD("gpu workload");
+
     /* Get devices. */
     const vector<Device_Info> devices = get_devices(false);
 
@@ -60,28 +66,38 @@ DWORD WINAPI GpuWorkload(LPVOID lpParam)
 
     /**
      * Calibration.
-     * Get time of run 100 times.
+     * Get time of run 100 times, in ns: a fast GPU runs them within one
+     * tick of GetTickCount64().
     */
-    ULONGLONG start_time = GetTickCount64();
+    uint64_t start_time = timing_now_ns();
 
     for (i = 0; i < MAX_CALIBRATION_COUNT; i++)
     {
+        TRACE_SCOPE("calibration run");
         kernelApp.run();
     }
 
-    UINT total_time = (UINT)(GetTickCount64() - start_time);
+    uint64_t total_time = timing_now_ns() - start_time;
+
+    if (0 == total_time)
+        total_time = 1;
 
-    UINT loops      = percentage * 10 * MAX_CALIBRATION_COUNT / total_time;
+    /* Runs that fill percentage * 10 ms of every second. */
+    UINT loops      = (UINT)(percentage * 10 * 1000000ull * MAX_CALIBRATION_COUNT / total_time);
     UINT sleepTime  = (100 - percentage) * 10;
 
-    /* Workload. */
-    while (TRUE)
+    TRACE_COUNTER("loops", loops);
+
+    /* Workload, until main sets stop. */
+    while (0 == stop)
     {
-        for (i = 0; i < loops; i++)
+        for (i = 0; i < loops && 0 == stop; i++)
         {
+            TRACE_SCOPE("kernel run");
             kernelApp.run();
         }
 
+        TRACE_SCOPE("sleep");
         Sleep(sleepTime);
     }
 
@@ -93,24 +109,36 @@ DWORD WINAPI GpuWorkload(LPVOID lpParam)
  * 
  * 1. GpuLoad.exe
  * 2. GpuLoad.exe [0|1|...] [0-100]
+ * 3. GpuLoad.exe [0|1|...] [0-100] -x trace.json
  * 
  * Example 1:
  * GpuLoad.exe
  * 
  * Example 2:
  * GpuLoad.exe 0 50
+ * 
+ * Example 3, the kernel runs and sleeps as a Chrome trace:
+ * GpuLoad.exe 0 50 -x gpuload.json
 */
 int main(int argc, char **argv)
 {
+    int arg = 1;
     UINT index = 0;
     percentage = 50;
 
-    if (argc > 2)
+    if (argc > 2 && '-' != argv[1][0])
     {
         index = atoi(argv[1]);
         percentage = atoi(argv[2]);
+        arg = 3;
     }
 
+    if (arg + 1 < argc && 0 == strcmp(argv[arg], "-x"))
+        tracePath = argv[arg + 1];
+
+    if (NULL != tracePath)
+        trace_start();
+
     HANDLE handle = CreateThread(NULL, 0, GpuWorkload, &index, CREATE_SUSPENDED, NULL);
 
     if (!handle)
@@ -119,10 +147,20 @@ int main(int argc, char **argv)
     ResumeThread(handle);
     Sleep(10000);
 
-    /* Destroy. */
-    percentage = 0;
-    SuspendThread(handle);
+    /**
+     * Destroy: the worker leaves after its run or sleep and frees the
+     * device. A thread suspended anywhere could hold the heap or CRT
+     * lock the export needs.
+    */
+    InterlockedExchange(&stop, 1);
+    WaitForSingleObject(handle, INFINITE);
     CloseHandle(handle);
 
+    if (NULL != tracePath)
+    {
+        trace_stop();
+        trace_export(tracePath);
+    }
+
     return 0;
 }